@@ -101,6 +101,8 @@ struct lxc_arguments {
 	int ignore_auto;
 	int list;
 	char *groups; /* also used by lxc-ls */
+	unsigned int jobs; /* containers started concurrently */
+	int start_timeout; /* wait for RUNNING when starting concurrently */
 
 	/* lxc-snapshot and lxc-copy */
 	enum task {
@@ -128,6 +130,7 @@ struct lxc_arguments {
 	char *ls_fancy_format;
 	char *ls_filter;
 	unsigned int ls_nesting; /* maximum allowed nesting level */
+	unsigned int ls_jobs; /* number of containers queried concurrently */
 	bool ls_active;
 	bool ls_fancy;
 	bool ls_frozen;
@@ -392,7 +392,8 @@ struct bdev *bdev_copy(struct lxc_container *c0, const char *cname,
 	if (am_unpriv() && chown_mapped_root(new->src, c0->lxc_conf) < 0)
 		WARN("Failed to update ownership of %s", new->dest);
 
-	if (snap)
+	/* dir snapshots are reflinked copies, made below */
+	if (snap && strcmp(new->type, "dir"))
 		return new;
 
 	/*
@@ -34,6 +34,10 @@ lxc_log_define(lxcdir, lxc);
 /*
  * for a simple directory bind mount, we substitute the old container
  * name and paths for the new
+ *
+ * A snapshot of a directory is a copy whose file data is shared with the
+ * original through reflinks where the filesystem supports them. The copy
+ * itself is done by bdev_copy().
  */
 int dir_clonepaths(struct bdev *orig, struct bdev *new, const char *oldname,
 		const char *cname, const char *oldpath, const char *lxcpath,
@@ -41,11 +45,6 @@ int dir_clonepaths(struct bdev *orig, struct bdev *new, const char *oldname,
 {
 	int len, ret;
 
-	if (snap) {
-		ERROR("directories cannot be snapshotted.  Try aufs or overlayfs.");
-		return -1;
-	}
-
 	if (!orig->dest || !orig->src)
 		return -1;
 
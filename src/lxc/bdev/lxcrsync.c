@@ -22,15 +22,25 @@
  */
 
 #define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <grp.h>
+#include <pthread.h>
 #include <sched.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/types.h>
+#include <sys/ioctl.h>
 #include <sys/mount.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/xattr.h>
 
 #include "bdev.h"
 #include "log.h"
@@ -39,30 +49,689 @@
 
 lxc_log_define(lxcrsync, lxc);
 
-/* the bulk of this needs to become a common helper */
-int do_rsync(const char *src, const char *dest)
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+/*
+ * In-process replacement for "rsync -aHX --delete src/ dest".
+ *
+ * Directories are handed out to a pool of worker threads through a shared
+ * queue. Each worker copies the non-directory entries of the directory it
+ * picked up and queues its subdirectories. Hardlinks beyond the first one
+ * and the mode and timestamps of directories are applied once all workers
+ * are done so that they are not disturbed by concurrent copies.
+ *
+ * File data is reflinked where the filesystem supports it, which makes
+ * copies within one XFS or btrfs filesystem nearly free. Once reflinks or
+ * copy_file_range() turn out not to be supported, workers stop trying them.
+ */
+#define LXC_COPY_MAX_WORKERS 8
+#define LXC_COPY_INODE_HASH 4096
+#define LXC_COPY_BUFSIZE 65536
+
+struct copy_dir {
+	char *src;
+	char *dest;
+	/* the destination did not exist before, nothing to delete */
+	bool fresh;
+	struct copy_dir *next;
+};
+
+struct copy_inode {
+	dev_t dev;
+	ino_t ino;
+	char *dest;
+	struct copy_inode *next;
+};
+
+struct copy_link {
+	char *target;
+	char *path;
+	struct copy_link *next;
+};
+
+struct copy_meta {
+	char *path;
+	mode_t mode;
+	struct timespec times[2];
+	struct copy_meta *next;
+};
+
+#define COPY_NO_REFLINK (1 << 0)
+#define COPY_NO_RANGE   (1 << 1)
+
+/* per worker, merged into the context after each directory */
+struct copy_stats {
+	unsigned int flags;
+	unsigned long reflinked;
+	unsigned long copied;
+};
+
+struct copy_ctx {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct copy_dir *queue;
+	int busy;
+	bool failed;
+	struct copy_stats stats;
+	struct copy_inode *inodes[LXC_COPY_INODE_HASH];
+	struct copy_link *links;
+	struct copy_meta *dirs;
+};
+
+static int copy_queue_dir(struct copy_ctx *ctx, const char *src,
+			  const char *dest, bool fresh)
+{
+	struct copy_dir *d;
+
+	d = malloc(sizeof(*d));
+	if (!d)
+		return -1;
+	d->src = strdup(src);
+	d->dest = strdup(dest);
+	if (!d->src || !d->dest) {
+		free(d->src);
+		free(d->dest);
+		free(d);
+		return -1;
+	}
+	d->fresh = fresh;
+
+	pthread_mutex_lock(&ctx->lock);
+	d->next = ctx->queue;
+	ctx->queue = d;
+	pthread_cond_signal(&ctx->cond);
+	pthread_mutex_unlock(&ctx->lock);
+
+	return 0;
+}
+
+static int copy_record_dir(struct copy_ctx *ctx, const char *dest,
+			   struct stat *st)
+{
+	struct copy_meta *m;
+
+	m = malloc(sizeof(*m));
+	if (!m)
+		return -1;
+	m->path = strdup(dest);
+	if (!m->path) {
+		free(m);
+		return -1;
+	}
+	m->mode = st->st_mode & 07777;
+	m->times[0] = st->st_atim;
+	m->times[1] = st->st_mtim;
+
+	pthread_mutex_lock(&ctx->lock);
+	m->next = ctx->dirs;
+	ctx->dirs = m;
+	pthread_mutex_unlock(&ctx->lock);
+
+	return 0;
+}
+
+/*
+ * Returns 1 if the inode has been seen before, in which case @dest is
+ * queued to become a hardlink to the first copy, 0 if this is the first
+ * time we see it and -1 on error.
+ */
+static int copy_check_hardlink(struct copy_ctx *ctx, struct stat *st,
+			       const char *dest)
+{
+	struct copy_inode *i;
+	struct copy_link *l;
+	unsigned int h = (unsigned int)(st->st_ino ^ st->st_dev) % LXC_COPY_INODE_HASH;
+	int ret = -1;
+
+	pthread_mutex_lock(&ctx->lock);
+	for (i = ctx->inodes[h]; i; i = i->next)
+		if (i->ino == st->st_ino && i->dev == st->st_dev)
+			break;
+
+	if (i) {
+		l = malloc(sizeof(*l));
+		if (!l)
+			goto out;
+		l->target = i->dest;
+		l->path = strdup(dest);
+		if (!l->path) {
+			free(l);
+			goto out;
+		}
+		l->next = ctx->links;
+		ctx->links = l;
+		ret = 1;
+		goto out;
+	}
+
+	i = malloc(sizeof(*i));
+	if (!i)
+		goto out;
+	i->dest = strdup(dest);
+	if (!i->dest) {
+		free(i);
+		goto out;
+	}
+	i->dev = st->st_dev;
+	i->ino = st->st_ino;
+	i->next = ctx->inodes[h];
+	ctx->inodes[h] = i;
+	ret = 0;
+
+out:
+	pthread_mutex_unlock(&ctx->lock);
+	return ret;
+}
+
+static int copy_xattrs(const char *src, const char *dest)
+{
+	char *names, *name, *value = NULL;
+	ssize_t len, vlen;
+	int ret = 0;
+
+	len = llistxattr(src, NULL, 0);
+	if (len <= 0)
+		return 0;
+
+	names = malloc(len);
+	if (!names)
+		return -1;
+
+	len = llistxattr(src, names, len);
+	if (len < 0) {
+		free(names);
+		return 0;
+	}
+
+	for (name = names; name < names + len; name += strlen(name) + 1) {
+		vlen = lgetxattr(src, name, NULL, 0);
+		if (vlen < 0)
+			continue;
+
+		free(value);
+		value = malloc(vlen ? vlen : 1);
+		if (!value) {
+			ret = -1;
+			break;
+		}
+
+		vlen = lgetxattr(src, name, value, vlen);
+		if (vlen < 0)
+			continue;
+
+		if (lsetxattr(dest, name, value, vlen, 0) < 0) {
+			/* unsupported namespaces are skipped, like rsync does */
+			if (errno == ENOTSUP || errno == EPERM)
+				continue;
+			SYSERROR("Failed to set xattr %s on %s", name, dest);
+			ret = -1;
+		}
+	}
+
+	free(value);
+	free(names);
+	return ret;
+}
+
+static int copy_file_data(int ifd, int ofd, struct copy_stats *stats)
+{
+	char buf[LXC_COPY_BUFSIZE];
+	ssize_t nread, nwritten, off;
+
+	if (!(stats->flags & COPY_NO_REFLINK)) {
+		if (ioctl(ofd, FICLONE, ifd) == 0) {
+			stats->reflinked++;
+			return 0;
+		}
+		/* EINVAL and EXDEV only rule out this file (e.g. an inline
+		 * extent, or a source on another mount), keep trying the rest */
+		if (errno == EOPNOTSUPP || errno == ENOTTY)
+			stats->flags |= COPY_NO_REFLINK;
+	}
+
+	stats->copied++;
+
+#ifdef __NR_copy_file_range
+	while (!(stats->flags & COPY_NO_RANGE)) {
+		nread = syscall(__NR_copy_file_range, ifd, NULL, ofd, NULL,
+				(size_t)1 << 30, 0);
+		if (nread == 0)
+			return 0;
+		if (nread > 0)
+			continue;
+		if (errno == EINTR)
+			continue;
+		/* fall back to read/write from the current offsets, for the
+		 * rest of the copy only if the kernel or filesystem lacks
+		 * support, EXDEV and EINVAL only rule out this file */
+		if (errno == ENOSYS || errno == EOPNOTSUPP) {
+			stats->flags |= COPY_NO_RANGE;
+			break;
+		}
+		if (errno == EXDEV || errno == EINVAL)
+			break;
+		return -1;
+	}
+#endif
+
+	for (;;) {
+		nread = read(ifd, buf, sizeof(buf));
+		if (nread < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (nread == 0)
+			return 0;
+
+		for (off = 0; off < nread; off += nwritten) {
+			nwritten = write(ofd, buf + off, nread - off);
+			if (nwritten < 0) {
+				if (errno == EINTR) {
+					nwritten = 0;
+					continue;
+				}
+				return -1;
+			}
+		}
+	}
+}
+
+static int copy_file(int srcfd, int destfd, const char *name,
+		     const char *src, const char *dest, struct stat *st,
+		     struct copy_stats *stats)
+{
+	struct timespec times[2] = { st->st_atim, st->st_mtim };
+	int ifd, ofd, ret = -1;
+
+	ifd = openat(srcfd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (ifd < 0) {
+		SYSERROR("Failed to open %s", src);
+		return -1;
+	}
+
+	ofd = openat(destfd, name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (ofd < 0) {
+		SYSERROR("Failed to create %s", dest);
+		close(ifd);
+		return -1;
+	}
+
+	if (copy_file_data(ifd, ofd, stats) < 0) {
+		SYSERROR("Failed to copy %s to %s", src, dest);
+		goto out;
+	}
+
+	if (fchown(ofd, st->st_uid, st->st_gid) < 0) {
+		SYSERROR("Failed to chown %s", dest);
+		goto out;
+	}
+
+	/* after the chown, which clears the setuid and setgid bits */
+	if (fchmod(ofd, st->st_mode & 07777) < 0) {
+		SYSERROR("Failed to chmod %s", dest);
+		goto out;
+	}
+
+	if (copy_xattrs(src, dest) < 0)
+		goto out;
+
+	if (futimens(ofd, times) < 0) {
+		SYSERROR("Failed to set times on %s", dest);
+		goto out;
+	}
+
+	ret = 0;
+
+out:
+	close(ifd);
+	close(ofd);
+	return ret;
+}
+
+static int copy_remove(int destfd, const char *name, const char *dest)
+{
+	struct stat st;
+
+	if (fstatat(destfd, name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+		return errno == ENOENT ? 0 : -1;
+
+	if (S_ISDIR(st.st_mode))
+		return lxc_rmdir_onedev((char *)dest, NULL);
+
+	return unlinkat(destfd, name, 0);
+}
+
+/* Remove entries from @destfd which do not exist in @srcfd (--delete). */
+static int copy_delete_extraneous(int srcfd, int destfd, const char *dest)
+{
+	struct dirent *direntp;
+	struct stat st;
+	DIR *dir;
+	char *path;
+	int fd, ret = 0;
+
+	fd = dup(destfd);
+	if (fd < 0)
+		return -1;
+
+	dir = fdopendir(fd);
+	if (!dir) {
+		close(fd);
+		return -1;
+	}
+
+	while ((direntp = readdir(dir))) {
+		if (!strcmp(direntp->d_name, ".") ||
+		    !strcmp(direntp->d_name, ".."))
+			continue;
+
+		if (fstatat(srcfd, direntp->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 ||
+		    errno != ENOENT)
+			continue;
+
+		path = lxc_append_paths(dest, direntp->d_name);
+		if (!path || copy_remove(destfd, direntp->d_name, path) < 0) {
+			SYSERROR("Failed to delete %s/%s", dest, direntp->d_name);
+			ret = -1;
+		}
+		free(path);
+	}
+
+	closedir(dir);
+	return ret;
+}
+
+static int copy_entry(struct copy_ctx *ctx, int srcfd, int destfd,
+		      const char *name, const char *src, const char *dest,
+		      bool fresh, struct copy_stats *stats)
+{
+	struct timespec times[2];
+	struct stat st, dst;
+	char target[MAXPATHLEN];
+	bool exists = false;
+	ssize_t len;
+	int ret;
+
+	if (fstatat(srcfd, name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+		SYSERROR("Failed to stat %s", src);
+		return -1;
+	}
+
+	if (!fresh && fstatat(destfd, name, &dst, AT_SYMLINK_NOFOLLOW) == 0) {
+		if (S_ISDIR(st.st_mode) && S_ISDIR(dst.st_mode)) {
+			exists = true;
+		} else if (copy_remove(destfd, name, dest) < 0) {
+			SYSERROR("Failed to replace %s", dest);
+			return -1;
+		}
+	}
+
+	if (S_ISDIR(st.st_mode)) {
+		if (!exists && mkdirat(destfd, name, 0700) < 0) {
+			SYSERROR("Failed to create directory %s", dest);
+			return -1;
+		}
+		if (fchownat(destfd, name, st.st_uid, st.st_gid, AT_SYMLINK_NOFOLLOW) < 0) {
+			SYSERROR("Failed to chown %s", dest);
+			return -1;
+		}
+		if (copy_xattrs(src, dest) < 0)
+			return -1;
+		if (copy_record_dir(ctx, dest, &st) < 0)
+			return -1;
+		return copy_queue_dir(ctx, src, dest, !exists);
+	}
+
+	if (st.st_nlink > 1) {
+		ret = copy_check_hardlink(ctx, &st, dest);
+		if (ret != 0)
+			return ret < 0 ? -1 : 0;
+	}
+
+	if (S_ISREG(st.st_mode))
+		return copy_file(srcfd, destfd, name, src, dest, &st, stats);
+
+	if (S_ISLNK(st.st_mode)) {
+		len = readlinkat(srcfd, name, target, sizeof(target) - 1);
+		if (len < 0) {
+			SYSERROR("Failed to read link %s", src);
+			return -1;
+		}
+		target[len] = '\0';
+
+		if (symlinkat(target, destfd, name) < 0) {
+			SYSERROR("Failed to create symlink %s", dest);
+			return -1;
+		}
+	} else if (mknodat(destfd, name, st.st_mode, st.st_rdev) < 0) {
+		SYSERROR("Failed to create node %s", dest);
+		return -1;
+	}
+
+	if (fchownat(destfd, name, st.st_uid, st.st_gid, AT_SYMLINK_NOFOLLOW) < 0) {
+		SYSERROR("Failed to chown %s", dest);
+		return -1;
+	}
+
+	if (!S_ISLNK(st.st_mode) &&
+	    fchmodat(destfd, name, st.st_mode & 07777, 0) < 0) {
+		SYSERROR("Failed to chmod %s", dest);
+		return -1;
+	}
+
+	if (copy_xattrs(src, dest) < 0)
+		return -1;
+
+	times[0] = st.st_atim;
+	times[1] = st.st_mtim;
+	if (utimensat(destfd, name, times, AT_SYMLINK_NOFOLLOW) < 0) {
+		SYSERROR("Failed to set times on %s", dest);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int copy_dir_entries(struct copy_ctx *ctx, struct copy_dir *d,
+			    struct copy_stats *stats)
 {
-	// call out to rsync
-	pid_t pid;
-	char *s;
-	size_t l;
+	struct dirent *direntp;
+	DIR *dir;
+	char *src, *dest;
+	int srcfd, destfd, ret = 0;
 
-	pid = fork();
-	if (pid < 0)
+	srcfd = open(d->src, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (srcfd < 0) {
+		SYSERROR("Failed to open %s", d->src);
 		return -1;
-	if (pid > 0)
-		return wait_for_pid(pid);
+	}
+
+	destfd = open(d->dest, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (destfd < 0) {
+		SYSERROR("Failed to open %s", d->dest);
+		close(srcfd);
+		return -1;
+	}
+
+	if (!d->fresh && copy_delete_extraneous(srcfd, destfd, d->dest) < 0)
+		ret = -1;
+
+	dir = fdopendir(srcfd);
+	if (!dir) {
+		close(srcfd);
+		close(destfd);
+		return -1;
+	}
+
+	while ((direntp = readdir(dir))) {
+		if (!strcmp(direntp->d_name, ".") ||
+		    !strcmp(direntp->d_name, ".."))
+			continue;
+
+		src = lxc_append_paths(d->src, direntp->d_name);
+		dest = lxc_append_paths(d->dest, direntp->d_name);
+		if (!src || !dest ||
+		    copy_entry(ctx, srcfd, destfd, direntp->d_name, src, dest,
+			       d->fresh, stats) < 0)
+			ret = -1;
+		free(src);
+		free(dest);
+	}
+
+	closedir(dir);
+	close(destfd);
+	return ret;
+}
+
+static void *copy_worker(void *data)
+{
+	struct copy_ctx *ctx = data;
+	struct copy_stats stats;
+	struct copy_dir *d;
+	int ret;
+
+	for (;;) {
+		pthread_mutex_lock(&ctx->lock);
+		while (!ctx->queue && ctx->busy > 0)
+			pthread_cond_wait(&ctx->cond, &ctx->lock);
+		d = ctx->queue;
+		if (!d) {
+			/* nothing queued and nobody left to queue more */
+			pthread_cond_broadcast(&ctx->cond);
+			pthread_mutex_unlock(&ctx->lock);
+			return NULL;
+		}
+		ctx->queue = d->next;
+		ctx->busy++;
+		stats.flags = ctx->stats.flags;
+		stats.reflinked = 0;
+		stats.copied = 0;
+		pthread_mutex_unlock(&ctx->lock);
+
+		ret = copy_dir_entries(ctx, d, &stats);
+		free(d->src);
+		free(d->dest);
+		free(d);
+
+		pthread_mutex_lock(&ctx->lock);
+		if (ret < 0)
+			ctx->failed = true;
+		ctx->stats.flags |= stats.flags;
+		ctx->stats.reflinked += stats.reflinked;
+		ctx->stats.copied += stats.copied;
+		ctx->busy--;
+		pthread_cond_broadcast(&ctx->cond);
+		pthread_mutex_unlock(&ctx->lock);
+	}
+}
+
+/* Create the deferred hardlinks and restore directory modes and times. */
+static int copy_finish(struct copy_ctx *ctx)
+{
+	struct copy_inode *i;
+	struct copy_link *l;
+	struct copy_meta *m;
+	int h, ret = 0;
+
+	while ((l = ctx->links)) {
+		ctx->links = l->next;
+		if ((unlink(l->path) < 0 && errno != ENOENT) ||
+		    link(l->target, l->path) < 0) {
+			SYSERROR("Failed to link %s to %s", l->path, l->target);
+			ret = -1;
+		}
+		free(l->path);
+		free(l);
+	}
+
+	for (h = 0; h < LXC_COPY_INODE_HASH; h++) {
+		while ((i = ctx->inodes[h])) {
+			ctx->inodes[h] = i->next;
+			free(i->dest);
+			free(i);
+		}
+	}
+
+	/* children were recorded after their parents and are restored first */
+	while ((m = ctx->dirs)) {
+		ctx->dirs = m->next;
+		if (chmod(m->path, m->mode) < 0 ||
+		    utimensat(AT_FDCWD, m->path, m->times, AT_SYMLINK_NOFOLLOW) < 0) {
+			SYSERROR("Failed to restore attributes of %s", m->path);
+			ret = -1;
+		}
+		free(m->path);
+		free(m);
+	}
+
+	return ret;
+}
+
+/*
+ * Copy the contents of @src into @dest, preserving ownership, permissions,
+ * times, hardlinks, xattrs and special files, and delete anything in @dest
+ * which is not in @src.
+ */
+int do_rsync(const char *src, const char *dest)
+{
+	struct copy_ctx ctx;
+	struct stat st;
+	pthread_t workers[LXC_COPY_MAX_WORKERS - 1];
+	long nworkers;
+	int i, n, ret = -1;
+
+	memset(&ctx, 0, sizeof(ctx));
+	pthread_mutex_init(&ctx.lock, NULL);
+	pthread_cond_init(&ctx.cond, NULL);
+
+	if (stat(src, &st) < 0 || !S_ISDIR(st.st_mode)) {
+		SYSERROR("%s is not a directory", src);
+		goto out;
+	}
+
+	if (mkdir(dest, 0700) < 0 && errno != EEXIST) {
+		SYSERROR("Failed to create directory %s", dest);
+		goto out;
+	}
+
+	if (lchown(dest, st.st_uid, st.st_gid) < 0) {
+		SYSERROR("Failed to chown %s", dest);
+		goto out;
+	}
+
+	if (copy_xattrs(src, dest) < 0 ||
+	    copy_record_dir(&ctx, dest, &st) < 0 ||
+	    copy_queue_dir(&ctx, src, dest, false) < 0)
+		goto out;
+
+	nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nworkers < 1)
+		nworkers = 1;
+	if (nworkers > LXC_COPY_MAX_WORKERS)
+		nworkers = LXC_COPY_MAX_WORKERS;
+
+	for (n = 0; n < nworkers - 1; n++)
+		if (pthread_create(&workers[n], NULL, copy_worker, &ctx))
+			break;
+
+	copy_worker(&ctx);
+
+	for (i = 0; i < n; i++)
+		pthread_join(workers[i], NULL);
 
-	l = strlen(src) + 2;
-	s = malloc(l);
-	if (!s)
-		exit(1);
-	strcpy(s, src);
-	s[l-2] = '/';
-	s[l-1] = '\0';
+	ret = ctx.failed ? -1 : 0;
+	INFO("Copied %s to %s: %lu files reflinked, %lu copied", src, dest,
+	     ctx.stats.reflinked, ctx.stats.copied);
 
-	execlp("rsync", "rsync", "-aHX", "--delete", s, dest, (char *)NULL);
-	exit(1);
+out:
+	if (copy_finish(&ctx) < 0)
+		ret = -1;
+	pthread_cond_destroy(&ctx.cond);
+	pthread_mutex_destroy(&ctx.lock);
+	return ret;
 }
 
 int rsync_delta(struct rsync_data_char *data)
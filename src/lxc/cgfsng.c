@@ -42,6 +42,7 @@
 #include <unistd.h>
 #include <dirent.h>
 #include <grp.h>
+#include <fcntl.h>
 
 #include "log.h"
 #include "cgroup.h"
@@ -1365,20 +1366,44 @@ bad:
 	return retval;
 }
 
-static int recursive_count_nrtasks(char *dirname)
+/*
+ * Count the pids in @dirfd/cgroup.procs, a page at a time rather than with
+ * a getline() per pid.
+ */
+static int count_cgroup_procs(int dirfd)
+{
+	char buf[4096], *p, *end;
+	int fd, count = 0;
+	ssize_t n;
+
+	fd = openat(dirfd, "cgroup.procs", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		end = buf + n;
+		for (p = buf; (p = memchr(p, '\n', end - p)); p++)
+			count++;
+	}
+
+	close(fd);
+	return n < 0 ? -1 : count;
+}
+
+/* Walk the cgroup directory @fd, which is closed when done. */
+static int recursive_count_nrtasks(int fd)
 {
 	struct dirent dirent, *direntp;
 	DIR *dir;
-	int count = 0, ret;
-	char *path;
+	int count = 0, ret, subfd;
 
-	dir = opendir(dirname);
-	if (!dir)
+	dir = fdopendir(fd);
+	if (!dir) {
+		close(fd);
 		return 0;
+	}
 
 	while (!readdir_r(dir, &dirent, &direntp)) {
-		struct stat mystat;
-
 		if (!direntp)
 			break;
 
@@ -1386,24 +1411,20 @@ static int recursive_count_nrtasks(char *dirname)
 		    !strcmp(direntp->d_name, ".."))
 			continue;
 
-		path = must_make_path(dirname, direntp->d_name, NULL);
-
-		if (lstat(path, &mystat))
-			goto next;
+		if (direntp->d_type != DT_DIR && direntp->d_type != DT_UNKNOWN)
+			continue;
 
-		if (!S_ISDIR(mystat.st_mode))
-			goto next;
+		subfd = openat(dirfd(dir), direntp->d_name,
+			       O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if (subfd < 0)
+			continue;
 
-		count += recursive_count_nrtasks(path);
-next:
-		free(path);
+		count += recursive_count_nrtasks(subfd);
 	}
 
-	path = must_make_path(dirname, "cgroup.procs", NULL);
-	ret = lxc_count_file_lines(path);
+	ret = count_cgroup_procs(dirfd(dir));
 	if (ret != -1)
 		count += ret;
-	free(path);
 
 	(void) closedir(dir);
 
@@ -1412,15 +1433,31 @@ next:
 
 static int cgfsng_nrtasks(void *hdata) {
 	struct cgfsng_handler_data *d = hdata;
-	char *path;
-	int count;
+	struct hierarchy *h;
+	char *path, buf[32] = {0};
+	int count, fd;
 
 	if (!d || !d->container_cgroup || !hierarchies)
 		return -1;
-	path = must_make_path(hierarchies[0]->fullcgpath, NULL);
-	count = recursive_count_nrtasks(path);
-	free(path);
-	return count;
+
+	/*
+	 * pids.current is hierarchical and costs a single read, but it counts
+	 * threads rather than processes.  It is exact as long as it is at most
+	 * 1, which is the case the shutdown polling in lxcutmp.c waits for.
+	 */
+	h = get_hierarchy("pids");
+	if (h && h->fullcgpath) {
+		path = must_make_path(h->fullcgpath, "pids.current", NULL);
+		count = lxc_read_from_file(path, buf, sizeof(buf) - 1);
+		free(path);
+		if (count > 0 && atoi(buf) <= 1)
+			return atoi(buf);
+	}
+
+	fd = open(hierarchies[0]->fullcgpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	return recursive_count_nrtasks(fd);
 }
 
 /* Only root needs to escape to the cgroup of its init */
@@ -1597,6 +1634,133 @@ static int cgfsng_set(const char *filename, const char *value, const char *name,
 	return ret;
 }
 
+/*
+ * Cache of a running container's cgroup directories for callers which read
+ * or write its cgroup files over and over.  Every hierarchy is looked up
+ * through the commands API on first use and its directory kept open.  Once
+ * the container has been restarted the old directory is gone, openat()
+ * fails with ENOENT and the hierarchy is looked up again.  Lookups only
+ * happen with @resolve set, otherwise they are reported as ESTALE.
+ */
+struct cgfsng_cg_handle {
+	int *dirfds;	/* one per entry of hierarchies, -1 until looked up */
+};
+
+static void *cgfsng_handle_new(void)
+{
+	struct cgfsng_cg_handle *ch;
+	int i, n = 0;
+
+	while (hierarchies && hierarchies[n])
+		n++;
+
+	ch = must_alloc(sizeof(*ch));
+	ch->dirfds = must_alloc((n + 1) * sizeof(int));
+	for (i = 0; i < n; i++)
+		ch->dirfds[i] = -1;
+	return ch;
+}
+
+static void cgfsng_handle_free(void *hdata)
+{
+	struct cgfsng_cg_handle *ch = hdata;
+	int i;
+
+	for (i = 0; hierarchies && hierarchies[i]; i++)
+		if (ch->dirfds[i] >= 0)
+			close(ch->dirfds[i]);
+	free(ch->dirfds);
+	free(ch);
+}
+
+static int cgfsng_handle_open(struct cgfsng_cg_handle *ch, const char *filename,
+			      int flags, const char *name, const char *lxcpath,
+			      bool resolve)
+{
+	char *subsystem, *p, *path, *dir;
+	int i, fd;
+
+	subsystem = alloca(strlen(filename) + 1);
+	strcpy(subsystem, filename);
+	if ((p = strchr(subsystem, '.')) != NULL)
+		*p = '\0';
+
+	for (i = 0; hierarchies && hierarchies[i]; i++)
+		if (string_in_list(hierarchies[i]->controllers, subsystem))
+			break;
+	if (!hierarchies || !hierarchies[i])
+		return -1;
+
+	if (ch->dirfds[i] >= 0) {
+		fd = openat(ch->dirfds[i], filename, flags);
+		if (fd >= 0 || errno != ENOENT)
+			return fd;
+		if (!resolve) {
+			errno = ESTALE;
+			return -1;
+		}
+		/* the cgroup is gone, the container was restarted or stopped */
+		close(ch->dirfds[i]);
+		ch->dirfds[i] = -1;
+	} else if (!resolve) {
+		errno = ESTALE;
+		return -1;
+	}
+
+	path = lxc_cmd_get_cgroup_path(name, lxcpath, subsystem);
+	if (!path) // not running
+		return -1;
+
+	dir = build_full_cgpath_from_monitorpath(hierarchies[i], path, NULL);
+	free(path);
+	ch->dirfds[i] = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (ch->dirfds[i] < 0) {
+		SYSERROR("Failed to open %s", dir);
+		free(dir);
+		return -1;
+	}
+	free(dir);
+
+	return openat(ch->dirfds[i], filename, flags);
+}
+
+static int cgfsng_handle_get(void *hdata, const char *filename, char *value,
+			     size_t len, const char *name, const char *lxcpath,
+			     bool resolve)
+{
+	int fd, ret, saved_errno;
+
+	fd = cgfsng_handle_open(hdata, filename, O_RDONLY | O_CLOEXEC, name,
+				lxcpath, resolve);
+	if (fd < 0)
+		return -1;
+
+	ret = lxc_read_from_fd(fd, value, len);
+	saved_errno = errno;
+	close(fd);
+	errno = saved_errno;
+	return ret;
+}
+
+static int cgfsng_handle_set(void *hdata, const char *filename, const char *value,
+			     const char *name, const char *lxcpath, bool resolve)
+{
+	size_t len = strlen(value);
+	int fd, saved_errno;
+	ssize_t ret;
+
+	fd = cgfsng_handle_open(hdata, filename, O_WRONLY | O_TRUNC | O_CLOEXEC,
+				name, lxcpath, resolve);
+	if (fd < 0)
+		return -1;
+
+	ret = lxc_write_nointr(fd, value, len);
+	saved_errno = errno;
+	close(fd);
+	errno = saved_errno;
+	return (ret < 0 || (size_t)ret != len) ? -1 : 0;
+}
+
 /*
  * Called from setup_limits - here we have the container's cgroup_data because
  * we created the cgroups
@@ -1689,6 +1853,10 @@ static struct cgroup_ops cgfsng_ops = {
 	.get_cgroup = cgfsng_get_cgroup,
 	.get = cgfsng_get,
 	.set = cgfsng_set,
+	.handle_new = cgfsng_handle_new,
+	.handle_free = cgfsng_handle_free,
+	.handle_get = cgfsng_handle_get,
+	.handle_set = cgfsng_handle_set,
 	.unfreeze = cgfsng_unfreeze,
 	.setup_limits = cgfsng_setup_limits,
 	.name = "cgroupfs-ng",
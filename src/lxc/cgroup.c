@@ -21,6 +21,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <stdlib.h>
 #include <unistd.h>
 #include <sys/types.h>
 
@@ -194,6 +195,63 @@ int lxc_cgroup_get(const char *filename, char *value, size_t len, const char *na
 	return -1;
 }
 
+struct lxc_cgroup_handle {
+	char *name;
+	char *lxcpath;
+	void *data;
+};
+
+struct lxc_cgroup_handle *lxc_cgroup_handle_new(const char *name, const char *lxcpath)
+{
+	struct lxc_cgroup_handle *h;
+
+	h = malloc(sizeof(*h));
+	if (!h)
+		return NULL;
+	h->name = strdup(name);
+	h->lxcpath = strdup(lxcpath);
+	h->data = NULL;
+	if (!h->name || !h->lxcpath)
+		goto err;
+	if (ops && ops->handle_new) {
+		h->data = ops->handle_new();
+		if (!h->data)
+			goto err;
+	}
+	return h;
+
+err:
+	free(h->name);
+	free(h->lxcpath);
+	free(h);
+	return NULL;
+}
+
+void lxc_cgroup_handle_free(struct lxc_cgroup_handle *h)
+{
+	if (!h)
+		return;
+	if (h->data)
+		ops->handle_free(h->data);
+	free(h->name);
+	free(h->lxcpath);
+	free(h);
+}
+
+int lxc_cgroup_handle_get(struct lxc_cgroup_handle *h, const char *filename, char *value, size_t len, bool resolve)
+{
+	if (h->data)
+		return ops->handle_get(h->data, filename, value, len, h->name, h->lxcpath, resolve);
+	return lxc_cgroup_get(filename, value, len, h->name, h->lxcpath);
+}
+
+int lxc_cgroup_handle_set(struct lxc_cgroup_handle *h, const char *filename, const char *value, bool resolve)
+{
+	if (h->data)
+		return ops->handle_set(h->data, filename, value, h->name, h->lxcpath, resolve);
+	return lxc_cgroup_set(filename, value, h->name, h->lxcpath);
+}
+
 void cgroup_disconnect(void)
 {
 	if (ops && ops->disconnect)
@@ -58,6 +58,10 @@ struct cgroup_ops {
 	bool (*mount_cgroup)(void *hdata, const char *root, int type);
 	int (*nrtasks)(void *hdata);
 	void (*disconnect)(void);
+	void *(*handle_new)(void);
+	void (*handle_free)(void *hdata);
+	int (*handle_get)(void *hdata, const char *filename, char *value, size_t len, const char *name, const char *lxcpath, bool resolve);
+	int (*handle_set)(void *hdata, const char *filename, const char *value, const char *name, const char *lxcpath, bool resolve);
 	cgroup_driver_t driver;
 };
 
@@ -83,6 +87,20 @@ extern bool cgroup_unfreeze(struct lxc_handler *handler);
 extern void cgroup_disconnect(void);
 extern cgroup_driver_t cgroup_driver(void);
 
+/*
+ * A handle for repeated cgroup reads and writes on a running container from
+ * outside of it.  Drivers which support it cache the container's cgroup
+ * paths in it, others simply fall back to lxc_cgroup_get/set.
+ * Without @resolve the handle is left untouched, so several threads may use
+ * it at once; if a path has to be looked up first, -1 is returned with
+ * errno set to ESTALE and the caller has to retry with @resolve set, alone.
+ */
+struct lxc_cgroup_handle;
+extern struct lxc_cgroup_handle *lxc_cgroup_handle_new(const char *name, const char *lxcpath);
+extern void lxc_cgroup_handle_free(struct lxc_cgroup_handle *h);
+extern int lxc_cgroup_handle_get(struct lxc_cgroup_handle *h, const char *filename, char *value, size_t len, bool resolve);
+extern int lxc_cgroup_handle_set(struct lxc_cgroup_handle *h, const char *filename, const char *value, bool resolve);
+
 extern void prune_init_scope(char *cg);
 extern bool is_crucial_cgroup_subsystem(const char *s);
 
@@ -28,6 +28,7 @@
 #include <fcntl.h>
 #include <poll.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <inttypes.h>
 #include <sys/un.h>
 #include <sys/param.h>
@@ -44,6 +45,7 @@
 #include "console.h"
 #include "confile.h"
 #include "mainloop.h"
+#include "timing.h"
 #include "af_unix.h"
 #include "config.h"
 
@@ -137,6 +139,11 @@ static const char *lxc_cmd_str(lxc_cmd_t cmd)
 		[LXC_CMD_GET_CONFIG_ITEM] = "get_config_item",
 		[LXC_CMD_GET_NAME]        = "get_name",
 		[LXC_CMD_GET_LXCPATH]     = "get_lxcpath",
+		[LXC_CMD_GET_MULTI]       = "get_multi",
+		[LXC_CMD_CONSOLE_LOG]     = "console_log",
+		[LXC_CMD_GET_START_TIMING] = "get_start_timing",
+		[LXC_CMD_GET_WARM]        = "get_warm",
+		[LXC_CMD_CLAIM]           = "claim",
 	};
 
 	if (cmd >= LXC_CMD_MAX)
@@ -164,6 +171,7 @@ static const char *lxc_cmd_str(lxc_cmd_t cmd)
 static int lxc_cmd_rsp_recv(int sock, struct lxc_cmd_rr *cmd)
 {
 	int ret,rspfd;
+	int datamax = LXC_CMD_DATA_MAX;
 	struct lxc_cmd_rsp *rsp = &cmd->rsp;
 
 	ret = lxc_abstract_unix_recv_fd(sock, &rspfd, rsp, sizeof(*rsp));
@@ -195,9 +203,17 @@ static int lxc_cmd_rsp_recv(int sock, struct lxc_cmd_rr *cmd)
 
 	if (rsp->datalen == 0)
 		return ret;
-	if (rsp->datalen > LXC_CMD_DATA_MAX) {
+	if (cmd->req.cmd == LXC_CMD_GET_MULTI)
+		datamax = LXC_CMD_MULTI_DATA_MAX;
+	else if (cmd->req.cmd == LXC_CMD_CONSOLE_LOG)
+		datamax = LXC_CONSOLE_BUFFER_MAX;
+	else if (cmd->req.cmd == LXC_CMD_GET_START_TIMING)
+		datamax = LXC_TIMING_DATA_MAX;
+	if (rsp->datalen > datamax) {
 		ERROR("command %s response data %d too long",
 		      lxc_cmd_str(cmd->req.cmd), rsp->datalen);
+		rsp->data = NULL;
+		rsp->datalen = 0;
 		errno = EFBIG;
 		return -1;
 	}
@@ -206,12 +222,16 @@ static int lxc_cmd_rsp_recv(int sock, struct lxc_cmd_rr *cmd)
 	if (!rsp->data) {
 		ERROR("command %s unable to allocate response buffer",
 		      lxc_cmd_str(cmd->req.cmd));
+		rsp->datalen = 0;
 		return -1;
 	}
-	ret = recv(sock, rsp->data, rsp->datalen, 0);
+	ret = recv(sock, rsp->data, rsp->datalen, MSG_WAITALL);
 	if (ret != rsp->datalen) {
 		ERROR("command %s failed to receive response data",
 		      lxc_cmd_str(cmd->req.cmd));
+		free(rsp->data);
+		rsp->data = NULL;
+		rsp->datalen = 0;
 		if (ret >= 0)
 			ret = -1;
 	}
@@ -219,6 +239,45 @@ static int lxc_cmd_rsp_recv(int sock, struct lxc_cmd_rr *cmd)
 	return ret;
 }
 
+/*
+ * While a LXC_CMD_GET_MULTI request is being served, the callbacks of the
+ * individual queries are run unchanged and their responses are collected
+ * here instead of being sent to the client one by one.
+ */
+struct lxc_cmd_rsp_buf {
+	char *data;
+	size_t len;
+	bool answered;
+};
+
+static struct lxc_cmd_rsp_buf *rsp_capture;
+
+static int lxc_cmd_rsp_capture(struct lxc_cmd_rsp_buf *buf,
+			       struct lxc_cmd_rsp *rsp)
+{
+	size_t datalen = rsp->datalen > 0 ? rsp->datalen : 0;
+	size_t newlen = buf->len + sizeof(*rsp) + datalen;
+	char *data;
+
+	if (newlen > LXC_CMD_MULTI_DATA_MAX) {
+		ERROR("command %s response too long",
+		      lxc_cmd_str(LXC_CMD_GET_MULTI));
+		return -1;
+	}
+
+	data = realloc(buf->data, newlen);
+	if (!data)
+		return -1;
+
+	memcpy(data + buf->len, rsp, sizeof(*rsp));
+	if (datalen)
+		memcpy(data + buf->len + sizeof(*rsp), rsp->data, datalen);
+	buf->data = data;
+	buf->len = newlen;
+	buf->answered = true;
+	return 0;
+}
+
 /*
  * lxc_cmd_rsp_send: Send a command response
  *
@@ -231,6 +290,9 @@ static int lxc_cmd_rsp_send(int fd, struct lxc_cmd_rsp *rsp)
 {
 	int ret;
 
+	if (rsp_capture)
+		return lxc_cmd_rsp_capture(rsp_capture, rsp);
+
 	ret = send(fd, rsp, sizeof(*rsp), 0);
 	if (ret != sizeof(*rsp)) {
 		ERROR("failed to send command response %d %s", ret,
@@ -250,32 +312,23 @@ static int lxc_cmd_rsp_send(int fd, struct lxc_cmd_rsp *rsp)
 }
 
 /*
- * lxc_cmd: Connect to the specified running container, send it a command
- * request and collect the response
+ * lxc_cmd_connect: Connect to the command socket of a running container
  *
  * @name           : name of container to connect to
- * @cmd            : command with initialized reqest to send
+ * @cmd            : command the connection is made for (used for logging)
  * @stopped        : output indicator if the container was not running
  * @lxcpath        : the lxcpath in which the container is running
+ * @hashed_sock_name: hashed socket name, or NULL to derive it from @name
  *
- * Returns the size of the response message on success, < 0 on failure
- *
- * Note that there is a special case for LXC_CMD_CONSOLE. For this command
- * the fd cannot be closed because it is used as a placeholder to indicate
- * that a particular tty slot is in use. The fd is also used as a signal to
- * the container that when the caller dies or closes the fd, the container
- * will notice the fd on its side of the socket in its mainloop select and
- * then free the slot with lxc_cmd_fd_cleanup(). The socket fd will be
- * returned in the cmd response structure.
+ * Returns the connected socket on success, < 0 on failure
  */
-static int lxc_cmd(const char *name, struct lxc_cmd_rr *cmd, int *stopped,
-		   const char *lxcpath, const char *hashed_sock_name)
+static int lxc_cmd_connect(const char *name, lxc_cmd_t cmd, int *stopped,
+			   const char *lxcpath, const char *hashed_sock_name)
 {
-	int sock, ret = -1;
+	int sock;
 	char path[sizeof(((struct sockaddr_un *)0)->sun_path)] = { 0 };
 	char *offset = &path[1];
 	int len;
-	int stay_connected = cmd->req.cmd == LXC_CMD_CONSOLE;
 
 	*stopped = 0;
 
@@ -294,34 +347,84 @@ static int lxc_cmd(const char *name, struct lxc_cmd_rr *cmd, int *stopped,
 			*stopped = 1;
 		else
 			SYSERROR("command %s failed to connect to '@%s'",
-				 lxc_cmd_str(cmd->req.cmd), offset);
+				 lxc_cmd_str(cmd), offset);
 		return -1;
 	}
 
-	ret = lxc_abstract_unix_send_credential(sock, &cmd->req, sizeof(cmd->req));
-	if (ret != sizeof(cmd->req)) {
-		if (errno == EPIPE)
-			goto epipe;
-		SYSERROR("command %s failed to send req to '@%s' %d",
-			 lxc_cmd_str(cmd->req.cmd), offset, ret);
-		if (ret >=0)
-			ret = -1;
-		goto out;
+	return sock;
+}
+
+/*
+ * lxc_cmd_req_send: Send a command request on a connected socket
+ *
+ * @sock  : the socket connected to the container
+ * @req   : request to send
+ *
+ * Returns the size of the request header on success, < 0 on failure with
+ * errno set (EPIPE if the container went away)
+ */
+static int lxc_cmd_req_send(int sock, struct lxc_cmd_req *req)
+{
+	int ret;
+
+	ret = lxc_abstract_unix_send_credential(sock, req, sizeof(*req));
+	if (ret != sizeof(*req)) {
+		if (errno != EPIPE)
+			SYSERROR("command %s failed to send req %d",
+				 lxc_cmd_str(req->cmd), ret);
+		return -1;
 	}
 
-	if (cmd->req.datalen > 0) {
-		ret = send(sock, cmd->req.data, cmd->req.datalen, MSG_NOSIGNAL);
-		if (ret != cmd->req.datalen) {
-			if (errno == EPIPE)
-				goto epipe;
-			SYSERROR("command %s failed to send request data to '@%s' %d",
-				 lxc_cmd_str(cmd->req.cmd), offset, ret);
-			if (ret >=0)
-				ret = -1;
-			goto out;
+	if (req->datalen > 0) {
+		ret = send(sock, req->data, req->datalen, MSG_NOSIGNAL);
+		if (ret != req->datalen) {
+			if (errno != EPIPE)
+				SYSERROR("command %s failed to send request data %d",
+					 lxc_cmd_str(req->cmd), ret);
+			return -1;
 		}
 	}
 
+	return sizeof(*req);
+}
+
+/*
+ * lxc_cmd: Connect to the specified running container, send it a command
+ * request and collect the response
+ *
+ * @name           : name of container to connect to
+ * @cmd            : command with initialized reqest to send
+ * @stopped        : output indicator if the container was not running
+ * @lxcpath        : the lxcpath in which the container is running
+ *
+ * Returns the size of the response message on success, < 0 on failure
+ *
+ * Note that there is a special case for LXC_CMD_CONSOLE. For this command
+ * the fd cannot be closed because it is used as a placeholder to indicate
+ * that a particular tty slot is in use. The fd is also used as a signal to
+ * the container that when the caller dies or closes the fd, the container
+ * will notice the fd on its side of the socket in its mainloop select and
+ * then free the slot with lxc_cmd_fd_cleanup(). The socket fd will be
+ * returned in the cmd response structure.
+ */
+static int lxc_cmd(const char *name, struct lxc_cmd_rr *cmd, int *stopped,
+		   const char *lxcpath, const char *hashed_sock_name)
+{
+	int sock, ret = -1;
+	int stay_connected = cmd->req.cmd == LXC_CMD_CONSOLE;
+
+	sock = lxc_cmd_connect(name, cmd->req.cmd, stopped, lxcpath,
+			       hashed_sock_name);
+	if (sock < 0)
+		return -1;
+
+	ret = lxc_cmd_req_send(sock, &cmd->req);
+	if (ret < 0) {
+		if (errno == EPIPE)
+			goto epipe;
+		goto out;
+	}
+
 	ret = lxc_cmd_rsp_recv(sock, cmd);
 out:
 	if (!stay_connected || ret <= 0)
@@ -337,6 +440,194 @@ epipe:
 	return 0;
 }
 
+/*
+ * A command session keeps one connection to a container's command socket
+ * open across many requests. The server side already keeps an accepted
+ * connection in its mainloop until the peer hangs up, so a session simply
+ * reuses the socket instead of connecting for every request, and pipelines
+ * up to LXC_CMD_PIPELINE_MAX requests before collecting their responses.
+ *
+ * Responses on a stream socket come back in the order the requests were
+ * sent, so a request's position in the batch is its tag. This keeps the
+ * wire format unchanged and sessions work against already running
+ * monitors.
+ */
+#define LXC_CMD_PIPELINE_MAX 16
+
+struct lxc_cmd_session {
+	int fd;
+	char *name;
+	char *lxcpath;
+	char *hashed_sock_name;
+};
+
+/*
+ * lxc_cmd_session_open: Create a command session for a container
+ *
+ * @name           : name of container to connect to
+ * @lxcpath        : the lxcpath in which the container is running
+ * @hashed_sock_name: hashed socket name, or NULL to derive it from @name
+ *
+ * The connection itself is established lazily by lxc_cmd_session_run(), so
+ * a session can be created for a container which is not running yet.
+ *
+ * Returns the session on success, NULL on failure. The session must be
+ * released with lxc_cmd_session_close().
+ */
+struct lxc_cmd_session *lxc_cmd_session_open(const char *name,
+					     const char *lxcpath,
+					     const char *hashed_sock_name)
+{
+	struct lxc_cmd_session *session;
+
+	session = malloc(sizeof(*session));
+	if (!session)
+		return NULL;
+	memset(session, 0, sizeof(*session));
+	session->fd = -1;
+
+	if (name && !(session->name = strdup(name)))
+		goto err;
+	if (lxcpath && !(session->lxcpath = strdup(lxcpath)))
+		goto err;
+	if (hashed_sock_name &&
+	    !(session->hashed_sock_name = strdup(hashed_sock_name)))
+		goto err;
+
+	return session;
+
+err:
+	lxc_cmd_session_close(session);
+	return NULL;
+}
+
+void lxc_cmd_session_close(struct lxc_cmd_session *session)
+{
+	if (!session)
+		return;
+	if (session->fd >= 0)
+		close(session->fd);
+	free(session->name);
+	free(session->lxcpath);
+	free(session->hashed_sock_name);
+	free(session);
+}
+
+/*
+ * Send @ncmds requests on @sock before collecting their responses. Returns
+ * how many of them were answered, fewer than @ncmds with errno set if the
+ * connection failed. A failed lxc_cmd_rsp_recv() does not leave any data
+ * behind, so the unanswered commands can simply be sent again.
+ */
+static int lxc_cmd_session_batch(int sock, struct lxc_cmd_rr *cmds, int ncmds)
+{
+	int i, ret;
+
+	for (i = 0; i < ncmds; i++) {
+		if (lxc_cmd_req_send(sock, &cmds[i].req) < 0)
+			return 0;
+	}
+
+	for (i = 0; i < ncmds; i++) {
+		ret = lxc_cmd_rsp_recv(sock, &cmds[i]);
+		if (ret == 0)
+			errno = EPIPE;
+		if (ret <= 0)
+			return i;
+	}
+
+	return ncmds;
+}
+
+/*
+ * lxc_cmd_session_run: Send a batch of commands over a session and collect
+ * all responses
+ *
+ * @session : session created with lxc_cmd_session_open()
+ * @cmds    : commands with initialized requests; responses are filled in
+ * @ncmds   : number of commands in @cmds
+ * @stopped : output indicator if the container was not running
+ *
+ * LXC_CMD_CONSOLE and LXC_CMD_STOP take over or tear down the connection and
+ * cannot be sent over a session. All other commands are side-effect free,
+ * so if a reused connection turns out to be stale (e.g. the container was
+ * restarted) the session reconnects once and sends the requests which were
+ * not answered yet again.
+ *
+ * Returns 0 on success, < 0 on failure. On failure no response data is
+ * left allocated. On success, as with lxc_cmd(), response data of each
+ * command is malloc()ed when its datalen > 0 and must be free()ed by the
+ * caller.
+ */
+int lxc_cmd_session_run(struct lxc_cmd_session *session,
+			struct lxc_cmd_rr *cmds, int ncmds, int *stopped)
+{
+	int i, n, done, saved_errno;
+	bool reused, retried = false;
+
+	*stopped = 0;
+
+	for (i = 0; i < ncmds; i++) {
+		if (cmds[i].req.cmd == LXC_CMD_CONSOLE ||
+		    cmds[i].req.cmd == LXC_CMD_STOP ||
+		    cmds[i].req.cmd >= LXC_CMD_MAX) {
+			ERROR("command %s cannot be sent over a session",
+			      lxc_cmd_str(cmds[i].req.cmd));
+			errno = EINVAL;
+			return -1;
+		}
+		memset(&cmds[i].rsp, 0, sizeof(cmds[i].rsp));
+	}
+
+	/* commands before i have been answered */
+	for (i = 0; i < ncmds; i += done) {
+		n = ncmds - i;
+		if (n > LXC_CMD_PIPELINE_MAX)
+			n = LXC_CMD_PIPELINE_MAX;
+
+		reused = session->fd >= 0;
+		if (!reused) {
+			session->fd = lxc_cmd_connect(session->name,
+						      cmds[i].req.cmd, stopped,
+						      session->lxcpath,
+						      session->hashed_sock_name);
+			if (session->fd < 0) {
+				saved_errno = errno;
+				goto err;
+			}
+		}
+
+		done = lxc_cmd_session_batch(session->fd, &cmds[i], n);
+		if (done == n)
+			continue;
+
+		saved_errno = errno;
+		close(session->fd);
+		session->fd = -1;
+		if (!reused || retried) {
+			i += done;
+			*stopped = saved_errno == EPIPE;
+			goto err;
+		}
+
+		DEBUG("command session to '%s' went stale, reconnecting",
+		      session->name ? session->name : session->hashed_sock_name);
+		retried = true;
+	}
+
+	return 0;
+
+err:
+	/* drop the responses collected before the failure */
+	for (n = 0; n < i; n++) {
+		if (cmds[n].rsp.datalen > 0)
+			free(cmds[n].rsp.data);
+		memset(&cmds[n].rsp, 0, sizeof(cmds[n].rsp));
+	}
+	errno = saved_errno;
+	return -1;
+}
+
 int lxc_try_cmd(const char *name, const char *lxcpath)
 {
 	int stopped, ret;
@@ -835,6 +1126,578 @@ static int lxc_cmd_get_lxcpath_callback(int fd, struct lxc_cmd_req *req,
 	return lxc_cmd_rsp_send(fd, &rsp);
 }
 
+/*
+ * lxc_cmd_console_log: Fetch the recent console output of a container from
+ * the ring buffer kept by its monitor (see lxc.console.buffer.size)
+ *
+ * @name      : name of container to connect to
+ * @lxcpath   : the lxcpath in which the container is running
+ * @clear     : empty the ring buffer once it was read
+ * @data      : set to the malloc()ed output, oldest first, NULL if empty
+ * @len       : set to the length of @data
+ *
+ * Returns 0 on success, -ENODATA if the container has no console buffer,
+ * < 0 on other failures
+ */
+int lxc_cmd_console_log(const char *name, const char *lxcpath, bool clear,
+			char **data, size_t *len)
+{
+	int ret, stopped;
+	struct lxc_cmd_rr cmd = {
+		.req = {
+			.cmd = LXC_CMD_CONSOLE_LOG,
+			.data = INT_TO_PTR(clear),
+		},
+	};
+
+	*data = NULL;
+	*len = 0;
+
+	ret = lxc_cmd(name, &cmd, &stopped, lxcpath, NULL);
+	if (ret < 0)
+		return ret;
+
+	if (cmd.rsp.ret < 0) {
+		if (cmd.rsp.datalen > 0)
+			free(cmd.rsp.data);
+		return cmd.rsp.ret;
+	}
+
+	if (cmd.rsp.datalen > 0) {
+		*data = cmd.rsp.data;
+		*len = cmd.rsp.datalen;
+	}
+	return 0;
+}
+
+static int lxc_cmd_console_log_callback(int fd, struct lxc_cmd_req *req,
+					struct lxc_handler *handler)
+{
+	struct lxc_cmd_rsp rsp;
+	char *data;
+	size_t len;
+	int ret;
+
+	memset(&rsp, 0, sizeof(rsp));
+
+	rsp.ret = lxc_console_buffer_read(&handler->conf->console,
+					  PTR_TO_INT(req->data), &data, &len);
+	rsp.data = data;
+	rsp.datalen = len;
+
+	ret = lxc_cmd_rsp_send(fd, &rsp);
+	free(data);
+	return ret;
+}
+
+/*
+ * lxc_cmd_get_start_timing: Fetch the phase timing of the container's last
+ * start, as also written to $lxcpath/$name/start-timing
+ *
+ * @name      : name of container to connect to
+ * @lxcpath   : the lxcpath in which the container is running
+ * @data      : set to the malloc()ed text, one phase per line
+ * @len       : set to the length of @data
+ *
+ * Returns 0 on success, -ENODATA if the start was not timed, < 0 on other
+ * failures
+ */
+int lxc_cmd_get_start_timing(const char *name, const char *lxcpath,
+			     char **data, size_t *len)
+{
+	int ret, stopped;
+	struct lxc_cmd_rr cmd = {
+		.req = { .cmd = LXC_CMD_GET_START_TIMING },
+	};
+
+	*data = NULL;
+	*len = 0;
+
+	ret = lxc_cmd(name, &cmd, &stopped, lxcpath, NULL);
+	if (ret < 0)
+		return ret;
+
+	if (cmd.rsp.ret < 0) {
+		if (cmd.rsp.datalen > 0)
+			free(cmd.rsp.data);
+		return cmd.rsp.ret;
+	}
+
+	*data = cmd.rsp.data;
+	*len = cmd.rsp.datalen;
+	return 0;
+}
+
+static int lxc_cmd_get_start_timing_callback(int fd, struct lxc_cmd_req *req,
+					     struct lxc_handler *handler)
+{
+	struct lxc_cmd_rsp rsp;
+	char *data = NULL;
+	size_t len = 0;
+	int ret;
+
+	memset(&rsp, 0, sizeof(rsp));
+
+	if (!handler->timing) {
+		rsp.ret = -ENODATA;
+	} else {
+		data = lxc_timing_format(handler->timing, handler->name, &len);
+		if (!data)
+			rsp.ret = -ENOMEM;
+	}
+	rsp.data = data;
+	rsp.datalen = len;
+
+	ret = lxc_cmd_rsp_send(fd, &rsp);
+	free(data);
+	return ret;
+}
+
+/*
+ * lxc_cmd_get_warm: Get whether a container started with lxc.warm is still
+ * waiting to be claimed
+ *
+ * @name      : name of container to connect to
+ * @lxcpath   : the lxcpath in which the container is running
+ *
+ * Returns LXC_WARM_NONE, LXC_WARM_PARKED, LXC_WARM_CLAIMING or
+ * LXC_WARM_CLAIMED, < 0 on failure
+ */
+int lxc_cmd_get_warm(const char *name, const char *lxcpath)
+{
+	int ret, stopped;
+	struct lxc_cmd_rr cmd = {
+		.req = { .cmd = LXC_CMD_GET_WARM },
+	};
+
+	ret = lxc_cmd(name, &cmd, &stopped, lxcpath, NULL);
+	if (ret < 0)
+		return ret;
+
+	return PTR_TO_INT(cmd.rsp.data);
+}
+
+static int lxc_cmd_get_warm_callback(int fd, struct lxc_cmd_req *req,
+				     struct lxc_handler *handler)
+{
+	struct lxc_cmd_rsp rsp = { .data = INT_TO_PTR(handler->warm_state) };
+
+	return lxc_cmd_rsp_send(fd, &rsp);
+}
+
+/*
+ * lxc_cmd_claim: Hand a parked warm container its identity and let its
+ * init exec
+ *
+ * @name      : name of container to connect to
+ * @lxcpath   : the lxcpath in which the container is running
+ * @items     : NUL terminated "key=value" items, see lxc_claim_check()
+ * @len       : length of @items, including the last NUL
+ *
+ * Returns 0 once init has applied @items, -EBUSY if the container was
+ * claimed already or a claim is in progress, -EINVAL if it is not warm or
+ * @items are refused, -ETIMEDOUT if init did not answer within
+ * LXC_CLAIM_TIMEOUT seconds, < 0 on other failures. The container is still
+ * parked after -EBUSY or a refusal, after other failures it stops.
+ */
+int lxc_cmd_claim(const char *name, const char *lxcpath, const char *items,
+		  size_t len)
+{
+	int ret, stopped;
+	struct lxc_cmd_rr cmd = {
+		.req = {
+			.cmd = LXC_CMD_CLAIM,
+			.data = items,
+			.datalen = len,
+		},
+	};
+
+	if (len > LXC_CLAIM_MAX)
+		return -E2BIG;
+
+	ret = lxc_cmd(name, &cmd, &stopped, lxcpath, NULL);
+	if (ret < 0)
+		return stopped ? -ENOENT : ret;
+
+	return cmd.rsp.ret;
+}
+
+/*
+ * A claim is answered once the parked init has applied it, which may take
+ * a while (addresses, routes). The monitor does not wait for that: the
+ * callback only hands the claim to init and parks the client's connection.
+ * lxc_cmd_handler() then takes the connection out of the mainloop and
+ * watches init's end of the socketpair and a timer instead, and
+ * lxc_cmd_claim_answer() sends the response.
+ */
+static int lxc_cmd_claim_callback(int fd, struct lxc_cmd_req *req,
+				  struct lxc_handler *handler)
+{
+	struct lxc_cmd_rsp rsp = { .ret = -EINVAL };
+
+	if (handler->warm_state == LXC_WARM_CLAIMED ||
+	    handler->warm_state == LXC_WARM_CLAIMING) {
+		rsp.ret = -EBUSY;
+		goto out;
+	}
+	if (handler->warm_state != LXC_WARM_PARKED || req->datalen <= 0 ||
+	    lxc_claim_check(handler->conf, req->data, req->datalen) < 0)
+		goto out;
+
+	handler->claim = malloc(req->datalen);
+	if (!handler->claim) {
+		rsp.ret = -ENOMEM;
+		goto out;
+	}
+
+	if (send(handler->warmsock[0], req->data, req->datalen,
+		 MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {
+		rsp.ret = -errno;
+		free(handler->claim);
+		handler->claim = NULL;
+		goto out;
+	}
+
+	memcpy(handler->claim, req->data, req->datalen);
+	handler->claimlen = req->datalen;
+	handler->claimfd = fd;
+	handler->warm_state = LXC_WARM_CLAIMING;
+	return 0;
+
+out:
+	return lxc_cmd_rsp_send(fd, &rsp);
+}
+
+/*
+ * Answer the client waiting for its claim with @ret. Unless @parked, init
+ * does not wait for another claim anymore.
+ */
+static void lxc_cmd_claim_done(struct lxc_handler *handler,
+			       struct lxc_epoll_descr *descr, int ret,
+			       bool parked)
+{
+	struct lxc_cmd_rsp rsp = { .ret = ret };
+
+	if (handler->claimtimer != -1) {
+		lxc_mainloop_del_handler(descr, handler->claimtimer);
+		close(handler->claimtimer);
+		handler->claimtimer = -1;
+	}
+	lxc_mainloop_del_handler(descr, handler->warmsock[0]);
+
+	if (ret == 0) {
+		/* keep the config served to clients in line with the container */
+		lxc_claim_setup(handler->conf, handler->claim,
+				handler->claimlen, false);
+		handler->warm_state = LXC_WARM_CLAIMED;
+		/* a reboot keeps the identity and goes straight to the workload */
+		handler->conf->warm = false;
+		close(handler->warmsock[0]);
+		handler->warmsock[0] = -1;
+		INFO("'%s' has been claimed", handler->name);
+	} else if (parked) {
+		/* refused by init, which waits for another claim */
+		handler->warm_state = LXC_WARM_PARKED;
+	} else {
+		/* init failed to apply the claim or is in an unknown state,
+		 * closing the socket makes it give up in any case */
+		close(handler->warmsock[0]);
+		handler->warmsock[0] = -1;
+		handler->warm_state = LXC_WARM_NONE;
+		ERROR("'%s' could not be claimed: %s", handler->name,
+		      strerror(-ret));
+	}
+
+	free(handler->claim);
+	handler->claim = NULL;
+
+	lxc_cmd_rsp_send(handler->claimfd, &rsp);
+	lxc_console_free(handler->conf, handler->claimfd);
+	close(handler->claimfd);
+	handler->claimfd = -1;
+}
+
+static int lxc_cmd_claim_answer(int fd, uint32_t events, void *data,
+				struct lxc_epoll_descr *descr)
+{
+	struct lxc_handler *handler = data;
+	struct lxc_claim_answer answer;
+	ssize_t len;
+
+	if (fd == handler->claimtimer) {
+		ERROR("no answer from the init of '%s' to its claim",
+		      handler->name);
+		lxc_cmd_claim_done(handler, descr, -ETIMEDOUT, false);
+		return 0;
+	}
+
+	len = recv(fd, &answer, sizeof(answer), MSG_DONTWAIT);
+	if (len < 0 && (errno == EINTR || errno == EAGAIN))
+		return 0;
+	if (len != sizeof(answer)) {
+		ERROR("init of '%s' went away while being claimed",
+		      handler->name);
+		answer.ret = -EIO;
+		answer.parked = 0;
+	}
+
+	lxc_cmd_claim_done(handler, descr, answer.ret, answer.parked);
+	return 0;
+}
+
+/*
+ * Called by lxc_cmd_handler() after lxc_cmd_claim_callback() handed a claim
+ * to init. If the answer cannot be waited for, the client is answered right
+ * away.
+ */
+static void lxc_cmd_claim_wait(struct lxc_handler *handler,
+			      struct lxc_epoll_descr *descr)
+{
+	struct itimerspec its = { .it_value = { .tv_sec = LXC_CLAIM_TIMEOUT } };
+
+	/* nothing else is read from the client before it has its answer */
+	lxc_mainloop_del_handler(descr, handler->claimfd);
+
+	handler->claimtimer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (handler->claimtimer < 0)
+		goto err;
+
+	if (timerfd_settime(handler->claimtimer, 0, &its, NULL) < 0 ||
+	    lxc_mainloop_add_handler(descr, handler->claimtimer,
+				     lxc_cmd_claim_answer, handler) < 0) {
+		close(handler->claimtimer);
+		handler->claimtimer = -1;
+		goto err;
+	}
+
+	if (lxc_mainloop_add_handler(descr, handler->warmsock[0],
+				     lxc_cmd_claim_answer, handler) < 0)
+		goto err;
+
+	return;
+
+err:
+	SYSERROR("failed to wait for the init of '%s' to be claimed",
+		 handler->name);
+	lxc_cmd_claim_done(handler, descr, -EIO, false);
+}
+
+/*
+ * lxc_cmd_get_multi: Run several queries against a container in one round
+ * trip
+ *
+ * @name      : name of container to connect to
+ * @lxcpath   : the lxcpath in which the container is running
+ * @items     : queries to run, the response of each is filled in
+ * @nitems    : number of entries in @items
+ *
+ * Monitors which predate LXC_CMD_GET_MULTI close the connection on the
+ * unknown command; the queries are then pipelined as single commands over
+ * one connection instead.
+ *
+ * Returns 0 on success, < 0 on failure (including the container not
+ * running). As with the single commands, rsp.data of each item is
+ * malloc()ed when its rsp.datalen > 0 and must be free()ed by the caller.
+ */
+int lxc_cmd_get_multi(const char *name, const char *lxcpath,
+		      struct lxc_cmd_multi_item *items, int nitems)
+{
+	int i, ret, stopped;
+	size_t len = 0, off;
+	char *reqdata, *rspdata;
+	struct lxc_cmd_rr *cmds;
+	struct lxc_cmd_session *session;
+	struct lxc_cmd_multi_req hdr;
+	struct lxc_cmd_rr cmd = {
+		.req = { .cmd = LXC_CMD_GET_MULTI },
+	};
+
+	for (i = 0; i < nitems; i++) {
+		len += sizeof(hdr);
+		if (items[i].arg)
+			len += strlen(items[i].arg) + 1;
+		memset(&items[i].rsp, 0, sizeof(items[i].rsp));
+	}
+	if (len > LXC_CMD_DATA_MAX) {
+		ERROR("command %s request too long", lxc_cmd_str(cmd.req.cmd));
+		errno = EFBIG;
+		return -1;
+	}
+
+	reqdata = alloca(len);
+	for (i = 0, off = 0; i < nitems; i++) {
+		hdr.cmd = items[i].cmd;
+		hdr.datalen = items[i].arg ? strlen(items[i].arg) + 1 : 0;
+		memcpy(reqdata + off, &hdr, sizeof(hdr));
+		off += sizeof(hdr);
+		if (hdr.datalen) {
+			memcpy(reqdata + off, items[i].arg, hdr.datalen);
+			off += hdr.datalen;
+		}
+	}
+	cmd.req.data = reqdata;
+	cmd.req.datalen = len;
+
+	ret = lxc_cmd(name, &cmd, &stopped, lxcpath, NULL);
+	if (ret < 0 || stopped)
+		return -1;
+	if (ret > 0)
+		goto unpack;
+
+	/* old monitor, fall back to pipelining the single commands */
+	DEBUG("'%s' does not support %s, pipelining single commands", name,
+	      lxc_cmd_str(cmd.req.cmd));
+	cmds = alloca(nitems * sizeof(*cmds));
+	memset(cmds, 0, nitems * sizeof(*cmds));
+	for (i = 0; i < nitems; i++) {
+		cmds[i].req.cmd = items[i].cmd;
+		cmds[i].req.data = items[i].arg;
+		cmds[i].req.datalen = items[i].arg ? strlen(items[i].arg) + 1 : 0;
+	}
+
+	session = lxc_cmd_session_open(name, lxcpath, NULL);
+	if (!session)
+		return -1;
+	ret = lxc_cmd_session_run(session, cmds, nitems, &stopped);
+	lxc_cmd_session_close(session);
+	if (ret < 0)
+		return -1;
+
+	for (i = 0; i < nitems; i++)
+		items[i].rsp = cmds[i].rsp;
+	return 0;
+
+unpack:
+	if (cmd.rsp.ret < 0) {
+		ERROR("command %s failed for '%s': %s",
+		      lxc_cmd_str(cmd.req.cmd), name, strerror(-cmd.rsp.ret));
+		ret = -1;
+		goto out;
+	}
+
+	rspdata = cmd.rsp.data;
+	for (i = 0, off = 0; i < nitems; i++) {
+		struct lxc_cmd_rsp *rsp = &items[i].rsp;
+
+		if (off + sizeof(*rsp) > cmd.rsp.datalen)
+			goto err_short;
+		memcpy(rsp, rspdata + off, sizeof(*rsp));
+		off += sizeof(*rsp);
+		if (rsp->datalen <= 0)
+			continue;
+
+		if (off + rsp->datalen > cmd.rsp.datalen)
+			goto err_short;
+		rsp->data = malloc(rsp->datalen);
+		if (!rsp->data) {
+			rsp->datalen = 0;
+			ret = -1;
+			goto err;
+		}
+		memcpy(rsp->data, rspdata + off, rsp->datalen);
+		off += rsp->datalen;
+	}
+	ret = 0;
+	goto out;
+
+err_short:
+	ERROR("command %s response for '%s' is truncated",
+	      lxc_cmd_str(cmd.req.cmd), name);
+	ret = -1;
+	memset(&items[i].rsp, 0, sizeof(items[i].rsp));
+err:
+	while (i-- > 0) {
+		if (items[i].rsp.datalen > 0)
+			free(items[i].rsp.data);
+		memset(&items[i].rsp, 0, sizeof(items[i].rsp));
+	}
+out:
+	if (cmd.rsp.datalen > 0)
+		free(cmd.rsp.data);
+	return ret;
+}
+
+static int lxc_cmd_process(int fd, struct lxc_cmd_req *req,
+			   struct lxc_handler *handler);
+
+static int lxc_cmd_get_multi_callback(int fd, struct lxc_cmd_req *req,
+				      struct lxc_handler *handler)
+{
+	struct lxc_cmd_rsp rsp;
+	struct lxc_cmd_rsp_buf buf = { .data = NULL };
+	struct lxc_cmd_multi_req hdr;
+	struct lxc_cmd_req subreq;
+	const char *data = req->data;
+	int off = 0, ret;
+
+	memset(&rsp, 0, sizeof(rsp));
+
+	while (off < req->datalen) {
+		if (off + sizeof(hdr) > req->datalen)
+			goto err;
+		memcpy(&hdr, data + off, sizeof(hdr));
+		off += sizeof(hdr);
+		if (hdr.datalen < 0 || off + hdr.datalen > req->datalen)
+			goto err;
+
+		memset(&subreq, 0, sizeof(subreq));
+		subreq.cmd = hdr.cmd;
+		subreq.datalen = hdr.datalen;
+		if (hdr.datalen) {
+			/* arguments must be proper strings */
+			if (data[off + hdr.datalen - 1] != '\0')
+				goto err;
+			subreq.data = data + off;
+			off += hdr.datalen;
+		}
+
+		switch (subreq.cmd) {
+		case LXC_CMD_GET_STATE:
+		case LXC_CMD_GET_INIT_PID:
+		case LXC_CMD_GET_CLONE_FLAGS:
+		case LXC_CMD_GET_CGROUP:
+		case LXC_CMD_GET_CONFIG_ITEM:
+		case LXC_CMD_GET_NAME:
+		case LXC_CMD_GET_LXCPATH:
+		case LXC_CMD_GET_WARM:
+			break;
+		default:
+			ERROR("command %s cannot be part of %s",
+			      lxc_cmd_str(subreq.cmd),
+			      lxc_cmd_str(LXC_CMD_GET_MULTI));
+			goto err;
+		}
+
+		buf.answered = false;
+		rsp_capture = &buf;
+		ret = lxc_cmd_process(fd, &subreq, handler);
+		rsp_capture = NULL;
+		if (buf.answered)
+			continue;
+
+		/* the callback failed without answering */
+		rsp.ret = ret < 0 ? ret : -1;
+		rsp_capture = &buf;
+		ret = lxc_cmd_rsp_send(fd, &rsp);
+		rsp_capture = NULL;
+		if (ret < 0)
+			goto err;
+		memset(&rsp, 0, sizeof(rsp));
+	}
+
+	rsp.data = buf.data;
+	rsp.datalen = buf.len;
+	goto out;
+
+err:
+	memset(&rsp, 0, sizeof(rsp));
+	rsp.ret = -EINVAL;
+out:
+	ret = lxc_cmd_rsp_send(fd, &rsp);
+	free(buf.data);
+	return ret;
+}
+
 static int lxc_cmd_process(int fd, struct lxc_cmd_req *req,
 			   struct lxc_handler *handler)
 {
@@ -851,6 +1714,11 @@ static int lxc_cmd_process(int fd, struct lxc_cmd_req *req,
 		[LXC_CMD_GET_CONFIG_ITEM] = lxc_cmd_get_config_item_callback,
 		[LXC_CMD_GET_NAME]        = lxc_cmd_get_name_callback,
 		[LXC_CMD_GET_LXCPATH]     = lxc_cmd_get_lxcpath_callback,
+		[LXC_CMD_GET_MULTI]       = lxc_cmd_get_multi_callback,
+		[LXC_CMD_CONSOLE_LOG]     = lxc_cmd_console_log_callback,
+		[LXC_CMD_GET_START_TIMING] = lxc_cmd_get_start_timing_callback,
+		[LXC_CMD_GET_WARM]        = lxc_cmd_get_warm_callback,
+		[LXC_CMD_CLAIM]           = lxc_cmd_claim_callback,
 	};
 
 	if (req->cmd >= LXC_CMD_MAX) {
@@ -868,13 +1736,26 @@ static void lxc_cmd_fd_cleanup(int fd, struct lxc_handler *handler,
 	close(fd);
 }
 
+/*
+ * lxc_cmd_pending: Check whether a client pipelined another request behind
+ * the one just served
+ */
+static bool lxc_cmd_pending(int fd)
+{
+	char c;
+
+	return recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) > 0;
+}
+
 static int lxc_cmd_handler(int fd, uint32_t events, void *data,
 			   struct lxc_epoll_descr *descr)
 {
-	int ret;
+	int ret, served = 0;
 	struct lxc_cmd_req req;
 	struct lxc_handler *handler = data;
+	char reqdata[LXC_CMD_DATA_MAX];
 
+next:
 	ret = lxc_abstract_unix_rcv_credential(fd, &req, sizeof(req));
 	if (ret == -EACCES) {
 		/* we don't care for the peer, just send and close */
@@ -907,9 +1788,6 @@ static int lxc_cmd_handler(int fd, uint32_t events, void *data,
 	}
 
 	if (req.datalen > 0) {
-		void *reqdata;
-
-		reqdata = alloca(req.datalen);
 		ret = recv(fd, reqdata, req.datalen, 0);
 		if (ret != req.datalen) {
 			WARN("partial request, ignored");
@@ -926,6 +1804,21 @@ static int lxc_cmd_handler(int fd, uint32_t events, void *data,
 		goto out_close;
 	}
 
+	/* the client is answered once init is done with its claim */
+	if (req.cmd == LXC_CMD_CLAIM && handler->claimfd == fd) {
+		lxc_cmd_claim_wait(handler, descr);
+		goto out;
+	}
+
+	/* serve requests a client pipelined behind this one in the
+	 * same wakeup, bounded so other fds in the mainloop are not starved.
+	 * The console fd doubles as the tty slot placeholder and is never
+	 * drained here.
+	 */
+	if (req.cmd != LXC_CMD_CONSOLE && ++served < LXC_CMD_PIPELINE_MAX &&
+	    lxc_cmd_pending(fd))
+		goto next;
+
 out:
 	return ret;
 out_close:
@@ -24,9 +24,14 @@
 #ifndef __LXC_COMMANDS_H
 #define __LXC_COMMANDS_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #include "state.h"
 
 #define LXC_CMD_DATA_MAX (MAXPATHLEN*2)
+/* LXC_CMD_GET_MULTI aggregates many answers into a single response */
+#define LXC_CMD_MULTI_DATA_MAX (LXC_CMD_DATA_MAX*16)
 
 /* https://developer.gnome.org/glib/2.28/glib-Type-Conversion-Macros.html */
 #define INT_TO_PTR(n) ((void *) (long) (n))
@@ -43,6 +48,11 @@ typedef enum {
 	LXC_CMD_GET_CONFIG_ITEM,
 	LXC_CMD_GET_NAME,
 	LXC_CMD_GET_LXCPATH,
+	LXC_CMD_GET_MULTI,
+	LXC_CMD_CONSOLE_LOG,
+	LXC_CMD_GET_START_TIMING,
+	LXC_CMD_GET_WARM,
+	LXC_CMD_CLAIM,
 	LXC_CMD_MAX,
 } lxc_cmd_t;
 
@@ -68,6 +78,24 @@ struct lxc_cmd_console_rsp_data {
 	int ttynum;
 };
 
+/*
+ * One query of a LXC_CMD_GET_MULTI request. @cmd is one of the side-effect
+ * free LXC_CMD_GET_* commands and @arg its argument (cgroup subsystem or
+ * config key), if it takes one. @rsp is filled in exactly like the response
+ * to the single command would be.
+ */
+struct lxc_cmd_multi_item {
+	lxc_cmd_t cmd;
+	const char *arg;
+	struct lxc_cmd_rsp rsp;
+};
+
+/* wire header preceding each query in a LXC_CMD_GET_MULTI request */
+struct lxc_cmd_multi_req {
+	lxc_cmd_t cmd;
+	int datalen;
+};
+
 extern int lxc_cmd_console_winch(const char *name, const char *lxcpath);
 extern int lxc_cmd_console(const char *name, int *ttynum, int *fd,
 			   const char *lxcpath);
@@ -82,9 +110,26 @@ extern char *lxc_cmd_get_config_item(const char *name, const char *item, const c
 extern char *lxc_cmd_get_name(const char *hashed_sock);
 extern char *lxc_cmd_get_lxcpath(const char *hashed_sock);
 extern pid_t lxc_cmd_get_init_pid(const char *name, const char *lxcpath);
+extern int lxc_cmd_get_multi(const char *name, const char *lxcpath,
+			     struct lxc_cmd_multi_item *items, int nitems);
+extern int lxc_cmd_console_log(const char *name, const char *lxcpath,
+			       bool clear, char **data, size_t *len);
+extern int lxc_cmd_get_start_timing(const char *name, const char *lxcpath,
+				    char **data, size_t *len);
+extern int lxc_cmd_get_warm(const char *name, const char *lxcpath);
+extern int lxc_cmd_claim(const char *name, const char *lxcpath,
+			 const char *items, size_t len);
 extern lxc_state_t lxc_cmd_get_state(const char *name, const char *lxcpath);
 extern int lxc_cmd_stop(const char *name, const char *lxcpath);
 
+struct lxc_cmd_session;
+extern struct lxc_cmd_session *lxc_cmd_session_open(const char *name,
+						    const char *lxcpath,
+						    const char *hashed_sock_name);
+extern int lxc_cmd_session_run(struct lxc_cmd_session *session,
+			       struct lxc_cmd_rr *cmds, int ncmds, int *stopped);
+extern void lxc_cmd_session_close(struct lxc_cmd_session *session);
+
 struct lxc_epoll_descr;
 struct lxc_handler;
 
@@ -29,6 +29,11 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <string.h>
+#include <signal.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <poll.h>
+#include <ctype.h>
 #include <dirent.h>
 #include <unistd.h>
 #include <inttypes.h>
@@ -72,6 +77,7 @@
 #include "parse.h"
 #include "utils.h"
 #include "conf.h"
+#include "confile.h"
 #include "log.h"
 #include "caps.h"       /* for lxc_caps_last_cap() */
 #include "bdev/bdev.h"
@@ -80,6 +86,7 @@
 #include "cgroup.h"
 #include "lxclock.h"
 #include "namespace.h"
+#include "timing.h"
 #include "lsm/lsm.h"
 
 #if HAVE_SYS_CAPABILITY_H
@@ -315,13 +322,81 @@ static struct caps_opt caps_opt[] = {
 static struct caps_opt caps_opt[] = {};
 #endif
 
+/* anything the shell would interpret rather than just split into words */
+#define SHELL_META "|&;<>()$`\\\"'*?[]#~=!{}\n"
+
+/*
+ * Split @buffer into an argv if running it through the shell would do
+ * nothing more than that. Returns a malloc()ed vector, strings included,
+ * or NULL if the shell is needed.
+ */
+static char **script_argv(const char *buffer)
+{
+	char **argv, *copy, *tok, *saveptr = NULL;
+	size_t len = strlen(buffer);
+	int n = 0, words = 1;
+	const char *p;
+
+	if (strpbrk(buffer, SHELL_META))
+		return NULL;
+
+	for (p = buffer; *p; p++)
+		if (*p == ' ' || *p == '\t')
+			words++;
+
+	argv = malloc((words + 1) * sizeof(*argv) + len + 1);
+	if (!argv)
+		return NULL;
+	copy = (char *)(argv + words + 1);
+	memcpy(copy, buffer, len + 1);
+
+	for (tok = strtok_r(copy, " \t", &saveptr); tok;
+	     tok = strtok_r(NULL, " \t", &saveptr))
+		argv[n++] = tok;
+	argv[n] = NULL;
+
+	if (!n) {
+		free(argv);
+		return NULL;
+	}
+	return argv;
+}
+
+/* start @buffer, straight from an argv where that is equivalent */
+static struct lxc_popen_FILE *script_popen(const char *buffer)
+{
+	struct lxc_popen_FILE *f;
+	char **argv;
+
+	argv = script_argv(buffer);
+	f = lxc_popen_argv(argv, buffer);
+	free(argv);
+	return f;
+}
+
+static int script_status(int ret)
+{
+	if (ret == -1) {
+		SYSERROR("Script exited on error");
+		return -1;
+	} else if (WIFEXITED(ret) && WEXITSTATUS(ret) != 0) {
+		ERROR("Script exited with status %d", WEXITSTATUS(ret));
+		return -1;
+	} else if (WIFSIGNALED(ret)) {
+		ERROR("Script terminated by signal %d (%s)", WTERMSIG(ret),
+		      strsignal(WTERMSIG(ret)));
+		return -1;
+	}
+
+	return 0;
+}
+
 static int run_buffer(char *buffer)
 {
 	struct lxc_popen_FILE *f;
 	char *output;
-	int ret;
 
-	f = lxc_popen(buffer);
+	f = script_popen(buffer);
 	if (!f) {
 		SYSERROR("popen failed");
 		return -1;
@@ -339,33 +414,17 @@ static int run_buffer(char *buffer)
 
 	free(output);
 
-	ret = lxc_pclose(f);
-	if (ret == -1) {
-		SYSERROR("Script exited on error");
-		return -1;
-	} else if (WIFEXITED(ret) && WEXITSTATUS(ret) != 0) {
-		ERROR("Script exited with status %d", WEXITSTATUS(ret));
-		return -1;
-	} else if (WIFSIGNALED(ret)) {
-		ERROR("Script terminated by signal %d (%s)", WTERMSIG(ret),
-		      strsignal(WTERMSIG(ret)));
-		return -1;
-	}
-
-	return 0;
+	return script_status(lxc_pclose(f));
 }
 
-static int run_script_argv(const char *name, const char *section,
-		      const char *script, const char *hook, const char *lxcpath,
-		      char **argsin)
+static char *script_argv_buffer(const char *name, const char *section,
+				const char *script, const char *hook,
+				char **argsin)
 {
 	int ret, i;
 	char *buffer;
 	size_t size = 0;
 
-	INFO("Executing script '%s' for container '%s', config section '%s'",
-	     script, name, section);
-
 	for (i=0; argsin && argsin[i]; i++)
 		size += strlen(argsin[i]) + 1;
 
@@ -377,18 +436,18 @@ static int run_script_argv(const char *name, const char *section,
 	size += 3;
 
 	if (size > INT_MAX)
-		return -1;
+		return NULL;
 
-	buffer = alloca(size);
+	buffer = malloc(size);
 	if (!buffer) {
 		ERROR("failed to allocate memory");
-		return -1;
+		return NULL;
 	}
 
 	ret = snprintf(buffer, size, "%s %s %s %s", script, name, section, hook);
 	if (ret < 0 || ret >= size) {
 		ERROR("Script name too long");
-		return -1;
+		goto err;
 	}
 
 	for (i=0; argsin && argsin[i]; i++) {
@@ -397,12 +456,180 @@ static int run_script_argv(const char *name, const char *section,
 		rc = snprintf(buffer + ret, len, " %s", argsin[i]);
 		if (rc < 0 || rc >= len) {
 			ERROR("Script args too long");
-			return -1;
+			goto err;
 		}
 		ret += rc;
 	}
 
-	return run_buffer(buffer);
+	return buffer;
+
+err:
+	free(buffer);
+	return NULL;
+}
+
+static int run_script_argv(const char *name, const char *section,
+		      const char *script, const char *hook, const char *lxcpath,
+		      char **argsin)
+{
+	char *buffer;
+	int ret;
+
+	INFO("Executing script '%s' for container '%s', config section '%s'",
+	     script, name, section);
+
+	buffer = script_argv_buffer(name, section, script, hook, argsin);
+	if (!buffer)
+		return -1;
+
+	ret = run_buffer(buffer);
+	free(buffer);
+	return ret;
+}
+
+/* output kept per hook when the hooks of a type run concurrently */
+#define LXC_HOOK_OUTPUT_MAX 65536
+
+struct hook_run {
+	const char *script;
+	char *cmd;
+	struct lxc_popen_FILE *f;
+	char *out;
+	size_t len;
+	int phase;
+};
+
+/* Returns > 0 while there may be more to read from @fd */
+static int hook_read(struct hook_run *r, int fd)
+{
+	char buf[4096], *out;
+	ssize_t n;
+
+	n = read(fd, buf, sizeof(buf));
+	if (n < 0)
+		return errno == EINTR || errno == EAGAIN ? 1 : -1;
+	if (n == 0)
+		return 0;
+
+	if (r->len + n > LXC_HOOK_OUTPUT_MAX)
+		n = LXC_HOOK_OUTPUT_MAX - r->len;
+	if (n == 0)
+		return 1;
+
+	out = realloc(r->out, r->len + n + 1);
+	if (!out)
+		return 1;
+	memcpy(out + r->len, buf, n);
+	r->out = out;
+	r->len += n;
+	r->out[r->len] = '\0';
+	return 1;
+}
+
+static void hook_log_output(struct hook_run *r)
+{
+	char *line, *saveptr = NULL;
+
+	if (!r->out)
+		return;
+
+	for (line = strtok_r(r->out, "\n", &saveptr); line;
+	     line = strtok_r(NULL, "\n", &saveptr))
+		DEBUG("script '%s' output: %s", r->script, line);
+
+	if (r->len == LXC_HOOK_OUTPUT_MAX)
+		DEBUG("script '%s' output truncated", r->script);
+}
+
+/*
+ * Start all @hooks at once. Their output is collected as they run and
+ * logged per hook once all of them finished. Unlike in sequence, a
+ * failing hook does not keep the others from running; the result is an
+ * error if any of them failed.
+ */
+static int run_hooks_parallel(const char *name, const char *hook,
+			      struct lxc_list *hooks, char **argv)
+{
+	struct hook_run *runs;
+	struct pollfd *pfd;
+	struct lxc_list *it;
+	int i = 0, n, nopen = 0, ret = 0;
+
+	n = lxc_list_len(hooks);
+	runs = calloc(n, sizeof(*runs));
+	pfd = calloc(n, sizeof(*pfd));
+	if (!runs || !pfd) {
+		ERROR("failed to allocate memory");
+		free(runs);
+		free(pfd);
+		return -1;
+	}
+
+	lxc_list_for_each(it, hooks) {
+		struct hook_run *r = &runs[i];
+
+		pfd[i++].fd = -1;
+		r->script = it->elem;
+		INFO("Executing script '%s' for container '%s', config section 'lxc'",
+		     r->script, name);
+
+		r->cmd = script_argv_buffer(name, "lxc", r->script, hook, argv);
+		if (!r->cmd) {
+			ret = -1;
+			continue;
+		}
+
+		r->phase = lxc_timing_begin("hook.%s %s", hook, r->script);
+		r->f = script_popen(r->cmd);
+		if (!r->f) {
+			SYSERROR("popen failed");
+			ret = -1;
+			continue;
+		}
+
+		pfd[i - 1].fd = fileno(r->f->f);
+		pfd[i - 1].events = POLLIN;
+		nopen++;
+	}
+
+	while (nopen > 0) {
+		if (poll(pfd, n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			SYSERROR("failed to wait for the output of the hooks");
+			ret = -1;
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (pfd[i].fd < 0 || !pfd[i].revents)
+				continue;
+			if (hook_read(&runs[i], pfd[i].fd) <= 0) {
+				pfd[i].fd = -1;
+				nopen--;
+			}
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		struct hook_run *r = &runs[i];
+
+		if (r->f) {
+			hook_log_output(r);
+			if (script_status(lxc_pclose(r->f)) < 0) {
+				ERROR("%s hook '%s' failed", hook, r->script);
+				ret = -1;
+			} else {
+				lxc_timing_end(r->phase);
+			}
+		}
+		free(r->out);
+		free(r->cmd);
+	}
+
+	free(runs);
+	free(pfd);
+	return ret;
 }
 
 static int run_script(const char *name, const char *section,
@@ -1900,25 +2127,22 @@ static int mount_file_entries(const struct lxc_rootfs *rootfs, FILE *file,
 {
 	struct mntent mntent;
 	char buf[4096];
-	int ret = -1;
+	int ret = -1, phase;
 
 	while (getmntent_r(file, &mntent, buf, sizeof(buf))) {
 
+		phase = lxc_timing_begin("mount.entry %s", mntent.mnt_dir);
 		if (!rootfs->path) {
 			if (mount_entry_on_systemfs(&mntent))
 				goto out;
-			continue;
-		}
-
-		/* We have a separate root, mounts are relative to it */
-		if (mntent.mnt_dir[0] != '/') {
+		} else if (mntent.mnt_dir[0] != '/') {
+			/* We have a separate root, mounts are relative to it */
 			if (mount_entry_on_relative_rootfs(&mntent, rootfs, lxc_name, lxc_path))
 				goto out;
-			continue;
-		}
-
-		if (mount_entry_on_absolute_rootfs(&mntent, rootfs, lxc_name, lxc_path))
+		} else if (mount_entry_on_absolute_rootfs(&mntent, rootfs, lxc_name, lxc_path)) {
 			goto out;
+		}
+		lxc_timing_end(phase);
 	}
 
 	ret = 0;
@@ -2478,6 +2702,8 @@ struct lxc_conf *lxc_conf_init(void)
 	new->console.peerpty.slave = -1;
 	new->console.master = -1;
 	new->console.slave = -1;
+	new->console.splice_pipe[0] = new->console.splice_pipe[1] = -1;
+	new->console.tee_pipe[0] = new->console.tee_pipe[1] = -1;
 	new->console.name[0] = '\0';
 	new->maincmd_fd = -1;
 	new->nbd_idx = -1;
@@ -2854,6 +3080,7 @@ int lxc_create_network(struct lxc_handler *handler)
 	struct lxc_list *iterator;
 	struct lxc_netdev *netdev;
 	int am_root = (getuid() == 0);
+	int phase;
 
 	if (!am_root)
 		return 0;
@@ -2868,10 +3095,14 @@ int lxc_create_network(struct lxc_handler *handler)
 			return -1;
 		}
 
+		phase = lxc_timing_begin("net.create %s %s",
+					 netdev->link ? netdev->link : "-",
+					 lxc_net_type_to_str(netdev->type));
 		if (netdev_conf[netdev->type](handler, netdev)) {
 			ERROR("failed to create netdev");
 			return -1;
 		}
+		lxc_timing_end(phase);
 
 	}
 
@@ -3013,15 +3244,18 @@ int lxc_assign_network(const char *lxcpath, char *lxcname,
 	struct lxc_netdev *netdev;
 	char ifname[IFNAMSIZ];
 	int am_root = (getuid() == 0);
-	int err;
+	int err, phase;
 
 	lxc_list_for_each(iterator, network) {
 
 		netdev = iterator->elem;
 
 		if (netdev->type == LXC_NET_VETH && !am_root) {
+			phase = lxc_timing_begin("net.assign %s lxc-user-nic",
+						 netdev->link ? netdev->link : "-");
 			if (unpriv_assign_nic(lxcpath, lxcname, netdev, pid))
 				return -1;
+			lxc_timing_end(phase);
 			// lxc-user-nic has moved the nic to the new ns.
 			// unpriv_assign_nic() fills in netdev->name.
 			// netdev->ifindex will be filed in at setup_netdev.
@@ -3038,12 +3272,14 @@ int lxc_assign_network(const char *lxcpath, char *lxcname,
 			return -1;
 		}
 
+		phase = lxc_timing_begin("net.assign %s", ifname);
 		err = lxc_netdev_move_by_name(ifname, pid, NULL);
 		if (err) {
 			ERROR("failed to move '%s' to the container : %s",
 			      netdev->link, strerror(-err));
 			return -1;
 		}
+		lxc_timing_end(phase);
 
 		DEBUG("move '%s' to '%d'", netdev->name, pid);
 	}
@@ -3077,13 +3313,99 @@ static int write_id_mapping(enum idtype idtype, pid_t pid, const char *buf,
 	return ret < 0 ? ret : closeret;
 }
 
+/* newuidmap and newgidmap, looked up on $PATH once per process */
+static char *idmap_helper[2];
+static pthread_once_t idmap_helper_once = PTHREAD_ONCE_INIT;
+
+static void idmap_helper_init(void)
+{
+	idmap_helper[ID_TYPE_UID] = on_path("newuidmap", NULL);
+	idmap_helper[ID_TYPE_GID] = on_path("newgidmap", NULL);
+}
+
+/*
+ * Start new[ug]idmap for the @type entries of @idmap, straight from an
+ * argv rather than through a shell. Returns the helper's pid, 0 if there
+ * is nothing to map, -1 on error.
+ */
+static pid_t idmap_helper_spawn(struct lxc_list *idmap, enum idtype type,
+				pid_t pid)
+{
+	struct lxc_list *iterator;
+	struct id_map *map;
+	posix_spawnattr_t attr;
+	sigset_t mask;
+	char **argv, *args, *pos;
+	pid_t child = -1;
+	int n = 0, i = 0, ret;
+	size_t len;
+
+	lxc_list_for_each(iterator, idmap) {
+		map = iterator->elem;
+		if (map->idtype == type)
+			n++;
+	}
+	if (!n)
+		return 0;
+
+	if (!idmap_helper[type]) {
+		ERROR("Missing new%cidmap", type == ID_TYPE_UID ? 'u' : 'g');
+		return -1;
+	}
+
+	/* three numbers per entry plus the pid, each fits in 21 bytes */
+	len = (3 * n + 1) * 21;
+	argv = malloc((3 * n + 3) * sizeof(*argv));
+	args = pos = malloc(len);
+	if (!argv || !args)
+		goto out;
+
+	argv[i++] = type == ID_TYPE_UID ? "newuidmap" : "newgidmap";
+	argv[i++] = pos;
+	pos += sprintf(pos, "%d", pid) + 1;
+	lxc_list_for_each(iterator, idmap) {
+		map = iterator->elem;
+		if (map->idtype != type)
+			continue;
+		argv[i++] = pos;
+		pos += sprintf(pos, "%lu", map->nsid) + 1;
+		argv[i++] = pos;
+		pos += sprintf(pos, "%lu", map->hostid) + 1;
+		argv[i++] = pos;
+		pos += sprintf(pos, "%lu", map->range) + 1;
+	}
+	argv[i] = NULL;
+
+	/* the monitor blocks all signals, the helper should not inherit that */
+	if (posix_spawnattr_init(&attr))
+		goto out;
+	sigemptyset(&mask);
+	ret = posix_spawnattr_setsigmask(&attr, &mask);
+	if (!ret)
+		ret = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+	if (!ret)
+		ret = posix_spawn(&child, idmap_helper[type], NULL, &attr, argv, environ);
+	posix_spawnattr_destroy(&attr);
+	if (ret) {
+		errno = ret;
+		SYSERROR("failed to run %s", idmap_helper[type]);
+		child = -1;
+	}
+
+out:
+	free(argv);
+	free(args);
+	return child;
+}
+
 int lxc_map_ids(struct lxc_list *idmap, pid_t pid)
 {
 	struct lxc_list *iterator;
 	struct id_map *map;
-	int ret = 0, use_shadow = 0;
+	int ret = 0;
 	enum idtype type;
-	char *buf = NULL, *pos, *cmdpath = NULL;
+	char *buf = NULL, *pos;
+	pid_t helper[2];
 
 	/*
 	 * If newuidmap exists, that is, if shadow is handing out subuid
@@ -3091,13 +3413,30 @@ int lxc_map_ids(struct lxc_list *idmap, pid_t pid)
 	 * will protected it by preventing another user from being handed the
 	 * range by shadow.
 	 */
-	cmdpath = on_path("newuidmap", NULL);
-	if (cmdpath) {
-		use_shadow = 1;
-		free(cmdpath);
+	pthread_once(&idmap_helper_once, idmap_helper_init);
+
+	if (idmap_helper[ID_TYPE_UID]) {
+		/* the uid and gid maps are independent, write them concurrently */
+		for (type = ID_TYPE_UID; type <= ID_TYPE_GID; type++) {
+			helper[type] = idmap_helper_spawn(idmap, type, pid);
+			if (helper[type] < 0)
+				ret = -1;
+		}
+
+		for (type = ID_TYPE_UID; type <= ID_TYPE_GID; type++) {
+			if (helper[type] <= 0)
+				continue;
+			if (wait_for_pid(helper[type]) < 0) {
+				ERROR("new%cidmap failed to write the mapping of %d",
+				      type == ID_TYPE_UID ? 'u' : 'g', pid);
+				ret = -1;
+			}
+		}
+
+		return ret;
 	}
 
-	if (!use_shadow && geteuid()) {
+	if (geteuid()) {
 		ERROR("Missing newuidmap/newgidmap");
 		return -1;
 	}
@@ -3111,10 +3450,6 @@ int lxc_map_ids(struct lxc_list *idmap, pid_t pid)
 				return -ENOMEM;
 		}
 		pos = buf;
-		if (use_shadow)
-			pos += sprintf(buf, "new%cidmap %d",
-				type == ID_TYPE_UID ? 'u' : 'g',
-				pid);
 
 		lxc_list_for_each(iterator, idmap) {
 			/* The kernel only takes <= 4k for writes to /proc/<nr>/[ug]id_map */
@@ -3124,10 +3459,8 @@ int lxc_map_ids(struct lxc_list *idmap, pid_t pid)
 
 			had_entry = 1;
 			left = 4096 - (pos - buf);
-			fill = snprintf(pos, left, "%s%lu %lu %lu%s",
-					use_shadow ? " " : "",
-					map->nsid, map->hostid, map->range,
-					use_shadow ? "" : "\n");
+			fill = snprintf(pos, left, "%lu %lu %lu\n",
+					map->nsid, map->hostid, map->range);
 			if (fill <= 0 || fill >= left)
 				SYSERROR("snprintf failed, too many mappings");
 			pos += fill;
@@ -3135,17 +3468,7 @@ int lxc_map_ids(struct lxc_list *idmap, pid_t pid)
 		if (!had_entry)
 			continue;
 
-		if (!use_shadow) {
-			ret = write_id_mapping(type, pid, buf, pos-buf);
-		} else {
-			left = 4096 - (pos - buf);
-			fill = snprintf(pos, left, "\n");
-			if (fill <= 0 || fill >= left)
-				SYSERROR("snprintf failed, too many mappings");
-			pos += fill;
-			ret = system(buf);
-		}
-
+		ret = write_id_mapping(type, pid, buf, pos-buf);
 		if (ret)
 			break;
 	}
@@ -3689,11 +4012,14 @@ int lxc_setup(struct lxc_handler *handler)
 	const char *name = handler->name;
 	struct lxc_conf *lxc_conf = handler->conf;
 	const char *lxcpath = handler->lxcpath;
+	int phase;
 
+	phase = lxc_timing_begin("setup.rootfs");
 	if (do_rootfs_setup(lxc_conf, name, lxcpath) < 0) {
 		ERROR("Error setting up rootfs mount after spawn");
 		return -1;
 	}
+	lxc_timing_end(phase);
 
 	if (lxc_conf->inherit_ns_fd[LXC_NS_UTS] == -1) {
 		if (setup_utsname(lxc_conf->utsname)) {
@@ -3702,25 +4028,31 @@ int lxc_setup(struct lxc_handler *handler)
 		}
 	}
 
+	phase = lxc_timing_begin("setup.network");
 	if (setup_network(&lxc_conf->network)) {
 		ERROR("failed to setup the network for '%s'", name);
 		return -1;
 	}
+	lxc_timing_end(phase);
 
 	if (lxc_conf->autodev > 0) {
+		phase = lxc_timing_begin("setup.autodev");
 		if (mount_autodev(name, &lxc_conf->rootfs, lxcpath)) {
 			ERROR("failed to mount /dev in the container");
 			return -1;
 		}
+		lxc_timing_end(phase);
 	}
 
 	/* do automatic mounts (mainly /proc and /sys), but exclude
 	 * those that need to wait until other stuff has finished
 	 */
+	phase = lxc_timing_begin("setup.automounts");
 	if (lxc_mount_auto_mounts(lxc_conf, lxc_conf->auto_mounts & ~LXC_AUTO_CGROUP_MASK, handler) < 0) {
 		ERROR("failed to setup the automatic mounts for '%s'", name);
 		return -1;
 	}
+	lxc_timing_end(phase);
 
 	if (setup_mount(&lxc_conf->rootfs, lxc_conf->fstab, name, lxcpath)) {
 		ERROR("failed to setup the mounts for '%s'", name);
@@ -3743,10 +4075,12 @@ int lxc_setup(struct lxc_handler *handler)
 	 * before, /sys could not have been mounted
 	 * (is either mounted automatically or via fstab entries)
 	 */
+	phase = lxc_timing_begin("setup.automounts cgroup");
 	if (lxc_mount_auto_mounts(lxc_conf, lxc_conf->auto_mounts & LXC_AUTO_CGROUP_MASK, handler) < 0) {
 		ERROR("failed to setup the automatic mounts for '%s'", name);
 		return -1;
 	}
+	lxc_timing_end(phase);
 
 	if (run_lxc_hooks(name, "mount", lxc_conf, lxcpath, NULL)) {
 		ERROR("failed to run mount hooks for container '%s'.", name);
@@ -3760,10 +4094,12 @@ int lxc_setup(struct lxc_handler *handler)
 			ERROR("failed to run autodev hooks for container '%s'.", name);
 			return -1;
 		}
+		phase = lxc_timing_begin("setup.autodev fill");
 		if (fill_autodev(&lxc_conf->rootfs, mount_console)) {
 			ERROR("failed to populate /dev in the container");
 			return -1;
 		}
+		lxc_timing_end(phase);
 	}
 
 	if (!lxc_conf->is_execute && setup_console(&lxc_conf->rootfs, &lxc_conf->console, lxc_conf->ttydir)) {
@@ -3787,16 +4123,19 @@ int lxc_setup(struct lxc_handler *handler)
 		return -1;
 	}
 
+	phase = lxc_timing_begin("setup.pivot_root");
 	if (setup_pivot_root(&lxc_conf->rootfs)) {
 		ERROR("failed to set rootfs for '%s'", name);
 		return -1;
 	}
+	lxc_timing_end(phase);
 
 	if (setup_pts(lxc_conf->pts)) {
 		ERROR("failed to setup the new pts instance");
 		return -1;
 	}
 
+	phase = lxc_timing_begin("setup.ttys");
 	if (lxc_create_tty(name, lxc_conf)) {
 		ERROR("failed to create the ttys");
 		return -1;
@@ -3806,6 +4145,7 @@ int lxc_setup(struct lxc_handler *handler)
 		ERROR("failure sending console info to parent");
 		return -1;
 	}
+	lxc_timing_end(phase);
 
 
 	if (!lxc_conf->is_execute && setup_tty(lxc_conf)) {
@@ -3822,6 +4162,18 @@ int lxc_setup(struct lxc_handler *handler)
 		return -1;
 	}
 
+	/* a warm container is claimed with its capabilities still in place,
+	 * do_start() drops them once that is done */
+	if (!lxc_conf->warm && lxc_setup_caps(lxc_conf))
+		return -1;
+
+	NOTICE("'%s' is setup.", name);
+
+	return 0;
+}
+
+int lxc_setup_caps(struct lxc_conf *lxc_conf)
+{
 	if (!lxc_list_empty(&lxc_conf->keepcaps)) {
 		if (!lxc_list_empty(&lxc_conf->caps)) {
 			ERROR("Simultaneously requested dropping and keeping caps");
@@ -3836,7 +4188,208 @@ int lxc_setup(struct lxc_handler *handler)
 		return -1;
 	}
 
-	NOTICE("'%s' is setup.", name);
+	return 0;
+}
+
+/*
+ * Split "key=value" claim @item into @key and @value. Returns the netdev
+ * an "lxc.network.<n>.<subkey>" key refers to, with @subkey pointing into
+ * @key, or NULL (and @subkey NULL) for other keys.
+ */
+static int claim_split(struct lxc_conf *conf, const char *item, char *key,
+		       size_t keysz, const char **value,
+		       struct lxc_netdev **netdev, const char **subkey)
+{
+	struct lxc_list *it;
+	unsigned long idx, i = 0;
+	const char *eq;
+	char *end;
+
+	*netdev = NULL;
+	*subkey = NULL;
+
+	eq = strchr(item, '=');
+	if (!eq || eq == item || eq - item >= keysz)
+		return -EINVAL;
+	memcpy(key, item, eq - item);
+	key[eq - item] = '\0';
+	*value = eq + 1;
+
+	if (strncmp(key, "lxc.network.", 12) != 0 || !isdigit(key[12]))
+		return 0;
+	idx = strtoul(key + 12, &end, 10);
+	if (*end != '.')
+		return -EINVAL;
+	*subkey = end + 1;
+	lxc_list_for_each(it, &conf->network) {
+		if (i++ == idx) {
+			*netdev = it->elem;
+			break;
+		}
+	}
+	return 0;
+}
+
+int lxc_claim_check(struct lxc_conf *conf, const char *items, size_t len)
+{
+	static const char *net_keys[] = { "hwaddr", "ipv4", "ipv6",
+					  "ipv4.gateway", "ipv6.gateway", NULL };
+	struct lxc_netdev *netdev;
+	const char *item, *value, *subkey;
+	char key[LXC_CLAIM_KEY_MAX];
+	int i;
+
+	if (!len || items[len - 1] != '\0')
+		return -EINVAL;
+
+	for (item = items; item < items + len; item += strlen(item) + 1) {
+		if (!*item)
+			continue;
+		if (claim_split(conf, item, key, sizeof(key), &value, &netdev, &subkey) < 0)
+			goto bad;
+		if (strcmp(key, "lxc.utsname") == 0)
+			continue;
+		if (!netdev || netdev->type == LXC_NET_EMPTY ||
+		    netdev->type == LXC_NET_NONE)
+			goto bad;
+		for (i = 0; net_keys[i]; i++)
+			if (strcmp(subkey, net_keys[i]) == 0)
+				break;
+		if (!net_keys[i])
+			goto bad;
+		/* the monitor and the container must end up with the same value */
+		if (strcmp(subkey, "hwaddr") == 0 && strchr(value, 'x'))
+			goto bad;
+		/* gateways can only be detected before the network is moved */
+		if (strcmp(value, "auto") == 0)
+			goto bad;
+	}
+	return 0;
+
+bad:
+	ERROR("'%s' cannot be set when claiming a container", item);
+	return -EINVAL;
+}
+
+static int claim_gateways(struct lxc_netdev *netdev)
+{
+	int err;
+
+	if (netdev->ipv4_gateway) {
+		err = lxc_ipv4_gateway_add(netdev->ifindex, netdev->ipv4_gateway);
+		if (err && err != -EEXIST) {
+			lxc_ipv4_dest_add(netdev->ifindex, netdev->ipv4_gateway);
+			err = lxc_ipv4_gateway_add(netdev->ifindex, netdev->ipv4_gateway);
+		}
+		if (err && err != -EEXIST) {
+			ERROR("failed to setup ipv4 gateway : %s", strerror(-err));
+			return err;
+		}
+	}
+
+	if (netdev->ipv6_gateway) {
+		err = lxc_ipv6_gateway_add(netdev->ifindex, netdev->ipv6_gateway);
+		if (err && err != -EEXIST) {
+			lxc_ipv6_dest_add(netdev->ifindex, netdev->ipv6_gateway);
+			err = lxc_ipv6_gateway_add(netdev->ifindex, netdev->ipv6_gateway);
+		}
+		if (err && err != -EEXIST) {
+			ERROR("failed to setup ipv6 gateway : %s", strerror(-err));
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Hostname and hardware addresses go first: changing the latter takes the
+ * interface down, which drops its routes and, possibly, ipv6 addresses.
+ * Gateways are (re)added last, once the addresses they are reached through
+ * are in place.
+ */
+int lxc_claim_setup(struct lxc_conf *conf, const char *items, size_t len,
+		    bool live)
+{
+	struct lxc_config_t *config;
+	struct lxc_netdev *netdev;
+	struct lxc_inetdev *inetdev;
+	struct lxc_inet6dev *inet6dev;
+	struct lxc_list *it;
+	const char *item, *value, *subkey;
+	char key[LXC_CLAIM_KEY_MAX], ifname[IFNAMSIZ];
+	bool routes = false, first;
+	int pass, err;
+
+	for (pass = 0; pass < 2; pass++) {
+		for (item = items; item < items + len; item += strlen(item) + 1) {
+			if (!*item)
+				continue;
+			if (claim_split(conf, item, key, sizeof(key), &value, &netdev, &subkey) < 0)
+				return -EINVAL;
+			first = !netdev || strcmp(subkey, "hwaddr") == 0;
+			if (first != (pass == 0))
+				continue;
+
+			config = lxc_getconfig(key);
+			if (!config || config->cb(key, value, conf) != 0) {
+				ERROR("failed to parse '%s'", item);
+				return -EINVAL;
+			}
+			if (!live)
+				continue;
+
+			if (!netdev) {
+				if (setup_utsname(conf->utsname))
+					return -errno;
+				continue;
+			}
+
+			if (!if_indextoname(netdev->ifindex, ifname)) {
+				ERROR("no interface corresponding to index '%d'",
+				      netdev->ifindex);
+				return -ENODEV;
+			}
+
+			if (strcmp(subkey, "hwaddr") == 0) {
+				routes = true;
+				if (netdev->flags & IFF_UP)
+					lxc_netdev_down(ifname);
+				err = setup_hw_addr(netdev->hwaddr, ifname) ? -EINVAL : 0;
+				if (netdev->flags & IFF_UP && !err)
+					err = lxc_netdev_up(ifname);
+			} else if (strcmp(subkey, "ipv4") == 0) {
+				inetdev = lxc_list_last_elem(&netdev->ipv4);
+				err = lxc_ipv4_addr_add(netdev->ifindex, &inetdev->addr,
+							&inetdev->bcast, inetdev->prefix);
+			} else if (strcmp(subkey, "ipv6") == 0) {
+				inet6dev = lxc_list_last_elem(&netdev->ipv6);
+				err = lxc_ipv6_addr_add(netdev->ifindex, &inet6dev->addr,
+							&inet6dev->mcast, &inet6dev->acast,
+							inet6dev->prefix);
+			} else {
+				routes = true;
+				err = 0;
+			}
+			if (err) {
+				ERROR("failed to apply '%s' to '%s' : %s", item,
+				      ifname, strerror(-err));
+				return err;
+			}
+		}
+	}
+
+	if (!live || !routes)
+		return 0;
+
+	lxc_list_for_each(it, &conf->network) {
+		netdev = it->elem;
+		if (!netdev->ifindex || !(netdev->flags & IFF_UP))
+			continue;
+		err = claim_gateways(netdev);
+		if (err)
+			return err;
+	}
 
 	return 0;
 }
@@ -3867,12 +4420,18 @@ int run_lxc_hooks(const char *name, char *hook, struct lxc_conf *conf,
 		which = LXCHOOK_DESTROY;
 	else
 		return -1;
+
+	if (conf->hooks_parallel && lxc_list_len(&conf->hooks[which]) > 1)
+		return run_hooks_parallel(name, hook, &conf->hooks[which], argv);
+
 	lxc_list_for_each(it, &conf->hooks[which]) {
-		int ret;
+		int ret, phase;
 		char *hookname = it->elem;
+		phase = lxc_timing_begin("hook.%s %s", hook, hookname);
 		ret = run_script_argv(name, "lxc", hookname, hook, lxcpath, argv);
 		if (ret)
 			return ret;
+		lxc_timing_end(phase);
 	}
 	return 0;
 }
@@ -4148,14 +4707,17 @@ void lxc_conf_free(struct lxc_conf *conf)
 	free(conf->rootfs.options);
 	free(conf->rootfs.path);
 	free(conf->logfile);
-	if (conf->logfd != -1)
+	if (conf->logfd != -1) {
+		lxc_log_flush();
 		close(conf->logfd);
+	}
 	free(conf->utsname);
 	free(conf->ttydir);
 	free(conf->fstab);
 	free(conf->rcfile);
 	free(conf->init_cmd);
-	free(conf->unexpanded_config);
+	free(conf->unexpanded_config.buf);
+	free(conf->unexpanded_config.lines);
 	free(conf->pty_names);
 	lxc_clear_config_network(conf);
 	free(conf->lsm_aa_profile);
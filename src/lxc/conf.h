@@ -31,6 +31,7 @@
 #include <sys/param.h>
 #include <sys/types.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "list.h"
 #include "start.h" /* for lxc_handler */
@@ -195,6 +196,23 @@ struct lxc_tty_info {
 
 struct lxc_tty_state;
 
+/* upper limit of lxc.console.buffer.size */
+#define LXC_CONSOLE_BUFFER_MAX (16 * 1024 * 1024)
+
+/*
+ * Ring buffer keeping the most recent console output in the monitor
+ * @addr  : the buffer, NULL if lxc.console.buffer.size is not set
+ * @size  : its size
+ * @w_off : where the next byte goes
+ * @full  : whether it wrapped around at least once
+ */
+struct lxc_console_ringbuf {
+	char *addr;
+	uint64_t size;
+	uint64_t w_off;
+	bool full;
+};
+
 /*
  * Defines the structure to store the console information
  * @peer   : the file descriptor put/get console traffic
@@ -212,6 +230,14 @@ struct lxc_console {
 	char name[MAXPATHLEN];
 	struct termios *tios;
 	struct lxc_tty_state *tty_state;
+	int splice_pipe[2]; /* output of master on its way to peer and log */
+	int tee_pipe[2]; /* copy of splice_pipe for the log */
+	bool nosplice; /* master doesn't support splice */
+	uint64_t buffer_size; /* lxc.console.buffer.size */
+	struct lxc_console_ringbuf ringbuf;
+	uint64_t log_size; /* lxc.console.size, 0 means unlimited */
+	uint64_t log_written; /* current size of the log file */
+	int log_rotate; /* lxc.console.rotate */
 };
 
 /*
@@ -260,6 +286,30 @@ enum {
 	LXC_AUTO_ALL_MASK             = 0x0FF,   /* all known settings */
 };
 
+/*
+ * The config file as it was read, before includes are expanded, kept as an
+ * index of lines so that keys can be dropped or rewritten without moving the
+ * rest of the text around.
+ * @buf      : the text of all lines, each NUL terminated; only ever appended
+ *             to, and compacted once half of it is stale
+ * @stale    : bytes of @buf which belong to removed or rewritten lines
+ * @lines    : offset into @buf and length (including the trailing newline)
+ *             of every line, in file order; a removed line has length 0
+ * @len      : size of the config when written out
+ */
+struct lxc_unexp_line {
+	size_t off;
+	size_t len;
+};
+
+struct lxc_unexp_config {
+	char *buf;
+	size_t buf_len, buf_size, stale;
+	struct lxc_unexp_line *lines;
+	size_t nlines, lines_size;
+	size_t len;
+};
+
 /*
  * Defines the global container configuration
  * @rootfs     : root directory to run the container
@@ -315,6 +365,7 @@ struct lxc_conf {
 	char *ttydir;
 	int close_all_fds;
 	struct lxc_list hooks[NUM_LXC_HOOKS];
+	int hooks_parallel; /* run the hooks of a type concurrently */
 
 	char *lsm_aa_profile;
 	int lsm_aa_allow_incomplete;
@@ -365,8 +416,7 @@ struct lxc_conf {
 	struct lxc_list environment;
 
 	/* text representation of the config file */
-	char *unexpanded_config;
-	size_t unexpanded_len, unexpanded_alloced;
+	struct lxc_unexp_config unexpanded_config;
 
 	/* init command */
 	char *init_cmd;
@@ -378,6 +428,9 @@ struct lxc_conf {
 
 	/* indicator if the container will be destroyed on shutdown */
 	int ephemeral;
+
+	/* park init just before its exec until the container is claimed */
+	bool warm;
 };
 
 #ifdef HAVE_TLS
@@ -389,6 +442,20 @@ extern struct lxc_conf *current_config;
 int run_lxc_hooks(const char *name, char *hook, struct lxc_conf *conf,
 		  const char *lxcpath, char *argv[]);
 
+/*
+ * A warm container is claimed with a list of "key=value" config items,
+ * each NUL terminated, empty ones being skipped: lxc.utsname and the hwaddr, ipv4, ipv6 and gateways
+ * of existing network devices. lxc_claim_check() validates the list,
+ * lxc_claim_setup() stores it in @conf and, if @live, applies it from
+ * inside the container.
+ */
+#define LXC_CLAIM_MAX 4096
+#define LXC_CLAIM_TIMEOUT 10 /* seconds the monitor waits for init to apply it */
+#define LXC_CLAIM_KEY_MAX 64
+extern int lxc_claim_check(struct lxc_conf *conf, const char *items, size_t len);
+extern int lxc_claim_setup(struct lxc_conf *conf, const char *items, size_t len,
+			   bool live);
+
 extern int detect_shared_rootfs(void);
 
 /*
@@ -432,6 +499,7 @@ extern int do_rootfs_setup(struct lxc_conf *conf, const char *name,
 
 struct cgroup_process_info;
 extern int lxc_setup(struct lxc_handler *handler);
+extern int lxc_setup_caps(struct lxc_conf *lxc_conf);
 
 extern void lxc_rename_phys_nics_on_shutdown(int netnsfd, struct lxc_conf *conf);
 
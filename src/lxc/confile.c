@@ -22,10 +22,12 @@
  */
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <libgen.h>
 #include <fcntl.h>
 #include <ctype.h>
 #include <signal.h>
@@ -38,6 +40,7 @@
 #include <net/if.h>
 #include <time.h>
 #include <dirent.h>
+#include <pthread.h>
 
 #include "parse.h"
 #include "config.h"
@@ -48,6 +51,7 @@
 #include "conf.h"
 #include "network.h"
 #include "lxcseccomp.h"
+#include "version.h"
 
 #if HAVE_SYS_PERSONALITY_H
 #include <sys/personality.h>
@@ -97,6 +101,9 @@ static int config_cap_drop(const char *, const char *, struct lxc_conf *);
 static int config_cap_keep(const char *, const char *, struct lxc_conf *);
 static int config_console(const char *, const char *, struct lxc_conf *);
 static int config_console_logfile(const char *, const char *, struct lxc_conf *);
+static int config_console_buffer_size(const char *, const char *, struct lxc_conf *);
+static int config_console_size(const char *, const char *, struct lxc_conf *);
+static int config_console_rotate(const char *, const char *, struct lxc_conf *);
 static int config_seccomp(const char *, const char *, struct lxc_conf *);
 static int config_includefile(const char *, const char *, struct lxc_conf *);
 static int config_network_nic(const char *, const char *, struct lxc_conf *);
@@ -112,78 +119,135 @@ static int config_init_cmd(const char *, const char *, struct lxc_conf *);
 static int config_init_uid(const char *, const char *, struct lxc_conf *);
 static int config_init_gid(const char *, const char *, struct lxc_conf *);
 static int config_ephemeral(const char *, const char *, struct lxc_conf *);
+static int config_hook_parallel(const char *, const char *, struct lxc_conf *);
+
+static int get_config_arch(const char *, char *, int, struct lxc_conf *);
+static int get_config_pts(const char *, char *, int, struct lxc_conf *);
+static int get_config_tty(const char *, char *, int, struct lxc_conf *);
+static int get_config_devttydir(const char *, char *, int, struct lxc_conf *);
+static int get_config_aa_profile(const char *, char *, int, struct lxc_conf *);
+static int get_config_aa_allow_incomplete(const char *, char *, int, struct lxc_conf *);
+static int get_config_se_context(const char *, char *, int, struct lxc_conf *);
+static int get_config_cgroup(const char *, char *, int, struct lxc_conf *);
+static int get_config_loglevel(const char *, char *, int, struct lxc_conf *);
+static int get_config_logfile(const char *, char *, int, struct lxc_conf *);
+static int get_config_mount_entry(const char *, char *, int, struct lxc_conf *);
+static int get_config_mount_auto(const char *, char *, int, struct lxc_conf *);
+static int get_config_mount(const char *, char *, int, struct lxc_conf *);
+static int get_config_rootfs_mount(const char *, char *, int, struct lxc_conf *);
+static int get_config_rootfs_options(const char *, char *, int, struct lxc_conf *);
+static int get_config_rootfs_backend(const char *, char *, int, struct lxc_conf *);
+static int get_config_rootfs(const char *, char *, int, struct lxc_conf *);
+static int get_config_utsname(const char *, char *, int, struct lxc_conf *);
+static int get_config_hook(const char *, char *, int, struct lxc_conf *);
+static int get_config_network_nic(const char *, char *, int, struct lxc_conf *);
+static int get_config_network(const char *, char *, int, struct lxc_conf *);
+static int get_config_cap_drop(const char *, char *, int, struct lxc_conf *);
+static int get_config_cap_keep(const char *, char *, int, struct lxc_conf *);
+static int get_config_console_logfile(const char *, char *, int, struct lxc_conf *);
+static int get_config_console_buffer_size(const char *, char *, int, struct lxc_conf *);
+static int get_config_console_size(const char *, char *, int, struct lxc_conf *);
+static int get_config_console_rotate(const char *, char *, int, struct lxc_conf *);
+static int get_config_console(const char *, char *, int, struct lxc_conf *);
+static int get_config_seccomp(const char *, char *, int, struct lxc_conf *);
+static int get_config_start_auto(const char *, char *, int, struct lxc_conf *);
+static int get_config_start_delay(const char *, char *, int, struct lxc_conf *);
+static int get_config_start_order(const char *, char *, int, struct lxc_conf *);
+static int get_config_monitor_unshare(const char *, char *, int, struct lxc_conf *);
+static int get_config_group(const char *, char *, int, struct lxc_conf *);
+static int get_config_environment(const char *, char *, int, struct lxc_conf *);
+static int get_config_init_cmd(const char *, char *, int, struct lxc_conf *);
+static int get_config_init_uid(const char *, char *, int, struct lxc_conf *);
+static int get_config_init_gid(const char *, char *, int, struct lxc_conf *);
+static int get_config_ephemeral(const char *, char *, int, struct lxc_conf *);
+static int get_config_hook_parallel(const char *, char *, int, struct lxc_conf *);
+static int clr_config_cgroup(const char *, struct lxc_conf *);
+static int clr_config_idmap(const char *, struct lxc_conf *);
+static int clr_config_mount_entry(const char *, struct lxc_conf *);
+static int clr_config_mount_auto(const char *, struct lxc_conf *);
+static int clr_config_hook(const char *, struct lxc_conf *);
+static int clr_config_network_nic(const char *, struct lxc_conf *);
+static int clr_config_network(const char *, struct lxc_conf *);
+static int clr_config_cap_drop(const char *, struct lxc_conf *);
+static int clr_config_cap_keep(const char *, struct lxc_conf *);
+static int clr_config_group(const char *, struct lxc_conf *);
+static int clr_config_environment(const char *, struct lxc_conf *);
 
 static struct lxc_config_t config[] = {
 
-	{ "lxc.arch",                 config_personality          },
-	{ "lxc.pts",                  config_pts                  },
-	{ "lxc.tty",                  config_tty                  },
-	{ "lxc.devttydir",            config_ttydir               },
-	{ "lxc.kmsg",                 config_kmsg                 },
-	{ "lxc.aa_profile",           config_lsm_aa_profile       },
-	{ "lxc.aa_allow_incomplete",  config_lsm_aa_incomplete    },
-	{ "lxc.se_context",           config_lsm_se_context       },
-	{ "lxc.cgroup",               config_cgroup               },
-	{ "lxc.id_map",               config_idmap                },
-	{ "lxc.loglevel",             config_loglevel             },
-	{ "lxc.logfile",              config_logfile              },
-	{ "lxc.mount.entry",          config_mount                },
-	{ "lxc.mount.auto",           config_mount_auto           },
-	{ "lxc.mount",                config_fstab                },
-	{ "lxc.rootfs.mount",         config_rootfs_mount         },
-	{ "lxc.rootfs.options",       config_rootfs_options       },
-	{ "lxc.rootfs.backend",       config_rootfs_backend       },
-	{ "lxc.rootfs",               config_rootfs               },
-	{ "lxc.pivotdir",             config_pivotdir             },
-	{ "lxc.utsname",              config_utsname              },
-	{ "lxc.hook.pre-start",       config_hook                 },
-	{ "lxc.hook.pre-mount",       config_hook                 },
-	{ "lxc.hook.mount",           config_hook                 },
-	{ "lxc.hook.autodev",         config_hook                 },
-	{ "lxc.hook.start",           config_hook                 },
-	{ "lxc.hook.stop",            config_hook                 },
-	{ "lxc.hook.post-stop",       config_hook                 },
-	{ "lxc.hook.clone",           config_hook                 },
-	{ "lxc.hook.destroy",         config_hook                 },
-	{ "lxc.hook",                 config_hook                 },
-	{ "lxc.network.type",         config_network_type         },
-	{ "lxc.network.flags",        config_network_flags        },
-	{ "lxc.network.link",         config_network_link         },
-	{ "lxc.network.name",         config_network_name         },
-	{ "lxc.network.macvlan.mode", config_network_macvlan_mode },
-	{ "lxc.network.veth.pair",    config_network_veth_pair    },
-	{ "lxc.network.script.up",    config_network_script_up    },
-	{ "lxc.network.script.down",  config_network_script_down  },
-	{ "lxc.network.hwaddr",       config_network_hwaddr       },
-	{ "lxc.network.mtu",          config_network_mtu          },
-	{ "lxc.network.vlan.id",      config_network_vlan_id      },
-	{ "lxc.network.ipv4.gateway", config_network_ipv4_gateway },
-	{ "lxc.network.ipv4",         config_network_ipv4         },
-	{ "lxc.network.ipv6.gateway", config_network_ipv6_gateway },
-	{ "lxc.network.ipv6",         config_network_ipv6         },
+	{ "lxc.arch",                 config_personality,           get_config_arch,                 NULL                    },
+	{ "lxc.pts",                  config_pts,                   get_config_pts,                  NULL                    },
+	{ "lxc.tty",                  config_tty,                   get_config_tty,                  NULL                    },
+	{ "lxc.devttydir",            config_ttydir,                get_config_devttydir,            NULL                    },
+	{ "lxc.kmsg",                 config_kmsg,                  NULL,                            NULL                    },
+	{ "lxc.aa_profile",           config_lsm_aa_profile,        get_config_aa_profile,           NULL                    },
+	{ "lxc.aa_allow_incomplete",  config_lsm_aa_incomplete,     get_config_aa_allow_incomplete,  NULL                    },
+	{ "lxc.se_context",           config_lsm_se_context,        get_config_se_context,           NULL                    },
+	{ "lxc.cgroup",               config_cgroup,                get_config_cgroup,               clr_config_cgroup       },
+	{ "lxc.id_map",               config_idmap,                 NULL,                            clr_config_idmap        },
+	{ "lxc.loglevel",             config_loglevel,              get_config_loglevel,             NULL                    },
+	{ "lxc.logfile",              config_logfile,               get_config_logfile,              NULL                    },
+	{ "lxc.mount.entry",          config_mount,                 get_config_mount_entry,          clr_config_mount_entry  },
+	{ "lxc.mount.auto",           config_mount_auto,            get_config_mount_auto,           clr_config_mount_auto   },
+	{ "lxc.mount",                config_fstab,                 get_config_mount,                NULL                    },
+	{ "lxc.rootfs.mount",         config_rootfs_mount,          get_config_rootfs_mount,         NULL                    },
+	{ "lxc.rootfs.options",       config_rootfs_options,        get_config_rootfs_options,       NULL                    },
+	{ "lxc.rootfs.backend",       config_rootfs_backend,        get_config_rootfs_backend,       NULL                    },
+	{ "lxc.rootfs",               config_rootfs,                get_config_rootfs,               NULL                    },
+	{ "lxc.pivotdir",             config_pivotdir,              NULL,                            NULL                    },
+	{ "lxc.utsname",              config_utsname,               get_config_utsname,              NULL                    },
+	{ "lxc.hook.pre-start",       config_hook,                  get_config_hook,                 clr_config_hook         },
+	{ "lxc.hook.pre-mount",       config_hook,                  get_config_hook,                 clr_config_hook         },
+	{ "lxc.hook.mount",           config_hook,                  get_config_hook,                 clr_config_hook         },
+	{ "lxc.hook.autodev",         config_hook,                  get_config_hook,                 clr_config_hook         },
+	{ "lxc.hook.start",           config_hook,                  get_config_hook,                 clr_config_hook         },
+	{ "lxc.hook.stop",            config_hook,                  get_config_hook,                 clr_config_hook         },
+	{ "lxc.hook.post-stop",       config_hook,                  get_config_hook,                 clr_config_hook         },
+	{ "lxc.hook.clone",           config_hook,                  get_config_hook,                 clr_config_hook         },
+	{ "lxc.hook.destroy",         config_hook,                  get_config_hook,                 clr_config_hook         },
+	{ "lxc.hook.parallel",        config_hook_parallel,         get_config_hook_parallel,        NULL                    },
+	{ "lxc.hook",                 config_hook,                  get_config_hook,                 clr_config_hook         },
+	{ "lxc.network.type",         config_network_type,          get_config_network_nic,          clr_config_network_nic  },
+	{ "lxc.network.flags",        config_network_flags,         get_config_network_nic,          clr_config_network_nic  },
+	{ "lxc.network.link",         config_network_link,          get_config_network_nic,          clr_config_network_nic  },
+	{ "lxc.network.name",         config_network_name,          get_config_network_nic,          clr_config_network_nic  },
+	{ "lxc.network.macvlan.mode", config_network_macvlan_mode,  get_config_network_nic,          clr_config_network_nic  },
+	{ "lxc.network.veth.pair",    config_network_veth_pair,     get_config_network_nic,          clr_config_network_nic  },
+	{ "lxc.network.script.up",    config_network_script_up,     get_config_network_nic,          clr_config_network_nic  },
+	{ "lxc.network.script.down",  config_network_script_down,   get_config_network_nic,          clr_config_network_nic  },
+	{ "lxc.network.hwaddr",       config_network_hwaddr,        get_config_network_nic,          clr_config_network_nic  },
+	{ "lxc.network.mtu",          config_network_mtu,           get_config_network_nic,          clr_config_network_nic  },
+	{ "lxc.network.vlan.id",      config_network_vlan_id,       get_config_network_nic,          clr_config_network_nic  },
+	{ "lxc.network.ipv4.gateway", config_network_ipv4_gateway,  get_config_network_nic,          clr_config_network_nic  },
+	{ "lxc.network.ipv4",         config_network_ipv4,          get_config_network_nic,          clr_config_network_nic  },
+	{ "lxc.network.ipv6.gateway", config_network_ipv6_gateway,  get_config_network_nic,          clr_config_network_nic  },
+	{ "lxc.network.ipv6",         config_network_ipv6,          get_config_network_nic,          clr_config_network_nic  },
 	/* config_network_nic must come after all other 'lxc.network.*' entries */
-	{ "lxc.network.",             config_network_nic          },
-	{ "lxc.network",              config_network              },
-	{ "lxc.cap.drop",             config_cap_drop             },
-	{ "lxc.cap.keep",             config_cap_keep             },
-	{ "lxc.console.logfile",      config_console_logfile      },
-	{ "lxc.console",              config_console              },
-	{ "lxc.seccomp",              config_seccomp              },
-	{ "lxc.include",              config_includefile          },
-	{ "lxc.autodev",              config_autodev              },
-	{ "lxc.haltsignal",           config_haltsignal           },
-	{ "lxc.rebootsignal",         config_rebootsignal         },
-	{ "lxc.stopsignal",           config_stopsignal           },
-	{ "lxc.start.auto",           config_start                },
-	{ "lxc.start.delay",          config_start                },
-	{ "lxc.start.order",          config_start                },
-	{ "lxc.monitor.unshare",      config_monitor              },
-	{ "lxc.group",                config_group                },
-	{ "lxc.environment",          config_environment          },
-	{ "lxc.init_cmd",             config_init_cmd             },
-	{ "lxc.init_uid",             config_init_uid             },
-	{ "lxc.init_gid",             config_init_gid             },
-	{ "lxc.ephemeral",            config_ephemeral            },
+	{ "lxc.network.",             config_network_nic,           get_config_network_nic,          clr_config_network_nic  },
+	{ "lxc.network",              config_network,               get_config_network,              clr_config_network      },
+	{ "lxc.cap.drop",             config_cap_drop,              get_config_cap_drop,             clr_config_cap_drop     },
+	{ "lxc.cap.keep",             config_cap_keep,              get_config_cap_keep,             clr_config_cap_keep     },
+	{ "lxc.console.logfile",      config_console_logfile,       get_config_console_logfile,      NULL                    },
+	{ "lxc.console.buffer.size",  config_console_buffer_size,   get_config_console_buffer_size,  NULL                    },
+	{ "lxc.console.size",         config_console_size,          get_config_console_size,         NULL                    },
+	{ "lxc.console.rotate",       config_console_rotate,        get_config_console_rotate,       NULL                    },
+	{ "lxc.console",              config_console,               get_config_console,              NULL                    },
+	{ "lxc.seccomp",              config_seccomp,               get_config_seccomp,              NULL                    },
+	{ "lxc.include",              config_includefile,           NULL,                            NULL                    },
+	{ "lxc.autodev",              config_autodev,               NULL,                            NULL                    },
+	{ "lxc.haltsignal",           config_haltsignal,            NULL,                            NULL                    },
+	{ "lxc.rebootsignal",         config_rebootsignal,          NULL,                            NULL                    },
+	{ "lxc.stopsignal",           config_stopsignal,            NULL,                            NULL                    },
+	{ "lxc.start.auto",           config_start,                 get_config_start_auto,           NULL                    },
+	{ "lxc.start.delay",          config_start,                 get_config_start_delay,          NULL                    },
+	{ "lxc.start.order",          config_start,                 get_config_start_order,          NULL                    },
+	{ "lxc.monitor.unshare",      config_monitor,               get_config_monitor_unshare,      NULL                    },
+	{ "lxc.group",                config_group,                 get_config_group,                clr_config_group        },
+	{ "lxc.environment",          config_environment,           get_config_environment,          clr_config_environment  },
+	{ "lxc.init_cmd",             config_init_cmd,              get_config_init_cmd,             NULL                    },
+	{ "lxc.init_uid",             config_init_uid,              get_config_init_uid,             NULL                    },
+	{ "lxc.init_gid",             config_init_gid,              get_config_init_gid,             NULL                    },
+	{ "lxc.ephemeral",            config_ephemeral,             get_config_ephemeral,            NULL                    },
 };
 
 struct signame {
@@ -270,13 +334,96 @@ static const struct signame signames[] = {
 #endif
 };
 
-static const size_t config_size = sizeof(config)/sizeof(struct lxc_config_t);
+#define CONFIG_NENTRIES (sizeof(config)/sizeof(struct lxc_config_t))
+
+/*
+ * Keys are resolved through an index over the first component after
+ * "lxc." ("network" for "lxc.network.0.link").  Every bucket chains its
+ * entries in table order, so the first entry of the chain which is a
+ * prefix of the key is the same one a linear scan of config[] would
+ * return.  Keys whose first component is not itself a table component
+ * (e.g. "lxc.hookfoo") fall back to the linear scan.
+ */
+#define CONFIG_PREFIX "lxc."
+#define CONFIG_PREFIX_LEN 4
+#define CONFIG_HASH_SIZE 128	/* power of two, well above #components */
+
+static pthread_once_t config_hash_once = PTHREAD_ONCE_INIT;
+static unsigned char config_hash[CONFIG_HASH_SIZE];	/* first entry + 1 */
+static unsigned char config_next[CONFIG_NENTRIES];	/* next entry + 1 */
+static unsigned char config_namelen[CONFIG_NENTRIES];
+static unsigned char config_seglen[CONFIG_NENTRIES];
+
+static size_t config_segment(const char *key, unsigned int *hash)
+{
+	unsigned int h = 2166136261u;
+	size_t len;
+
+	for (len = 0; key[len] && key[len] != '.'; len++) {
+		h ^= (unsigned char)key[len];
+		h *= 16777619u;
+	}
+	*hash = h;
+	return len;
+}
+
+static void config_hash_init(void)
+{
+	unsigned char tail[CONFIG_HASH_SIZE] = {0};
+	unsigned int h, slot;
+	size_t i, len, first;
+
+	for (i = 0; i < CONFIG_NENTRIES; i++) {
+		config_namelen[i] = strlen(config[i].name);
+		len = config_segment(config[i].name + CONFIG_PREFIX_LEN, &h);
+		config_seglen[i] = len;
+
+		for (slot = h & (CONFIG_HASH_SIZE - 1); config_hash[slot];
+		     slot = (slot + 1) & (CONFIG_HASH_SIZE - 1)) {
+			first = config_hash[slot] - 1;
+			if (config_seglen[first] == len &&
+			    !strncmp(config[first].name, config[i].name,
+				     CONFIG_PREFIX_LEN + len))
+				break;
+		}
+
+		if (!config_hash[slot])
+			config_hash[slot] = i + 1;
+		else
+			config_next[tail[slot] - 1] = i + 1;
+		tail[slot] = i + 1;
+	}
+}
 
 extern struct lxc_config_t *lxc_getconfig(const char *key)
 {
-	size_t i;
+	unsigned int h, slot;
+	size_t i, len;
+
+	if (strncmp(key, CONFIG_PREFIX, CONFIG_PREFIX_LEN))
+		return NULL;
+
+	pthread_once(&config_hash_once, config_hash_init);
+
+	len = config_segment(key + CONFIG_PREFIX_LEN, &h);
+	for (slot = h & (CONFIG_HASH_SIZE - 1); config_hash[slot];
+	     slot = (slot + 1) & (CONFIG_HASH_SIZE - 1)) {
+		i = config_hash[slot] - 1;
+		if (config_seglen[i] != len ||
+		    strncmp(config[i].name + CONFIG_PREFIX_LEN,
+			    key + CONFIG_PREFIX_LEN, len))
+			continue;
+
+		for (; ; i = config_next[i] - 1) {
+			if (!strncmp(config[i].name, key, config_namelen[i]))
+				return &config[i];
+			if (!config_next[i])
+				break;
+		}
+		break;
+	}
 
-	for (i = 0; i < config_size; i++)
+	for (i = 0; i < CONFIG_NENTRIES; i++)
 		if (!strncmp(config[i].name, key,
 			     strlen(config[i].name)))
 			return &config[i];
@@ -304,7 +451,7 @@ int lxc_listconfigs(char *retv, int inlen)
 		inlen = 0;
 	else
 		memset(retv, 0, inlen);
-	for (i = 0; i < config_size; i++) {
+	for (i = 0; i < CONFIG_NENTRIES; i++) {
 		char *s = config[i].name;
 		if (s[strlen(s)-1] == '.')
 			continue;
@@ -1730,6 +1877,80 @@ static int config_console_logfile(const char *key, const char *value,
 	return config_path_item(&lxc_conf->console.log_path, value);
 }
 
+/*
+ * Parse a size in bytes, optionally followed by a K, M or G unit
+ */
+static int config_parse_size(const char *key, const char *value, uint64_t *size)
+{
+	char *end;
+	unsigned long long v;
+
+	errno = 0;
+	v = strtoull(value, &end, 10);
+	if (errno || end == value || *value == '-')
+		goto err;
+
+	while (isblank(*end))
+		end++;
+
+	switch (*end) {
+	case 'k': case 'K': v <<= 10; end++; break;
+	case 'm': case 'M': v <<= 20; end++; break;
+	case 'g': case 'G': v <<= 30; end++; break;
+	}
+
+	if (*end == 'B' || *end == 'b')
+		end++;
+	while (isspace(*end))
+		end++;
+	if (*end)
+		goto err;
+
+	*size = v;
+	return 0;
+
+err:
+	ERROR("invalid size '%s' for %s", value, key);
+	return -1;
+}
+
+static int config_console_buffer_size(const char *key, const char *value,
+				      struct lxc_conf *lxc_conf)
+{
+	uint64_t size;
+
+	if (config_parse_size(key, value, &size) < 0)
+		return -1;
+
+	if (size > LXC_CONSOLE_BUFFER_MAX) {
+		WARN("limiting %s to %d bytes", key, LXC_CONSOLE_BUFFER_MAX);
+		size = LXC_CONSOLE_BUFFER_MAX;
+	}
+
+	lxc_conf->console.buffer_size = size;
+	return 0;
+}
+
+static int config_console_size(const char *key, const char *value,
+			       struct lxc_conf *lxc_conf)
+{
+	return config_parse_size(key, value, &lxc_conf->console.log_size);
+}
+
+static int config_console_rotate(const char *key, const char *value,
+				 struct lxc_conf *lxc_conf)
+{
+	int v = atoi(value);
+
+	if (v != 0 && v != 1) {
+		ERROR("Wrong value for lxc.console.rotate. Can only be set to 0 or 1");
+		return -1;
+	}
+
+	lxc_conf->console.log_rotate = v;
+	return 0;
+}
+
 /*
  * If we find a lxc.network.hwaddr in the original config file,
  * we expand it in the unexpanded_config, so that after a save_config
@@ -1759,31 +1980,490 @@ static void update_hwaddr(const char *line)
 	rand_complete_hwaddr(p);
 }
 
+#define UNEXP_MIN_BUF 4096
+#define UNEXP_MIN_LINES 64
+
+static inline char *unexp_line(struct lxc_unexp_config *u, size_t i)
+{
+	return u->buf + u->lines[i].off;
+}
+
+/* Make room for one more line of @len bytes, growing geometrically. */
+static int unexp_reserve(struct lxc_unexp_config *u, size_t len)
+{
+	size_t size;
+	void *tmp;
+
+	if (u->buf_len + len + 1 > u->buf_size) {
+		size = u->buf_size ? u->buf_size : UNEXP_MIN_BUF;
+		while (size < u->buf_len + len + 1)
+			size *= 2;
+		tmp = realloc(u->buf, size);
+		if (!tmp)
+			return -1;
+		u->buf = tmp;
+		u->buf_size = size;
+	}
+
+	if (u->nlines == u->lines_size) {
+		size = u->lines_size ? u->lines_size * 2 : UNEXP_MIN_LINES;
+		tmp = realloc(u->lines, size * sizeof(*u->lines));
+		if (!tmp)
+			return -1;
+		u->lines = tmp;
+		u->lines_size = size;
+	}
+
+	return 0;
+}
+
+/*
+ * Rewrite line @i, replacing the @oldlen bytes at @pos with @new.  The new
+ * text goes to the end of the buffer, the old one becomes stale.
+ */
+static int unexp_replace(struct lxc_unexp_config *u, size_t i, size_t pos,
+			 size_t oldlen, const char *new, size_t newlen)
+{
+	size_t len = u->lines[i].len - oldlen + newlen;
+	char *src, *dst;
+
+	if (unexp_reserve(u, len) < 0)
+		return -1;
+
+	src = unexp_line(u, i);
+	dst = u->buf + u->buf_len;
+	memcpy(dst, src, pos);
+	memcpy(dst + pos, new, newlen);
+	memcpy(dst + pos + newlen, src + pos + oldlen,
+	       u->lines[i].len - pos - oldlen + 1);
+
+	u->stale += u->lines[i].len + 1;
+	u->len += len - u->lines[i].len;
+	u->lines[i].off = u->buf_len;
+	u->lines[i].len = len;
+	u->buf_len += len + 1;
+	return 0;
+}
+
+static void unexp_remove(struct lxc_unexp_config *u, size_t i)
+{
+	u->stale += u->lines[i].len + 1;
+	u->len -= u->lines[i].len;
+	u->lines[i].len = 0;
+}
+
+/* Drop removed lines and stale text once they make up half the buffer. */
+static void unexp_compact(struct lxc_unexp_config *u)
+{
+	size_t i, n = 0, off = 0, size;
+	char *buf;
+
+	if (u->stale <= u->buf_len / 2)
+		return;
+
+	size = u->buf_len - u->stale;
+	if (size < UNEXP_MIN_BUF)
+		size = UNEXP_MIN_BUF;
+	buf = malloc(size);
+	if (!buf)
+		return;
+
+	for (i = 0; i < u->nlines; i++) {
+		if (!u->lines[i].len)
+			continue;
+		memcpy(buf + off, unexp_line(u, i), u->lines[i].len + 1);
+		u->lines[n].off = off;
+		u->lines[n].len = u->lines[i].len;
+		off += u->lines[n].len + 1;
+		n++;
+	}
+
+	free(u->buf);
+	u->buf = buf;
+	u->buf_len = off;
+	u->buf_size = size;
+	u->stale = 0;
+	u->nlines = n;
+}
+
 int append_unexp_config_line(const char *line, struct lxc_conf *conf)
 {
-	size_t len = conf->unexpanded_len, linelen = strlen(line);
+	struct lxc_unexp_config *u = &conf->unexpanded_config;
+	const char *end;
+	size_t len;
+	char *p;
 
 	update_hwaddr(line);
 
-	while (conf->unexpanded_alloced <= len + linelen + 2) {
-		char *tmp = realloc(conf->unexpanded_config, conf->unexpanded_alloced + 1024);
+	/* every newline separated part of @line is indexed on its own */
+	do {
+		end = strchr(line, '\n');
+		len = end ? end - line : strlen(line);
+
+		if (unexp_reserve(u, len + 1) < 0)
+			return -1;
+
+		p = u->buf + u->buf_len;
+		memcpy(p, line, len);
+		p[len] = '\n';
+		p[len + 1] = '\0';
+
+		u->lines[u->nlines].off = u->buf_len;
+		u->lines[u->nlines].len = len + 1;
+		u->nlines++;
+		u->buf_len += len + 2;
+		u->len += len + 1;
+
+		line = end ? end + 1 : NULL;
+	} while (line && *line);
+
+	return 0;
+}
+
+struct parse_line_conf {
+	struct lxc_conf *conf;
+	bool from_include;
+	/* records what was read while the config cache is being built */
+	struct config_cache *cache;
+};
+
+/*
+ * Compiled config cache.
+ *
+ * Reading a container config means reading the config file and everything
+ * it includes, trimming and splitting every line and looking up its key. On
+ * a cache miss lxc_config_read_cached() records the outcome of all of that:
+ * the lines which make up the unexpanded config, and for every item the
+ * split key and value, whose handler is looked up again on load. It also
+ * records the stat signature of each file and include directory which was
+ * read. As long as all signatures still match, a later load replays the
+ * records straight into the lxc_conf without touching the config files.
+ *
+ * lxc.network.hwaddr lines of the container config are replayed through
+ * parse_line() since their unexpanded form is randomized on every load.
+ */
+#define CONFIG_CACHE_MAGIC "LXCCFGC2"
+
+/* append the raw line to the unexpanded config */
+#define CONFIG_CACHE_UNEXP (1 << 0)
+/* replay the raw line through parse_line() */
+#define CONFIG_CACHE_PARSE (1 << 1)
+/* set key to value through the key's handler */
+#define CONFIG_CACHE_ITEM (1 << 2)
+#define CONFIG_CACHE_FLAGS \
+	(CONFIG_CACHE_UNEXP | CONFIG_CACHE_PARSE | CONFIG_CACHE_ITEM)
+
+struct config_cache_hdr {
+	char magic[8];
+	char version[32];
+	uint32_t ndeps;
+	uint32_t nrecs;
+};
+
+struct config_cache_dep {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	int64_t ctime_sec;
+	int64_t ctime_nsec;
+	uint32_t pathlen;
+};
+
+struct config_cache_rec {
+	uint32_t flags;
+	uint32_t rawlen;
+	uint32_t keylen;
+	uint32_t valuelen;
+};
+
+struct config_cache_buf {
+	char *data;
+	size_t len;
+	size_t alloced;
+};
+
+struct config_cache {
+	struct config_cache_buf deps;
+	struct config_cache_buf recs;
+	uint32_t ndeps;
+	uint32_t nrecs;
+	bool failed;
+};
+
+static int config_cache_append(struct config_cache_buf *b, const void *data,
+			       size_t len)
+{
+	char *tmp;
+	size_t alloced;
+
+	if (b->len + len > b->alloced) {
+		alloced = b->alloced ? b->alloced : 4096;
+		while (alloced < b->len + len)
+			alloced *= 2;
+		tmp = realloc(b->data, alloced);
 		if (!tmp)
 			return -1;
-		if (!conf->unexpanded_config)
-			*tmp = '\0';
-		conf->unexpanded_config = tmp;
-		conf->unexpanded_alloced += 1024;
+		b->data = tmp;
+		b->alloced = alloced;
+	}
+
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+	return 0;
+}
+
+static void config_cache_stat(struct config_cache_dep *dep, struct stat *st)
+{
+	memset(dep, 0, sizeof(*dep));
+	dep->dev = st->st_dev;
+	dep->ino = st->st_ino;
+	dep->size = st->st_size;
+	dep->mtime_sec = st->st_mtim.tv_sec;
+	dep->mtime_nsec = st->st_mtim.tv_nsec;
+	dep->ctime_sec = st->st_ctim.tv_sec;
+	dep->ctime_nsec = st->st_ctim.tv_nsec;
+}
+
+static void config_cache_add_dep(struct config_cache *cache, const char *path)
+{
+	struct config_cache_dep dep;
+	struct stat st;
+
+	if (!cache || cache->failed)
+		return;
+
+	if (stat(path, &st) < 0) {
+		cache->failed = true;
+		return;
+	}
+
+	config_cache_stat(&dep, &st);
+	dep.pathlen = strlen(path) + 1;
+	if (config_cache_append(&cache->deps, &dep, sizeof(dep)) < 0 ||
+	    config_cache_append(&cache->deps, path, dep.pathlen) < 0) {
+		cache->failed = true;
+		return;
+	}
+	cache->ndeps++;
+}
+
+static void config_cache_add_rec(struct config_cache *cache,
+				 unsigned int flags, const char *raw,
+				 const char *key, const char *value)
+{
+	struct config_cache_rec rec;
+
+	if (!cache || cache->failed)
+		return;
+
+	rec.flags = flags;
+	rec.rawlen = strlen(raw) + 1;
+	rec.keylen = strlen(key) + 1;
+	rec.valuelen = strlen(value) + 1;
+	if (config_cache_append(&cache->recs, &rec, sizeof(rec)) < 0 ||
+	    config_cache_append(&cache->recs, raw, rec.rawlen) < 0 ||
+	    config_cache_append(&cache->recs, key, rec.keylen) < 0 ||
+	    config_cache_append(&cache->recs, value, rec.valuelen) < 0) {
+		cache->failed = true;
+		return;
+	}
+	cache->nrecs++;
+}
+
+static void config_cache_hdr_init(struct config_cache_hdr *hdr)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, CONFIG_CACHE_MAGIC, sizeof(hdr->magic));
+	strncpy(hdr->version, LXC_VERSION, sizeof(hdr->version) - 1);
+}
+
+static int config_cache_write(struct config_cache *cache, const char *cachefile)
+{
+	struct config_cache_hdr hdr;
+	char *tmpfile, *dir;
+	size_t len;
+	int fd;
+
+	dir = strdupa(cachefile);
+	dir = dirname(dir);
+	if (mkdir_p(dir, 0700) < 0)
+		return -1;
+
+	len = strlen(cachefile) + 8;
+	tmpfile = alloca(len);
+	snprintf(tmpfile, len, "%s.XXXXXX", cachefile);
+	fd = mkstemp(tmpfile);
+	if (fd < 0)
+		return -1;
+
+	config_cache_hdr_init(&hdr);
+	hdr.ndeps = cache->ndeps;
+	hdr.nrecs = cache->nrecs;
+
+	if (lxc_write_nointr(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    lxc_write_nointr(fd, cache->deps.data, cache->deps.len) != (ssize_t)cache->deps.len ||
+	    lxc_write_nointr(fd, cache->recs.data, cache->recs.len) != (ssize_t)cache->recs.len) {
+		close(fd);
+		unlink(tmpfile);
+		return -1;
 	}
-	strcat(conf->unexpanded_config, line);
-	conf->unexpanded_len += linelen;
-	if (line[linelen-1] != '\n') {
-		strcat(conf->unexpanded_config, "\n");
-		conf->unexpanded_len++;
+	close(fd);
+
+	if (rename(tmpfile, cachefile) < 0) {
+		unlink(tmpfile);
+		return -1;
 	}
+
 	return 0;
 }
 
-static int do_includedir(const char *dirp, struct lxc_conf *lxc_conf)
+static int parse_line(char *buffer, void *data);
+
+/*
+ * Returns 0 if the config was replayed from the cache, 1 if there is no
+ * valid cache and -1 if a replayed item failed.
+ */
+static int config_cache_load(const char *cachefile, const char *file,
+			     struct lxc_conf *conf)
+{
+	struct config_cache_hdr hdr, *fhdr;
+	struct config_cache_dep dep, *fdep;
+	struct config_cache_rec *rec;
+	struct lxc_config_t **items = NULL;
+	struct parse_line_conf plc;
+	struct stat st;
+	char *buf = NULL, *p, *end, *path, *raw, *key, *value;
+	uint32_t i;
+	int fd, ret = 1;
+
+	fd = open(cachefile, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 1;
+
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(hdr))
+		goto out;
+
+	buf = malloc(st.st_size);
+	if (!buf || lxc_read_nointr(fd, buf, st.st_size) != st.st_size)
+		goto out;
+
+	p = buf;
+	end = buf + st.st_size;
+
+	fhdr = (struct config_cache_hdr *)p;
+	config_cache_hdr_init(&hdr);
+	if (memcmp(fhdr->magic, hdr.magic, sizeof(hdr.magic)) ||
+	    memcmp(fhdr->version, hdr.version, sizeof(hdr.version)) ||
+	    !fhdr->ndeps || fhdr->nrecs > (size_t)st.st_size / sizeof(*rec))
+		goto out;
+	p += sizeof(hdr);
+
+	/* the first dependency is the config file itself */
+	for (i = 0; i < fhdr->ndeps; i++) {
+		if ((size_t)(end - p) < sizeof(*fdep))
+			goto out;
+		fdep = (struct config_cache_dep *)p;
+		p += sizeof(*fdep);
+		if (!fdep->pathlen || fdep->pathlen > (size_t)(end - p) ||
+		    p[fdep->pathlen - 1] != '\0')
+			goto out;
+		path = p;
+		p += fdep->pathlen;
+
+		if (i == 0 && strcmp(path, file))
+			goto out;
+		if (stat(path, &st) < 0)
+			goto out;
+		config_cache_stat(&dep, &st);
+		dep.pathlen = fdep->pathlen;
+		if (memcmp(&dep, fdep, sizeof(dep)))
+			goto out;
+	}
+
+	/* validate all records and resolve their keys before anything is
+	 * applied */
+	items = calloc(fhdr->nrecs ? fhdr->nrecs : 1, sizeof(*items));
+	if (!items)
+		goto out;
+	raw = p;
+	for (i = 0; i < fhdr->nrecs; i++) {
+		if ((size_t)(end - p) < sizeof(*rec))
+			goto out;
+		rec = (struct config_cache_rec *)p;
+		p += sizeof(*rec);
+		if ((size_t)(end - p) < (size_t)rec->rawlen + rec->keylen + rec->valuelen ||
+		    !rec->rawlen || !rec->keylen || !rec->valuelen ||
+		    p[rec->rawlen - 1] || p[rec->rawlen + rec->keylen - 1] ||
+		    p[rec->rawlen + rec->keylen + rec->valuelen - 1] ||
+		    !rec->flags || (rec->flags & ~CONFIG_CACHE_FLAGS))
+			goto out;
+		if (rec->flags & CONFIG_CACHE_ITEM) {
+			items[i] = lxc_getconfig(p + rec->rawlen);
+			if (!items[i] || items[i]->cb == config_includefile)
+				goto out;
+		}
+		p += rec->rawlen + rec->keylen + rec->valuelen;
+	}
+	if (p != end)
+		goto out;
+
+	if (access(file, R_OK) < 0)
+		goto out;
+
+	if (!conf->rcfile)
+		conf->rcfile = strdup(file);
+
+	plc.conf = conf;
+	plc.from_include = false;
+	plc.cache = NULL;
+
+	ret = 0;
+	p = raw;
+	for (i = 0; i < fhdr->nrecs; i++) {
+		rec = (struct config_cache_rec *)p;
+		p += sizeof(*rec);
+		raw = p;
+		key = raw + rec->rawlen;
+		value = key + rec->keylen;
+		p = value + rec->valuelen;
+
+		if (rec->flags & CONFIG_CACHE_PARSE) {
+			if (parse_line(raw, &plc)) {
+				ret = -1;
+				break;
+			}
+			continue;
+		}
+
+		if ((rec->flags & CONFIG_CACHE_UNEXP) &&
+		    append_unexp_config_line(raw, conf)) {
+			ret = -1;
+			break;
+		}
+
+		if (items[i] && items[i]->cb(key, value, conf)) {
+			ret = -1;
+			break;
+		}
+	}
+
+	if (ret == 0)
+		DEBUG("loaded %s from %s", file, cachefile);
+
+out:
+	free(items);
+	free(buf);
+	close(fd);
+	return ret;
+}
+
+static int config_read(const char *file, struct lxc_conf *conf,
+		       bool from_include, struct config_cache *cache);
+
+static int do_includedir(const char *dirp, struct lxc_conf *lxc_conf,
+			 struct config_cache *cache)
 {
 	struct dirent dirent, *direntp;
 	DIR *dir;
@@ -1796,6 +2476,9 @@ static int do_includedir(const char *dirp, struct lxc_conf *lxc_conf)
 		return -1;
 	}
 
+	/* catches files being added to or removed from the directory */
+	config_cache_add_dep(cache, dirp);
+
 	while (!readdir_r(dir, &dirent, &direntp)) {
 		const char *fnam;
 		if (!direntp)
@@ -1818,7 +2501,7 @@ static int do_includedir(const char *dirp, struct lxc_conf *lxc_conf)
 			goto out;
 		}
 
-		ret = lxc_config_read(path, lxc_conf, true);
+		ret = config_read(path, lxc_conf, true, cache);
 		if (ret < 0)
 			goto out;
 	}
@@ -1831,13 +2514,19 @@ out:
 	return ret;
 }
 
-static int config_includefile(const char *key, const char *value,
-			  struct lxc_conf *lxc_conf)
+static int do_includefile(const char *value, struct lxc_conf *lxc_conf,
+			  struct config_cache *cache)
 {
 	if (is_dir(value))
-		return do_includedir(value, lxc_conf);
+		return do_includedir(value, lxc_conf, cache);
+
+	return config_read(value, lxc_conf, true, cache);
+}
 
-	return lxc_config_read(value, lxc_conf, true);
+static int config_includefile(const char *key, const char *value,
+			  struct lxc_conf *lxc_conf)
+{
+	return do_includefile(value, lxc_conf, NULL);
 }
 
 static int config_rootfs(const char *key, const char *value,
@@ -1905,20 +2594,16 @@ static int config_utsname(const char *key, const char *value,
 	return 0;
 }
 
-struct parse_line_conf {
-	struct lxc_conf *conf;
-	bool from_include;
-};
-
 static int parse_line(char *buffer, void *data)
 {
-	struct lxc_config_t *config;
+	struct lxc_config_t *config = NULL;
 	char *line, *linep;
 	char *dot;
-	char *key;
-	char *value;
+	char *key = NULL;
+	char *value = NULL;
 	int ret = 0;
 	struct parse_line_conf *plc = data;
+	unsigned int flags;
 
 	if (lxc_is_line_empty(buffer))
 		return 0;
@@ -1978,9 +2663,24 @@ static int parse_line(char *buffer, void *data)
 		goto out;
 	}
 
-	ret = config->cb(key, value, plc->conf);
+	if (config->cb == config_includefile)
+		ret = do_includefile(value, plc->conf, plc->cache);
+	else
+		ret = config->cb(key, value, plc->conf);
 
 out:
+	if (ret == 0 && plc->cache) {
+		flags = plc->from_include ? 0 : CONFIG_CACHE_UNEXP;
+		if (config && config->cb == config_includefile)
+			config = NULL;
+		if (config && flags && !strcmp(config->name, "lxc.network.hwaddr"))
+			flags = CONFIG_CACHE_PARSE;
+		if (config && flags != CONFIG_CACHE_PARSE)
+			flags |= CONFIG_CACHE_ITEM;
+		if (flags)
+			config_cache_add_rec(plc->cache, flags, buffer,
+					     key ? key : "", value ? value : "");
+	}
 	free(linep);
 	return ret;
 }
@@ -1991,16 +2691,19 @@ static int lxc_config_readline(char *buffer, struct lxc_conf *conf)
 
 	c.conf = conf;
 	c.from_include = false;
+	c.cache = NULL;
 
 	return parse_line(buffer, &c);
 }
 
-int lxc_config_read(const char *file, struct lxc_conf *conf, bool from_include)
+static int config_read(const char *file, struct lxc_conf *conf,
+		       bool from_include, struct config_cache *cache)
 {
 	struct parse_line_conf c;
 
 	c.conf = conf;
 	c.from_include = from_include;
+	c.cache = cache;
 
 	if( access(file, R_OK) == -1 ) {
 		return -1;
@@ -2010,12 +2713,43 @@ int lxc_config_read(const char *file, struct lxc_conf *conf, bool from_include)
 	if( ! conf->rcfile )
 		conf->rcfile = strdup( file );
 
+	config_cache_add_dep(cache, file);
+
 	return lxc_file_for_each_line(file, parse_line, &c);
 }
 
-int lxc_config_define_add(struct lxc_list *defines, char* arg)
+int lxc_config_read(const char *file, struct lxc_conf *conf, bool from_include)
 {
-	struct lxc_list *dent;
+	return config_read(file, conf, from_include, NULL);
+}
+
+int lxc_config_read_cached(const char *file, const char *cachefile,
+			   struct lxc_conf *conf)
+{
+	struct config_cache cache;
+	int ret;
+
+	if (!cachefile)
+		return lxc_config_read(file, conf, false);
+
+	ret = config_cache_load(cachefile, file, conf);
+	if (ret <= 0)
+		return ret;
+
+	memset(&cache, 0, sizeof(cache));
+	ret = config_read(file, conf, false, &cache);
+	if (ret == 0 && !cache.failed &&
+	    config_cache_write(&cache, cachefile) < 0)
+		DEBUG("failed to write config cache %s", cachefile);
+
+	free(cache.deps.data);
+	free(cache.recs.data);
+	return ret;
+}
+
+int lxc_config_define_add(struct lxc_list *defines, char* arg)
+{
+	struct lxc_list *dent;
 
 	dent = malloc(sizeof(struct lxc_list));
 	if (!dent)
@@ -2122,6 +2856,15 @@ static int lxc_get_conf_int(struct lxc_conf *c, char *retv, int inlen, int v)
 	return snprintf(retv, inlen, "%d", v);
 }
 
+static int lxc_get_conf_uint64(struct lxc_conf *c, char *retv, int inlen, uint64_t v)
+{
+	if (!retv)
+		inlen = 0;
+	else
+		memset(retv, 0, inlen);
+	return snprintf(retv, inlen, "%llu", (unsigned long long)v);
+}
+
 static int lxc_get_arch_entry(struct lxc_conf *c, char *retv, int inlen)
 {
 	int fulllen = 0;
@@ -2461,134 +3204,397 @@ static int lxc_get_item_network(struct lxc_conf *c, char *retv, int inlen)
 	return fulllen;
 }
 
-int lxc_get_config_item(struct lxc_conf *c, const char *key, char *retv,
-			int inlen)
+static int lxc_get_conf_str(char *retv, int inlen, const char *v)
 {
-	const char *v = NULL;
-
-	if (strcmp(key, "lxc.mount.entry") == 0)
-		return lxc_get_mount_entries(c, retv, inlen);
-	else if (strcmp(key, "lxc.mount.auto") == 0)
-		return lxc_get_auto_mounts(c, retv, inlen);
-	else if (strcmp(key, "lxc.mount") == 0)
-		v = c->fstab;
-	else if (strcmp(key, "lxc.tty") == 0)
-		return lxc_get_conf_int(c, retv, inlen, c->tty);
-	else if (strcmp(key, "lxc.pts") == 0)
-		return lxc_get_conf_int(c, retv, inlen, c->pts);
-	else if (strcmp(key, "lxc.devttydir") == 0)
-		v = c->ttydir;
-	else if (strcmp(key, "lxc.arch") == 0)
-		return lxc_get_arch_entry(c, retv, inlen);
-	else if (strcmp(key, "lxc.aa_profile") == 0)
-		v = c->lsm_aa_profile;
-	else if (strcmp(key, "lxc.aa_allow_incomplete") == 0)
-		return lxc_get_conf_int(c, retv, inlen, c->lsm_aa_allow_incomplete);
-	else if (strcmp(key, "lxc.se_context") == 0)
-		v = c->lsm_se_context;
-	else if (strcmp(key, "lxc.logfile") == 0)
-		v = c->logfile;
-	else if (strcmp(key, "lxc.loglevel") == 0)
-		v = lxc_log_priority_to_string(c->loglevel);
-	else if (strcmp(key, "lxc.cgroup") == 0) // all cgroup info
-		return lxc_get_cgroup_entry(c, retv, inlen, "all");
-	else if (strncmp(key, "lxc.cgroup.", 11) == 0) // specific cgroup info
-		return lxc_get_cgroup_entry(c, retv, inlen, key + 11);
-	else if (strcmp(key, "lxc.utsname") == 0)
-		v = c->utsname ? c->utsname->nodename : NULL;
-	else if (strcmp(key, "lxc.console.logfile") == 0)
-		v = c->console.log_path;
-	else if (strcmp(key, "lxc.console") == 0)
-		v = c->console.path;
-	else if (strcmp(key, "lxc.rootfs.mount") == 0)
-		v = c->rootfs.mount;
-	else if (strcmp(key, "lxc.rootfs.backend") == 0)
-		v = c->rootfs.bdev_type;
-	else if (strcmp(key, "lxc.rootfs.options") == 0)
-		v = c->rootfs.options;
-	else if (strcmp(key, "lxc.rootfs") == 0)
-		v = c->rootfs.path;
-	else if (strcmp(key, "lxc.cap.drop") == 0)
-		return lxc_get_item_cap_drop(c, retv, inlen);
-	else if (strcmp(key, "lxc.cap.keep") == 0)
-		return lxc_get_item_cap_keep(c, retv, inlen);
-	else if (strncmp(key, "lxc.hook", 8) == 0)
-		return lxc_get_item_hooks(c, retv, inlen, key);
-	else if (strcmp(key, "lxc.network") == 0)
-		return lxc_get_item_network(c, retv, inlen);
-	else if (strncmp(key, "lxc.network.", 12) == 0)
-		return lxc_get_item_nic(c, retv, inlen, key + 12);
-	else if (strcmp(key, "lxc.start.auto") == 0)
-		return lxc_get_conf_int(c, retv, inlen, c->start_auto);
-	else if (strcmp(key, "lxc.start.delay") == 0)
-		return lxc_get_conf_int(c, retv, inlen, c->start_delay);
-	else if (strcmp(key, "lxc.start.order") == 0)
-		return lxc_get_conf_int(c, retv, inlen, c->start_order);
-	else if (strcmp(key, "lxc.monitor.unshare") == 0)
-		return lxc_get_conf_int(c, retv, inlen, c->monitor_unshare);
-	else if (strcmp(key, "lxc.group") == 0)
-		return lxc_get_item_groups(c, retv, inlen);
-	else if (strcmp(key, "lxc.seccomp") == 0)
-		v = c->seccomp;
-	else if (strcmp(key, "lxc.environment") == 0)
-		return lxc_get_item_environment(c, retv, inlen);
-	else if (strcmp(key, "lxc.init_cmd") == 0)
-		v = c->init_cmd;
-	else if (strcmp(key, "lxc.init_uid") == 0)
-		return lxc_get_conf_int(c, retv, inlen, c->init_uid);
-	else if (strcmp(key, "lxc.init_gid") == 0)
-		return lxc_get_conf_int(c, retv, inlen, c->init_gid);
-	else if (strcmp(key, "lxc.ephemeral") == 0)
-		return lxc_get_conf_int(c, retv, inlen, c->ephemeral);
-	else return -1;
-
 	if (!v)
 		return 0;
 	if (retv && inlen >= strlen(v) + 1)
-		strncpy(retv, v, strlen(v)+1);
+		memcpy(retv, v, strlen(v) + 1);
 	return strlen(v);
 }
 
-int lxc_clear_config_item(struct lxc_conf *c, const char *key)
+static int get_config_arch(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
 {
-	if (strcmp(key, "lxc.network") == 0)
-		return lxc_clear_config_network(c);
-	else if (strncmp(key, "lxc.network.", 12) == 0)
-		return lxc_clear_nic(c, key + 12);
-	else if (strcmp(key, "lxc.cap.drop") == 0)
-		return lxc_clear_config_caps(c);
-	else if (strcmp(key, "lxc.cap.keep") == 0)
-		return lxc_clear_config_keepcaps(c);
-	else if (strncmp(key, "lxc.cgroup", 10) == 0)
-		return lxc_clear_cgroups(c, key);
-	else if (strcmp(key, "lxc.mount.entry") == 0)
-		return lxc_clear_mount_entries(c);
-	else if (strcmp(key, "lxc.mount.auto") == 0)
-		return lxc_clear_automounts(c);
-	else if (strncmp(key, "lxc.hook", 8) == 0)
-		return lxc_clear_hooks(c, key);
-	else if (strncmp(key, "lxc.group", 9) == 0)
-		return lxc_clear_groups(c);
-	else if (strncmp(key, "lxc.environment", 15) == 0)
-		return lxc_clear_environment(c);
-	else if (strncmp(key, "lxc.id_map", 10) == 0)
-		return lxc_clear_idmaps(c);
+	return lxc_get_arch_entry(c, retv, inlen);
+}
+
+static int get_config_pts(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_int(c, retv, inlen, c->pts);
+}
+
+static int get_config_tty(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_int(c, retv, inlen, c->tty);
+}
+
+static int get_config_devttydir(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_str(retv, inlen, c->ttydir);
+}
+
+static int get_config_aa_profile(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_str(retv, inlen, c->lsm_aa_profile);
+}
+
+static int get_config_aa_allow_incomplete(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_int(c, retv, inlen, c->lsm_aa_allow_incomplete);
+}
+
+static int get_config_se_context(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_str(retv, inlen, c->lsm_se_context);
+}
+
+static int get_config_cgroup(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	if (strcmp(key, "lxc.cgroup") == 0) // all cgroup info
+		return lxc_get_cgroup_entry(c, retv, inlen, "all");
+	if (strncmp(key, "lxc.cgroup.", 11) == 0) // specific cgroup info
+		return lxc_get_cgroup_entry(c, retv, inlen, key + 11);
 	return -1;
 }
 
+static int get_config_loglevel(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_str(retv, inlen, lxc_log_priority_to_string(c->loglevel));
+}
+
+static int get_config_logfile(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_str(retv, inlen, c->logfile);
+}
+
+static int get_config_mount_entry(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_mount_entries(c, retv, inlen);
+}
+
+static int get_config_mount_auto(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_auto_mounts(c, retv, inlen);
+}
+
+static int get_config_mount(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_str(retv, inlen, c->fstab);
+}
+
+static int get_config_rootfs_mount(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_str(retv, inlen, c->rootfs.mount);
+}
+
+static int get_config_rootfs_options(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_str(retv, inlen, c->rootfs.options);
+}
+
+static int get_config_rootfs_backend(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_str(retv, inlen, c->rootfs.bdev_type);
+}
+
+static int get_config_rootfs(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_str(retv, inlen, c->rootfs.path);
+}
+
+static int get_config_utsname(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_str(retv, inlen, c->utsname ? c->utsname->nodename : NULL);
+}
+
+static int get_config_hook(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_item_hooks(c, retv, inlen, key);
+}
+
+static int get_config_network_nic(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_item_nic(c, retv, inlen, key + 12);
+}
+
+static int get_config_network(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_item_network(c, retv, inlen);
+}
+
+static int get_config_cap_drop(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_item_cap_drop(c, retv, inlen);
+}
+
+static int get_config_cap_keep(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_item_cap_keep(c, retv, inlen);
+}
+
+static int get_config_console_logfile(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_str(retv, inlen, c->console.log_path);
+}
+
+static int get_config_console_buffer_size(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_uint64(c, retv, inlen, c->console.buffer_size);
+}
+
+static int get_config_console_size(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_uint64(c, retv, inlen, c->console.log_size);
+}
+
+static int get_config_console_rotate(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_int(c, retv, inlen, c->console.log_rotate);
+}
+
+static int get_config_console(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_str(retv, inlen, c->console.path);
+}
+
+static int get_config_seccomp(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_str(retv, inlen, c->seccomp);
+}
+
+static int get_config_start_auto(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_int(c, retv, inlen, c->start_auto);
+}
+
+static int get_config_start_delay(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_int(c, retv, inlen, c->start_delay);
+}
+
+static int get_config_start_order(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_int(c, retv, inlen, c->start_order);
+}
+
+static int get_config_monitor_unshare(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_int(c, retv, inlen, c->monitor_unshare);
+}
+
+static int get_config_group(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_item_groups(c, retv, inlen);
+}
+
+static int get_config_environment(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_item_environment(c, retv, inlen);
+}
+
+static int get_config_init_cmd(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_str(retv, inlen, c->init_cmd);
+}
+
+static int get_config_init_uid(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_int(c, retv, inlen, c->init_uid);
+}
+
+static int get_config_init_gid(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_int(c, retv, inlen, c->init_gid);
+}
+
+static int get_config_ephemeral(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_int(c, retv, inlen, c->ephemeral);
+}
+
+static int get_config_hook_parallel(const char *key, char *retv, int inlen,
+			struct lxc_conf *c)
+{
+	return lxc_get_conf_int(c, retv, inlen, c->hooks_parallel);
+}
+
+static int clr_config_cgroup(const char *key, struct lxc_conf *c)
+{
+	return lxc_clear_cgroups(c, key);
+}
+
+static int clr_config_idmap(const char *key, struct lxc_conf *c)
+{
+	return lxc_clear_idmaps(c);
+}
+
+static int clr_config_mount_entry(const char *key, struct lxc_conf *c)
+{
+	return lxc_clear_mount_entries(c);
+}
+
+static int clr_config_mount_auto(const char *key, struct lxc_conf *c)
+{
+	return lxc_clear_automounts(c);
+}
+
+static int clr_config_hook(const char *key, struct lxc_conf *c)
+{
+	return lxc_clear_hooks(c, key);
+}
+
+static int clr_config_network_nic(const char *key, struct lxc_conf *c)
+{
+	return lxc_clear_nic(c, key + 12);
+}
+
+static int clr_config_network(const char *key, struct lxc_conf *c)
+{
+	return lxc_clear_config_network(c);
+}
+
+static int clr_config_cap_drop(const char *key, struct lxc_conf *c)
+{
+	return lxc_clear_config_caps(c);
+}
+
+static int clr_config_cap_keep(const char *key, struct lxc_conf *c)
+{
+	return lxc_clear_config_keepcaps(c);
+}
+
+static int clr_config_group(const char *key, struct lxc_conf *c)
+{
+	return lxc_clear_groups(c);
+}
+
+static int clr_config_environment(const char *key, struct lxc_conf *c)
+{
+	return lxc_clear_environment(c);
+}
+
+/*
+ * lxc_getconfig() matches keys by prefix, as parsing always did. Getting
+ * and clearing only accept the exact key, or a subkey of the entries whose
+ * handlers take one ("lxc.cgroup.<item>", "lxc.hook.<type>" and the
+ * "lxc.network.<n>.<key>" catch-all), so "lxc.ttyx" is not "lxc.tty".
+ */
+static struct lxc_config_t *lxc_getconfig_exact(const char *key)
+{
+	struct lxc_config_t *item;
+	size_t len;
+
+	item = lxc_getconfig(key);
+	if (!item)
+		return NULL;
+
+	len = strlen(item->name);
+	if (key[len] == '\0' || item->name[len - 1] == '.')
+		return item;
+	if (key[len] == '.' && (!strcmp(item->name, "lxc.cgroup") ||
+				!strcmp(item->name, "lxc.hook")))
+		return item;
+	return NULL;
+}
+
+int lxc_get_config_item(struct lxc_conf *c, const char *key, char *retv,
+			int inlen)
+{
+	struct lxc_config_t *config;
+
+	config = lxc_getconfig_exact(key);
+	if (!config || !config->get)
+		return -1;
+	return config->get(key, retv, inlen, c);
+}
+
+int lxc_clear_config_item(struct lxc_conf *c, const char *key)
+{
+	struct lxc_config_t *config;
+
+	config = lxc_getconfig_exact(key);
+	if (!config || !config->clr)
+		return -1;
+	return config->clr(key, c);
+}
+
+static bool unexp_line_matches(const char *line, const char *key,
+			       size_t keylen, bool rm_subkeys)
+{
+	if (strncmp(line, key, keylen) != 0)
+		return false;
+	if (rm_subkeys)
+		return true;
+	return isspace(line[keylen]) || line[keylen] == '=';
+}
+
 /*
  * writing out a confile.
  */
+static void do_write_config(FILE *fout, struct lxc_conf *c, const char *skip)
+{
+	struct lxc_unexp_config *u = &c->unexpanded_config;
+	size_t i, skiplen = skip ? strlen(skip) : 0;
+
+	for (i = 0; i < u->nlines; i++) {
+		if (!u->lines[i].len)
+			continue;
+		if (skip && unexp_line_matches(unexp_line(u, i), skip, skiplen, false))
+			continue;
+		if (fwrite(unexp_line(u, i), 1, u->lines[i].len, fout) != u->lines[i].len) {
+			SYSERROR("Error writing configuration file");
+			return;
+		}
+	}
+}
+
 void write_config(FILE *fout, struct lxc_conf *c)
 {
-	size_t len = c->unexpanded_len;
-	int ret;
+	do_write_config(fout, c, NULL);
+}
 
-	if (!len)
-		return;
-	ret = fwrite(c->unexpanded_config, 1, len, fout);
-	if (ret != len)
-		SYSERROR("Error writing configuration file");
+void write_config_except(FILE *fout, struct lxc_conf *c, const char *key)
+{
+	do_write_config(fout, c, key);
 }
 
 bool do_append_unexp_config_line(struct lxc_conf *conf, const char *key, const char *v)
@@ -2610,45 +3616,27 @@ bool do_append_unexp_config_line(struct lxc_conf *conf, const char *key, const c
 
 void clear_unexp_config_line(struct lxc_conf *conf, const char *key, bool rm_subkeys)
 {
-	char *lstart = conf->unexpanded_config, *lend;
+	struct lxc_unexp_config *u = &conf->unexpanded_config;
+	size_t i, keylen = strlen(key);
 
-	if (!conf->unexpanded_config)
-		return;
-	while (*lstart) {
-		lend = strchr(lstart, '\n');
-		char v;
-		if (!lend)
-			lend = lstart + strlen(lstart);
-		else
-			lend++;
-		if (strncmp(lstart, key, strlen(key)) != 0) {
-			lstart = lend;
+	for (i = 0; i < u->nlines; i++) {
+		if (!u->lines[i].len)
 			continue;
-		}
-		if (!rm_subkeys) {
-			v = lstart[strlen(key)];
-			if (!isspace(v) && v != '=') {
-				lstart = lend;
-				continue;
-			}
-		}
-		conf->unexpanded_len -= (lend - lstart);
-		if (*lend == '\0') {
-			*lstart = '\0';
-			return;
-		}
-		memmove(lstart, lend, strlen(lend)+1);
+		if (unexp_line_matches(unexp_line(u, i), key, keylen, rm_subkeys))
+			unexp_remove(u, i);
 	}
+	unexp_compact(u);
 }
 
 bool clone_update_unexp_ovl_paths(struct lxc_conf *conf, const char *oldpath,
 				  const char *newpath, const char *oldname,
 				  const char *newname, const char *ovldir)
 {
+	struct lxc_unexp_config *u = &conf->unexpanded_config;
 	const char *key = "lxc.mount.entry";
 	int ret;
-	char *lstart = conf->unexpanded_config;
-	char *lend;
+	size_t i;
+	char *lstart;
 	char *p;
 	char *q;
 	size_t newdirlen = strlen(ovldir) + strlen(newpath) + strlen(newname) + 2;
@@ -2666,74 +3654,38 @@ bool clone_update_unexp_ovl_paths(struct lxc_conf *conf, const char *oldpath,
 		ERROR("Bug in %s", __func__);
 		return false;
 	}
-	if (!conf->unexpanded_config)
-		return true;
-	while (*lstart) {
-		lend = strchr(lstart, '\n');
-		if (!lend)
-			lend = lstart + strlen(lstart);
-		else
-			lend++;
+	for (i = 0; i < u->nlines; i++) {
+		if (!u->lines[i].len)
+			continue;
+		lstart = unexp_line(u, i);
 		if (strncmp(lstart, key, strlen(key)) != 0)
-                        goto next;
+			continue;
 		p = strchr(lstart + strlen(key), '=');
 		if (!p)
-                        goto next;
+			continue;
 		p++;
 		while (isblank(*p))
 			p++;
-		if (p >= lend)
-                        goto next;
-                /* Whenever an lxc.mount.entry entry is found in a line we check
-                *  if the substring " overlay" or the substring " aufs" is
-                *  present before doing any further work. We check for "
-                *  overlay" and " aufs" since both substrings need to have at
-                *  least one space before them in a valid overlay
-                *  lxc.mount.entry (/A B overlay).  When the space before is
-                *  missing it is very likely that these substrings are part of a
-                *  path or something else. (Checking q >= lend ensures that we
-                *  only count matches in the current line.) */
-		if ((!(q = strstr(p, " overlay")) || q >= lend) && (!(q = strstr(p, " aufs")) || q >= lend))
-                        goto next;
-		if (!(q = strstr(p, olddir)) || (q >= lend))
-                        goto next;
+		/* Whenever an lxc.mount.entry entry is found in a line we check
+		 * if the substring " overlay" or the substring " aufs" is
+		 * present before doing any further work. We check for "
+		 * overlay" and " aufs" since both substrings need to have at
+		 * least one space before them in a valid overlay
+		 * lxc.mount.entry (/A B overlay).  When the space before is
+		 * missing it is very likely that these substrings are part of a
+		 * path or something else. */
+		if (!strstr(p, " overlay") && !strstr(p, " aufs"))
+			continue;
+		if (!(q = strstr(p, olddir)))
+			continue;
 
 		/* replace the olddir with newdir */
-		if (olddirlen >= newdirlen) {
-			size_t diff = olddirlen - newdirlen;
-			memcpy(q, newdir, newdirlen);
-			if (olddirlen != newdirlen) {
-				memmove(q + newdirlen, q + newdirlen + diff,
-					strlen(q) - newdirlen - diff + 1);
-				lend -= diff;
-				conf->unexpanded_len -= diff;
-			}
-		} else {
-			char *new;
-			size_t diff = newdirlen - olddirlen;
-			size_t oldlen = conf->unexpanded_len;
-			size_t newlen = oldlen + diff;
-			size_t poffset = q - conf->unexpanded_config;
-			new = realloc(conf->unexpanded_config, newlen + 1);
-			if (!new) {
-				ERROR("Out of memory");
-				return false;
-			}
-			conf->unexpanded_len = newlen;
-			conf->unexpanded_alloced = newlen + 1;
-			new[newlen - 1] = '\0';
-			lend = new + (lend - conf->unexpanded_config);
-			/* move over the remainder to make room for the newdir */
-			memmove(new + poffset + newdirlen,
-				new + poffset + olddirlen,
-				oldlen - poffset - olddirlen + 1);
-			conf->unexpanded_config = new;
-			memcpy(new + poffset, newdir, newdirlen);
-			lend += diff;
+		if (unexp_replace(u, i, q - lstart, olddirlen, newdir, newdirlen) < 0) {
+			ERROR("Out of memory");
+			return false;
 		}
-next:
-			lstart = lend;
 	}
+	unexp_compact(u);
 	return true;
 }
 
@@ -2741,9 +3693,11 @@ bool clone_update_unexp_hooks(struct lxc_conf *conf, const char *oldpath,
 			      const char *newpath, const char *oldname,
 			      const char *newname)
 {
+	struct lxc_unexp_config *u = &conf->unexpanded_config;
 	const char *key = "lxc.hook";
 	int ret;
-	char *lstart = conf->unexpanded_config, *lend, *p;
+	size_t i;
+	char *lstart, *p;
 	size_t newdirlen = strlen(newpath) + strlen(newname) + 1;
 	size_t olddirlen = strlen(oldpath) + strlen(oldname) + 1;
 	char *olddir = alloca(olddirlen + 1);
@@ -2759,62 +3713,27 @@ bool clone_update_unexp_hooks(struct lxc_conf *conf, const char *oldpath,
 		ERROR("Bug in %s", __func__);
 		return false;
 	}
-	if (!conf->unexpanded_config)
-		return true;
-	while (*lstart) {
-		lend = strchr(lstart, '\n');
-		if (!lend)
-			lend = lstart + strlen(lstart);
-		else
-			lend++;
+	for (i = 0; i < u->nlines; i++) {
+		if (!u->lines[i].len)
+			continue;
+		lstart = unexp_line(u, i);
 		if (strncmp(lstart, key, strlen(key)) != 0)
-                        goto next;
+			continue;
 		p = strchr(lstart + strlen(key), '=');
 		if (!p)
-                        goto next;
+			continue;
 		p++;
 		while (isblank(*p))
 			p++;
-                if (p >= lend)
-                        goto next;
 		if (strncmp(p, olddir, strlen(olddir)) != 0)
-                        goto next;
+			continue;
 		/* replace the olddir with newdir */
-		if (olddirlen >= newdirlen) {
-			size_t diff = olddirlen - newdirlen;
-			memcpy(p, newdir, newdirlen);
-			if (olddirlen != newdirlen) {
-				memmove(p + newdirlen, p + newdirlen + diff,
-					strlen(p) - newdirlen - diff + 1);
-				lend -= diff;
-				conf->unexpanded_len -= diff;
-			}
-		} else {
-			char *new;
-			size_t diff = newdirlen - olddirlen;
-			size_t oldlen = conf->unexpanded_len;
-			size_t newlen = oldlen + diff;
-			size_t poffset = p - conf->unexpanded_config;
-			new = realloc(conf->unexpanded_config, newlen + 1);
-			if (!new) {
-				ERROR("Out of memory");
-				return false;
-			}
-			conf->unexpanded_len = newlen;
-			conf->unexpanded_alloced = newlen + 1;
-			new[newlen - 1] = '\0';
-			lend = new + (lend - conf->unexpanded_config);
-			/* move over the remainder to make room for the newdir */
-			memmove(new + poffset + newdirlen,
-				new + poffset + olddirlen,
-				oldlen - poffset - olddirlen + 1);
-			conf->unexpanded_config = new;
-			memcpy(new + poffset, newdir, newdirlen);
-			lend += diff;
+		if (unexp_replace(u, i, p - lstart, olddirlen, newdir, newdirlen) < 0) {
+			ERROR("Out of memory");
+			return false;
 		}
-next:
-			lstart = lend;
 	}
+	unexp_compact(u);
 	return true;
 }
 
@@ -2854,40 +3773,32 @@ static void new_hwaddr(char *hwaddr)
  */
 bool network_new_hwaddrs(struct lxc_conf *conf)
 {
+	struct lxc_unexp_config *u = &conf->unexpanded_config;
 	struct lxc_list *it;
+	size_t i;
 
 	const char *key = "lxc.network.hwaddr";
-	char *lstart = conf->unexpanded_config, *lend, *p, *p2;
+	char *lstart, *p, *p2;
 
-	if (!conf->unexpanded_config)
-		return true;
-	while (*lstart) {
+	for (i = 0; i < u->nlines; i++) {
 		char newhwaddr[18], oldhwaddr[17];
-		lend = strchr(lstart, '\n');
-		if (!lend)
-			lend = lstart + strlen(lstart);
-		else
-			lend++;
-		if (strncmp(lstart, key, strlen(key)) != 0) {
-			lstart = lend;
+
+		if (!u->lines[i].len)
+			continue;
+		lstart = unexp_line(u, i);
+		if (strncmp(lstart, key, strlen(key)) != 0)
 			continue;
-		}
 		p = strchr(lstart+strlen(key), '=');
-		if (!p) {
-			lstart = lend;
+		if (!p)
 			continue;
-		}
 		p++;
 		while (isblank(*p))
 			p++;
-		if (!*p)
-			return true;
 		p2 = p;
 		while (*p2 && !isblank(*p2) && *p2 != '\n')
 			p2++;
 		if (p2-p != 17) {
 			WARN("Bad hwaddr entry");
-			lstart = lend;
 			continue;
 		}
 		memcpy(oldhwaddr, p, 17);
@@ -2898,8 +3809,6 @@ bool network_new_hwaddrs(struct lxc_conf *conf)
 			if (n->hwaddr && memcmp(oldhwaddr, n->hwaddr, 17) == 0)
 				memcpy(n->hwaddr, newhwaddr, 17);
 		}
-
-		lstart = lend;
 	}
 	return true;
 }
@@ -2919,3 +3828,17 @@ static int config_ephemeral(const char *key, const char *value,
 	return 0;
 }
 
+static int config_hook_parallel(const char *key, const char *value,
+				struct lxc_conf *lxc_conf)
+{
+	int v = atoi(value);
+
+	if (v != 0 && v != 1) {
+		ERROR("Wrong value for lxc.hook.parallel. Can only be set to 0 or 1");
+		return -1;
+	}
+
+	lxc_conf->hooks_parallel = v;
+	return 0;
+}
+
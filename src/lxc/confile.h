@@ -32,15 +32,25 @@ struct lxc_conf;
 struct lxc_list;
 
 typedef int (*config_cb)(const char *, const char *, struct lxc_conf *);
+typedef int (*config_get_cb)(const char *, char *, int, struct lxc_conf *);
+typedef int (*config_clr_cb)(const char *, struct lxc_conf *);
 struct lxc_config_t {
 	char *name;
 	config_cb cb;
+	config_get_cb get;
+	config_clr_cb clr;
 };
 
 extern struct lxc_config_t *lxc_getconfig(const char *key);
 extern int lxc_list_nicconfigs(struct lxc_conf *c, const char *key, char *retv, int inlen);
 extern int lxc_listconfigs(char *retv, int inlen);
 extern int lxc_config_read(const char *file, struct lxc_conf *conf, bool from_include);
+/*
+ * Read the container config @file through the compiled cache @cachefile,
+ * which is (re)built when it is missing or out of date.
+ */
+extern int lxc_config_read_cached(const char *file, const char *cachefile,
+				  struct lxc_conf *conf);
 extern int append_unexp_config_line(const char *line, struct lxc_conf *conf);
 
 extern int lxc_config_define_add(struct lxc_list *defines, char* arg);
@@ -54,6 +64,8 @@ extern int lxc_fill_elevated_privileges(char *flaglist, int *flags);
 extern int lxc_get_config_item(struct lxc_conf *c, const char *key, char *retv, int inlen);
 extern int lxc_clear_config_item(struct lxc_conf *c, const char *key);
 extern void write_config(FILE *fout, struct lxc_conf *c);
+/* write the config, leaving out the lines which set @key */
+extern void write_config_except(FILE *fout, struct lxc_conf *c, const char *key);
 
 extern bool do_append_unexp_config_line(struct lxc_conf *conf, const char *key, const char *v);
 
@@ -21,15 +21,18 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#define _GNU_SOURCE
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <termios.h>
 #include <unistd.h>
 #include <sys/epoll.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 
 #include <lxc/lxccontainer.h>
@@ -54,6 +57,9 @@
 
 lxc_log_define(lxc_console, lxc);
 
+/* matches the default capacity of a pipe */
+#define LXC_CONSOLE_BUFFER_SIZE 65536
+
 static struct lxc_list lxc_ttys;
 
 typedef void (*sighandler_t)(int);
@@ -156,13 +162,258 @@ void lxc_console_sigwinch_fini(struct lxc_tty_state *ts)
 	free(ts);
 }
 
+static void lxc_console_ringbuf_write(struct lxc_console_ringbuf *rb,
+				      const char *data, size_t len)
+{
+	size_t first;
+
+	if (!rb->addr || len == 0)
+		return;
+
+	/* only the tail of a chunk larger than the buffer survives */
+	if (len >= rb->size) {
+		memcpy(rb->addr, data + len - rb->size, rb->size);
+		rb->w_off = 0;
+		rb->full = true;
+		return;
+	}
+
+	first = rb->size - rb->w_off;
+	if (first > len)
+		first = len;
+	memcpy(rb->addr + rb->w_off, data, first);
+	memcpy(rb->addr, data + first, len - first);
+
+	if (rb->w_off + len >= rb->size)
+		rb->full = true;
+	rb->w_off = (rb->w_off + len) % rb->size;
+}
+
+int lxc_console_buffer_read(struct lxc_console *console, bool clear,
+			    char **data, size_t *len)
+{
+	struct lxc_console_ringbuf *rb = &console->ringbuf;
+	size_t tail;
+
+	*data = NULL;
+	*len = 0;
+
+	if (!rb->addr)
+		return -ENODATA;
+
+	*len = rb->full ? rb->size : rb->w_off;
+	if (*len > 0) {
+		*data = malloc(*len);
+		if (!*data) {
+			*len = 0;
+			return -ENOMEM;
+		}
+
+		/* oldest data first */
+		tail = rb->full ? rb->size - rb->w_off : 0;
+		memcpy(*data, rb->addr + (rb->full ? rb->w_off : 0), tail ? tail : *len);
+		if (tail)
+			memcpy(*data + tail, rb->addr, rb->w_off);
+	}
+
+	if (clear) {
+		rb->w_off = 0;
+		rb->full = false;
+	}
+
+	return 0;
+}
+
+/*
+ * Make room for @len more bytes in the console log if lxc.console.size is
+ * set: the log is moved aside to "<logfile>.1" if lxc.console.rotate is
+ * set and truncated otherwise.
+ */
+static void lxc_console_log_rotate(struct lxc_console *console, size_t len)
+{
+	char path[MAXPATHLEN];
+	int fd, ret;
+
+	if (!console->log_size || console->log_written == 0 ||
+	    console->log_written + len <= console->log_size)
+		return;
+
+	if (console->log_rotate) {
+		ret = snprintf(path, sizeof(path), "%s.1", console->log_path);
+		if (ret < 0 || ret >= sizeof(path) ||
+		    rename(console->log_path, path) < 0) {
+			SYSERROR("failed to rotate console log '%s'", console->log_path);
+			goto truncate;
+		}
+
+		/* reopen under the same fd, which is still the old file */
+		fd = lxc_unpriv(open(console->log_path, O_CLOEXEC | O_RDWR |
+				     O_CREAT | O_APPEND, 0600));
+		if (fd < 0) {
+			SYSERROR("failed to reopen console log '%s'", console->log_path);
+			return;
+		}
+		if (dup3(fd, console->log_fd, O_CLOEXEC) < 0) {
+			SYSERROR("failed to reopen console log '%s'", console->log_path);
+			close(fd);
+			return;
+		}
+		close(fd);
+		console->log_written = 0;
+		return;
+	}
+
+truncate:
+	if (ftruncate(console->log_fd, 0) < 0) {
+		SYSERROR("failed to truncate console log '%s'", console->log_path);
+		return;
+	}
+	console->log_written = 0;
+}
+
+/*
+ * Copy @len bytes out of the pipe @from to @to1 and @to2 (if >= 0) through
+ * a buffer, for data splice() can't move.  Returns the number of bytes
+ * written to each destination through @w1 and @w2.
+ */
+static void lxc_console_copy_pipe(int from, size_t len, int to1, int to2,
+				  ssize_t *w1, ssize_t *w2)
+{
+	char buf[LXC_CONSOLE_BUFFER_SIZE];
+	ssize_t r;
+
+	while (len > 0) {
+		r = lxc_read_nointr(from, buf, len < sizeof(buf) ? len : sizeof(buf));
+		if (r <= 0)
+			return;
+		len -= r;
+
+		if (to1 >= 0 && lxc_write_nointr(to1, buf, r) == r)
+			*w1 += r;
+		if (to2 >= 0 && lxc_write_nointr(to2, buf, r) == r)
+			*w2 += r;
+	}
+}
+
+/*
+ * Move @len bytes out of the pipe @from into @to, falling back to copying
+ * if @to doesn't support splice.  Whatever can't be written is drained so
+ * the pipe is empty afterwards.  Returns the number of bytes written.
+ */
+static ssize_t lxc_console_splice_out(int from, int to, size_t len)
+{
+	ssize_t ret, w = 0, unused = 0;
+	bool copy = false;
+
+	while (len > 0) {
+		ret = splice(from, NULL, to, NULL, len, SPLICE_F_MOVE);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0 && errno == EINVAL)
+			copy = true;
+		if (ret <= 0)
+			break;
+		w += ret;
+		len -= ret;
+	}
+
+	/* copy (or, if the write failed, just drain) the rest */
+	if (len > 0)
+		lxc_console_copy_pipe(from, len, copy ? to : -1, -1, &w, &unused);
+
+	return w;
+}
+
+/*
+ * Zero-copy path for the output of the container: the data is spliced from
+ * the master into a pipe, duplicated with tee() if it goes to both the
+ * log and the peer, then spliced to them.  Returns the number of bytes
+ * read, 0 on EOF, -EINVAL if the master doesn't support splice, and
+ * another negative errno on error.
+ */
+static int lxc_console_splice_con(struct lxc_console *console)
+{
+	ssize_t r, t = 0, wlog = 0, wpeer = 0;
+	int log_fd = console->log_fd, peer = console->peer;
+
+	if (console->splice_pipe[0] < 0 &&
+	    pipe2(console->splice_pipe, O_CLOEXEC) < 0)
+		return -EINVAL;
+
+	if (log_fd >= 0 && peer >= 0 && console->tee_pipe[0] < 0 &&
+	    pipe2(console->tee_pipe, O_CLOEXEC) < 0)
+		return -EINVAL;
+
+	r = splice(console->master, NULL, console->splice_pipe[1], NULL,
+		   LXC_CONSOLE_BUFFER_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (r < 0)
+		return -errno;
+	if (r == 0)
+		return 0;
+
+	if (log_fd >= 0)
+		lxc_console_log_rotate(console, r);
+
+	if (log_fd >= 0 && peer >= 0) {
+		/* both pipes are empty here, so this normally copies all */
+		do {
+			t = tee(console->splice_pipe[0], console->tee_pipe[1],
+				r, SPLICE_F_NONBLOCK);
+		} while (t < 0 && errno == EINTR);
+		if (t < 0)
+			t = 0;
+
+		wlog = lxc_console_splice_out(console->tee_pipe[0], log_fd, t);
+		wpeer = lxc_console_splice_out(console->splice_pipe[0], peer, t);
+	} else if (log_fd >= 0 || peer >= 0) {
+		t = r;
+		if (log_fd >= 0)
+			wlog = lxc_console_splice_out(console->splice_pipe[0], log_fd, r);
+		else
+			wpeer = lxc_console_splice_out(console->splice_pipe[0], peer, r);
+	}
+
+	/* what tee() did not duplicate (or nobody wants) */
+	if (t < r)
+		lxc_console_copy_pipe(console->splice_pipe[0], r - t,
+				      log_fd, peer, &wlog, &wpeer);
+
+	console->log_written += wlog;
+
+	if ((log_fd >= 0 && wlog != r) || (peer >= 0 && wpeer != r))
+		WARN("console short write r:%zd log:%zd peer:%zd", r, wlog, wpeer);
+
+	return r;
+}
+
 static int lxc_console_cb_con(int fd, uint32_t events, void *data,
 			      struct lxc_epoll_descr *descr)
 {
 	struct lxc_console *console = (struct lxc_console *)data;
-	char buf[1024];
+	char buf[LXC_CONSOLE_BUFFER_SIZE];
 	int r, w;
 
+	/* the ring buffer needs the data in userspace */
+	if (fd == console->master && !console->nosplice &&
+	    !console->ringbuf.addr) {
+		r = lxc_console_splice_con(console);
+		if (r == -EAGAIN || r == -EINTR)
+			return 0;
+
+		if (r != -EINVAL) {
+			if (r <= 0) {
+				INFO("console client on fd %d has exited", fd);
+				lxc_mainloop_del_handler(descr, fd);
+				close(fd);
+				return 1;
+			}
+			return 0;
+		}
+
+		DEBUG("console does not support splice, copying instead");
+		console->nosplice = true;
+	}
+
 	w = r = lxc_read_nointr(fd, buf, sizeof(buf));
 	if (r <= 0) {
 		INFO("console client on fd %d has exited", fd);
@@ -175,8 +426,14 @@ static int lxc_console_cb_con(int fd, uint32_t events, void *data,
 		w = lxc_write_nointr(console->master, buf, r);
 
 	if (fd == console->master) {
-		if (console->log_fd >= 0)
+		lxc_console_ringbuf_write(&console->ringbuf, buf, r);
+
+		if (console->log_fd >= 0) {
+			lxc_console_log_rotate(console, r);
 			w = lxc_write_nointr(console->log_fd, buf, r);
+			if (w > 0)
+				console->log_written += w;
+		}
 
 		if (console->peer >= 0)
 			w = lxc_write_nointr(console->peer, buf, r);
@@ -472,6 +729,8 @@ out:
 
 void lxc_console_delete(struct lxc_console *console)
 {
+	int i;
+
 	if (console->tios && console->peer >= 0 &&
 	    tcsetattr(console->peer, TCSAFLUSH, console->tios))
 		WARN("failed to set old terminal settings");
@@ -483,6 +742,17 @@ void lxc_console_delete(struct lxc_console *console)
 	close(console->slave);
 	if (console->log_fd >= 0)
 		close(console->log_fd);
+	free(console->ringbuf.addr);
+	console->ringbuf.addr = NULL;
+	console->ringbuf.w_off = 0;
+	console->ringbuf.full = false;
+	for (i = 0; i < 2; i++) {
+		if (console->splice_pipe[i] >= 0)
+			close(console->splice_pipe[i]);
+		if (console->tee_pipe[i] >= 0)
+			close(console->tee_pipe[i]);
+		console->splice_pipe[i] = console->tee_pipe[i] = -1;
+	}
 
 	console->peer = -1;
 	console->master = -1;
@@ -493,6 +763,7 @@ void lxc_console_delete(struct lxc_console *console)
 int lxc_console_create(struct lxc_conf *conf)
 {
 	struct lxc_console *console = &conf->console;
+	struct stat st;
 	int ret;
 
 	if (conf->is_execute) {
@@ -536,6 +807,22 @@ int lxc_console_create(struct lxc_conf *conf)
 			goto err;
 		}
 		DEBUG("using '%s' as console log", console->log_path);
+
+		console->log_written = 0;
+		if (fstat(console->log_fd, &st) == 0)
+			console->log_written = st.st_size;
+	}
+
+	if (console->buffer_size > 0) {
+		console->ringbuf.addr = malloc(console->buffer_size);
+		if (!console->ringbuf.addr) {
+			ERROR("failed to allocate %llu bytes console buffer",
+			      (unsigned long long)console->buffer_size);
+			goto err;
+		}
+		console->ringbuf.size = console->buffer_size;
+		console->ringbuf.w_off = 0;
+		console->ringbuf.full = false;
 	}
 
 	return 0;
@@ -99,6 +99,20 @@ extern void lxc_console_delete(struct lxc_console *);
  */
 extern void lxc_console_free(struct lxc_conf *conf, int fd);
 
+/*
+ * lxc_console_buffer_read: copy out the recent console output kept in the
+ * ring buffer, oldest first
+ *
+ * @console : the console
+ * @clear   : empty the ring buffer afterwards
+ * @data    : set to a malloc()ed copy of the buffer, NULL if it's empty
+ * @len     : set to the length of @data
+ *
+ * Returns 0 on success, -ENODATA if lxc.console.buffer.size is not set.
+ */
+extern int lxc_console_buffer_read(struct lxc_console *console, bool clear,
+				   char **data, size_t *len);
+
 /*
  * Register pty event handlers in an open mainloop
  */
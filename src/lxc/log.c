@@ -27,6 +27,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <string.h>
 #include <pthread.h>
 #include <time.h>
@@ -52,6 +53,189 @@ static char *log_fname = NULL;
 
 lxc_log_define(lxc_log, lxc);
 
+/*
+ * Optional buffering of the logfile appender: events are formatted into
+ * log_buffer and written out in batches with writev() when it fills up, when
+ * an error is logged, before forking, when the mainloop goes idle and when
+ * the log is closed.  Each record is a struct log_record followed by the
+ * formatted line.  Only the process which enabled buffering uses it, forked
+ * children inherit a copy which they ignore and write directly instead, so
+ * nothing is written twice or lost on exec.
+ */
+#define LXC_LOG_BUFFER_MIN	(4 * LXC_LOG_BUFFER_SIZE)
+#define LXC_LOG_IOV_MAX		64
+
+struct log_record {
+	int fd;
+	int len;
+};
+
+#define LOG_RECORD_SIZE(len) \
+	(sizeof(struct log_record) + \
+	 (((len) + sizeof(struct log_record) - 1) & ~(sizeof(struct log_record) - 1)))
+
+static struct {
+	pthread_mutex_t lock;
+	pid_t owner; /* process buffering is enabled in, 0 if disabled */
+	char *data;
+	size_t size;
+	size_t used;
+	unsigned long dropped; /* records which could not be written */
+} log_buffer = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void log_writev(int fd, struct iovec *iov, int niov)
+{
+	ssize_t ret;
+
+	while (niov > 0) {
+		ret = writev(fd, iov, niov);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			log_buffer.dropped += niov;
+			return;
+		}
+
+		/* skip what was written, then retry the rest */
+		while (niov > 0 && ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			niov--;
+		}
+		if (niov > 0) {
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+}
+
+static void log_buffer_flush_locked(void)
+{
+	struct iovec iov[LXC_LOG_IOV_MAX];
+	struct log_record *rec;
+	char note[LXC_LOG_BUFFER_SIZE];
+	size_t off = 0;
+	int fd = -1, niov = 0, n;
+
+	while (off < log_buffer.used) {
+		rec = (struct log_record *)(log_buffer.data + off);
+
+		/* one writev() per run of records going to the same file */
+		if (niov == LXC_LOG_IOV_MAX || (niov > 0 && rec->fd != fd)) {
+			log_writev(fd, iov, niov);
+			niov = 0;
+		}
+
+		fd = rec->fd;
+		iov[niov].iov_base = rec + 1;
+		iov[niov].iov_len = rec->len;
+		niov++;
+		off += LOG_RECORD_SIZE(rec->len);
+	}
+
+	if (niov > 0)
+		log_writev(fd, iov, niov);
+	log_buffer.used = 0;
+
+	if (log_buffer.dropped && fd >= 0) {
+		n = snprintf(note, sizeof(note), "%15s lost %lu log messages\n",
+			     log_prefix, log_buffer.dropped);
+		if (n > 0 && n < sizeof(note) && write(fd, note, n) == n)
+			log_buffer.dropped = 0;
+	}
+}
+
+/*
+ * Queue a formatted event in the log buffer.  Returns false if buffering is
+ * not enabled for this process and the caller should write it itself.
+ */
+static bool log_buffer_append(int fd, const char *msg, int len, int priority)
+{
+	struct log_record *rec;
+	size_t need = LOG_RECORD_SIZE(len);
+
+	if (log_buffer.owner != getpid())
+		return false;
+
+	pthread_mutex_lock(&log_buffer.lock);
+
+	if (log_buffer.used + need > log_buffer.size)
+		log_buffer_flush_locked();
+
+	rec = (struct log_record *)(log_buffer.data + log_buffer.used);
+	rec->fd = fd;
+	rec->len = len;
+	memcpy(rec + 1, msg, len);
+	log_buffer.used += need;
+
+	/* don't keep errors around, the process may be about to die */
+	if (priority >= LXC_LOG_PRIORITY_ERROR)
+		log_buffer_flush_locked();
+
+	pthread_mutex_unlock(&log_buffer.lock);
+	return true;
+}
+
+extern void lxc_log_flush(void)
+{
+	if (log_buffer.owner != getpid())
+		return;
+
+	pthread_mutex_lock(&log_buffer.lock);
+	log_buffer_flush_locked();
+	pthread_mutex_unlock(&log_buffer.lock);
+}
+
+#ifdef HAVE_PTHREAD_ATFORK
+static void log_buffer_atfork_prepare(void)
+{
+	lxc_log_flush();
+}
+#endif
+
+__attribute__((destructor))
+static void log_buffer_fini(void)
+{
+	lxc_log_flush();
+}
+
+extern int lxc_log_set_buffer(size_t size)
+{
+#ifdef HAVE_PTHREAD_ATFORK
+	static bool atfork_registered;
+#endif
+	char *data = NULL;
+
+	if (size) {
+		if (size < LXC_LOG_BUFFER_MIN)
+			size = LXC_LOG_BUFFER_MIN;
+
+		data = malloc(size);
+		if (!data)
+			return -ENOMEM;
+	}
+
+	lxc_log_flush();
+
+	pthread_mutex_lock(&log_buffer.lock);
+	free(log_buffer.data);
+	log_buffer.data = data;
+	log_buffer.size = size;
+	log_buffer.used = 0;
+	log_buffer.owner = size ? getpid() : 0;
+#ifdef HAVE_PTHREAD_ATFORK
+	if (size && !atfork_registered) {
+		pthread_atfork(log_buffer_atfork_prepare, NULL, NULL);
+		atfork_registered = true;
+	}
+#endif
+	pthread_mutex_unlock(&log_buffer.lock);
+
+	return 0;
+}
+
 /*---------------------------------------------------------------------------*/
 static int log_append_stderr(const struct lxc_log_appender *appender,
 			     struct lxc_log_event *event)
@@ -112,6 +296,9 @@ static int log_append_logfile(const struct lxc_log_appender *appender,
 
 	buffer[n] = '\n';
 
+	if (log_buffer_append(fd_to_use, buffer, n + 1, event->priority))
+		return n + 1;
+
 	return write(fd_to_use, buffer, n + 1);
 }
 
@@ -253,6 +440,8 @@ static char *build_log_path(const char *name, const char *lxcpath)
 
 extern void lxc_log_close(void)
 {
+	lxc_log_flush();
+
 	if (lxc_log_fd == -1)
 		return;
 	close(lxc_log_fd);
@@ -327,6 +516,7 @@ extern int lxc_log_init(const char *name, const char *file,
 			const char *lxcpath)
 {
 	int lxc_priority = LXC_LOG_PRIORITY_ERROR;
+	const char *bufsize;
 	int ret;
 
 	if (lxc_log_fd != -1) {
@@ -334,6 +524,12 @@ extern int lxc_log_init(const char *name, const char *file,
 		return 0;
 	}
 
+	/* size of the log buffer in KiB, unbuffered by default */
+	bufsize = lxc_global_config_value("lxc.log.buffer");
+	if (bufsize && atoi(bufsize) > 0 &&
+	    lxc_log_set_buffer((size_t)atoi(bufsize) * 1024) < 0)
+		WARN("failed to allocate a %s KiB log buffer", bufsize);
+
 	if (priority)
 		lxc_priority = lxc_log_priority_to_int(priority);
 
@@ -426,6 +622,7 @@ extern bool lxc_log_has_valid_level(void)
 extern int lxc_log_set_file(int *fd, const char *fname)
 {
 	if (*fd != -1) {
+		lxc_log_flush();
 		close(*fd);
 		*fd = -1;
 	}
@@ -321,4 +321,12 @@ extern int lxc_log_get_level(void);
 extern bool lxc_log_has_valid_level(void);
 extern const char *lxc_log_get_prefix(void);
 extern void lxc_log_options_no_override();
+
+/*
+ * Buffer logfile output in memory and write it out in batches, @size bytes
+ * at most, 0 to write every event right away (the default).
+ * lxc_log_flush() writes out what has been buffered so far.
+ */
+extern int lxc_log_set_buffer(size_t size);
+extern void lxc_log_flush(void);
 #endif
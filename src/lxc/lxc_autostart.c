@@ -18,8 +18,13 @@
  *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 
 #include <lxc/lxccontainer.h>
 
@@ -27,6 +32,8 @@
 #include "list.h"
 #include "log.h"
 
+#define OPT_START_TIMEOUT OPT_USAGE+1
+
 lxc_log_define(lxc_autostart_ui, lxc);
 static struct lxc_list *accumulate_list(char *input, char *delimiter, struct lxc_list *str_list);
 
@@ -34,6 +41,9 @@ struct lxc_list *cmd_groups_list = NULL;
 
 static int my_parser(struct lxc_arguments* args, int c, char* arg)
 {
+	char *invalid;
+	unsigned long m;
+
 	switch (c) {
 	case 'k': args->hardstop = 1; break;
 	case 'L': args->list = 1; break;
@@ -43,6 +53,20 @@ static int my_parser(struct lxc_arguments* args, int c, char* arg)
 	case 'A': args->ignore_auto = 1; break;
 	case 'g': cmd_groups_list = accumulate_list( arg, ",", cmd_groups_list); break;
 	case 't': args->timeout = atoi(arg); break;
+	case OPT_START_TIMEOUT: args->start_timeout = atoi(arg); break;
+	case 'j':
+		errno = 0;
+		m = strtoul(arg, &invalid, 0);
+		if (*arg == '-' || errno || *invalid != '\0' || m > UINT_MAX) {
+			fprintf(stderr, "Invalid number of jobs: %s\n", arg);
+			return -1;
+		}
+		if (m == 0) {
+			long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+			m = ncpus > 0 ? ncpus : 1;
+		}
+		args->jobs = m;
+		break;
 	}
 	return 0;
 }
@@ -56,6 +80,8 @@ static const struct option my_longopts[] = {
 	{"ignore-auto", no_argument, 0, 'A'},
 	{"groups", required_argument, 0, 'g'},
 	{"timeout", required_argument, 0, 't'},
+	{"jobs", required_argument, 0, 'j'},
+	{"start-timeout", required_argument, 0, OPT_START_TIMEOUT},
 	{"help", no_argument, 0, 'h'},
 	LXC_COMMON_OPTIONS
 };
@@ -75,11 +101,18 @@ Options:\n\
   -a, --all         list all auto-started containers (ignore groups)\n\
   -A, --ignore-auto ignore lxc.start.auto and select all matching containers\n\
   -g, --groups      list of groups (comma separated) to select\n\
-  -t, --timeout=T   wait T seconds before hard-stopping\n",
+  -t, --timeout=T   wait T seconds before hard-stopping\n\
+  -j, --jobs=NUM    start up to NUM containers of the same lxc.start.order\n\
+                    concurrently (0 means one per CPU, default is 1)\n\
+      --start-timeout=T\n\
+                    with --jobs, wait up to T seconds for each container\n\
+                    to be RUNNING before counting its start delay\n",
 	.options  = my_longopts,
 	.parser   = my_parser,
 	.checker  = NULL,
 	.timeout = 60,
+	.jobs = 1,
+	.start_timeout = 60,
 };
 
 int list_contains_entry( char *str_ptr, struct lxc_list *p1 ) {
@@ -309,6 +342,102 @@ static int cmporder(const void *p1, const void *p2) {
 		return (c1_order - c2_order);
 }
 
+/*
+ * Start (or reboot) a container, then hold off for its lxc.start.delay
+ * before the next one may go.  A concurrent start is first waited on until
+ * the container is RUNNING, so that its delay holds back the next tier
+ * from that point on.  Returns false on error.
+ */
+static bool do_autostart(struct lxc_container *c)
+{
+	if (my_args.reboot) {
+		if (!c->reboot(c)) {
+			fprintf(stderr, "Error rebooting container: %s\n", c->name);
+			fflush(stderr);
+			return false;
+		}
+	}
+	else {
+		if (!c->start(c, 0, NULL) ||
+		    (my_args.jobs > 1 &&
+		     !c->wait(c, "RUNNING", my_args.start_timeout))) {
+			fprintf(stderr, "Error starting container: %s\n", c->name);
+			fflush(stderr);
+			return false;
+		}
+	}
+
+	sleep(get_config_integer(c, "lxc.start.delay"));
+	return true;
+}
+
+/*
+ * With --jobs, every container is started by a child process of its own.
+ * Children of one lxc.start.order tier run concurrently, each keeping its
+ * slot for the container's lxc.start.delay, and a tier only begins once
+ * the previous one is done.
+ */
+static pid_t *workers;
+static unsigned int nworkers;
+static int workers_order;
+
+static void wait_workers(unsigned int max)
+{
+	unsigned int i;
+	int status;
+	pid_t pid;
+
+	while (nworkers > max) {
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			nworkers = 0;
+			return;
+		}
+
+		for (i = 0; i < nworkers; i++) {
+			if (workers[i] == pid) {
+				workers[i] = workers[--nworkers];
+				break;
+			}
+		}
+	}
+}
+
+static void autostart(struct lxc_container *c)
+{
+	int order;
+	pid_t pid;
+
+	if (my_args.jobs <= 1 || !workers) {
+		do_autostart(c);
+		return;
+	}
+
+	order = get_config_integer(c, "lxc.start.order");
+	if (order != workers_order)
+		wait_workers(0);
+	workers_order = order;
+	wait_workers(my_args.jobs - 1);
+
+	/* don't duplicate buffered output in the child */
+	fflush(stdout);
+	fflush(stderr);
+
+	pid = fork();
+	if (pid < 0) {
+		SYSERROR("failed to fork, starting %s in the foreground", c->name);
+		do_autostart(c);
+		return;
+	}
+
+	if (pid == 0)
+		exit(do_autostart(c) ? EXIT_SUCCESS : EXIT_FAILURE);
+
+	workers[nworkers++] = pid;
+}
+
 static int toss_list( struct lxc_list *c_groups_list ) {
 	struct lxc_list *it, *next;
 
@@ -346,6 +475,10 @@ int main(int argc, char *argv[])
 	if (count < 0)
 		return 1;
 
+	if (my_args.jobs > 1 && !my_args.list && !my_args.shutdown &&
+	    !my_args.hardstop)
+		workers = calloc(my_args.jobs, sizeof(*workers));
+
 	if (!my_args.all) {
 		/* Allocate an array for our container group lists */
 		c_groups_lists = calloc( count, sizeof( struct lxc_list * ) );
@@ -463,14 +596,8 @@ int main(int argc, char *argv[])
 						       get_config_integer(c, "lxc.start.delay"));
 						fflush(stdout);
 					}
-					else {
-						if (!c->reboot(c)) {
-							fprintf(stderr, "Error rebooting container: %s\n", c->name);
-							fflush(stderr);
-						}
-						else
-							sleep(get_config_integer(c, "lxc.start.delay"));
-					}
+					else
+						autostart(c);
 				}
 			}
 			else {
@@ -481,14 +608,8 @@ int main(int argc, char *argv[])
 						       get_config_integer(c, "lxc.start.delay"));
 						fflush(stdout);
 					}
-					else {
-						if (!c->start(c, 0, NULL)) {
-							fprintf(stderr, "Error starting container: %s\n", c->name);
-							fflush(stderr);
-						}
-						else
-							sleep(get_config_integer(c, "lxc.start.delay"));
-					}
+					else
+						autostart(c);
 				}
 			}
 
@@ -506,7 +627,10 @@ int main(int argc, char *argv[])
 			}
 		}
 
+		/* groups are processed one after another */
+		wait_workers(0);
 	}
+	free(workers);
 
 	/* clean up any lingering detritus */
 	for (i = 0; i < count; i++) {
@@ -36,24 +36,27 @@ lxc_log_define(lxc_destroy_ui, lxc);
 
 static int my_parser(struct lxc_arguments* args, int c, char* arg);
 static bool quiet;
+static bool async;
 
 static const struct option my_longopts[] = {
 	{"force", no_argument, 0, 'f'},
 	{"snapshots", no_argument, 0, 's'},
+	{"async", no_argument, 0, 'a'},
 	LXC_COMMON_OPTIONS
 };
 
 static struct lxc_arguments my_args = {
 	.progname = "lxc-destroy",
 	.help     = "\
---name=NAME [-f] [-P lxcpath]\n\
+--name=NAME [-f] [-a] [-P lxcpath]\n\
 \n\
 lxc-destroy destroys a container with the identifier NAME\n\
 \n\
 Options :\n\
   -n, --name=NAME   NAME of the container\n\
   -s, --snapshots   destroy including all snapshots\n\
-  -f, --force       wait for the container to shut down\n",
+  -f, --force       wait for the container to shut down\n\
+  -a, --async       remove the container's files in the background\n",
 	.options  = my_longopts,
 	.parser   = my_parser,
 	.checker  = NULL,
@@ -124,6 +127,7 @@ static int my_parser(struct lxc_arguments *args, int c, char *arg)
 	switch (c) {
 	case 'f': args->force = 1; break;
 	case 's': args->task = SNAP; break;
+	case 'a': async = true; break;
 	}
 	return 0;
 }
@@ -166,7 +170,7 @@ static bool do_destroy(struct lxc_container *c)
 	/* If the container was ephemeral we have already removed it when we
 	 * stopped it. */
 	if (c->is_defined(c) && !c->lxc_conf->ephemeral)
-		bret = c->destroy(c);
+		bret = async ? c->destroy_async(c, false) : c->destroy(c);
 
 	if (!bret) {
 		if (!quiet)
@@ -248,7 +252,9 @@ static bool do_destroy_with_snapshots(struct lxc_container *c)
 	if (ret < 0 || ret >= MAXPATHLEN)
 		return false;
 
-	if (dir_exists(path))
+	if (dir_exists(path) && async)
+		bret = c->destroy_async(c, true);
+	else if (dir_exists(path))
 		bret = c->destroy_with_snapshots(c);
 	else
 		bret = do_destroy(c);
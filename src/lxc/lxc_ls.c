@@ -19,6 +19,7 @@
 #include "config.h"
 
 #include <getopt.h>
+#include <pthread.h>
 #include <regex.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -54,6 +55,7 @@ lxc_log_define(lxc_ls, lxc);
 #define LS_RUNNING 4
 #define LS_NESTING 5
 #define LS_FILTER 6
+#define LS_JOBS 7
 
 #ifndef SOCK_CLOEXEC
 #  define SOCK_CLOEXEC                02000000
@@ -89,15 +91,48 @@ struct lengths {
 	unsigned int autostart_length;
 };
 
+/* Arguments shared by all containers collected in one ls_get() call. */
+struct ls_pool {
+	const struct lxc_arguments *args;
+	const char *basepath;
+	const char *path;
+	const char *parent;
+	unsigned int lvl;
+	char **grps_must;
+	size_t grps_must_len;
+};
+
+/* Result of a single container collected by a worker thread. */
+struct ls_job {
+	const char *name;
+	struct ls *m;
+	size_t size;
+	char *lockpath;
+	int ret;
+};
+
+struct ls_workers {
+	const struct ls_pool *pool;
+	struct ls_job *jobs;
+	size_t njobs;
+	size_t next;
+	pthread_mutex_t lock;
+};
+
 static int ls_deserialize(int rpipefd, struct ls **m, size_t *len);
 static void ls_field_width(const struct ls *l, const size_t size,
 		struct lengths *lht);
 static void ls_free(struct ls *l, size_t size);
+static void ls_free_entry(struct ls *m);
 static void ls_free_arr(char **arr, size_t size);
 static int ls_get(struct ls **m, size_t *size, const struct lxc_arguments *args,
 		const char *basepath, const char *parent, unsigned int lvl,
 		char **lockpath, size_t len_lockpath, char **grps_must,
 		size_t grps_must_len);
+static int ls_get_concurrent(const struct ls_pool *pool, struct ls **m,
+		size_t *size, char **names, size_t nnames);
+static int ls_get_one(const struct ls_pool *pool, struct ls **m, size_t *size,
+		const char *name, char **lockpath, size_t len_lockpath);
 static char *ls_get_cgroup_item(struct lxc_container *c, const char *item);
 static char *ls_get_config_item(struct lxc_container *c, const char *item,
 		bool running);
@@ -171,15 +206,16 @@ static const struct option my_longopts[] = {
 	{"nesting", optional_argument, 0, LS_NESTING},
 	{"groups", required_argument, 0, 'g'},
 	{"filter", required_argument, 0, LS_FILTER},
+	{"jobs", required_argument, 0, LS_JOBS},
 	LXC_COMMON_OPTIONS
 };
 
 static struct lxc_arguments my_args = {
 	.progname = "lxc-ls",
 	.help = "\n\
-[-P lxcpath] [--active] [--running] [--frozen] [--stopped] [--nesting] [-g groups] [--filter regex]\n\
-[-1] [-P lxcpath] [--active] [--running] [--frozen] [--stopped] [--nesting] [-g groups] [--filter regex]\n\
-[-f] [-P lxcpath] [--active] [--running] [--frozen] [--stopped] [--nesting] [-g groups] [--filter regex]\n\
+[-P lxcpath] [--active] [--running] [--frozen] [--stopped] [--nesting] [-g groups] [--filter regex] [--jobs NUM]\n\
+[-1] [-P lxcpath] [--active] [--running] [--frozen] [--stopped] [--nesting] [-g groups] [--filter regex] [--jobs NUM]\n\
+[-f] [-P lxcpath] [--active] [--running] [--frozen] [--stopped] [--nesting] [-g groups] [--filter regex] [--jobs NUM]\n\
 \n\
 lxc-ls list containers\n\
 \n\
@@ -193,10 +229,12 @@ Options :\n\
   --stopped          list only stopped containers\n\
   --nesting=NUM      list nested containers up to NUM (default is 5) levels of nesting\n\
   --filter=REGEX     filter container names by regular expression\n\
+  --jobs=NUM         query up to NUM containers concurrently (0 means one per CPU, default is 1)\n\
   -g --groups        comma separated list of groups a container must have to be displayed\n",
 	.options = my_longopts,
 	.parser = my_parser,
 	.ls_nesting = 0,
+	.ls_jobs = 1,
 };
 
 int main(int argc, char *argv[])
@@ -276,18 +314,21 @@ out:
 	exit(ret);
 }
 
+static void ls_free_entry(struct ls *m)
+{
+	free(m->groups);
+	free(m->interface);
+	free(m->ipv4);
+	free(m->ipv6);
+	free(m->name);
+	free(m->state);
+}
+
 static void ls_free(struct ls *l, size_t size)
 {
 	size_t i;
-	struct ls *m = NULL;
-	for (i = 0, m = l; i < size; i++, m++) {
-		free(m->groups);
-		free(m->interface);
-		free(m->ipv4);
-		free(m->ipv6);
-		free(m->name);
-		free(m->state);
-	}
+	for (i = 0; i < size; i++)
+		ls_free_entry(&l[i]);
 	free(l);
 }
 
@@ -321,6 +362,195 @@ static void ls_free_arr(char **arr, size_t size)
 	free(arr);
 }
 
+/*
+ * Gather the information about a single container and, if it matches the
+ * filters, append it (and its nested containers) to @m.
+ *
+ * Returns -1 on out of memory, 0 otherwise.
+ */
+static int ls_get_one(const struct ls_pool *pool, struct ls **m, size_t *size,
+		      const char *name, char **lockpath, size_t len_lockpath)
+{
+	int check;
+	char *tmp = NULL;
+	struct ls *l = NULL;
+	struct lxc_container *c = NULL;
+
+	errno = 0;
+	c = lxc_container_new(name, pool->path);
+	if ((errno == ENOMEM) && !c)
+		return -1;
+	else if (!c)
+		return 0;
+
+	if (!c->is_defined(c))
+		goto put_and_next;
+
+	/* This does not allocate memory so no worries about freeing it
+	 * when we goto put_and_next. */
+	const char *state_tmp = c->state(c);
+	if (!state_tmp)
+		state_tmp = "UNKNOWN";
+
+	if (pool->args->ls_running && !c->is_running(c))
+		goto put_and_next;
+
+	if (pool->args->ls_frozen && !pool->args->ls_active && strcmp(state_tmp, "FROZEN"))
+		goto put_and_next;
+
+	if (pool->args->ls_stopped && strcmp(state_tmp, "STOPPED"))
+		goto put_and_next;
+
+	bool running = c->is_running(c);
+
+	char *grp_tmp = ls_get_groups(c, running);
+	if (!ls_has_all_grps(grp_tmp, pool->grps_must, pool->grps_must_len)) {
+		free(grp_tmp);
+		goto put_and_next;
+	}
+
+	/* Now it makes sense to allocate memory. */
+	l = ls_new(m, size);
+	if (!l) {
+		free(grp_tmp);
+		goto put_and_next;
+	}
+
+	/* How deeply nested are we? */
+	l->nestlvl = pool->lvl;
+
+	l->groups = grp_tmp;
+
+	l->running = running;
+
+	if (pool->parent && pool->args->ls_nesting && (pool->args->ls_line || !pool->args->ls_fancy))
+		/* Prepend the name of the container with all its parents when
+		 * the user requests it. */
+		l->name = lxc_append_paths(pool->parent, name);
+	else
+		/* Otherwise simply record the name. */
+		l->name = strdup(name);
+	if (!l->name)
+		goto put_and_next;
+
+	/* Do not record stuff the user did not explictly request. */
+	if (pool->args->ls_fancy) {
+		/* Maybe we should even consider the name sensitive and
+		 * hide it when you're not allowed to control the
+		 * container. */
+		if (!c->may_control(c))
+			goto put_and_next;
+
+		l->state = strdup(state_tmp);
+		if (!l->state)
+			goto put_and_next;
+
+		tmp = ls_get_config_item(c, "lxc.start.auto", running);
+		if (tmp)
+			l->autostart = atoi(tmp);
+		free(tmp);
+
+		if (running) {
+			l->init = c->init_pid(c);
+
+			l->interface = ls_get_interface(c);
+
+			l->ipv4 = ls_get_ips(c, "inet");
+
+			l->ipv6 = ls_get_ips(c, "inet6");
+
+			tmp = ls_get_cgroup_item(c, "memory.usage_in_bytes");
+			if (tmp) {
+				l->ram = strtoull(tmp, NULL, 0);
+				l->ram = l->ram / 1024 /1024;
+				free(tmp);
+			}
+
+			l->swap = ls_get_swap(c);
+		}
+	}
+
+	/* Get nested containers: Only do this after we have gathered
+	 * all other information we need. */
+	if (pool->args->ls_nesting && running) {
+		struct wrapargs wargs = (struct wrapargs){.args = NULL};
+		/* Open a socket so that the child can communicate with us. */
+		check = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, wargs.pipefd);
+		if (check == -1)
+			goto put_and_next;
+
+		/* Set the next nesting level. */
+		wargs.nestlvl = pool->lvl + 1;
+		/* Send in the parent for the next nesting level. */
+		wargs.parent = l->name;
+		wargs.args = pool->args;
+		wargs.grps_must = pool->grps_must;
+		wargs.grps_must_len = pool->grps_must_len;
+
+		pid_t out;
+
+		lxc_attach_options_t aopt = LXC_ATTACH_OPTIONS_DEFAULT;
+		aopt.env_policy = LXC_ATTACH_CLEAR_ENV;
+
+		/* fork(): Attach to the namespace of the container and
+		 * run ls_get() in it which is called in ls_get_wrapper(). */
+		check = c->attach(c, ls_get_wrapper, &wargs, &aopt, &out);
+		/* close the socket */
+		close(wargs.pipefd[1]);
+
+		/* Retrieve all information we want from the child. */
+		if (check == 0)
+			if (ls_deserialize(wargs.pipefd[0], m, size) == -1)
+				goto put_and_next;
+
+		/* Wait for the child to finish. */
+		wait_for_pid(out);
+
+		/* We've done all the communication we need so shutdown
+		 * the socket and close it. */
+		shutdown(wargs.pipefd[0], SHUT_RDWR);
+		close(wargs.pipefd[0]);
+	} else if (pool->args->ls_nesting && !running) {
+		/* This way of extracting the rootfs is not safe since
+		 * it will return very different things depending on the
+		 * storage backend that is used for the container. We
+		 * need a path-extractor function. We face the same
+		 * problem with the ovl_mkdir() function in
+		 * lxcoverlay.{c,h}. */
+		char *curr_path = ls_get_config_item(c, "lxc.rootfs", running);
+		if (!curr_path)
+			goto put_and_next;
+
+		/* Since the container is not running and we cannot
+		 * attach to it we need another strategy to retrieve
+		 * nested containers. What we do is simply create a
+		 * growing path which will lead us into the rootfs of
+		 * the next container where it stores its containers. */
+		char *newpath = lxc_append_paths(pool->basepath, curr_path);
+		free(curr_path);
+		if (!newpath)
+			goto put_and_next;
+
+		/* We want to remove all locks we create under
+		 * /run/lxc/lock so we create a string pointing us to
+		 * the lock path for the current container. */
+		if (ls_remove_lock(pool->path, name, lockpath, &len_lockpath, true) == -1)
+			goto put_and_next;
+
+		ls_get(m, size, pool->args, newpath, l->name, pool->lvl + 1,
+		       lockpath, len_lockpath, pool->grps_must,
+		       pool->grps_must_len);
+		free(newpath);
+
+		/* Remove the lock. No need to check for failure here. */
+		ls_remove_lock(pool->path, name, lockpath, &len_lockpath, false);
+	}
+
+put_and_next:
+	lxc_container_put(c);
+	return 0;
+}
+
 static int ls_get(struct ls **m, size_t *size, const struct lxc_arguments *args,
 		const char *basepath, const char *parent, unsigned int lvl,
 		char **lockpath, size_t len_lockpath, char **grps_must,
@@ -366,9 +596,7 @@ static int ls_get(struct ls **m, size_t *size, const struct lxc_arguments *args,
 
 	char *tmp = NULL;
 	int check;
-	struct ls *l = NULL;
-	struct lxc_container *c = NULL;
-	size_t i;
+	size_t i, nwork = 0;
 	for (i = 0; i < (size_t)num; i++) {
 		char *name = containers[i];
 
@@ -387,187 +615,138 @@ static int ls_get(struct ls **m, size_t *size, const struct lxc_arguments *args,
 				continue;
 		}
 
- 		errno = 0;
-		c = lxc_container_new(name, path);
- 		if ((errno == ENOMEM) && !c)
- 			goto out;
- 		else if (!c)
- 			continue;
-
-		if (!c->is_defined(c))
-			goto put_and_next;
-
-		/* This does not allocate memory so no worries about freeing it
-		 * when we goto next or out. */
-		const char *state_tmp = c->state(c);
-		if (!state_tmp)
-			state_tmp = "UNKNOWN";
-
-		if (args->ls_running && !c->is_running(c))
-			goto put_and_next;
-
-		if (args->ls_frozen && !args->ls_active && strcmp(state_tmp, "FROZEN"))
-			goto put_and_next;
-
-		if (args->ls_stopped && strcmp(state_tmp, "STOPPED"))
-			goto put_and_next;
-
-		bool running = c->is_running(c);
-
-		char *grp_tmp = ls_get_groups(c, running);
-		if (!ls_has_all_grps(grp_tmp, grps_must, grps_must_len)) {
-			free(grp_tmp);
-			goto put_and_next;
-		}
-
-		/* Now it makes sense to allocate memory. */
-		l = ls_new(m, size);
-		if (!l) {
-			free(grp_tmp);
-			goto put_and_next;
-		}
-
-		/* How deeply nested are we? */
-		l->nestlvl = lvl;
-
-		l->groups = grp_tmp;
-
-		l->running = running;
-
-		if (parent && args->ls_nesting && (args->ls_line || !args->ls_fancy))
-			/* Prepend the name of the container with all its parents when
-			 * the user requests it. */
-			l->name = lxc_append_paths(parent, name);
-		else
-			/* Otherwise simply record the name. */
-			l->name = strdup(name);
-		if (!l->name)
-			goto put_and_next;
+		/* Move the names we are interested in to the front. */
+		containers[i] = containers[nwork];
+		containers[nwork++] = name;
+	}
 
-		/* Do not record stuff the user did not explictly request. */
-		if (args->ls_fancy) {
-			/* Maybe we should even consider the name sensitive and
-			 * hide it when you're not allowed to control the
-			 * container. */
-			if (!c->may_control(c))
-				goto put_and_next;
+	struct ls_pool pool = {
+		.args = args,
+		.basepath = basepath,
+		.path = path,
+		.parent = parent,
+		.lvl = lvl,
+		.grps_must = grps_must,
+		.grps_must_len = grps_must_len,
+	};
 
-			l->state = strdup(state_tmp);
-			if (!l->state)
-				goto put_and_next;
+	/* Only the uppermost level is collected concurrently, nested levels
+	 * are walked by the worker which found the parent container. */
+	if (lvl == 0 && args->ls_jobs > 1 && nwork > 1) {
+		if (ls_get_concurrent(&pool, m, size, containers, nwork) < 0)
+			goto out;
+	} else {
+		for (i = 0; i < nwork; i++)
+			if (ls_get_one(&pool, m, size, containers[i], lockpath,
+				       len_lockpath) < 0)
+				goto out;
+	}
+	ret = 0;
 
-			tmp = ls_get_config_item(c, "lxc.start.auto", running);
-			if (tmp)
-				l->autostart = atoi(tmp);
-			free(tmp);
+out:
+	ls_free_arr(containers, num);
+	free(path);
+	/* lockpath is shared amongst all non-fork()ing recursive calls to
+	 * ls_get() so only free it on the uppermost level. */
+	if (lvl == 0)
+		free(*lockpath);
 
-			if (running) {
-				l->init = c->init_pid(c);
+	return ret;
+}
 
-				l->interface = ls_get_interface(c);
+static void *ls_worker(void *data)
+{
+	struct ls_workers *w = data;
+	struct ls_job *job;
+
+	for (;;) {
+		pthread_mutex_lock(&w->lock);
+		job = w->next < w->njobs ? &w->jobs[w->next++] : NULL;
+		pthread_mutex_unlock(&w->lock);
+		if (!job)
+			break;
 
-				l->ipv4 = ls_get_ips(c, "inet");
+		job->ret = ls_get_one(w->pool, &job->m, &job->size, job->name,
+				      &job->lockpath, 0);
+	}
 
-				l->ipv6 = ls_get_ips(c, "inet6");
+	return NULL;
+}
 
-				tmp = ls_get_cgroup_item(c, "memory.usage_in_bytes");
-				if (tmp) {
-					l->ram = strtoull(tmp, NULL, 0);
-					l->ram = l->ram / 1024 /1024;
-					free(tmp);
-				}
+/*
+ * Collect the containers in @names with a bounded pool of worker threads so
+ * that loading their configs, querying their state and looking up their
+ * interfaces and ips overlaps. Each container is collected into its own
+ * result which are appended to @m in the order of @names afterwards.
+ */
+static int ls_get_concurrent(const struct ls_pool *pool, struct ls **m,
+		size_t *size, char **names, size_t nnames)
+{
+	int ret = 0;
+	size_t i, j, nthreads, started = 0, total = *size;
+	pthread_t *threads;
+	struct ls *n;
+	struct ls_workers w = {
+		.pool = pool,
+		.njobs = nnames,
+	};
 
-				l->swap = ls_get_swap(c);
-			}
-		}
+	nthreads = pool->args->ls_jobs;
+	if (nthreads > nnames)
+		nthreads = nnames;
 
-		/* Get nested containers: Only do this after we have gathered
-		 * all other information we need. */
-		if (args->ls_nesting && running) {
-			struct wrapargs wargs = (struct wrapargs){.args = NULL};
-			/* Open a socket so that the child can communicate with us. */
-			check = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, wargs.pipefd);
-			if (check == -1)
-				goto put_and_next;
+	w.jobs = calloc(nnames, sizeof(*w.jobs));
+	threads = calloc(nthreads, sizeof(*threads));
+	if (!w.jobs || !threads) {
+		free(w.jobs);
+		free(threads);
+		return -1;
+	}
 
-			/* Set the next nesting level. */
-			wargs.nestlvl = lvl + 1;
-			/* Send in the parent for the next nesting level. */
-			wargs.parent = l->name;
-			wargs.args = args;
-			wargs.grps_must = grps_must;
-			wargs.grps_must_len = grps_must_len;
-
-			pid_t out;
-
-			lxc_attach_options_t aopt = LXC_ATTACH_OPTIONS_DEFAULT;
-			aopt.env_policy = LXC_ATTACH_CLEAR_ENV;
-
-			/* fork(): Attach to the namespace of the container and
-			 * run ls_get() in it which is called in ls_get_wrapper(). */
-			check = c->attach(c, ls_get_wrapper, &wargs, &aopt, &out);
-			/* close the socket */
-			close(wargs.pipefd[1]);
-
-			/* Retrieve all information we want from the child. */
-			if (check == 0)
-				if (ls_deserialize(wargs.pipefd[0], m, size) == -1)
-					goto put_and_next;
-
-			/* Wait for the child to finish. */
-			wait_for_pid(out);
-
-			/* We've done all the communication we need so shutdown
-			 * the socket and close it. */
-			shutdown(wargs.pipefd[0], SHUT_RDWR);
-			close(wargs.pipefd[0]);
-		} else if (args->ls_nesting && !running) {
-			/* This way of extracting the rootfs is not safe since
-			 * it will return very different things depending on the
-			 * storage backend that is used for the container. We
-			 * need a path-extractor function. We face the same
-			 * problem with the ovl_mkdir() function in
-			 * lxcoverlay.{c,h}. */
-			char *curr_path = ls_get_config_item(c, "lxc.rootfs", running);
-			if (!curr_path)
-				goto put_and_next;
+	for (i = 0; i < nnames; i++)
+		w.jobs[i].name = names[i];
 
-			/* Since the container is not running and we cannot
-			 * attach to it we need another strategy to retrieve
-			 * nested containers. What we do is simply create a
-			 * growing path which will lead us into the rootfs of
-			 * the next container where it stores its containers. */
-			char *newpath = lxc_append_paths(basepath, curr_path);
-			free(curr_path);
-			if (!newpath)
-				goto put_and_next;
+	pthread_mutex_init(&w.lock, NULL);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, ls_worker, &w) != 0)
+			break;
+		started++;
+	}
+	/* If we could not start any thread do the work ourselves. */
+	if (started == 0)
+		ls_worker(&w);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&w.lock);
+
+	for (i = 0; i < nnames; i++)
+		total += w.jobs[i].size;
+
+	n = realloc(*m, total * sizeof(struct ls));
+	if (!n && total > 0)
+		ret = -1;
+	else
+		*m = n;
 
-			/* We want to remove all locks we create under
-			 * /run/lxc/lock so we create a string pointing us to
-			 * the lock path for the current container. */
-			if (ls_remove_lock(path, name, lockpath, &len_lockpath, true) == -1)
-				goto put_and_next;
+	for (i = 0; i < nnames; i++) {
+		struct ls_job *job = &w.jobs[i];
 
-			ls_get(m, size, args, newpath, l->name, lvl + 1, lockpath, len_lockpath, grps_must, grps_must_len);
-			free(newpath);
+		if (job->ret < 0)
+			ret = -1;
 
-			/* Remove the lock. No need to check for failure here. */
-			ls_remove_lock(path, name, lockpath, &len_lockpath, false);
+		if (ret == 0) {
+			memcpy(*m + *size, job->m, job->size * sizeof(struct ls));
+			*size += job->size;
+		} else {
+			for (j = 0; j < job->size; j++)
+				ls_free_entry(&job->m[j]);
 		}
-
-put_and_next:
-		lxc_container_put(c);
+		free(job->m);
+		free(job->lockpath);
 	}
-	ret = 0;
-
-out:
-	ls_free_arr(containers, num);
-	free(path);
-	/* lockpath is shared amongst all non-fork()ing recursive calls to
-	 * ls_get() so only free it on the uppermost level. */
-	if (lvl == 0)
-		free(*lockpath);
 
+	free(w.jobs);
+	free(threads);
 	return ret;
 }
 
@@ -940,6 +1119,23 @@ static int my_parser(struct lxc_arguments *args, int c, char *arg)
 	case LS_FILTER:
 		args->ls_filter = arg;
 		break;
+	case LS_JOBS:
+		if (*arg == '-') {
+			fprintf(stderr, "Invalid number of jobs: %s\n", arg);
+			return -1;
+		}
+		errno = 0;
+		m = strtoul(arg, &invalid, 0);
+		if (errno || *invalid != '\0' || m > UINT_MAX) {
+			fprintf(stderr, "Invalid number of jobs: %s\n", arg);
+			return -1;
+		}
+		if (m == 0) {
+			long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+			m = ncpus > 0 ? ncpus : 1;
+		}
+		args->ls_jobs = m;
+		break;
 	case 'F':
 		args->ls_fancy_format = arg;
 		break;
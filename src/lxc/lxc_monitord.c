@@ -42,6 +42,7 @@
 #include "log.h"
 #include "mainloop.h"
 #include "monitor.h"
+#include "trash.h"
 #include "utils.h"
 
 #define CLIENTFDS_CHUNK 64
@@ -414,6 +415,11 @@ int main(int argc, char *argv[])
 	}
 
 	NOTICE("pid:%d monitoring lxcpath %s", getpid(), mon.lxcpath);
+
+	/* finish deferred destroys which were interrupted */
+	if (lxc_trash_reap_spawn(lxcpath) < 0)
+		WARN("failed to start the trash reaper for %s", lxcpath);
+
 	for(;;) {
 		ret = lxc_mainloop(&mon.descr, 1000 * 30);
 		if (mon.clientfds_cnt <= 0)
@@ -22,6 +22,7 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -30,6 +31,7 @@
 #include <unistd.h>
 #include <sys/epoll.h>
 #include <sys/ioctl.h>
+#include <sys/param.h>
 #include <lxc/lxccontainer.h>
 
 #include "arguments.h"
@@ -58,9 +60,58 @@ struct stats {
 	uint64_t blkio;
 };
 
+/*
+ * The cgroup files lxc-top reads. Each container keeps them open across
+ * refreshes and re-reads them with pread(), so a refresh costs one syscall
+ * per file instead of a command socket round trip plus open/read/close.
+ */
+enum {
+	STAT_MEM_USED,
+	STAT_MEM_LIMIT,
+	STAT_KMEM_USED,
+	STAT_KMEM_LIMIT,
+	STAT_CPU_USAGE,
+	STAT_CPU_STAT,
+	STAT_BLKIO,
+	STAT_FILE_MAX,
+};
+
+enum {
+	STAT_SUBSYS_MEMORY,
+	STAT_SUBSYS_CPUACCT,
+	STAT_SUBSYS_BLKIO,
+	STAT_SUBSYS_MAX,
+};
+
+static const char *stat_subsys[STAT_SUBSYS_MAX] = {
+	[STAT_SUBSYS_MEMORY]  = "memory",
+	[STAT_SUBSYS_CPUACCT] = "cpuacct",
+	[STAT_SUBSYS_BLKIO]   = "blkio",
+};
+
+static const struct {
+	int subsys;
+	const char *file;
+} stat_files[STAT_FILE_MAX] = {
+	[STAT_MEM_USED]   = { STAT_SUBSYS_MEMORY,  "memory.usage_in_bytes" },
+	[STAT_MEM_LIMIT]  = { STAT_SUBSYS_MEMORY,  "memory.limit_in_bytes" },
+	[STAT_KMEM_USED]  = { STAT_SUBSYS_MEMORY,  "memory.kmem.usage_in_bytes" },
+	[STAT_KMEM_LIMIT] = { STAT_SUBSYS_MEMORY,  "memory.kmem.limit_in_bytes" },
+	[STAT_CPU_USAGE]  = { STAT_SUBSYS_CPUACCT, "cpuacct.usage" },
+	[STAT_CPU_STAT]   = { STAT_SUBSYS_CPUACCT, "cpuacct.stat" },
+	[STAT_BLKIO]      = { STAT_SUBSYS_BLKIO,   "blkio.throttle.io_service_bytes" },
+};
+
+/* host mountpoint and mount root of each hierarchy we read from */
+static char *stat_mnt[STAT_SUBSYS_MAX];
+static char *stat_mnt_root[STAT_SUBSYS_MAX];
+
 struct ct {
 	struct lxc_container *c;
 	struct stats *stats;
+	int fds[STAT_FILE_MAX];
+	bool fds_resolved;	/* fds were opened, -1 entries are unavailable */
+	bool active;
 };
 
 static int delay = 3;
@@ -69,6 +120,7 @@ static int sort_reverse = 0;
 
 static struct termios oldtios;
 static struct ct *ct = NULL;
+static int ct_cnt = 0;
 static int ct_alloc_cnt = 0;
 
 static int my_parser(struct lxc_arguments* args, int c, char* arg)
@@ -198,74 +250,248 @@ static void size_humanize(unsigned long long val, char *buf, size_t bufsz)
 	}
 }
 
-static uint64_t stat_get_int(struct lxc_container *c, const char *item)
+/*
+ * Find the mountpoints of the hierarchies holding the memory, cpuacct and
+ * blkio controllers. Containers whose cgroup files cannot be found this way
+ * are read through the (slower) get_cgroup_item API instead.
+ */
+static void stat_mnt_init(void)
+{
+	FILE *f;
+	char *line = NULL;
+	size_t len = 0;
+	int i;
+
+	f = fopen("/proc/self/mountinfo", "r");
+	if (!f)
+		return;
+
+	while (getline(&line, &len, f) != -1) {
+		char *fields[5], *p, *sep, *fstype, *opts, *tok, *saveptr = NULL;
+		int j;
+
+		p = line;
+		for (j = 0; j < 5; j++) {
+			fields[j] = p;
+			p = strchr(p, ' ');
+			if (!p)
+				break;
+			*p++ = '\0';
+		}
+		if (j < 5)
+			continue;
+
+		sep = strstr(p, " - ");
+		if (!sep)
+			continue;
+		fstype = sep + 3;
+		p = strchr(fstype, ' ');
+		if (!p)
+			continue;
+		*p++ = '\0';
+		if (strcmp(fstype, "cgroup") != 0)
+			continue;
+
+		/* skip the mount source, the rest are the superblock options */
+		opts = strchr(p, ' ');
+		if (!opts)
+			continue;
+		opts++;
+		opts[strcspn(opts, "\n")] = '\0';
+
+		for (tok = strtok_r(opts, ",", &saveptr); tok;
+		     tok = strtok_r(NULL, ",", &saveptr)) {
+			for (i = 0; i < STAT_SUBSYS_MAX; i++) {
+				if (stat_mnt[i] || strcmp(tok, stat_subsys[i]) != 0)
+					continue;
+				stat_mnt[i] = strdup(fields[4]);
+				stat_mnt_root[i] = strdup(fields[3]);
+				if (!stat_mnt[i] || !stat_mnt_root[i]) {
+					ERROR("cannot alloc mem");
+					exit(EXIT_FAILURE);
+				}
+			}
+		}
+	}
+
+	free(line);
+	fclose(f);
+}
+
+static void stat_fds_close(struct ct *ct)
+{
+	int i;
+
+	for (i = 0; i < STAT_FILE_MAX; i++) {
+		if (ct->fds[i] >= 0)
+			close(ct->fds[i]);
+		ct->fds[i] = -1;
+	}
+	ct->fds_resolved = false;
+}
+
+/*
+ * Resolve the container's cgroup paths for all subsystems in a single
+ * round trip and open the stat files. Returns false if the paths could not
+ * be resolved at all.
+ */
+static bool stat_fds_open(struct ct *ct)
+{
+	struct lxc_container *c = ct->c;
+	struct lxc_running_item items[STAT_SUBSYS_MAX];
+	char path[MAXPATHLEN];
+	int i, ret;
+
+	stat_fds_close(ct);
+
+	for (i = 0; i < STAT_SUBSYS_MAX; i++) {
+		items[i].type = LXC_ITEM_CGROUP_PATH;
+		items[i].key = stat_subsys[i];
+	}
+	if (!c->get_running_items(c, items, STAT_SUBSYS_MAX))
+		return false;
+
+	for (i = 0; i < STAT_FILE_MAX; i++) {
+		int subsys = stat_files[i].subsys;
+		const char *cgpath = items[subsys].value;
+		const char *root = stat_mnt_root[subsys];
+
+		if (items[subsys].ret < 0 || !cgpath || !stat_mnt[subsys])
+			continue;
+
+		/* containers started by the old cgfsng hand out full paths */
+		if (strncmp(cgpath, "/sys/fs/cgroup/", 15) == 0) {
+			ret = snprintf(path, sizeof(path), "%s/%s", cgpath,
+				       stat_files[i].file);
+		} else {
+			if (strcmp(root, "/") != 0 &&
+			    strncmp(cgpath, root, strlen(root)) == 0)
+				cgpath += strlen(root);
+			ret = snprintf(path, sizeof(path), "%s/%s/%s",
+				       stat_mnt[subsys], cgpath,
+				       stat_files[i].file);
+		}
+		if (ret < 0 || ret >= sizeof(path))
+			continue;
+
+		ct->fds[i] = open(path, O_RDONLY | O_CLOEXEC);
+	}
+
+	for (i = 0; i < STAT_SUBSYS_MAX; i++)
+		free(items[i].value);
+
+	ct->fds_resolved = true;
+	return true;
+}
+
+/*
+ * Read a stat file into @buf. A read failing with ENODEV means the cgroup
+ * went away, e.g. because the container was restarted, so the fds are
+ * re-resolved once.
+ *
+ * Returns the length read, -ENOENT if the file does not exist for this
+ * container, or -1 if the cgroup paths could not be resolved and the
+ * caller should fall back to get_cgroup_item.
+ */
+static int stat_read(struct ct *ct, int file, char *buf, size_t bufsz)
+{
+	ssize_t len;
+	bool retried = false;
+
+again:
+	if (!ct->fds_resolved && !stat_fds_open(ct))
+		return -1;
+	if (ct->fds[file] < 0)
+		return stat_mnt[stat_files[file].subsys] ? -ENOENT : -1;
+
+	len = pread(ct->fds[file], buf, bufsz - 1, 0);
+	if (len < 0) {
+		if (!retried) {
+			retried = true;
+			stat_fds_close(ct);
+			goto again;
+		}
+		return -1;
+	}
+
+	buf[len] = '\0';
+	return len;
+}
+
+static int stat_read_item(struct ct *ct, int file, char *buf, size_t bufsz)
 {
-	char buf[80];
 	int len;
-	uint64_t val;
 
-	len = c->get_cgroup_item(c, item, buf, sizeof(buf));
+	len = stat_read(ct, file, buf, bufsz);
+	if (len >= 0)
+		return len;
+	if (len == -ENOENT)
+		return -1;
+
+	len = ct->c->get_cgroup_item(ct->c, stat_files[file].file, buf, bufsz);
 	if (len <= 0) {
-		ERROR("unable to read cgroup item %s", item);
-		return 0;
+		ERROR("unable to read cgroup item %s", stat_files[file].file);
+		return -1;
 	}
 
-	val = strtoull(buf, NULL, 0);
-	return val;
+	return len;
+}
+
+/*
+ * Allocation-free parsers for the contents of a stat file.
+ */
+static uint64_t stat_get_int(struct ct *ct, int file)
+{
+	char buf[80];
+
+	if (stat_read_item(ct, file, buf, sizeof(buf)) < 0)
+		return 0;
+
+	return strtoull(buf, NULL, 0);
 }
 
-static uint64_t stat_match_get_int(struct lxc_container *c, const char *item,
+static uint64_t stat_match_get_int(struct ct *ct, int file,
 				   const char *match, int column)
 {
 	char buf[4096];
-	int i,j,len;
-	uint64_t val = 0;
-	char **lines, **cols;
+	const char *line, *p;
 	size_t matchlen;
+	int j;
 
-	len = c->get_cgroup_item(c, item, buf, sizeof(buf));
-	if (len <= 0) {
-		ERROR("unable to read cgroup item %s", item);
-		goto out;
-	}
-
-	lines = lxc_string_split_and_trim(buf, '\n');
-	if (!lines)
-		goto out;
+	if (stat_read_item(ct, file, buf, sizeof(buf)) < 0)
+		return 0;
 
 	matchlen = strlen(match);
-	for (i = 0; lines[i]; i++) {
-		if (strncmp(lines[i], match, matchlen) == 0) {
-			cols = lxc_string_split_and_trim(lines[i], ' ');
-			if (!cols)
-				goto err1;
-			for (j = 0; cols[j]; j++) {
-				if (j == column) {
-					val = strtoull(cols[j], NULL, 0);
-					break;
-				}
-			}
-			lxc_free_array((void **)cols, free);
-			break;
+	for (line = buf; *line; line = p) {
+		p = strchr(line, '\n');
+		p = p ? p + 1 : line + strlen(line);
+
+		line += strspn(line, " \t");
+		if (strncmp(line, match, matchlen) != 0)
+			continue;
+
+		for (j = 0; j < column; j++) {
+			line += strcspn(line, " \t\n");
+			if (*line == '\n' || *line == '\0')
+				return 0;
+			line += strspn(line, " \t");
 		}
+		return strtoull(line, NULL, 0);
 	}
-err1:
-	lxc_free_array((void **)lines, free);
-out:
-	return val;
+
+	return 0;
 }
 
-static void stats_get(struct lxc_container *c, struct ct *ct, struct stats *total)
+static void stats_get(struct ct *ct, struct stats *total)
 {
-	ct->c = c;
-	ct->stats->mem_used      = stat_get_int(c, "memory.usage_in_bytes");
-	ct->stats->mem_limit     = stat_get_int(c, "memory.limit_in_bytes");
-	ct->stats->kmem_used     = stat_get_int(c, "memory.kmem.usage_in_bytes");
-	ct->stats->kmem_limit    = stat_get_int(c, "memory.kmem.limit_in_bytes");
-	ct->stats->cpu_use_nanos = stat_get_int(c, "cpuacct.usage");
-	ct->stats->cpu_use_user  = stat_match_get_int(c, "cpuacct.stat", "user", 1);
-	ct->stats->cpu_use_sys   = stat_match_get_int(c, "cpuacct.stat", "system", 1);
-	ct->stats->blkio         = stat_match_get_int(c, "blkio.throttle.io_service_bytes", "Total", 1);
+	ct->stats->mem_used      = stat_get_int(ct, STAT_MEM_USED);
+	ct->stats->mem_limit     = stat_get_int(ct, STAT_MEM_LIMIT);
+	ct->stats->kmem_used     = stat_get_int(ct, STAT_KMEM_USED);
+	ct->stats->kmem_limit    = stat_get_int(ct, STAT_KMEM_LIMIT);
+	ct->stats->cpu_use_nanos = stat_get_int(ct, STAT_CPU_USAGE);
+	ct->stats->cpu_use_user  = stat_match_get_int(ct, STAT_CPU_STAT, "user", 1);
+	ct->stats->cpu_use_sys   = stat_match_get_int(ct, STAT_CPU_STAT, "system", 1);
+	ct->stats->blkio         = stat_match_get_int(ct, STAT_BLKIO, "Total", 1);
 
 	if (total) {
 		total->mem_used      = total->mem_used      + ct->stats->mem_used;
@@ -382,39 +608,62 @@ static void ct_sort(int active)
 	qsort(ct, active, sizeof(*ct), (int (*)(const void *,const void *))cmp_func);
 }
 
-static void ct_free(void)
+/*
+ * Sync the container table with the currently active containers. Entries
+ * of containers which are still running are kept, together with their open
+ * stat files, so only newly started containers need to be loaded.
+ */
+static void ct_update(const char *lxcpath, char **names, int active_cnt)
 {
-	int i;
+	int i, j;
 
-	for (i = 0; i < ct_alloc_cnt; i++) {
-		if (ct[i].c) {
-			lxc_container_put(ct[i].c);
-			ct[i].c = NULL;
+	for (j = 0; j < ct_cnt; j++)
+		ct[j].active = false;
+
+	for (i = 0; i < active_cnt; i++) {
+		for (j = 0; j < ct_cnt; j++) {
+			if (!ct[j].active && strcmp(ct[j].c->name, names[i]) == 0)
+				break;
+		}
+		if (j < ct_cnt) {
+			ct[j].active = true;
+			continue;
 		}
-		free(ct[i].stats);
-		ct[i].stats = NULL;
-	}
-}
 
-static void ct_realloc(int active_cnt)
-{
-	int i;
+		if (ct_cnt == ct_alloc_cnt) {
+			ct_alloc_cnt = ct_alloc_cnt ? ct_alloc_cnt * 2 : 16;
+			ct = realloc(ct, sizeof(*ct) * ct_alloc_cnt);
+			if (!ct) {
+				ERROR("cannot alloc mem");
+				exit(EXIT_FAILURE);
+			}
+		}
 
-	if (active_cnt > ct_alloc_cnt) {
-		ct_free();
-		ct = realloc(ct, sizeof(*ct) * active_cnt);
-		if (!ct) {
+		memset(&ct[ct_cnt], 0, sizeof(ct[ct_cnt]));
+		ct[ct_cnt].c = lxc_container_new(names[i], lxcpath);
+		if (!ct[ct_cnt].c)
+			continue;
+		ct[ct_cnt].stats = malloc(sizeof(*ct[0].stats));
+		if (!ct[ct_cnt].stats) {
 			ERROR("cannot alloc mem");
 			exit(EXIT_FAILURE);
 		}
-		for (i = 0; i < active_cnt; i++) {
-			ct[i].stats = malloc(sizeof(*ct[0].stats));
-			if (!ct[i].stats) {
-				ERROR("cannot alloc mem");
-				exit(EXIT_FAILURE);
-			}
+		for (j = 0; j < STAT_FILE_MAX; j++)
+			ct[ct_cnt].fds[j] = -1;
+		ct[ct_cnt].active = true;
+		ct_cnt++;
+	}
+
+	/* drop containers which have stopped */
+	for (j = 0; j < ct_cnt;) {
+		if (ct[j].active) {
+			j++;
+			continue;
 		}
-		ct_alloc_cnt = active_cnt;
+		stat_fds_close(&ct[j]);
+		lxc_container_put(ct[j].c);
+		free(ct[j].stats);
+		ct[j] = ct[--ct_cnt];
 	}
 }
 
@@ -429,6 +678,7 @@ int main(int argc, char *argv[])
 		goto out;
 
 	ct_print_cnt = stdin_tios_rows() - 3; /* 3 -> header and total */
+	stat_mnt_init();
 	if (stdin_tios_setup() < 0) {
 		ERROR("failed to setup terminal");
 		goto out;
@@ -452,17 +702,23 @@ int main(int argc, char *argv[])
 	}
 
 	for(;;) {
-		struct lxc_container **active;
+		char **active = NULL;
 		int i, active_cnt;
 		struct stats total;
 		char total_name[30];
 
-		active_cnt = list_active_containers(my_args.lxcpath[0], NULL, &active);
-		ct_realloc(active_cnt);
+		active_cnt = list_active_containers(my_args.lxcpath[0], &active, NULL);
+		if (active_cnt < 0)
+			active_cnt = 0;
+		ct_update(my_args.lxcpath[0], active, active_cnt);
+		for (i = 0; i < active_cnt; i++)
+			free(active[i]);
+		free(active);
+		active_cnt = ct_cnt;
 
 		memset(&total, 0, sizeof(total));
 		for (i = 0; i < active_cnt; i++)
-			stats_get(active[i], &ct[i], &total);
+			stats_get(&ct[i], &total);
 
 		ct_sort(active_cnt);
 
@@ -476,11 +732,6 @@ int main(int argc, char *argv[])
 		stats_print(total_name, &total, &total);
 		fflush(stdout);
 
-		for (i = 0; i < active_cnt; i++) {
-			lxc_container_put(ct[i].c);
-			ct[i].c = NULL;
-		}
-
 		in_char = '\0';
 		ret = lxc_mainloop(&descr, 1000 * delay);
 		if (ret != 0 || in_char == 'q')
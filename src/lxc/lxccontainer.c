@@ -20,6 +20,7 @@
 
 #define _GNU_SOURCE
 #include <assert.h>
+#include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -32,8 +33,10 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <linux/netlink.h>
 #include <sys/mman.h>
 #include <sys/mount.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -56,8 +59,11 @@
 #include "monitor.h"
 #include "namespace.h"
 #include "network.h"
+#include "nl.h"
+#include "start.h"
 #include "sync.h"
 #include "state.h"
+#include "trash.h"
 #include "utils.h"
 #include "version.h"
 
@@ -96,7 +102,7 @@ static bool do_lxcapi_destroy(struct lxc_container *c);
 static const char *lxcapi_get_config_path(struct lxc_container *c);
 #define do_lxcapi_get_config_path(c) lxcapi_get_config_path(c)
 static bool do_lxcapi_set_config_item(struct lxc_container *c, const char *key, const char *v);
-static bool container_destroy(struct lxc_container *c);
+static bool container_destroy(struct lxc_container *c, const char *trash);
 static bool get_snappath_dir(struct lxc_container *c, char *snappath);
 static bool lxcapi_snapshot_destroy_all(struct lxc_container *c);
 static bool do_lxcapi_save_config(struct lxc_container *c, const char *alt_file);
@@ -253,6 +259,12 @@ static void lxc_container_free(struct lxc_container *c)
 	}
 	free(c->config_path);
 	c->config_path = NULL;
+	if (c->netns_fd >= 0) {
+		close(c->netns_fd);
+		c->netns_fd = -1;
+	}
+	lxc_cgroup_handle_free(c->cgroup_handle);
+	c->cgroup_handle = NULL;
 
 	free(c);
 }
@@ -268,13 +280,13 @@ lxc_container_put()           |   lxc_container_get()
 \ lxc_container_free()        |   \ lxclock() returns
                               |   \ c->numthreads < 1 -> return 0
 \ \ (free stuff)              |
-\ \ sem_destroy(privlock)     |
+\ \ lxc_putlock(privlock)     |
 
  * When the get()er checks numthreads the first time, one of the following
  * is true:
  * 1. freer has set numthreads = 0.  get() returns 0
  * 2. freer is between lxclock and setting numthreads to 0.  get()er will
- *    sem_wait on privlock, get lxclock after freer() drops it, then see
+ *    wait on privlock, get lxclock after freer() drops it, then see
  *    numthreads is 0 and exit without touching lxclock again..
  * 3. freer has not yet locked privlock.  If get()er runs first, then put()er
  *    will see --numthreads = 1 and not call lxc_container_free().
@@ -326,7 +338,7 @@ static bool do_lxcapi_is_defined(struct lxc_container *c)
 	if (!c)
 		return false;
 
-	if (container_mem_lock(c))
+	if (container_mem_lock_shared(c))
 		return false;
 	if (!c->configfile)
 		goto out;
@@ -511,15 +523,63 @@ static pid_t do_lxcapi_init_pid(struct lxc_container *c)
 
 WRAP_API(pid_t, lxcapi_init_pid)
 
+/* $rundir/lxc/$lxcpath/config-cache/$name */
+static char *config_cache_path(const char *lxcpath, const char *name)
+{
+	char *rundir, *path;
+	size_t len;
+	int ret;
+
+	rundir = get_rundir();
+	if (!rundir)
+		return NULL;
+
+	len = strlen(rundir) + strlen(lxcpath) + strlen(name) + 20;
+	path = malloc(len);
+	if (path) {
+		ret = snprintf(path, len, "%s/lxc/%s/config-cache/%s", rundir,
+			       lxcpath, name);
+		if (ret < 0 || (size_t)ret >= len) {
+			free(path);
+			path = NULL;
+		}
+	}
+
+	free(rundir);
+	return path;
+}
+
+/* Drop the compiled config of container @name, if there is one. */
+static void config_cache_remove(const char *lxcpath, const char *name)
+{
+	char *cachefile;
+
+	cachefile = config_cache_path(lxcpath, name);
+	if (!cachefile)
+		return;
+
+	if (unlink(cachefile) < 0 && errno != ENOENT)
+		WARN("failed to remove config cache %s", cachefile);
+	free(cachefile);
+}
+
 static bool load_config_locked(struct lxc_container *c, const char *fname)
 {
+	char *cachefile = NULL;
+	int ret;
+
 	if (!c->lxc_conf)
 		c->lxc_conf = lxc_conf_init();
 	if (!c->lxc_conf)
 		return false;
-	if (lxc_config_read(fname, c->lxc_conf, false) != 0)
-		return false;
-	return true;
+
+	/* Only the container's own config is cached. */
+	if (c->configfile && strcmp(fname, c->configfile) == 0)
+		cachefile = config_cache_path(c->config_path, c->name);
+
+	ret = lxc_config_read_cached(fname, cachefile, c->lxc_conf);
+	free(cachefile);
+	return ret == 0;
 }
 
 static bool do_lxcapi_load_config(struct lxc_container *c, const char *alt_file)
@@ -538,17 +598,19 @@ static bool do_lxcapi_load_config(struct lxc_container *c, const char *alt_file)
 	/*
 	 * If we're reading something other than the container's config,
 	 * we only need to lock the in-memory container.  If loading the
-	 * container's config file, take the disk lock.
+	 * container's config file, also take the disk lock, shared since we
+	 * only read it.
 	 */
 	if (strcmp(fname, c->configfile) == 0)
 		need_disklock = true;
 
-	if (need_disklock)
-		lret = container_disk_lock(c);
-	else
-		lret = container_mem_lock(c);
+	lret = container_mem_lock(c);
 	if (lret)
 		return false;
+	if (need_disklock && lxclock_shared(c->slock, 0)) {
+		container_mem_unlock(c);
+		return false;
+	}
 
 	ret = load_config_locked(c, fname);
 
@@ -591,6 +653,21 @@ static bool do_lxcapi_want_close_all_fds(struct lxc_container *c, bool state)
 
 WRAP_API_1(bool, lxcapi_want_close_all_fds, bool)
 
+static bool do_lxcapi_want_warm(struct lxc_container *c, bool state)
+{
+	if (!c || !c->lxc_conf)
+		return false;
+	if (container_mem_lock(c)) {
+		ERROR("Error getting mem lock");
+		return false;
+	}
+	c->lxc_conf->warm = state;
+	container_mem_unlock(c);
+	return true;
+}
+
+WRAP_API_1(bool, lxcapi_want_warm, bool)
+
 static bool do_lxcapi_wait(struct lxc_container *c, const char *state, int timeout)
 {
 	int ret;
@@ -747,7 +824,7 @@ static bool do_lxcapi_start(struct lxc_container *c, int useinit, char * const a
 	if (useinit && !argv)
 		return false;
 
-	if (container_mem_lock(c))
+	if (container_mem_lock_shared(c))
 		return false;
 	conf = c->lxc_conf;
 	daemonize = c->daemonize;
@@ -1551,7 +1628,7 @@ out_unlock:
 		remove_partial(c, partial_fd);
 out:
 	if (!ret)
-		container_destroy(c);
+		container_destroy(c, NULL);
 free_tpath:
 	free(tpath);
 	return ret;
@@ -1758,7 +1835,266 @@ static bool remove_from_array(char ***names, char *cname, int size)
 	return false;
 }
 
-static char ** do_lxcapi_get_interfaces(struct lxc_container *c)
+/*
+ * Return a duplicate of the cached fd of the container's network namespace,
+ * reopening it if the container was restarted since it was cached.
+ */
+static int container_netns_fd(struct lxc_container *c)
+{
+	char path[MAXPATHLEN];
+	struct stat cur, cached;
+	pid_t pid;
+	int fd, ret;
+
+	pid = do_lxcapi_init_pid(c);
+	if (pid <= 0)
+		return -1;
+
+	ret = snprintf(path, MAXPATHLEN, "/proc/%d/ns/net", pid);
+	if (ret < 0 || ret >= MAXPATHLEN)
+		return -1;
+
+	if (stat(path, &cur) < 0)
+		return -1;
+
+	/* the common case: the cached fd is still current */
+	if (container_mem_lock_shared(c))
+		return -1;
+	fd = -1;
+	if (c->netns_fd >= 0 && fstat(c->netns_fd, &cached) == 0 &&
+	    cached.st_dev == cur.st_dev && cached.st_ino == cur.st_ino)
+		fd = fcntl(c->netns_fd, F_DUPFD_CLOEXEC, 0);
+	container_mem_unlock(c);
+	if (fd >= 0)
+		return fd;
+
+	if (container_mem_lock(c))
+		return -1;
+
+	if (c->netns_fd >= 0 && (fstat(c->netns_fd, &cached) < 0 ||
+				 cached.st_dev != cur.st_dev ||
+				 cached.st_ino != cur.st_ino)) {
+		close(c->netns_fd);
+		c->netns_fd = -1;
+	}
+
+	if (c->netns_fd < 0) {
+		c->netns_fd = open(path, O_RDONLY | O_CLOEXEC);
+		/* init may have died and its pid been reused meanwhile */
+		if (c->netns_fd >= 0 && (fstat(c->netns_fd, &cached) < 0 ||
+					 cached.st_dev != cur.st_dev ||
+					 cached.st_ino != cur.st_ino)) {
+			close(c->netns_fd);
+			c->netns_fd = -1;
+		}
+	}
+
+	fd = -1;
+	if (c->netns_fd >= 0)
+		fd = fcntl(c->netns_fd, F_DUPFD_CLOEXEC, 0);
+	container_mem_unlock(c);
+
+	return fd;
+}
+
+struct netns_link {
+	int ifindex;
+	char name[IFNAMSIZ];
+};
+
+struct netns_links {
+	struct netns_link *links;
+	int count;
+};
+
+static int netns_link_cb(int ifindex, const char *ifname, void *data)
+{
+	struct netns_links *l = data;
+	struct netns_link *tmp;
+
+	tmp = realloc(l->links, (l->count + 1) * sizeof(*tmp));
+	if (!tmp)
+		return -ENOMEM;
+	l->links = tmp;
+
+	tmp[l->count].ifindex = ifindex;
+	snprintf(tmp[l->count].name, IFNAMSIZ, "%s", ifname);
+	l->count++;
+
+	return 0;
+}
+
+static const char *netns_link_name(struct netns_links *l, int ifindex)
+{
+	int i;
+
+	for (i = 0; i < l->count; i++)
+		if (l->links[i].ifindex == ifindex)
+			return l->links[i].name;
+
+	return NULL;
+}
+
+/*
+ * Open a rtnetlink socket inside the container's network namespace and dump
+ * its links.  Callers which would have to attach to the container's user
+ * namespace first can't do this from a thread, they have to fork.
+ */
+static bool netns_rtnl_open(struct lxc_container *c, struct nl_handler *nlh,
+			    struct netns_links *links)
+{
+	int fd, ret;
+
+	if (geteuid() != 0)
+		return false;
+
+	fd = container_netns_fd(c);
+	if (fd < 0)
+		return false;
+
+	ret = lxc_netns_rtnl_open(fd, nlh);
+	close(fd);
+	if (ret < 0) {
+		DEBUG("failed to open netlink socket in %s's network namespace", c->name);
+		return false;
+	}
+
+	links->links = NULL;
+	links->count = 0;
+	ret = lxc_netdev_list(nlh, netns_link_cb, links);
+	if (ret < 0) {
+		DEBUG("failed to list network devices of %s", c->name);
+		free(links->links);
+		netlink_close(nlh);
+		return false;
+	}
+
+	return true;
+}
+
+static void free_array(char **array, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		free(array[i]);
+	free(array);
+}
+
+static bool get_interfaces_netlink(struct lxc_container *c, char ***interfaces)
+{
+	struct nl_handler nlh;
+	struct netns_links links;
+	char **names = NULL;
+	int i, count = 0;
+
+	if (!netns_rtnl_open(c, &nlh, &links))
+		return false;
+	netlink_close(&nlh);
+
+	for (i = 0; i < links.count; i++) {
+		if (array_contains(&names, links.links[i].name, count))
+			continue;
+
+		if (!add_to_array(&names, links.links[i].name, count)) {
+			free_array(names, count);
+			free(links.links);
+			return false;
+		}
+		count++;
+	}
+	free(links.links);
+
+	/* Append NULL to the array */
+	if (names)
+		names = (char **)lxc_append_null_to_array((void **)names, count);
+
+	*interfaces = names;
+	return true;
+}
+
+struct netns_ips {
+	struct netns_links *links;
+	const char *interface;
+	const char *family;
+	int scope;
+	char **addresses;
+	int count;
+};
+
+static int netns_ip_cb(int ifindex, int family, const void *addr, void *data)
+{
+	struct netns_ips *ips = data;
+	char buf[INET6_ADDRSTRLEN];
+	const char *ifname;
+	int scope_id = 0;
+
+	if (family == AF_INET) {
+		if (ips->family && strcmp(ips->family, "inet"))
+			return 0;
+	} else {
+		if (ips->family && strcmp(ips->family, "inet6"))
+			return 0;
+
+		/* same scope id as getifaddrs() reports */
+		if (IN6_IS_ADDR_LINKLOCAL(addr) || IN6_IS_ADDR_MC_LINKLOCAL(addr))
+			scope_id = ifindex;
+		if (scope_id != ips->scope)
+			return 0;
+	}
+
+	ifname = netns_link_name(ips->links, ifindex);
+	if (!ifname)
+		return 0;
+
+	if (ips->interface && strcmp(ips->interface, ifname))
+		return 0;
+	else if (!ips->interface && strcmp("lo", ifname) == 0)
+		return 0;
+
+	if (!inet_ntop(family, addr, buf, sizeof(buf)))
+		return 0;
+
+	if (!add_to_array(&ips->addresses, buf, ips->count))
+		return -ENOMEM;
+	ips->count++;
+
+	return 0;
+}
+
+static bool get_ips_netlink(struct lxc_container *c, const char *interface,
+			    const char *family, int scope, char ***addresses)
+{
+	struct nl_handler nlh;
+	struct netns_links links;
+	struct netns_ips ips = {
+		.links = &links,
+		.interface = interface,
+		.family = family,
+		.scope = scope,
+	};
+	int ret;
+
+	if (!netns_rtnl_open(c, &nlh, &links))
+		return false;
+
+	ret = lxc_ipaddr_list(&nlh, AF_UNSPEC, netns_ip_cb, &ips);
+	netlink_close(&nlh);
+	free(links.links);
+	if (ret < 0) {
+		free_array(ips.addresses, ips.count);
+		return false;
+	}
+
+	/* Append NULL to the array */
+	if (ips.addresses)
+		ips.addresses = (char **)lxc_append_null_to_array((void **)ips.addresses, ips.count);
+
+	*addresses = ips.addresses;
+	return true;
+}
+
+static char **get_interfaces_fork(struct lxc_container *c)
 {
 	pid_t pid;
 	int i, count = 0, pipefd[2];
@@ -1845,9 +2181,19 @@ static char ** do_lxcapi_get_interfaces(struct lxc_container *c)
 	return interfaces;
 }
 
+static char **do_lxcapi_get_interfaces(struct lxc_container *c)
+{
+	char **interfaces;
+
+	if (get_interfaces_netlink(c, &interfaces))
+		return interfaces;
+
+	return get_interfaces_fork(c);
+}
+
 WRAP_API(char **, lxcapi_get_interfaces)
 
-static char** do_lxcapi_get_ips(struct lxc_container *c, const char* interface, const char* family, int scope)
+static char **get_ips_fork(struct lxc_container *c, const char *interface, const char *family, int scope)
 {
 	pid_t pid;
 	int i, count = 0, pipefd[2];
@@ -1964,6 +2310,16 @@ static char** do_lxcapi_get_ips(struct lxc_container *c, const char* interface,
 	return addresses;
 }
 
+static char **do_lxcapi_get_ips(struct lxc_container *c, const char *interface, const char *family, int scope)
+{
+	char **addresses;
+
+	if (get_ips_netlink(c, interface, family, scope, &addresses))
+		return addresses;
+
+	return get_ips_fork(c, interface, family, scope);
+}
+
 WRAP_API_3(char **, lxcapi_get_ips, const char *, const char *, int)
 
 static int do_lxcapi_get_config_item(struct lxc_container *c, const char *key, char *retv, int inlen)
@@ -1972,7 +2328,7 @@ static int do_lxcapi_get_config_item(struct lxc_container *c, const char *key, c
 
 	if (!c || !c->lxc_conf)
 		return -1;
-	if (container_mem_lock(c))
+	if (container_mem_lock_shared(c))
 		return -1;
 	ret = lxc_get_config_item(c->lxc_conf, key, retv, inlen);
 	container_mem_unlock(c);
@@ -1987,7 +2343,7 @@ static char* do_lxcapi_get_running_config_item(struct lxc_container *c, const ch
 
 	if (!c || !c->lxc_conf)
 		return NULL;
-	if (container_mem_lock(c))
+	if (container_mem_lock_shared(c))
 		return NULL;
 	ret = lxc_cmd_get_config_item(c->name, key, do_lxcapi_get_config_path(c));
 	container_mem_unlock(c);
@@ -1996,6 +2352,164 @@ static char* do_lxcapi_get_running_config_item(struct lxc_container *c, const ch
 
 WRAP_API_1(char *, lxcapi_get_running_config_item, const char *)
 
+static bool do_lxcapi_console_log(struct lxc_container *c, bool clear,
+				  char **data, size_t *len)
+{
+	int ret;
+
+	if (!c || !data || !len)
+		return false;
+
+	ret = lxc_cmd_console_log(c->name, c->config_path, clear, data, len);
+	if (ret == -ENODATA)
+		INFO("%s keeps no console buffer, see lxc.console.buffer.size", c->name);
+
+	return ret == 0;
+}
+
+WRAP_API_3(bool, lxcapi_console_log, bool, char **, size_t *)
+
+/*
+ * Pack claim @items into @buf as lxc_cmd_claim() expects them. Returns the
+ * length of the message or 0 if it does not fit.
+ */
+static size_t claim_pack(const char * const items[], char buf[LXC_CLAIM_MAX])
+{
+	size_t len = 0, n;
+	int i;
+
+	/* an empty claim still has to be a non-empty message */
+	buf[len++] = '\0';
+	for (i = 0; items[i]; i++) {
+		n = strlen(items[i]) + 1;
+		if (len + n > LXC_CLAIM_MAX)
+			return 0;
+		memcpy(buf + len, items[i], n);
+		len += n;
+	}
+
+	return len;
+}
+
+static bool do_lxcapi_claim(struct lxc_container *c, const char * const items[])
+{
+	char buf[LXC_CLAIM_MAX];
+	size_t len;
+	int ret;
+
+	if (!c || !items)
+		return false;
+
+	len = claim_pack(items, buf);
+	if (!len) {
+		ERROR("claim of %s too long", c->name);
+		return false;
+	}
+
+	ret = lxc_cmd_claim(c->name, c->config_path, buf, len);
+	if (ret == -EBUSY)
+		INFO("%s has been claimed already", c->name);
+	else if (ret < 0)
+		ERROR("failed to claim %s: %s", c->name, strerror(-ret));
+
+	return ret == 0;
+}
+
+WRAP_API_1(bool, lxcapi_claim, const char * const *)
+
+static bool do_lxcapi_get_running_items(struct lxc_container *c,
+					struct lxc_running_item *items,
+					int nitems)
+{
+	struct lxc_cmd_multi_item *cmds;
+	int i, ret;
+
+	if (!c || !items || nitems <= 0)
+		return false;
+
+	cmds = malloc(nitems * sizeof(*cmds));
+	if (!cmds)
+		return false;
+
+	for (i = 0; i < nitems; i++) {
+		items[i].ret = -EINVAL;
+		items[i].value = NULL;
+		cmds[i].arg = items[i].key;
+		switch (items[i].type) {
+		case LXC_ITEM_STATE:
+			cmds[i].cmd = LXC_CMD_GET_STATE;
+			break;
+		case LXC_ITEM_INIT_PID:
+			cmds[i].cmd = LXC_CMD_GET_INIT_PID;
+			break;
+		case LXC_ITEM_CLONE_FLAGS:
+			cmds[i].cmd = LXC_CMD_GET_CLONE_FLAGS;
+			break;
+		case LXC_ITEM_CGROUP_PATH:
+			cmds[i].cmd = LXC_CMD_GET_CGROUP;
+			break;
+		case LXC_ITEM_CONFIG_ITEM:
+			cmds[i].cmd = LXC_CMD_GET_CONFIG_ITEM;
+			break;
+		default:
+			ERROR("Unknown item type %d", items[i].type);
+			free(cmds);
+			return false;
+		}
+		if ((cmds[i].cmd == LXC_CMD_GET_CGROUP ||
+		     cmds[i].cmd == LXC_CMD_GET_CONFIG_ITEM) && !items[i].key) {
+			ERROR("Item type %d requires a key", items[i].type);
+			free(cmds);
+			return false;
+		}
+	}
+
+	ret = lxc_cmd_get_multi(c->name, c->config_path, cmds, nitems);
+	if (ret < 0) {
+		free(cmds);
+		return false;
+	}
+
+	for (i = 0; i < nitems; i++) {
+		struct lxc_cmd_rsp *rsp = &cmds[i].rsp;
+
+		items[i].ret = rsp->ret;
+		if (rsp->ret < 0) {
+			if (rsp->datalen > 0)
+				free(rsp->data);
+			continue;
+		}
+
+		switch (cmds[i].cmd) {
+		case LXC_CMD_GET_STATE:
+			items[i].value = strdup(lxc_state2str(PTR_TO_INT(rsp->data)));
+			break;
+		case LXC_CMD_GET_INIT_PID:
+		case LXC_CMD_GET_CLONE_FLAGS:
+			if (asprintf(&items[i].value, "%d", PTR_TO_INT(rsp->data)) < 0)
+				items[i].value = NULL;
+			break;
+		default:
+			/* an empty value is answered without data */
+			if (rsp->datalen > 0) {
+				items[i].value = rsp->data;
+				rsp->data = NULL;
+			} else {
+				items[i].value = strdup("");
+			}
+			break;
+		}
+		/* only allocating the value can have failed here */
+		if (!items[i].value)
+			items[i].ret = -ENOMEM;
+	}
+
+	free(cmds);
+	return true;
+}
+
+WRAP_API_2(bool, lxcapi_get_running_items, struct lxc_running_item *, int)
+
 static int do_lxcapi_get_keys(struct lxc_container *c, const char *key, char *retv, int inlen)
 {
 	if (!key)
@@ -2007,7 +2521,7 @@ static int do_lxcapi_get_keys(struct lxc_container *c, const char *key, char *re
 	 */
 	if (!c || !c->lxc_conf)
 		return -1;
-	if (container_mem_lock(c))
+	if (container_mem_lock_shared(c))
 		return -1;
 	int ret = -1;
 	if (strncmp(key, "lxc.network.", 12) == 0)
@@ -2310,15 +2824,57 @@ static bool do_destroy_container(struct lxc_conf *conf) {
 	return bdev_destroy(conf);
 }
 
-static int lxc_rmdir_onedev_wrapper(void *data)
-{
-	char *arg = (char *) data;
-	return lxc_rmdir_onedev(arg, "snaps");
+static int lxc_rmdir_onedev_wrapper(void *data)
+{
+	char *arg = (char *) data;
+	return lxc_rmdir_onedev(arg, "snaps");
+}
+
+/*
+ * Storage which lives entirely inside the container directory can go to
+ * the trash along with it instead of being destroyed up front.
+ */
+static bool rootfs_in_container_dir(struct lxc_container *c)
+{
+	struct lxc_conf *conf = c->lxc_conf;
+	struct bdev *bdev;
+	const char *p;
+	char *dir;
+	size_t len;
+	bool bret = false;
+
+	if (!conf || !conf->rootfs.path || !conf->rootfs.mount)
+		return true;
+
+	bdev = bdev_init(conf, conf->rootfs.path, conf->rootfs.mount, NULL);
+	if (!bdev)
+		return false;
+
+	if (strcmp(bdev->type, "dir") && strcmp(bdev->type, "overlayfs") &&
+	    strcmp(bdev->type, "aufs") && strcmp(bdev->type, "loop"))
+		goto out;
+
+	/* for overlayfs and aufs the upper directory is the last element */
+	p = strrchr(bdev->src, ':');
+	p = p ? p + 1 : bdev->src;
+
+	len = strlen(c->config_path) + strlen(c->name) + 3;
+	dir = alloca(len);
+	snprintf(dir, len, "%s/%s/", c->config_path, c->name);
+	bret = strncmp(p, dir, len - 1) == 0;
+
+out:
+	bdev_put(bdev);
+	return bret;
 }
 
-static bool container_destroy(struct lxc_container *c)
+/*
+ * If @trash is set, the container directory is moved into the trash of
+ * that lxcpath rather than removed, see trash.h.
+ */
+static bool container_destroy(struct lxc_container *c, const char *trash)
 {
-	bool bret = false;
+	bool bret = false, deferred = false;
 	int ret = 0;
 	struct lxc_conf *conf;
 
@@ -2366,12 +2922,20 @@ static bool container_destroy(struct lxc_container *c)
 	if (current_config && conf == current_config) {
 		current_config = NULL;
 		if (conf->logfd != -1) {
+			lxc_log_flush();
 			close(conf->logfd);
 			conf->logfd = -1;
 		}
 	}
 
-	if (conf && conf->rootfs.path && conf->rootfs.mount) {
+	/* The reaper could not remove files owned by mapped ids. */
+	if (trash && am_unpriv())
+		trash = NULL;
+
+	if (trash)
+		deferred = rootfs_in_container_dir(c);
+
+	if (conf && conf->rootfs.path && conf->rootfs.mount && !deferred) {
 		if (!do_destroy_container(conf)) {
 			ERROR("Error destroying rootfs for %s", c->name);
 			goto out;
@@ -2384,6 +2948,22 @@ static bool container_destroy(struct lxc_container *c)
 	const char *p1 = do_lxcapi_get_config_path(c);
 	char *path = alloca(strlen(p1) + strlen(c->name) + 2);
 	sprintf(path, "%s/%s", p1, c->name);
+	if (trash) {
+		ret = lxc_trash_move(trash, path);
+		if (ret == 0) {
+			INFO("Moved directory for %s to the trash", c->name);
+			config_cache_remove(c->config_path, c->name);
+			bret = true;
+			goto out;
+		}
+
+		WARN("Could not move %s to the trash, removing it now", path);
+		if (deferred && !do_destroy_container(conf)) {
+			ERROR("Error destroying rootfs for %s", c->name);
+			goto out;
+		}
+	}
+
 	if (am_unpriv())
 		ret = userns_exec_1(conf, lxc_rmdir_onedev_wrapper, path);
 	else
@@ -2393,6 +2973,7 @@ static bool container_destroy(struct lxc_container *c)
 		goto out;
 	}
 	INFO("Destroyed directory for %s", c->name);
+	config_cache_remove(c->config_path, c->name);
 
 	bret = true;
 
@@ -2401,7 +2982,7 @@ out:
 	return bret;
 }
 
-static bool do_lxcapi_destroy(struct lxc_container *c)
+static bool do_container_destroy(struct lxc_container *c, const char *trash)
 {
 	if (!c || !lxcapi_is_defined(c))
 		return false;
@@ -2415,7 +2996,12 @@ static bool do_lxcapi_destroy(struct lxc_container *c)
 		return false;
 	}
 
-	return container_destroy(c);
+	return container_destroy(c, trash);
+}
+
+static bool do_lxcapi_destroy(struct lxc_container *c)
+{
+	return do_container_destroy(c, NULL);
 }
 
 WRAP_API(bool, lxcapi_destroy)
@@ -2554,13 +3140,55 @@ err:
 
 WRAP_API_1(bool, lxcapi_set_config_path, const char *)
 
+static bool do_lxcapi_want_cgroup_cache(struct lxc_container *c, bool state)
+{
+	if (!c)
+		return false;
+	if (container_mem_lock(c)) {
+		ERROR("Error getting mem lock");
+		return false;
+	}
+	if (state && !c->cgroup_handle)
+		c->cgroup_handle = lxc_cgroup_handle_new(c->name, c->config_path);
+	else if (!state) {
+		lxc_cgroup_handle_free(c->cgroup_handle);
+		c->cgroup_handle = NULL;
+	}
+	container_mem_unlock(c);
+	return !state || c->cgroup_handle;
+}
+
+WRAP_API_1(bool, lxcapi_want_cgroup_cache, bool)
+
 static bool do_lxcapi_set_cgroup_item(struct lxc_container *c, const char *subsys, const char *value)
 {
+	bool stale;
 	int ret;
 
 	if (!c)
 		return false;
 
+	/* the handle finds out by itself whether the container is running,
+	 * it is only modified to look paths up again */
+	if (container_mem_lock_shared(c))
+		return false;
+	if (c->cgroup_handle) {
+		ret = lxc_cgroup_handle_set(c->cgroup_handle, subsys, value, false);
+		stale = ret < 0 && errno == ESTALE;
+		container_mem_unlock(c);
+		if (!stale)
+			return ret == 0;
+
+		if (container_mem_lock(c))
+			return false;
+		ret = -1;
+		if (c->cgroup_handle)
+			ret = lxc_cgroup_handle_set(c->cgroup_handle, subsys, value, true);
+		container_mem_unlock(c);
+		return ret == 0;
+	}
+	container_mem_unlock(c);
+
 	if (is_stopped(c))
 		return false;
 
@@ -2577,15 +3205,35 @@ WRAP_API_2(bool, lxcapi_set_cgroup_item, const char *, const char *)
 
 static int do_lxcapi_get_cgroup_item(struct lxc_container *c, const char *subsys, char *retv, int inlen)
 {
+	bool stale;
 	int ret;
 
 	if (!c)
 		return -1;
 
+	if (container_mem_lock_shared(c))
+		return -1;
+	if (c->cgroup_handle) {
+		ret = lxc_cgroup_handle_get(c->cgroup_handle, subsys, retv, inlen, false);
+		stale = ret < 0 && errno == ESTALE;
+		container_mem_unlock(c);
+		if (!stale)
+			return ret;
+
+		if (container_mem_lock(c))
+			return -1;
+		ret = -1;
+		if (c->cgroup_handle)
+			ret = lxc_cgroup_handle_get(c->cgroup_handle, subsys, retv, inlen, true);
+		container_mem_unlock(c);
+		return ret;
+	}
+	container_mem_unlock(c);
+
 	if (is_stopped(c))
 		return -1;
 
-	if (container_disk_lock(c))
+	if (container_disk_lock_shared(c))
 		return -1;
 
 	ret = lxc_cgroup_get(subsys, retv, inlen, c->name, c->config_path);
@@ -3040,9 +3688,8 @@ static struct lxc_container *do_lxcapi_clone(struct lxc_container *c, const char
 	struct lxc_container *c2 = NULL;
 	char newpath[MAXPATHLEN];
 	int ret, storage_copied = 0;
-	char *origroot = NULL, *saved_unexp_conf = NULL;
+	char *origroot = NULL;
 	struct clone_update_data data;
-	size_t saved_unexp_len;
 	FILE *fout;
 	pid_t pid;
 
@@ -3089,22 +3736,9 @@ static struct lxc_container *do_lxcapi_clone(struct lxc_container *c, const char
 		goto out;
 	}
 
-	saved_unexp_conf = c->lxc_conf->unexpanded_config;
-	saved_unexp_len = c->lxc_conf->unexpanded_len;
-	c->lxc_conf->unexpanded_config = strdup(saved_unexp_conf);
-	if (!c->lxc_conf->unexpanded_config) {
-		ERROR("Out of memory");
-		fclose(fout);
-		goto out;
-	}
-	clear_unexp_config_line(c->lxc_conf, "lxc.rootfs", false);
-	write_config(fout, c->lxc_conf);
+	write_config_except(fout, c->lxc_conf, "lxc.rootfs");
 	fclose(fout);
 	c->lxc_conf->rootfs.path = origroot;
-	free(c->lxc_conf->unexpanded_config);
-	c->lxc_conf->unexpanded_config = saved_unexp_conf;
-	saved_unexp_conf = NULL;
-	c->lxc_conf->unexpanded_len = saved_unexp_len;
 
 	sprintf(newpath, "%s/%s/rootfs", lxcpath, newname);
 	if (mkdir(newpath, 0755) < 0) {
@@ -3253,10 +3887,13 @@ static bool do_lxcapi_rename(struct lxc_container *c, const char *newname)
 	if (newc && lxcapi_is_defined(newc))
 		lxc_container_put(newc);
 
-	if (!container_destroy(c)) {
+	if (!container_destroy(c, NULL)) {
 		ERROR("Could not destroy existing container %s", c->name);
 		return false;
 	}
+	/* container_destroy() dropped the old name's cache, the new name's
+	 * is rebuilt from the renamed config on its next load */
+	config_cache_remove(c->config_path, newname);
 	return true;
 }
 
@@ -3611,7 +4248,7 @@ static bool do_lxcapi_snapshot_restore(struct lxc_container *c, const char *snap
 	}
 
 	if (strcmp(c->name, newname) == 0) {
-		if (!container_destroy(c)) {
+		if (!container_destroy(c, NULL)) {
 			ERROR("Could not destroy existing container %s", newname);
 			lxc_container_put(snap);
 			bdev_put(bdev);
@@ -3634,7 +4271,8 @@ static bool do_lxcapi_snapshot_restore(struct lxc_container *c, const char *snap
 
 WRAP_API_2(bool, lxcapi_snapshot_restore, const char *, const char *)
 
-static bool do_snapshot_destroy(const char *snapname, const char *clonelxcpath)
+static bool do_snapshot_destroy(const char *snapname, const char *clonelxcpath,
+				const char *trash)
 {
 	struct lxc_container *snap = NULL;
 	bool bret = false;
@@ -3645,7 +4283,7 @@ static bool do_snapshot_destroy(const char *snapname, const char *clonelxcpath)
 		goto err;
 	}
 
-	if (!do_lxcapi_destroy(snap)) {
+	if (!do_container_destroy(snap, trash)) {
 		ERROR("Could not destroy snapshot %s", snapname);
 		goto err;
 	}
@@ -3657,7 +4295,7 @@ err:
 	return bret;
 }
 
-static bool remove_all_snapshots(const char *path)
+static bool remove_all_snapshots(const char *path, const char *trash)
 {
 	DIR *dir;
 	struct dirent dirent, *direntp;
@@ -3675,7 +4313,7 @@ static bool remove_all_snapshots(const char *path)
 			continue;
 		if (!strcmp(direntp->d_name, ".."))
 			continue;
-		if (!do_snapshot_destroy(direntp->d_name, path)) {
+		if (!do_snapshot_destroy(direntp->d_name, path, trash)) {
 			bret = false;
 			continue;
 		}
@@ -3699,7 +4337,7 @@ static bool do_lxcapi_snapshot_destroy(struct lxc_container *c, const char *snap
 	if (!get_snappath_dir(c, clonelxcpath))
 		return false;
 
-	return do_snapshot_destroy(snapname, clonelxcpath);
+	return do_snapshot_destroy(snapname, clonelxcpath, NULL);
 }
 
 WRAP_API_1(bool, lxcapi_snapshot_destroy, const char *)
@@ -3714,11 +4352,40 @@ static bool do_lxcapi_snapshot_destroy_all(struct lxc_container *c)
 	if (!get_snappath_dir(c, clonelxcpath))
 		return false;
 
-	return remove_all_snapshots(clonelxcpath);
+	return remove_all_snapshots(clonelxcpath, NULL);
 }
 
 WRAP_API(bool, lxcapi_snapshot_destroy_all)
 
+static bool do_lxcapi_destroy_async(struct lxc_container *c, bool with_snapshots)
+{
+	char clonelxcpath[MAXPATHLEN];
+	bool bret;
+
+	if (!c || !c->name || !c->config_path || !do_lxcapi_is_defined(c))
+		return false;
+
+	if (with_snapshots) {
+		if (!get_snappath_dir(c, clonelxcpath))
+			return false;
+
+		if (dir_exists(clonelxcpath) &&
+		    !remove_all_snapshots(clonelxcpath, c->config_path)) {
+			ERROR("Error deleting all snapshots");
+			return false;
+		}
+	}
+
+	bret = do_container_destroy(c, c->config_path);
+
+	if (lxc_trash_reap_spawn(c->config_path) < 0)
+		WARN("Failed to start the trash reaper for %s", c->config_path);
+
+	return bret;
+}
+
+WRAP_API_1(bool, lxcapi_destroy_async, bool)
+
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 
@@ -4128,6 +4795,7 @@ struct lxc_container *lxc_container_new(const char *name, const char *configpath
 		return NULL;
 	}
 	memset(c, 0, sizeof(*c));
+	c->netns_fd = -1;
 
 	if (configpath)
 		c->config_path = strdup(configpath);
@@ -4168,7 +4836,7 @@ struct lxc_container *lxc_container_new(const char *name, const char *configpath
 
 	if (ongoing_create(c) == 2) {
 		ERROR("Error: %s creation was not completed", c->name);
-		container_destroy(c);
+		container_destroy(c, NULL);
 		lxcapi_clear_config(c);
 	}
 	c->daemonize = true;
@@ -4231,6 +4899,12 @@ struct lxc_container *lxc_container_new(const char *name, const char *configpath
 	c->checkpoint = lxcapi_checkpoint;
 	c->restore = lxcapi_restore;
 	c->migrate = lxcapi_migrate;
+	c->get_running_items = lxcapi_get_running_items;
+	c->console_log = lxcapi_console_log;
+	c->destroy_async = lxcapi_destroy_async;
+	c->want_cgroup_cache = lxcapi_want_cgroup_cache;
+	c->want_warm = lxcapi_want_warm;
+	c->claim = lxcapi_claim;
 
 	return c;
 
@@ -4340,25 +5014,152 @@ free_bad:
 	return -1;
 }
 
-int list_active_containers(const char *lxcpath, char ***nret,
-			   struct lxc_container ***cret)
+/*
+ * Resolve the container name behind a hashed command socket, querying its
+ * lxcpath and name over a single session. Returns false if the container
+ * does not live in @lxcpath.
+ */
+static bool lxc_cmd_get_hashed_name(const char *hashed_sock_name,
+				    const char *lxcpath, char **name)
+{
+	struct lxc_cmd_rr cmds[2] = {
+		{ .req = { .cmd = LXC_CMD_GET_LXCPATH } },
+		{ .req = { .cmd = LXC_CMD_GET_NAME } },
+	};
+	struct lxc_cmd_session *session;
+	int i, err, stopped;
+	bool ret = false;
+
+	*name = NULL;
+	session = lxc_cmd_session_open(NULL, NULL, hashed_sock_name);
+	if (!session)
+		return false;
+	err = lxc_cmd_session_run(session, cmds, 2, &stopped);
+	lxc_cmd_session_close(session);
+	if (err < 0)
+		return false;
+
+	if (cmds[0].rsp.ret || cmds[1].rsp.ret || !cmds[0].rsp.datalen ||
+	    !cmds[1].rsp.datalen)
+		goto out;
+
+	if (strncmp(lxcpath, cmds[0].rsp.data, strlen(lxcpath)) != 0)
+		goto out;
+
+	*name = cmds[1].rsp.data;
+	cmds[1].rsp.data = NULL;
+	ret = true;
+
+out:
+	for (i = 0; i < 2; i++)
+		if (cmds[i].rsp.datalen > 0)
+			free(cmds[i].rsp.data);
+	return ret;
+}
+
+/*
+ * Add the running container @name to the lists being built by
+ * list_active_containers().  Returns false on fatal errors only.
+ */
+static bool add_active_container(const char *lxcpath, char *name,
+				 char ***ct_name, int *ct_name_cnt,
+				 struct lxc_container ***cret, int *cret_cnt)
 {
-	int i, ret = -1, cret_cnt = 0, ct_name_cnt = 0;
-	int lxcpath_len;
-	char *line = NULL;
-	char **ct_name = NULL;
-	size_t len = 0;
 	struct lxc_container *c;
-	bool is_hashed;
 
-	if (!lxcpath)
-		lxcpath = lxc_global_config_value("lxc.lxcpath");
-	lxcpath_len = strlen(lxcpath);
+	if (array_contains(ct_name, name, *ct_name_cnt))
+		return true;
 
-	if (cret)
-		*cret = NULL;
-	if (nret)
-		*nret = NULL;
+	if (!add_to_array(ct_name, name, *ct_name_cnt))
+		return false;
+	(*ct_name_cnt)++;
+
+	if (!cret)
+		return true;
+
+	c = lxc_container_new(name, lxcpath);
+	if (!c) {
+		INFO("Container %s:%s is running but could not be loaded",
+			lxcpath, name);
+		remove_from_array(ct_name, name, (*ct_name_cnt)--);
+		return true;
+	}
+
+	/*
+	 * If this is an anonymous container, then is_defined *can*
+	 * return false.  So we don't do that check.  Count on the
+	 * fact that the command socket exists.
+	 */
+
+	if (!add_to_clist(cret, c, *cret_cnt, true)) {
+		lxc_container_put(c);
+		return false;
+	}
+	(*cret_cnt)++;
+
+	return true;
+}
+
+/*
+ * Collect the running containers from the registry their monitors keep in
+ * the rundir, which costs one lock probe per running container.  Returns
+ * 0 if that is all of them, 1 if the registry is marked incomplete as
+ * containers started by an older liblxc may be missing from it, -ENOENT if
+ * there is no registry for @lxcpath and -1 on fatal errors.
+ */
+static int list_active_registry(const char *lxcpath,
+				 char ***ct_name, int *ct_name_cnt,
+				 struct lxc_container ***cret, int *cret_cnt)
+{
+	char path[MAXPATHLEN];
+	struct dirent *direntp;
+	DIR *dir;
+	int ret = 0;
+
+	if (lxc_monitor_active_dir(lxcpath, path, sizeof(path), 0) < 0)
+		return -ENOENT;
+
+	dir = opendir(path);
+	if (!dir)
+		return -ENOENT;
+
+	while ((direntp = readdir(dir))) {
+		/* skips ".", ".." and entries still being registered */
+		if (direntp->d_name[0] == '.')
+			continue;
+
+		if (!lxc_monitor_active_check(dirfd(dir), direntp->d_name))
+			continue;
+
+		if (!add_active_container(lxcpath, direntp->d_name, ct_name,
+					  ct_name_cnt, cret, cret_cnt)) {
+			ret = -1;
+			break;
+		}
+	}
+
+	if (ret == 0 && lxc_monitor_active_incomplete(dirfd(dir)))
+		ret = 1;
+
+	closedir(dir);
+	return ret;
+}
+
+/*
+ * Find the running containers by their command sockets in /proc/net/unix.
+ * This reads every unix socket of the host, so it is only used when there
+ * is no registry or it may be incomplete.  Containers already found in the
+ * registry are skipped before any of them is loaded.
+ */
+static int list_active_sockets(const char *lxcpath,
+			       char ***ct_name, int *ct_name_cnt,
+			       struct lxc_container ***cret, int *cret_cnt)
+{
+	int ret = 0;
+	int lxcpath_len = strlen(lxcpath);
+	char *line = NULL, *hashed_name = NULL;
+	size_t len = 0;
+	bool is_hashed, ok;
 
 	FILE *f = fopen("/proc/net/unix", "r");
 	if (!f)
@@ -4394,41 +5195,56 @@ int list_active_containers(const char *lxcpath, char ***nret,
 		*p2 = '\0';
 
 		if (is_hashed) {
-			if (strncmp(lxcpath, lxc_cmd_get_lxcpath(p), lxcpath_len) != 0)
+			if (!lxc_cmd_get_hashed_name(p, lxcpath, &hashed_name))
 				continue;
-			p = lxc_cmd_get_name(p);
+			p = hashed_name;
 		}
 
-		if (array_contains(&ct_name, p, ct_name_cnt))
-			continue;
+		ok = add_active_container(lxcpath, p, ct_name, ct_name_cnt,
+					  cret, cret_cnt);
+		free(hashed_name);
+		hashed_name = NULL;
+		if (!ok) {
+			ret = -1;
+			break;
+		}
+	}
 
-		if (!add_to_array(&ct_name, p, ct_name_cnt))
-			goto free_cret_list;
+	free(line);
+	fclose(f);
+	return ret;
+}
 
-		ct_name_cnt++;
+int list_active_containers(const char *lxcpath, char ***nret,
+			   struct lxc_container ***cret)
+{
+	int i, ret, nregistered, cret_cnt = 0, ct_name_cnt = 0;
+	char **ct_name = NULL;
+	bool incomplete;
 
-		if (!cret)
-			continue;
+	if (!lxcpath)
+		lxcpath = lxc_global_config_value("lxc.lxcpath");
 
-		c = lxc_container_new(p, lxcpath);
-		if (!c) {
-			INFO("Container %s:%s is running but could not be loaded",
-				lxcpath, p);
-			remove_from_array(&ct_name, p, ct_name_cnt--);
-			continue;
-		}
+	if (cret)
+		*cret = NULL;
+	if (nret)
+		*nret = NULL;
 
-		/*
-		 * If this is an anonymous container, then is_defined *can*
-		 * return false.  So we don't do that check.  Count on the
-		 * fact that the command socket exists.
-		 */
+	ret = list_active_registry(lxcpath, &ct_name, &ct_name_cnt,
+				   cret, &cret_cnt);
+	if (ret < 0 && ret != -ENOENT)
+		goto free_cret_list;
 
-		if (!add_to_clist(cret, c, cret_cnt, true)) {
-			lxc_container_put(c);
+	if (ret != 0) {
+		incomplete = ret == 1;
+		nregistered = ct_name_cnt;
+		ret = list_active_sockets(lxcpath, &ct_name, &ct_name_cnt,
+					  cret, &cret_cnt);
+		if (ret < 0)
 			goto free_cret_list;
-		}
-		cret_cnt++;
+		/* nothing outside the registry is running anymore */
+		if (incomplete && ct_name_cnt == nregistered)
+			lxc_monitor_active_complete(lxcpath);
 	}
 
 	assert(!nret || !cret || cret_cnt == ct_name_cnt);
@@ -4437,13 +5253,15 @@ int list_active_containers(const char *lxcpath, char ***nret,
 		*nret = ct_name;
 	else
 		goto free_ct_name;
-	goto out;
+	return ret;
 
 free_cret_list:
+	ret = -1;
 	if (cret && *cret) {
 		for (i = 0; i < cret_cnt; i++)
 			lxc_container_put((*cret)[i]);
 		free(*cret);
+		*cret = NULL;
 	}
 
 free_ct_name:
@@ -4453,10 +5271,6 @@ free_ct_name:
 		free(ct_name);
 	}
 
-out:
-	free(line);
-
-	fclose(f);
 	return ret;
 }
 
@@ -4541,3 +5355,151 @@ free_ct_name:
 	free(ct_name);
 	return ret;
 }
+
+static bool warm_pool_member(const char *tmpl, const char *name)
+{
+	size_t len = strlen(tmpl);
+	char *end;
+
+	if (strncmp(name, tmpl, len) != 0 || strncmp(name + len, "-warm-", 6) != 0)
+		return false;
+	if (!isdigit(name[len + 6]))
+		return false;
+	strtoul(name + len + 6, &end, 10);
+	return *end == '\0';
+}
+
+int lxc_warm_pool_fill(const char *tmpl, const char *lxcpath, int n)
+{
+	struct lxc_container *t = NULL, *c;
+	char name[MAXPATHLEN];
+	char **names = NULL;
+	int i, k, ret, nactive, parked = 0, started = 0;
+
+	if (!tmpl || n < 0)
+		return -1;
+	if (!lxcpath)
+		lxcpath = lxc_global_config_value("lxc.lxcpath");
+
+	nactive = list_active_containers(lxcpath, &names, NULL);
+	if (nactive < 0)
+		return -1;
+
+	for (i = 0; i < nactive; i++)
+		if (warm_pool_member(tmpl, names[i]) &&
+		    lxc_cmd_get_warm(names[i], lxcpath) == LXC_WARM_PARKED)
+			parked++;
+
+	for (k = 0; parked + started < n; k++) {
+		ret = snprintf(name, sizeof(name), "%s-warm-%d", tmpl, k);
+		if (ret < 0 || ret >= sizeof(name))
+			goto err;
+		/* running, whether claimed or not */
+		if (array_contains(&names, name, nactive))
+			continue;
+
+		c = lxc_container_new(name, lxcpath);
+		if (!c)
+			goto err;
+
+		/* a member left stopped is an ephemeral clone already */
+		if (!do_lxcapi_is_defined(c)) {
+			lxc_container_put(c);
+			if (!t) {
+				t = lxc_container_new(tmpl, lxcpath);
+				if (!t || !do_lxcapi_is_defined(t)) {
+					ERROR("Template container %s is not defined", tmpl);
+					goto err;
+				}
+			}
+			c = do_lxcapi_clone(t, name, lxcpath,
+					    LXC_CLONE_SNAPSHOT | LXC_CLONE_MAYBE_SNAPSHOT,
+					    NULL, NULL, 0, NULL);
+			if (!c) {
+				ERROR("Failed to clone %s into %s", tmpl, name);
+				goto err;
+			}
+			if (!do_lxcapi_set_config_item(c, "lxc.ephemeral", "1") ||
+			    !do_lxcapi_save_config(c, NULL)) {
+				ERROR("Failed to make %s ephemeral", name);
+				do_lxcapi_destroy(c);
+				lxc_container_put(c);
+				goto err;
+			}
+		}
+
+		ret = do_lxcapi_want_warm(c, true) &&
+		      do_lxcapi_want_daemonize(c, true) &&
+		      do_lxcapi_start(c, 0, NULL);
+		lxc_container_put(c);
+		if (!ret) {
+			ERROR("Failed to start %s warm", name);
+			goto err;
+		}
+		started++;
+	}
+
+	ret = started;
+	goto out;
+
+err:
+	ret = -1;
+out:
+	if (t)
+		lxc_container_put(t);
+	for (i = 0; i < nactive; i++)
+		free(names[i]);
+	free(names);
+	return ret;
+}
+
+struct lxc_container *lxc_warm_pool_claim(const char *tmpl, const char *lxcpath,
+					  const char * const items[])
+{
+	struct lxc_container *c = NULL;
+	char buf[LXC_CLAIM_MAX];
+	char **names = NULL;
+	int i, nactive, ret, err = 0;
+	size_t len;
+
+	if (!tmpl || !items)
+		return NULL;
+	if (!lxcpath)
+		lxcpath = lxc_global_config_value("lxc.lxcpath");
+
+	len = claim_pack(items, buf);
+	if (!len) {
+		ERROR("claim of a warm container of %s too long", tmpl);
+		return NULL;
+	}
+
+	nactive = list_active_containers(lxcpath, &names, NULL);
+	if (nactive < 0)
+		return NULL;
+
+	for (i = 0; i < nactive; i++) {
+		if (c || err || !warm_pool_member(tmpl, names[i]) ||
+		    lxc_cmd_get_warm(names[i], lxcpath) != LXC_WARM_PARKED)
+			goto next;
+
+		/* others may be claiming from the same pool, the monitor
+		 * decides; losing that race or the member stopping meanwhile
+		 * is not worth a word. Anything else would most likely fail
+		 * the same way on every member, and may have cost this one. */
+		ret = lxc_cmd_claim(names[i], lxcpath, buf, len);
+		if (ret == 0)
+			c = lxc_container_new(names[i], lxcpath);
+		else if (ret != -EBUSY && ret != -ENOENT)
+			err = ret;
+next:
+		free(names[i]);
+	}
+	free(names);
+
+	if (!c && err)
+		ERROR("No warm container of %s could be claimed: %s", tmpl,
+		      strerror(-err));
+	else if (!c)
+		INFO("No warm container of %s is parked", tmpl);
+	return c;
+}
@@ -44,6 +44,7 @@ extern "C" {
 #define LXC_CREATE_MAXFLAGS       (1 << 1) /*!< Number of \c LXC_CREATE* flags */
 
 struct bdev_specs;
+struct lxc_cgroup_handle;
 
 struct lxc_snapshot;
 
@@ -51,6 +52,8 @@ struct lxc_lock;
 
 struct migrate_opts;
 
+struct lxc_running_item;
+
 /*!
  * An LXC container.
  *
@@ -862,6 +865,122 @@ struct lxc_container {
 	 * \return \c 0 on success, nonzero on failure.
 	 */
 	int (*export_destroy)(struct lxc_container *c);
+
+	/*!
+	 * \brief Query several properties of a running container in a
+	 *  single round trip to its monitor.
+	 *
+	 * \param c Container.
+	 * \param items Queries to run; \c ret and \c value of each entry
+	 *  are filled in.
+	 * \param nitems Number of entries in \p items.
+	 *
+	 * \return \c true if the container answered, \c false if it is not
+	 *  running or could not be queried.
+	 *
+	 * \note The \c value of each item must be freed by the caller.
+	 */
+	bool (*get_running_items)(struct lxc_container *c, struct lxc_running_item *items, int nitems);
+
+	/*!
+	 * \private
+	 * Cached file descriptor of the running container's network
+	 * namespace, used by \c get_interfaces() and \c get_ips().
+	 * \note protected by privlock.
+	 */
+	int netns_fd;
+
+	/*!
+	 * \brief Fetch the recent console output of a running container.
+	 *
+	 * The container's monitor keeps it in a ring buffer when
+	 * \c lxc.console.buffer.size is set.
+	 *
+	 * \param c Container.
+	 * \param clear Whether to empty the buffer once it was read.
+	 * \param[out] data Console output, oldest first, \c NULL if empty.
+	 * \param[out] len Length of \p data.
+	 *
+	 * \return \c true on success, \c false if the container is not
+	 *  running or keeps no console buffer.
+	 *
+	 * \note \p data must be freed by the caller.
+	 */
+	bool (*console_log)(struct lxc_container *c, bool clear, char **data, size_t *len);
+
+	/*!
+	 * \brief Delete the container, and optionally all its snapshots,
+	 *  leaving the removal of its files to a background process.
+	 *
+	 * The container directory is moved into the trash area of the
+	 * container's lxcpath, so the name can be reused as soon as this
+	 * returns. Storage which does not live inside the container directory
+	 * is destroyed right away, as is everything if the move fails.
+	 *
+	 * \param c Container.
+	 * \param with_snapshots Whether to delete the container's snapshots too.
+	 *
+	 * \return \c true on success, else \c false.
+	 *
+	 * \note Container must be stopped.
+	 */
+	bool (*destroy_async)(struct lxc_container *c, bool with_snapshots);
+
+	/*!
+	 * \private
+	 * Cached cgroup directories of the running container, used by
+	 * \c get_cgroup_item() and \c set_cgroup_item().
+	 * \note protected by privlock.
+	 */
+	struct lxc_cgroup_handle *cgroup_handle;
+
+	/*!
+	 * \brief Change whether \c get_cgroup_item() and
+	 *  \c set_cgroup_item() cache the running container's cgroup paths.
+	 *
+	 * Without the cache every call asks the container's monitor for its
+	 * cgroup. With it, each cgroup hierarchy is looked up once and kept
+	 * open until the container is restarted, which suits callers polling
+	 * the same container over and over.
+	 *
+	 * \param c Container.
+	 * \param state Whether to cache the cgroup paths.
+	 *
+	 * \return \c true on success, else \c false.
+	 */
+	bool (*want_cgroup_cache)(struct lxc_container *c, bool state);
+
+	/*!
+	 * \brief Change whether the container is started warm.
+	 *
+	 * A warm container is set up completely, down to its network and
+	 * mounts, but its init waits right before executing the workload
+	 * until the container is claimed. It shows as \c RUNNING meanwhile.
+	 *
+	 * \param c Container.
+	 * \param state Value for the warm bit (0 or 1).
+	 *
+	 * \return \c true on success, else \c false.
+	 */
+	bool (*want_warm)(struct lxc_container *c, bool state);
+
+	/*!
+	 * \brief Claim a running warm container and let its workload start.
+	 *
+	 * \param c Container.
+	 * \param items \c NULL terminated list of \c "key=value" config
+	 *  items giving the container its identity. Accepted are
+	 *  \c lxc.utsname and, for the container's existing network
+	 *  devices, \c lxc.network.<n>.hwaddr, \c .ipv4, \c .ipv6,
+	 *  \c .ipv4.gateway and \c .ipv6.gateway. May be empty.
+	 *
+	 * \return \c true once the items were applied inside the container,
+	 *  \c false if it is not warm, was claimed already or refused an
+	 *  item.
+	 *
+	 * \note The items are not saved to the container's config file.
+	 */
+	bool (*claim)(struct lxc_container *c, const char * const items[]);
 };
 
 /*!
@@ -902,6 +1021,27 @@ struct bdev_specs {
 	} rbd;
 };
 
+/*!
+ * \brief Properties which can be queried with \c get_running_items().
+ */
+enum {
+	LXC_ITEM_STATE, /*!< State, e.g. \c "RUNNING" */
+	LXC_ITEM_INIT_PID, /*!< Pid of the container's init, in decimal */
+	LXC_ITEM_CLONE_FLAGS, /*!< Clone flags the container was started with, in decimal */
+	LXC_ITEM_CGROUP_PATH, /*!< Cgroup path for the subsystem in \c key */
+	LXC_ITEM_CONFIG_ITEM, /*!< Value of the running config item in \c key */
+};
+
+/*!
+ * \brief A single query for the \c get_running_items() API call.
+ */
+struct lxc_running_item {
+	int type; /*!< One of the \c LXC_ITEM_* constants */
+	const char *key; /*!< Cgroup subsystem or config key, \c NULL if unused */
+	int ret; /*!< \c 0 on success, negative on failure */
+	char *value; /*!< Answer, or \c NULL on failure */
+};
+
 /*!
  * \brief Commands for the migrate API call.
  */
@@ -1039,6 +1179,35 @@ int list_active_containers(const char *lxcpath, char ***names, struct lxc_contai
  */
 int list_all_containers(const char *lxcpath, char ***names, struct lxc_container ***cret);
 
+/*!
+ * \brief Top up the pool of warm containers cloned from a template.
+ *
+ * The members of the pool are ephemeral clones of \p tmpl named
+ * \c "<tmpl>-warm-<n>", snapshots where the template's storage allows it.
+ * Members which are not running warm any more are not counted.
+ *
+ * \param tmpl Name of the (stopped) template container.
+ * \param lxcpath lxcpath of the template and its pool.
+ * \param n Number of unclaimed members to have running.
+ *
+ * \return Number of members started, or \c -1 on error.
+ */
+int lxc_warm_pool_fill(const char *tmpl, const char *lxcpath, int n);
+
+/*!
+ * \brief Claim a member of the warm pool of a template.
+ *
+ * \param tmpl Name of the template container.
+ * \param lxcpath lxcpath of the template and its pool.
+ * \param items Identity to give the member, as for \c claim().
+ *
+ * \return The claimed container, or \c NULL if none could be claimed.
+ *
+ * \note The returned container must be released with \c lxc_container_put().
+ */
+struct lxc_container *lxc_warm_pool_claim(const char *tmpl, const char *lxcpath,
+					  const char * const items[]);
+
 /*!
  * \brief Close log file.
  */
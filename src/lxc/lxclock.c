@@ -40,9 +40,12 @@
 #define MAX_STACKDEPTH 25
 
 #define OFLAG (O_CREAT | O_RDWR)
-#define SEMMODE 0660
-#define SEMVALUE 1
-#define SEMVALUE_LOCKED 0
+
+#ifndef F_OFD_GETLK
+#define F_OFD_GETLK	36
+#define F_OFD_SETLK	37
+#define F_OFD_SETLKW	38
+#endif
 
 lxc_log_define(lxc_lock, lxc);
 
@@ -142,20 +145,30 @@ static char *lxclock_name(const char *p, const char *n)
 	return dest;
 }
 
-static sem_t *lxc_new_unnamed_sem(void)
+static pthread_rwlock_t *lxc_new_unnamed_rwlock(void)
 {
-	sem_t *s;
+	pthread_rwlockattr_t attr;
+	pthread_rwlock_t *rw;
 	int ret;
 
-	s = malloc(sizeof(*s));
-	if (!s)
+	rw = malloc(sizeof(*rw));
+	if (!rw)
+		return NULL;
+	if (pthread_rwlockattr_init(&attr)) {
+		free(rw);
 		return NULL;
-	ret = sem_init(s, 0, 1);
+	}
+#ifdef __GLIBC__
+	/* don't let a steady stream of readers starve a writer */
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+	ret = pthread_rwlock_init(rw, &attr);
+	pthread_rwlockattr_destroy(&attr);
 	if (ret) {
-		free(s);
+		free(rw);
 		return NULL;
 	}
-	return s;
+	return rw;
 }
 
 struct lxc_lock *lxc_newlock(const char *lxcpath, const char *name)
@@ -167,9 +180,9 @@ struct lxc_lock *lxc_newlock(const char *lxcpath, const char *name)
 		goto out;
 
 	if (!name) {
-		l->type = LXC_LOCK_ANON_SEM;
-		l->u.sem = lxc_new_unnamed_sem();
-		if (!l->u.sem) {
+		l->type = LXC_LOCK_RWLOCK;
+		l->u.rw = lxc_new_unnamed_rwlock();
+		if (!l->u.rw) {
 			free(l);
 			l = NULL;
 		}
@@ -183,62 +196,149 @@ struct lxc_lock *lxc_newlock(const char *lxcpath, const char *name)
 		l = NULL;
 		goto out;
 	}
+	if (pthread_mutex_init(&l->u.f.mutex, NULL)) {
+		free(l->u.f.fname);
+		free(l);
+		l = NULL;
+		goto out;
+	}
 	l->u.f.fd = -1;
+	l->u.f.nshared = 0;
 
 out:
 	return l;
 }
 
-int lxclock(struct lxc_lock *l, int timeout)
+/*
+ * Open file description locks belong to the open file rather than to the
+ * process, so closing some other fd on the lockfile doesn't drop them.
+ * Kernels before 3.15 reject them with EINVAL; use process locks there.
+ */
+static int lockfile_fcntl(int fd, int ofd_cmd, int cmd, struct flock *lk)
+{
+	int ret;
+
+	ret = fcntl(fd, ofd_cmd, lk);
+	if (ret < 0 && errno == EINVAL)
+		ret = fcntl(fd, cmd, lk);
+	return ret;
+}
+
+static int lockfile_lock(int fd, short type, int timeout)
 {
-	int ret = -1, saved_errno = errno;
 	struct flock lk;
+	struct timespec deadline, now;
+	useconds_t delay = 1000;
+	int ret;
+
+	memset(&lk, 0, sizeof(lk));
+	lk.l_type = type;
+	lk.l_whence = SEEK_SET;
+	lk.l_start = 0;
+	lk.l_len = 0;
+
+	if (!timeout)
+		return lockfile_fcntl(fd, F_OFD_SETLKW, F_SETLKW, &lk);
+
+	/* there is no timed F_SETLKW, so poll with a backoff up to 100ms */
+	if (clock_gettime(CLOCK_MONOTONIC, &deadline) < 0)
+		return -2;
+	deadline.tv_sec += timeout;
+	for (;;) {
+		ret = lockfile_fcntl(fd, F_OFD_SETLK, F_SETLK, &lk);
+		if (ret == 0 || (errno != EAGAIN && errno != EACCES))
+			return ret;
+		if (clock_gettime(CLOCK_MONOTONIC, &now) < 0)
+			return -2;
+		if (now.tv_sec > deadline.tv_sec ||
+		    (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec)) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		usleep(delay);
+		if (delay < 100000)
+			delay *= 2;
+	}
+}
+
+static int lockfile_open(struct lxc_lock *l)
+{
+	if (l->u.f.fd != -1)
+		return 0;
+	l->u.f.fd = open(l->u.f.fname, O_RDWR | O_CREAT | O_CLOEXEC,
+			S_IWUSR | S_IRUSR);
+	if (l->u.f.fd == -1) {
+		ERROR("Error opening %s", l->u.f.fname);
+		return -1;
+	}
+	return 0;
+}
+
+static int do_lxclock(struct lxc_lock *l, int timeout, bool shared)
+{
+	int ret = -1, saved_errno = errno;
+	struct timespec ts;
 
 	switch(l->type) {
-	case LXC_LOCK_ANON_SEM:
+	case LXC_LOCK_RWLOCK:
 		if (!timeout) {
-			ret = sem_wait(l->u.sem);
-			if (ret == -1)
-				saved_errno = errno;
+			if (shared)
+				ret = pthread_rwlock_rdlock(l->u.rw);
+			else
+				ret = pthread_rwlock_wrlock(l->u.rw);
 		} else {
-			struct timespec ts;
 			if (clock_gettime(CLOCK_REALTIME, &ts) == -1) {
 				ret = -2;
 				goto out;
 			}
 			ts.tv_sec += timeout;
-			ret = sem_timedwait(l->u.sem, &ts);
-			if (ret == -1)
-				saved_errno = errno;
+			if (shared)
+				ret = pthread_rwlock_timedrdlock(l->u.rw, &ts);
+			else
+				ret = pthread_rwlock_timedwrlock(l->u.rw, &ts);
+		}
+		if (ret) {
+			saved_errno = ret;
+			ret = -1;
 		}
 		break;
 	case LXC_LOCK_FLOCK:
-		ret = -2;
-		if (timeout) {
-			ERROR("Error: timeout not supported with flock");
-			ret = -2;
-			goto out;
-		}
 		if (!l->u.f.fname) {
 			ERROR("Error: filename not set for flock");
 			ret = -2;
 			goto out;
 		}
-		if (l->u.f.fd == -1) {
-			l->u.f.fd = open(l->u.f.fname, O_RDWR|O_CREAT,
-					S_IWUSR | S_IRUSR);
-			if (l->u.f.fd == -1) {
-				ERROR("Error opening %s", l->u.f.fname);
+		if (!shared) {
+			if (lockfile_open(l) < 0)
 				goto out;
+			ret = lockfile_lock(l->u.f.fd, F_WRLCK, timeout);
+			if (ret < 0) {
+				saved_errno = errno;
+				close(l->u.f.fd);
+				l->u.f.fd = -1;
 			}
+			break;
 		}
-		lk.l_type = F_WRLCK;
-		lk.l_whence = SEEK_SET;
-		lk.l_start = 0;
-		lk.l_len = 0;
-		ret = fcntl(l->u.f.fd, F_SETLKW, &lk);
-		if (ret == -1)
-			saved_errno = errno;
+		/*
+		 * All shared holders in this process share one read lock on
+		 * the lockfile; the first one takes it and the last one to
+		 * unlock drops it.
+		 */
+		lock_mutex(&l->u.f.mutex);
+		if (l->u.f.nshared > 0) {
+			l->u.f.nshared++;
+			ret = 0;
+		} else if (lockfile_open(l) == 0) {
+			ret = lockfile_lock(l->u.f.fd, F_RDLCK, timeout);
+			if (ret < 0) {
+				saved_errno = errno;
+				close(l->u.f.fd);
+				l->u.f.fd = -1;
+			} else {
+				l->u.f.nshared = 1;
+			}
+		}
+		unlock_mutex(&l->u.f.mutex);
 		break;
 	}
 
@@ -247,33 +347,53 @@ out:
 	return ret;
 }
 
+int lxclock(struct lxc_lock *l, int timeout)
+{
+	return do_lxclock(l, timeout, false);
+}
+
+int lxclock_shared(struct lxc_lock *l, int timeout)
+{
+	return do_lxclock(l, timeout, true);
+}
+
 int lxcunlock(struct lxc_lock *l)
 {
 	int ret = 0, saved_errno = errno;
 	struct flock lk;
 
 	switch(l->type) {
-	case LXC_LOCK_ANON_SEM:
-		if (!l->u.sem)
+	case LXC_LOCK_RWLOCK:
+		if (!l->u.rw)
 			ret = -2;
 		else {
-			ret = sem_post(l->u.sem);
-			saved_errno = errno;
+			ret = pthread_rwlock_unlock(l->u.rw);
+			if (ret) {
+				saved_errno = ret;
+				ret = -1;
+			}
 		}
 		break;
 	case LXC_LOCK_FLOCK:
-		if (l->u.f.fd != -1) {
+		lock_mutex(&l->u.f.mutex);
+		if (l->u.f.fd == -1) {
+			ret = -2;
+		} else if (l->u.f.nshared > 1) {
+			l->u.f.nshared--;
+		} else {
+			memset(&lk, 0, sizeof(lk));
 			lk.l_type = F_UNLCK;
 			lk.l_whence = SEEK_SET;
 			lk.l_start = 0;
 			lk.l_len = 0;
-			ret = fcntl(l->u.f.fd, F_SETLK, &lk);
+			ret = lockfile_fcntl(l->u.f.fd, F_OFD_SETLK, F_SETLK, &lk);
 			if (ret < 0)
 				saved_errno = errno;
 			close(l->u.f.fd);
 			l->u.f.fd = -1;
-		} else
-			ret = -2;
+			l->u.f.nshared = 0;
+		}
+		unlock_mutex(&l->u.f.mutex);
 		break;
 	}
 
@@ -293,11 +413,11 @@ void lxc_putlock(struct lxc_lock *l)
 	if (!l)
 		return;
 	switch(l->type) {
-	case LXC_LOCK_ANON_SEM:
-		if (l->u.sem) {
-			sem_destroy(l->u.sem);
-			free(l->u.sem);
-			l->u.sem = NULL;
+	case LXC_LOCK_RWLOCK:
+		if (l->u.rw) {
+			pthread_rwlock_destroy(l->u.rw);
+			free(l->u.rw);
+			l->u.rw = NULL;
 		}
 		break;
 	case LXC_LOCK_FLOCK:
@@ -307,6 +427,7 @@ void lxc_putlock(struct lxc_lock *l)
 		}
 		free(l->u.f.fname);
 		l->u.f.fname = NULL;
+		pthread_mutex_destroy(&l->u.f.mutex);
 		break;
 	}
 	free(l);
@@ -344,6 +465,11 @@ int container_mem_lock(struct lxc_container *c)
 	return lxclock(c->privlock, 0);
 }
 
+int container_mem_lock_shared(struct lxc_container *c)
+{
+	return lxclock_shared(c->privlock, 0);
+}
+
 void container_mem_unlock(struct lxc_container *c)
 {
 	lxcunlock(c->privlock);
@@ -362,6 +488,23 @@ int container_disk_lock(struct lxc_container *c)
 	return 0;
 }
 
+/*
+ * The shared privlock keeps exclusive users of this container object, in
+ * particular container_disk_lock(), away from the slock's shared fd.
+ */
+int container_disk_lock_shared(struct lxc_container *c)
+{
+	int ret;
+
+	if ((ret = lxclock_shared(c->privlock, 0)))
+		return ret;
+	if ((ret = lxclock_shared(c->slock, 0))) {
+		lxcunlock(c->privlock);
+		return ret;
+	}
+	return 0;
+}
+
 void container_disk_unlock(struct lxc_container *c)
 {
 	lxcunlock(c->slock);
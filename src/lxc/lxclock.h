@@ -26,12 +26,12 @@
 #include <fcntl.h>           /* For O_* constants */
 #include <sys/stat.h>        /* For mode constants */
 #include <sys/file.h>
-#include <semaphore.h>
+#include <pthread.h>
 #include <string.h>
 #include <time.h>
 
-#define LXC_LOCK_ANON_SEM 1 /*!< Anonymous semaphore lock */
-#define LXC_LOCK_FLOCK    2 /*!< flock(2) lock */
+#define LXC_LOCK_RWLOCK   1 /*!< Anonymous reader/writer lock */
+#define LXC_LOCK_FLOCK    2 /*!< fcntl(2) lockfile lock */
 
 // private
 /*!
@@ -41,11 +41,13 @@ struct lxc_lock {
 	short type; //!< Lock type
 
 	union {
-		sem_t *sem; //!< Anonymous semaphore (LXC_LOCK_ANON_SEM)
+		pthread_rwlock_t *rw; //!< Reader/writer lock (LXC_LOCK_RWLOCK)
 		/*! LXC_LOCK_FLOCK details */
 		struct {
 			int   fd; //!< fd on which a lock is held (if not -1)
 			char *fname; //!< Name of lock
+			int   nshared; //!< Number of shared holders of \c fd
+			pthread_mutex_t mutex; //!< Protects \c fd and \c nshared for shared holders
 		} f;
 	} u; //!< Container for lock type elements
 };
@@ -58,14 +60,14 @@ struct lxc_lock {
  *
  * \return Newly-allocated lxclock on success, \c NULL on failure.
 
- * \note If \p name is not given, create an unnamed semaphore
+ * \note If \p name is not given, create an unnamed reader/writer lock
  *  (used to protect against racing threads).
  *
- * \note Note that an unnamed sem was malloced by us and needs to be freed.
+ * \note Note that an unnamed lock was malloced by us and needs to be freed.
  *
- * \internal \ref sem is initialized to a value of \c 1.
- * A 'sem_t *' which can be passed to \ref lxclock() and \ref lxcunlock()
- * will be placed in \c l->u.sem.
+ * \internal A writer-preferring 'pthread_rwlock_t *' which can be passed
+ * to \ref lxclock(), \ref lxclock_shared() and \ref lxcunlock() will be
+ * placed in \c l->u.rw.
  *
  * If \ref lxcpath and \ref name are given (both must be given if either is
  * given) then a lockfile is created as \c $lxcpath/$lxcname/locks/$name.
@@ -87,22 +89,43 @@ extern struct lxc_lock *lxc_newlock(const char *lxcpath, const char *name);
  * indefinite wait).
  *
  * \return \c 0 if lock obtained, \c -2 on failure to set timeout,
- *  or \c -1 on any other error (\c errno will be set by \c sem_wait(3)).
+ *  or \c -1 on any other error (\c errno will be set, \c ETIMEDOUT
+ *  if \p timeout expired).
  *
- * \note \p timeout is (currently?) only supported for privlock, not
- * for slock.  Since currently there is not a single use of the timeout
- * (except in the test case) I may remove the support for it in sem as
- * well.
+ * \note The lock is taken exclusively.  For lockfiles an open file
+ * description lock is used where the kernel supports it, so that the lock
+ * belongs to this \ref lxc_lock rather than to the whole process.
  */
 extern int lxclock(struct lxc_lock *lock, int timeout);
 
 /*!
- * \brief Unlock specified lock previously locked using \ref lxclock().
+ * \brief Take an existing lock in shared mode.
+ *
+ * \param lock Lock to operate on.
+ * \param timeout Seconds to wait to take lock (\c 0 signifies an
+ * indefinite wait).
+ *
+ * \return As for \ref lxclock().
+ *
+ * \note Any number of shared holders may hold the lock at once; an
+ * exclusive \ref lxclock() waits until all of them have dropped it.
+ * The lock must be released with \ref lxcunlock().
+ *
+ * \note Threads sharing a lockfile \ref lxc_lock share its lock, so
+ * they must be serialized against exclusive holders by an in-memory
+ * lock, as \ref container_disk_lock_shared() does.
+ */
+extern int lxclock_shared(struct lxc_lock *lock, int timeout);
+
+/*!
+ * \brief Unlock specified lock previously locked using \ref lxclock()
+ * or \ref lxclock_shared().
  *
  * \param lock \ref lxc_lock.
  *
  * \return \c 0 on success, \c -2 if provided lock was not already held,
- * otherwise \c -1 with \c errno saved from \c flock(2) or sem_post function.
+ * otherwise \c -1 with \c errno saved from \c fcntl(2) or
+ * pthread_rwlock_unlock function.
  */
 extern int lxcunlock(struct lxc_lock *lock);
 
@@ -134,6 +157,17 @@ struct lxc_container;
  */
 extern int container_mem_lock(struct lxc_container *c);
 
+/*!
+ * \brief Lock the containers memory for reading.
+ *
+ * \param c Container.
+ *
+ * \return As for \ref lxclock().
+ *
+ * \note Released with \ref container_mem_unlock().
+ */
+extern int container_mem_lock_shared(struct lxc_container *c);
+
 /*!
  * \brief Unlock the containers memory.
  *
@@ -151,6 +185,18 @@ extern void container_mem_unlock(struct lxc_container *c);
  */
 extern int container_disk_lock(struct lxc_container *c);
 
+/*!
+ * \brief Lock the containers disk data for reading.
+ *
+ * \param c Container.
+ *
+ * \return \c 0 on success, or an \ref lxclock() error return
+ * values on error.
+ *
+ * \note Released with \ref container_disk_unlock().
+ */
+extern int container_disk_lock_shared(struct lxc_container *c);
+
 /*!
  * \brief Unlock the containers disk data.
  */
@@ -28,6 +28,7 @@
 #include <unistd.h>
 #include <sys/epoll.h>
 
+#include "log.h"
 #include "mainloop.h"
 
 struct mainloop_handler {
@@ -46,6 +47,10 @@ int lxc_mainloop(struct lxc_epoll_descr *descr, int timeout_ms)
 
 	for (;;) {
 
+		/* write out buffered log messages before going idle */
+		if (timeout_ms != 0)
+			lxc_log_flush();
+
 		nfds = epoll_wait(descr->epfd, events, MAX_EVENTS, timeout_ms);
 		if (nfds < 0) {
 			if (errno == EINTR)
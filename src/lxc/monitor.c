@@ -32,6 +32,7 @@
 #include <inttypes.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/param.h>
 #include <sys/socket.h>
@@ -142,6 +143,157 @@ void lxc_monitor_send_exit_code(const char *name, int exit_code, const char *lxc
 	lxc_monitor_fifo_send(&msg, lxcpath);
 }
 
+/*
+ * Registry of running containers: every container monitor keeps a file
+ * named after its container in "$rundir/lxc/$lxcpath/active" locked for as
+ * long as it runs. A monitor which dies without cleaning up leaves an
+ * unlocked file behind, which readers ignore and the next start replaces.
+ *
+ * Containers started before the registry existed, by a liblxc without it,
+ * are missing. Whoever creates the registry therefore marks it incomplete,
+ * until a reader has found every running container in it.
+ */
+#define LXC_ACTIVE_INCOMPLETE ".incomplete"
+
+int lxc_monitor_active_dir(const char *lxcpath, char *path, size_t path_sz,
+			   int do_mkdirp)
+{
+	int ret;
+	char *rundir;
+
+	rundir = get_rundir();
+	if (!rundir)
+		return -1;
+
+	ret = snprintf(path, path_sz, "%s/lxc/%s/active", rundir, lxcpath);
+	free(rundir);
+	if (ret < 0 || ret >= path_sz) {
+		ERROR("rundir/lxcpath too long for active container registry");
+		return -1;
+	}
+
+	if (do_mkdirp && mkdir_p(path, 0755) < 0) {
+		ERROR("unable to create active container registry %s", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+int lxc_monitor_active_register(const char *name, const char *lxcpath)
+{
+	int fd, ret;
+	char dir[PATH_MAX], path[PATH_MAX], tmp[PATH_MAX];
+	bool created;
+
+	if (lxc_monitor_active_dir(lxcpath, dir, sizeof(dir), 0) < 0)
+		return -1;
+
+	created = !dir_exists(dir);
+	if (created && lxc_monitor_active_dir(lxcpath, dir, sizeof(dir), 1) < 0)
+		return -1;
+
+	if (created) {
+		ret = snprintf(path, sizeof(path), "%s/%s", dir,
+			       LXC_ACTIVE_INCOMPLETE);
+		if (ret < 0 || ret >= sizeof(path))
+			return -1;
+		fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+		if (fd < 0) {
+			SYSERROR("failed to create %s", path);
+			return -1;
+		}
+		close(fd);
+	}
+
+	ret = snprintf(path, sizeof(path), "%s/%s", dir, name);
+	if (ret < 0 || ret >= sizeof(path))
+		return -1;
+
+	ret = snprintf(tmp, sizeof(tmp), "%s/.%s.%d", dir, name, getpid());
+	if (ret < 0 || ret >= sizeof(tmp))
+		return -1;
+
+	/* lock before renaming into place so readers never see the entry
+	 * unlocked while we are running */
+	fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		SYSERROR("failed to create %s", tmp);
+		return -1;
+	}
+
+	if (flock(fd, LOCK_EX | LOCK_NB) < 0 || rename(tmp, path) < 0) {
+		SYSERROR("failed to register %s in %s", name, dir);
+		unlink(tmp);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+void lxc_monitor_active_unregister(const char *name, const char *lxcpath, int fd)
+{
+	int ret;
+	char dir[PATH_MAX], path[PATH_MAX];
+	struct stat cur, ours;
+
+	if (fd < 0)
+		return;
+
+	if (lxc_monitor_active_dir(lxcpath, dir, sizeof(dir), 0) < 0)
+		goto out;
+
+	ret = snprintf(path, sizeof(path), "%s/%s", dir, name);
+	if (ret < 0 || ret >= sizeof(path))
+		goto out;
+
+	/* don't remove an entry a new instance of the container put there */
+	if (stat(path, &cur) == 0 && fstat(fd, &ours) == 0 &&
+	    cur.st_dev == ours.st_dev && cur.st_ino == ours.st_ino)
+		unlink(path);
+
+out:
+	close(fd);
+}
+
+bool lxc_monitor_active_incomplete(int dirfd)
+{
+	return faccessat(dirfd, LXC_ACTIVE_INCOMPLETE, F_OK, 0) == 0;
+}
+
+void lxc_monitor_active_complete(const char *lxcpath)
+{
+	char path[PATH_MAX];
+	size_t len;
+
+	if (lxc_monitor_active_dir(lxcpath, path, sizeof(path), 0) < 0)
+		return;
+
+	len = strlen(path);
+	if (snprintf(path + len, sizeof(path) - len, "/%s",
+		     LXC_ACTIVE_INCOMPLETE) >= sizeof(path) - len)
+		return;
+
+	if (unlink(path) == 0)
+		INFO("active container registry of %s is complete", lxcpath);
+}
+
+bool lxc_monitor_active_check(int dirfd, const char *name)
+{
+	int fd;
+	bool running = false;
+
+	fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	if (fd < 0)
+		return false;
+
+	if (flock(fd, LOCK_SH | LOCK_NB) < 0 && errno == EWOULDBLOCK)
+		running = true;
+
+	close(fd);
+	return running;
+}
 
 /* routines used by monitor subscribers (lxc-monitor) */
 int lxc_monitor_close(int fd)
@@ -51,6 +51,29 @@ extern void lxc_monitor_send_exit_code(const char *name, int exit_code,
 			    const char *lxcpath);
 extern int lxc_monitord_spawn(const char *lxcpath);
 
+/*
+ * Registry of the running containers of a lxcpath
+ * lxc_monitor_active_dir : path of the registry directory, created if
+ *   @do_mkdirp is set
+ * lxc_monitor_active_register : add @name, returns a fd which has to be
+ *   kept open while the container runs, < 0 on error
+ * lxc_monitor_active_unregister : remove @name and close @fd
+ * lxc_monitor_active_check : whether the entry @name of the opened registry
+ *   directory @dirfd belongs to a running container
+ * lxc_monitor_active_incomplete : whether running containers may be missing
+ *   from the opened registry directory @dirfd
+ * lxc_monitor_active_complete : clear that, once every running container
+ *   was found in the registry
+ */
+extern int lxc_monitor_active_dir(const char *lxcpath, char *path,
+				  size_t path_sz, int do_mkdirp);
+extern int lxc_monitor_active_register(const char *name, const char *lxcpath);
+extern void lxc_monitor_active_unregister(const char *name,
+					  const char *lxcpath, int fd);
+extern bool lxc_monitor_active_check(int dirfd, const char *name);
+extern bool lxc_monitor_active_incomplete(int dirfd);
+extern void lxc_monitor_active_complete(const char *lxcpath);
+
 /*
  * Open the monitoring mechanism for a specific container
  * The function will return an fd corresponding to the events
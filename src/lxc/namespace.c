@@ -57,6 +57,9 @@ pid_t lxc_clone(int (*fn)(void *), void *arg, int flags)
 	void *stack = alloca(stack_size);
 	pid_t ret;
 
+	/* keep the log in order, the child writes its own messages directly */
+	lxc_log_flush();
+
 #ifdef __ia64__
 	ret = __clone2(do_clone, stack,
 		       stack_size, flags | SIGCHLD, &clone_arg);
@@ -31,6 +31,8 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <time.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
@@ -1590,3 +1592,160 @@ int setup_private_host_hw_addr(char *veth1)
 
 	return 0;
 }
+
+struct netns_rtnl_args {
+	int netns_fd;
+	struct nl_handler *nlh;
+	int err;
+};
+
+static void *netns_rtnl_open_thread(void *data)
+{
+	struct netns_rtnl_args *args = data;
+
+	/* setns() only moves this thread, which ends right after */
+	if (setns(args->netns_fd, CLONE_NEWNET) < 0) {
+		args->err = -errno;
+		return NULL;
+	}
+
+	/* the socket stays bound to the namespace it was created in */
+	args->err = netlink_open(args->nlh, NETLINK_ROUTE);
+	return NULL;
+}
+
+int lxc_netns_rtnl_open(int netns_fd, struct nl_handler *nlh)
+{
+	struct netns_rtnl_args args = { .netns_fd = netns_fd, .nlh = nlh };
+	pthread_t thread;
+	int ret;
+
+	ret = pthread_create(&thread, NULL, netns_rtnl_open_thread, &args);
+	if (ret)
+		return -ret;
+
+	ret = pthread_join(thread, NULL);
+	if (ret)
+		return -ret;
+
+	return args.err;
+}
+
+struct netdev_list_args {
+	lxc_netdev_cb cb;
+	void *data;
+};
+
+static int netdev_list_cb(struct nlmsghdr *msg, void *data)
+{
+	struct netdev_list_args *args = data;
+	struct ifinfomsg *ifi;
+	struct rtattr *rta;
+	int attr_len;
+
+	if (msg->nlmsg_type != RTM_NEWLINK)
+		return 0;
+
+	ifi = NLMSG_DATA(msg);
+	attr_len = IFLA_PAYLOAD(msg);
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta, attr_len);
+	     rta = RTA_NEXT(rta, attr_len)) {
+		if (rta->rta_type != IFLA_IFNAME)
+			continue;
+
+		return args->cb(ifi->ifi_index, RTA_DATA(rta), args->data);
+	}
+
+	return 0;
+}
+
+int lxc_netdev_list(struct nl_handler *nlh, lxc_netdev_cb cb, void *data)
+{
+	struct netdev_list_args args = { cb, data };
+	struct nlmsg *nlmsg;
+	struct ifinfomsg *ifi;
+	int err;
+
+	nlmsg = nlmsg_alloc(NLMSG_GOOD_SIZE);
+	if (!nlmsg)
+		return -ENOMEM;
+
+	nlmsg->nlmsghdr->nlmsg_type = RTM_GETLINK;
+
+	err = -ENOMEM;
+	ifi = nlmsg_reserve(nlmsg, sizeof(struct ifinfomsg));
+	if (!ifi)
+		goto out;
+	ifi->ifi_family = AF_UNSPEC;
+
+	err = netlink_dump(nlh, nlmsg, netdev_list_cb, &args);
+out:
+	nlmsg_free(nlmsg);
+	return err;
+}
+
+struct ipaddr_list_args {
+	lxc_ipaddr_cb cb;
+	void *data;
+};
+
+static int ipaddr_list_cb(struct nlmsghdr *msg, void *data)
+{
+	struct ipaddr_list_args *args = data;
+	struct ifaddrmsg *ifa;
+	struct rtattr *rta;
+	void *addr = NULL;
+	int attr_len;
+
+	if (msg->nlmsg_type != RTM_NEWADDR)
+		return 0;
+
+	ifa = NLMSG_DATA(msg);
+	if (ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6)
+		return 0;
+
+	/* IFA_LOCAL is the address of a point-to-point link's local end,
+	 * IFA_ADDRESS its peer; prefer the former like getifaddrs() does */
+	attr_len = IFA_PAYLOAD(msg);
+	for (rta = IFA_RTA(ifa); RTA_OK(rta, attr_len);
+	     rta = RTA_NEXT(rta, attr_len)) {
+		if (rta->rta_type == IFA_LOCAL) {
+			addr = RTA_DATA(rta);
+			break;
+		}
+
+		if (rta->rta_type == IFA_ADDRESS)
+			addr = RTA_DATA(rta);
+	}
+
+	if (!addr)
+		return 0;
+
+	return args->cb(ifa->ifa_index, ifa->ifa_family, addr, args->data);
+}
+
+int lxc_ipaddr_list(struct nl_handler *nlh, int family, lxc_ipaddr_cb cb,
+		    void *data)
+{
+	struct ipaddr_list_args args = { cb, data };
+	struct nlmsg *nlmsg;
+	struct ifaddrmsg *ifa;
+	int err;
+
+	nlmsg = nlmsg_alloc(NLMSG_GOOD_SIZE);
+	if (!nlmsg)
+		return -ENOMEM;
+
+	nlmsg->nlmsghdr->nlmsg_type = RTM_GETADDR;
+
+	err = -ENOMEM;
+	ifa = nlmsg_reserve(nlmsg, sizeof(struct ifaddrmsg));
+	if (!ifa)
+		goto out;
+	ifa->ifa_family = family;
+
+	err = netlink_dump(nlh, nlmsg, ipaddr_list_cb, &args);
+out:
+	nlmsg_free(nlmsg);
+	return err;
+}
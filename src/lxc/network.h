@@ -141,4 +141,29 @@ extern char *lxc_mkifname(char *template);
 extern const char *lxc_net_type_to_str(int type);
 extern int setup_private_host_hw_addr(char *veth1);
 extern int netdev_get_mtu(int ifindex);
+
+struct nl_handler;
+
+/*
+ * Open a rtnetlink socket inside the network namespace referred to by
+ * @netns_fd without moving the caller there; the socket is opened by a
+ * short-lived thread, which alone enters the namespace
+ */
+extern int lxc_netns_rtnl_open(int netns_fd, struct nl_handler *nlh);
+
+/*
+ * Dump all network devices seen by @nlh, calling @cb for each of them.
+ * A negative return value of @cb stops the dump and is returned
+ */
+typedef int (*lxc_netdev_cb)(int ifindex, const char *ifname, void *data);
+extern int lxc_netdev_list(struct nl_handler *nlh, lxc_netdev_cb cb, void *data);
+
+/*
+ * Dump all addresses of @family (AF_UNSPEC for all) seen by @nlh, calling
+ * @cb with a struct in_addr or struct in6_addr for each of them
+ */
+typedef int (*lxc_ipaddr_cb)(int ifindex, int family, const void *addr,
+			     void *data);
+extern int lxc_ipaddr_list(struct nl_handler *nlh, int family,
+			   lxc_ipaddr_cb cb, void *data);
 #endif
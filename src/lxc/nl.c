@@ -260,6 +260,63 @@ extern int netlink_transaction(struct nl_handler *handler,
 	return 0;
 }
 
+extern int netlink_dump(struct nl_handler *handler, struct nlmsg *request,
+			int (*cb)(struct nlmsghdr *msg, void *data), void *data)
+{
+	struct nlmsg *answer;
+	struct nlmsghdr *msg;
+	int ret, len;
+	ssize_t answer_len;
+
+	request->nlmsghdr->nlmsg_flags |= NLM_F_REQUEST | NLM_F_DUMP;
+
+	ret = netlink_send(handler, request);
+	if (ret < 0)
+		return ret;
+
+	answer = nlmsg_alloc_reserve(NLMSG_DUMP_SIZE);
+	if (!answer)
+		return -ENOMEM;
+
+	/* the receive overwrites the length of the answer buffer */
+	answer_len = answer->nlmsghdr->nlmsg_len;
+
+	for (;;) {
+		answer->nlmsghdr->nlmsg_len = answer_len;
+
+		ret = netlink_rcv(handler, answer);
+		if (ret < 0)
+			goto out;
+		if (ret == 0) {
+			ret = -EIO;
+			goto out;
+		}
+
+		len = ret;
+		for (msg = answer->nlmsghdr; NLMSG_OK(msg, len);
+		     msg = NLMSG_NEXT(msg, len)) {
+			if (msg->nlmsg_type == NLMSG_DONE) {
+				ret = 0;
+				goto out;
+			}
+
+			if (msg->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *err = (struct nlmsgerr*)NLMSG_DATA(msg);
+				ret = err->error;
+				goto out;
+			}
+
+			ret = cb(msg, data);
+			if (ret < 0)
+				goto out;
+		}
+	}
+
+out:
+	nlmsg_free(answer);
+	return ret;
+}
+
 extern int netlink_open(struct nl_handler *handler, int protocol)
 {
 	socklen_t socklen;
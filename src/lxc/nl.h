@@ -30,6 +30,10 @@
 #define PAGE_SIZE 4096
 #endif
 #define NLMSG_GOOD_SIZE (2*PAGE_SIZE)
+/*
+ * Dump answers are batched by the kernel, use a larger buffer to receive them
+ */
+#define NLMSG_DUMP_SIZE (8*PAGE_SIZE)
 #define NLMSG_TAIL(nmsg) \
         ((struct rtattr *) (((void *) (nmsg)) + NLMSG_ALIGN((nmsg)->nlmsg_len)))
 #define NLA_DATA(na) ((void *)((char*)(na) + NLA_HDRLEN))
@@ -125,6 +129,22 @@ int netlink_send(struct nl_handler *handler, struct nlmsg *nlmsg);
 int netlink_transaction(struct nl_handler *handler,
 			struct nlmsg *request, struct nlmsg *anwser);
 
+/*
+ * netlink_dump: send a dump request to the kernel and hand every message
+ *  of the (multipart) answer to a callback until the dump is done.
+ *  NLM_F_REQUEST and NLM_F_DUMP are set on the request.
+ *
+ * @handler: a handler to a opened netlink socket
+ * @request: a netlink message pointer containing the request
+ * @cb: called for each message of the answer, a negative return value
+ *  aborts the dump and is returned
+ * @data: passed to @cb
+ *
+ * Returns 0 on success, < 0 otherwise
+ */
+int netlink_dump(struct nl_handler *handler, struct nlmsg *request,
+		 int (*cb)(struct nlmsghdr *msg, void *data), void *data);
+
 /*
  * nla_put_string: copy a null terminated string to a netlink message
  *  attribute
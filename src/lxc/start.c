@@ -25,12 +25,12 @@
 #include "config.h"
 
 #include <alloca.h>
-#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <grp.h>
 #include <poll.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -70,6 +70,7 @@
 #include "namespace.h"
 #include "start.h"
 #include "sync.h"
+#include "timing.h"
 #include "utils.h"
 #include "bdev/bdev.h"
 #include "lsm/lsm.h"
@@ -192,69 +193,158 @@ error:
 	return -1;
 }
 
-static int match_fd(int fd)
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+static int cmp_fd(const void *a, const void *b)
 {
-	return (fd == 0 || fd == 1 || fd == 2);
+	return *(const int *)a - *(const int *)b;
 }
 
 /*
- * Check for any fds we need to close
- * * if fd_to_ignore != -1, then if we find that fd open we will ignore it.
- * * By default we warn about open fds we find.
- * * If closeall is true, we will close open fds.
- * * If lxc-start was passed "-C", then conf->close_all_fds will be true,
- *     in which case we also close all open fds.
- * * A daemonized container will always pass closeall=true.
+ * Fill @keep with the fds which must survive, sorted and without
+ * duplicates. Returns their number.
  */
-int lxc_check_inherited(struct lxc_conf *conf, bool closeall, int fd_to_ignore)
+static int inherited_keep(int *keep, int fd_to_ignore)
 {
-	struct dirent dirent, *direntp;
-	int fd, fddir;
-	DIR *dir;
+	int i, n = 0, nkeep = 0;
+
+	keep[n++] = 0;
+	keep[n++] = 1;
+	keep[n++] = 2;
+	if (lxc_log_fd >= 0)
+		keep[n++] = lxc_log_fd;
+	if (current_config && current_config->logfd >= 0)
+		keep[n++] = current_config->logfd;
+	if (fd_to_ignore >= 0)
+		keep[n++] = fd_to_ignore;
+
+	qsort(keep, n, sizeof(*keep), cmp_fd);
+	for (i = 0; i < n; i++)
+		if (!nkeep || keep[nkeep - 1] != keep[i])
+			keep[nkeep++] = keep[i];
+	return nkeep;
+}
 
-	if (conf && conf->close_all_fds)
-		closeall = true;
+/* close everything but @keep with one close_range() per gap */
+static int close_inherited_range(const int *keep, int nkeep)
+{
+	unsigned int lo = 0;
+	int i;
+
+	for (i = 0; i <= nkeep; i++) {
+		unsigned int hi = i < nkeep ? (unsigned int)keep[i] : ~0U;
+
+		if (hi > lo && lxc_close_range(lo, hi - 1, 0) < 0)
+			return -1;
+		lo = hi + 1;
+	}
+	return 0;
+}
+
+/*
+ * Collect the open fds not in @keep in one pass over /proc/self/fd, the
+ * directory is read with getdents64() so that nothing is allocated per
+ * entry. Returns their number and the malloc()ed list in @fds, or -1.
+ */
+static int list_inherited(const int *keep, int nkeep, int **fds)
+{
+	char buf[4096];
+	struct linux_dirent64 *d;
+	int fddir, fd, n = 0, size = 0, *tmp;
+	long len, off;
+	char *end;
+
+	*fds = NULL;
 
-restart:
-	dir = opendir("/proc/self/fd");
-	if (!dir) {
+	fddir = open("/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fddir < 0) {
 		WARN("failed to open directory: %m");
 		return -1;
 	}
 
-	fddir = dirfd(dir);
+	while ((len = syscall(__NR_getdents64, fddir, buf, sizeof(buf))) > 0) {
+		for (off = 0; off < len; off += d->d_reclen) {
+			d = (struct linux_dirent64 *)(buf + off);
+			if (d->d_name[0] == '.')
+				continue;
+
+			fd = strtol(d->d_name, &end, 10);
+			if (*end || fd == fddir)
+				continue;
+			if (bsearch(&fd, keep, nkeep, sizeof(*keep), cmp_fd))
+				continue;
 
-	while (!readdir_r(dir, &dirent, &direntp)) {
-		if (!direntp)
+			if (n == size) {
+				size = size ? size * 2 : 64;
+				tmp = realloc(*fds, size * sizeof(**fds));
+				if (!tmp) {
+					len = -1;
+					break;
+				}
+				*fds = tmp;
+			}
+			(*fds)[n++] = fd;
+		}
+		if (len < 0)
 			break;
+	}
 
-		if (!strcmp(direntp->d_name, "."))
-			continue;
+	if (len < 0) {
+		WARN("failed to read directory: %m");
+		free(*fds);
+		*fds = NULL;
+		n = -1;
+	}
+	close(fddir);
+	return n;
+}
 
-		if (!strcmp(direntp->d_name, ".."))
-			continue;
+/*
+ * Check for any fds we need to close
+ * * if fd_to_ignore != -1, then if we find that fd open we will ignore it.
+ * * By default we warn about open fds we find.
+ * * If closeall is true, we will close open fds.
+ * * If lxc-start was passed "-C", then conf->close_all_fds will be true,
+ *     in which case we also close all open fds.
+ * * A daemonized container will always pass closeall=true.
+ *
+ * Closing does not depend on the number of open fds where the kernel has
+ * close_range(), otherwise they are listed once and closed.
+ */
+int lxc_check_inherited(struct lxc_conf *conf, bool closeall, int fd_to_ignore)
+{
+	int keep[6], nkeep, i, n, *fds;
 
-		fd = atoi(direntp->d_name);
+	if (conf && conf->close_all_fds)
+		closeall = true;
 
-		if (fd == fddir || fd == lxc_log_fd || fd == fd_to_ignore)
-			continue;
+	nkeep = inherited_keep(keep, fd_to_ignore);
 
-		if (current_config && fd == current_config->logfd)
-			continue;
+	if (closeall && close_inherited_range(keep, nkeep) == 0) {
+		INFO("closed inherited fds");
+		return 0;
+	}
 
-		if (match_fd(fd))
-			continue;
+	n = list_inherited(keep, nkeep, &fds);
+	if (n < 0)
+		return -1;
 
+	for (i = 0; i < n; i++) {
 		if (closeall) {
-			close(fd);
-			closedir(dir);
-			INFO("closed inherited fd %d", fd);
-			goto restart;
+			close(fds[i]);
+			INFO("closed inherited fd %d", fds[i]);
+		} else {
+			WARN("inherited fd %d", fds[i]);
 		}
-		WARN("inherited fd %d", fd);
 	}
 
-	closedir(dir); /* cannot fail */
+	free(fds);
 	return 0;
 }
 
@@ -397,7 +487,7 @@ out_sigfd:
 
 struct lxc_handler *lxc_init(const char *name, struct lxc_conf *conf, const char *lxcpath)
 {
-	int i;
+	int i, phase, step;
 	struct lxc_handler *handler;
 
 	handler = malloc(sizeof(*handler));
@@ -406,10 +496,18 @@ struct lxc_handler *lxc_init(const char *name, struct lxc_conf *conf, const char
 
 	memset(handler, 0, sizeof(*handler));
 
+	/* not fatal, the start just goes unmeasured */
+	handler->timing = lxc_timing_new();
+	lxc_timing_set_current(handler->timing);
+	phase = lxc_timing_begin("init");
+
 	handler->ttysock[0] = handler->ttysock[1] = -1;
+	handler->warmsock[0] = handler->warmsock[1] = -1;
+	handler->claimfd = handler->claimtimer = -1;
 	handler->conf = conf;
 	handler->lxcpath = lxcpath;
 	handler->pinfd = -1;
+	handler->activefd = -1;
 
 	for (i = 0; i < LXC_NS_MAX; i++)
 		handler->nsfd[i] = -1;
@@ -425,10 +523,19 @@ struct lxc_handler *lxc_init(const char *name, struct lxc_conf *conf, const char
 	if (lxc_cmd_init(name, handler, lxcpath))
 		goto out_free_name;
 
+	/* listing containers relies on the registry being complete */
+	handler->activefd = lxc_monitor_active_register(name, lxcpath);
+	if (handler->activefd < 0) {
+		ERROR("failed to add '%s' to the active container registry", name);
+		goto out_close_maincmd_fd;
+	}
+
+	step = lxc_timing_begin("seccomp.read");
 	if (lxc_read_seccomp_config(conf) != 0) {
 		ERROR("failed loading seccomp policy");
 		goto out_close_maincmd_fd;
 	}
+	lxc_timing_end(step);
 
 	/* Begin by setting the state to STARTING */
 	if (lxc_set_state(name, handler, STARTING)) {
@@ -475,16 +582,19 @@ struct lxc_handler *lxc_init(const char *name, struct lxc_conf *conf, const char
 	}
 
 	/* do this after setting up signals since it might unblock SIGWINCH */
+	step = lxc_timing_begin("console.create");
 	if (lxc_console_create(conf)) {
 		ERROR("failed to create console");
 		goto out_restore_sigmask;
 	}
+	lxc_timing_end(step);
 
 	if (ttys_shift_ids(conf) < 0) {
 		ERROR("Failed to shift tty into container");
 		goto out_restore_sigmask;
 	}
 
+	lxc_timing_end(phase);
 	INFO("'%s' is initialized", name);
 	return handler;
 
@@ -495,12 +605,14 @@ out_delete_tty:
 out_aborting:
 	lxc_set_state(name, handler, ABORTING);
 out_close_maincmd_fd:
+	lxc_monitor_active_unregister(name, lxcpath, handler->activefd);
 	close(conf->maincmd_fd);
 	conf->maincmd_fd = -1;
 out_free_name:
 	free(handler->name);
 	handler->name = NULL;
 out_free:
+	lxc_timing_free(handler->timing);
 	free(handler);
 	return NULL;
 }
@@ -565,6 +677,7 @@ void lxc_fini(const char *name, struct lxc_handler *handler)
 
 	lxc_console_delete(&handler->conf->console);
 	lxc_delete_tty(&handler->conf->tty_info);
+	lxc_monitor_active_unregister(name, handler->lxcpath, handler->activefd);
 	close(handler->conf->maincmd_fd);
 	handler->conf->maincmd_fd = -1;
 	free(handler->name);
@@ -572,11 +685,22 @@ void lxc_fini(const char *name, struct lxc_handler *handler)
 		close(handler->ttysock[0]);
 		close(handler->ttysock[1]);
 	}
+	if (handler->warmsock[0] != -1)
+		close(handler->warmsock[0]);
+	if (handler->warmsock[1] != -1)
+		close(handler->warmsock[1]);
+	/* a client still waiting for its claim sees the connection close */
+	if (handler->claimfd != -1)
+		close(handler->claimfd);
+	if (handler->claimtimer != -1)
+		close(handler->claimtimer);
+	free(handler->claim);
 
 	if (handler->conf->ephemeral == 1 && handler->conf->reboot != 1)
 		lxc_destroy_container_on_signal(handler, name);
 
 	cgroup_destroy(handler);
+	lxc_timing_free(handler->timing);
 	free(handler);
 }
 
@@ -593,6 +717,54 @@ void lxc_abort(const char *name, struct lxc_handler *handler)
 #include <sys/reboot.h>
 #include <linux/reboot.h>
 
+/*
+ * Called by init of a warm container once it is set up, but before its
+ * capabilities are dropped and its seccomp policy is loaded. Release the
+ * monitor, which marks the container RUNNING, and wait for it to pass on
+ * the identity the container is claimed with before going on to exec.
+ * The wait ends without an exec if the monitor goes away.
+ */
+static int do_park(struct lxc_handler *handler)
+{
+	char buf[LXC_CLAIM_MAX];
+	struct lxc_claim_answer answer = { .parked = 1 };
+	int phase, sock = handler->warmsock[1];
+	ssize_t len;
+
+	lxc_sync_fini_child(handler);
+
+	phase = lxc_timing_begin("warm.park");
+	for (;;) {
+		len = recv(sock, buf, sizeof(buf), 0);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0) {
+			INFO("container released before being claimed");
+			return -1;
+		}
+
+		answer.ret = lxc_claim_check(handler->conf, buf, len);
+		if (answer.ret == 0)
+			break;
+		if (send(sock, &answer, sizeof(answer), MSG_NOSIGNAL) < 0)
+			return -1;
+	}
+	lxc_timing_end(phase);
+
+	/* a half applied claim can't be undone, there is no going back to
+	 * waiting after this */
+	phase = lxc_timing_begin("warm.claim");
+	answer.ret = lxc_claim_setup(handler->conf, buf, len, true);
+	answer.parked = 0;
+	lxc_timing_end(phase);
+
+	if (send(sock, &answer, sizeof(answer), MSG_NOSIGNAL) < 0 ||
+	    answer.ret < 0)
+		return -1;
+	close(sock);
+	return 0;
+}
+
 /*
  * reboot(LINUX_REBOOT_CMD_CAD_ON) will return -EINVAL
  * in a child pid namespace if container reboot support exists.
@@ -710,7 +882,7 @@ static int do_start(void *data)
 {
 	struct lxc_list *iterator;
 	struct lxc_handler *handler = data;
-	int devnull_fd = -1, ret;
+	int devnull_fd = -1, ret, phase;
 	char path[PATH_MAX];
 
 	if (sigprocmask(SIG_SETMASK, &handler->oldmask, NULL)) {
@@ -731,6 +903,11 @@ static int do_start(void *data)
 
 	lxc_sync_fini_parent(handler);
 
+	if (handler->warmsock[0] != -1) {
+		close(handler->warmsock[0]);
+		handler->warmsock[0] = -1;
+	}
+
 	/* don't leak the pinfd to the container */
 	if (handler->pinfd >= 0) {
 		close(handler->pinfd);
@@ -829,10 +1006,12 @@ static int do_start(void *data)
 	}
 
 	/* Setup the container, ip, names, utsname, ... */
+	phase = lxc_timing_begin("setup");
 	if (lxc_setup(handler)) {
 		ERROR("failed to setup the container");
 		goto out_warn_father;
 	}
+	lxc_timing_end(phase);
 
 	/* ask father to setup cgroups and wait for him to finish */
 	if (lxc_sync_barrier_parent(handler, LXC_SYNC_CGROUP))
@@ -854,8 +1033,20 @@ static int do_start(void *data)
 	/* If we mounted a temporary proc, then unmount it now */
 	tmp_proc_unmount(handler->conf);
 
+	/* Claiming sets up network devices and the like, so it has to happen
+	 * before capabilities are dropped and the seccomp policy is loaded.
+	 */
+	if (handler->conf->warm) {
+		if (do_park(handler) < 0)
+			goto out_error;
+		if (lxc_setup_caps(handler->conf))
+			goto out_error;
+	}
+
+	phase = lxc_timing_begin("seccomp.load");
 	if (lxc_seccomp_load(handler->conf) != 0)
 		goto out_warn_father;
+	lxc_timing_end(phase);
 
 	if (run_lxc_hooks(handler->name, "start", handler->conf, handler->lxcpath, NULL)) {
 		ERROR("failed to run start hooks for container '%s'.", handler->name);
@@ -915,6 +1106,8 @@ static int do_start(void *data)
 
 	setsid();
 
+	lxc_timing_mark("exec");
+
 	/* after this call, we are in error because this
 	 * ops should not return as it execs */
 	handler->ops->start(handler, handler->data);
@@ -1043,8 +1236,10 @@ static int lxc_spawn(struct lxc_handler *handler)
 	int saved_ns_fd[LXC_NS_MAX];
 	int preserve_mask = 0, i, flags;
 	int netpipepair[2], nveths;
+	int spawn, phase;
 
 	netpipe = -1;
+	spawn = lxc_timing_begin("spawn");
 
 	for (i = 0; i < LXC_NS_MAX; i++)
 		if (handler->conf->inherit_ns_fd[i] != -1)
@@ -1058,6 +1253,13 @@ static int lxc_spawn(struct lxc_handler *handler)
 		return -1;
 	}
 
+	if (handler->conf->warm &&
+	    socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, handler->warmsock) < 0) {
+		SYSERROR("failed to create the warm socketpair");
+		lxc_sync_fini(handler);
+		return -1;
+	}
+
 	resolve_clone_flags(handler);
 
 	if (handler->clone_flags & CLONE_NEWNET) {
@@ -1089,17 +1291,21 @@ static int lxc_spawn(struct lxc_handler *handler)
 		}
 	}
 
+	phase = lxc_timing_begin("cgroup.init");
 	if (!cgroup_init(handler)) {
 		ERROR("failed initializing cgroup support");
 		goto out_delete_net;
 	}
+	lxc_timing_end(phase);
 
 	cgroups_connected = true;
 
+	phase = lxc_timing_begin("cgroup.create");
 	if (!cgroup_create(handler)) {
 		ERROR("failed creating cgroups");
 		goto out_delete_net;
 	}
+	lxc_timing_end(phase);
 
 	/*
 	 * if the rootfs is not a blockdev, prevent the container from
@@ -1135,11 +1341,13 @@ static int lxc_spawn(struct lxc_handler *handler)
 	flags = handler->clone_flags;
 	if (handler->clone_flags & CLONE_NEWUSER)
 		flags &= ~CLONE_NEWNET;
+	phase = lxc_timing_begin("clone");
 	handler->pid = lxc_clone(do_start, handler, handler->clone_flags);
 	if (handler->pid < 0) {
 		SYSERROR("failed to fork into a new namespace");
 		goto out_delete_net;
 	}
+	lxc_timing_end(phase);
 
 	if (!preserve_ns(handler->nsfd, handler->clone_flags | preserve_mask, handler->pid, &errmsg)) {
 		INFO("Failed to store namespace references for stop hook: %s",
@@ -1151,16 +1359,22 @@ static int lxc_spawn(struct lxc_handler *handler)
 		WARN("failed to restore saved namespaces");
 
 	lxc_sync_fini_child(handler);
+	if (handler->warmsock[1] != -1) {
+		close(handler->warmsock[1]);
+		handler->warmsock[1] = -1;
+	}
 
 	/* map the container uids - the container became an invalid
 	 * userid the moment it was cloned with CLONE_NEWUSER - this
 	 * call doesn't change anything immediately, but allows the
 	 * container to setuid(0) (0 being mapped to something else on
 	 * the host) later to become a valid uid again */
+	phase = lxc_timing_begin("map_ids");
 	if (lxc_map_ids(&handler->conf->id_map, handler->pid)) {
 		ERROR("failed to set up id mapping");
 		goto out_delete_net;
 	}
+	lxc_timing_end(phase);
 
 	if (lxc_sync_wake_child(handler, LXC_SYNC_STARTUP)) {
 		failed_before_rename = 1;
@@ -1172,20 +1386,28 @@ static int lxc_spawn(struct lxc_handler *handler)
 		goto out_delete_net;
 	}
 
+	phase = lxc_timing_begin("cgroup.create_legacy");
 	if (!cgroup_create_legacy(handler)) {
 		ERROR("failed to setup the legacy cgroups for %s", name);
 		goto out_delete_net;
 	}
+	lxc_timing_end(phase);
+	phase = lxc_timing_begin("cgroup.setup_limits");
 	if (!cgroup_setup_limits(handler, false)) {
 		ERROR("failed to setup the cgroup limits for '%s'", name);
 		goto out_delete_net;
 	}
+	lxc_timing_end(phase);
 
+	phase = lxc_timing_begin("cgroup.enter");
 	if (!cgroup_enter(handler))
 		goto out_delete_net;
+	lxc_timing_end(phase);
 
+	phase = lxc_timing_begin("cgroup.chown");
 	if (!cgroup_chown(handler))
 		goto out_delete_net;
+	lxc_timing_end(phase);
 
 	if (failed_before_rename)
 		goto out_delete_net;
@@ -1222,19 +1444,23 @@ static int lxc_spawn(struct lxc_handler *handler)
 	if (lxc_sync_barrier_child(handler, LXC_SYNC_POST_CONFIGURE))
 		goto out_delete_net;
 
+	phase = lxc_timing_begin("cgroup.setup_devices");
 	if (!cgroup_setup_limits(handler, true)) {
 		ERROR("failed to setup the devices cgroup for '%s'", name);
 		goto out_delete_net;
 	}
+	lxc_timing_end(phase);
 
 	cgroup_disconnect();
 	cgroups_connected = false;
 
 	/* read tty fds allocated by child */
+	phase = lxc_timing_begin("ttys.recv");
 	if (recv_ttys_from_child(handler) < 0) {
 		ERROR("failed to receive tty info from child");
 		goto out_delete_net;
 	}
+	lxc_timing_end(phase);
 
 	/* Tell the child to complete its initialization and wait for
 	 * it to exec or return an error.  (the child will never
@@ -1249,8 +1475,10 @@ static int lxc_spawn(struct lxc_handler *handler)
 	if (detect_shared_rootfs())
 		umount2(handler->conf->rootfs.mount, MNT_DETACH);
 
+	phase = lxc_timing_begin("post_start");
 	if (handler->ops->post_start(handler, handler->data))
 		goto out_abort;
+	lxc_timing_end(phase);
 
 	if (lxc_set_state(name, handler, RUNNING)) {
 		ERROR("failed to set state to %s",
@@ -1258,7 +1486,11 @@ static int lxc_spawn(struct lxc_handler *handler)
 		goto out_abort;
 	}
 
+	if (handler->conf->warm)
+		handler->warm_state = LXC_WARM_PARKED;
+
 	lxc_sync_fini(handler);
+	lxc_timing_end(spawn);
 
 	return 0;
 
@@ -1304,7 +1536,7 @@ int __lxc_start(const char *name, struct lxc_conf *conf,
 {
 	struct lxc_handler *handler;
 	int err = -1;
-	int status;
+	int status, phase;
 	int netnsfd = -1;
 
 	handler = lxc_init(name, conf, lxcpath);
@@ -1340,15 +1572,19 @@ int __lxc_start(const char *name, struct lxc_conf *conf,
 				goto out_fini_nonet;
 			}
 			remount_all_slave();
+			phase = lxc_timing_begin("rootfs.premount");
 			if (do_rootfs_setup(conf, name, lxcpath) < 0) {
 				ERROR("Error setting up rootfs mount as root before spawn");
 				goto out_fini_nonet;
 			}
+			lxc_timing_end(phase);
 			INFO("Set up container rootfs as host root");
 		}
 	}
 
 	err = lxc_spawn(handler);
+	if (handler->timing)
+		lxc_timing_write(handler->timing, name, lxcpath);
 	if (err) {
 		ERROR("failed to spawn '%s'", name);
 		goto out_detach_blockdev;
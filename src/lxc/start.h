@@ -59,6 +59,22 @@ struct ns_info {
 
 extern const struct ns_info ns_info[LXC_NS_MAX];
 
+/* state of a container started with lxc.warm, see lxc_cmd_claim() */
+enum {
+	LXC_WARM_NONE,
+	LXC_WARM_PARKED,
+	LXC_WARM_CLAIMED,
+	LXC_WARM_CLAIMING, /* waiting for init to apply a claim */
+};
+
+/* what a parked init answers to a claim */
+struct lxc_claim_answer {
+	int ret;
+	/* the claim was refused and init still waits for another one; if
+	 * applying it failed instead, init is on its way out */
+	int parked;
+};
+
 struct lxc_handler {
 	pid_t pid;
 	char *name;
@@ -76,6 +92,14 @@ struct lxc_handler {
 	int ttysock[2]; // socketpair for child->parent tty fd passing
 	bool backgrounded; // indicates whether should we close std{in,out,err} on start
 	int nsfd[LXC_NS_MAX];
+	int activefd; // locked entry in the active container registry
+	struct lxc_timing *timing; // phase timing of the start
+	int warmsock[2]; // socketpair to hand the claim to a parked init
+	int warm_state;
+	int claimfd; // client waiting for init to answer its claim
+	int claimtimer; // timerfd bounding that wait
+	char *claim; // the items of that claim
+	int claimlen;
 };
 
 
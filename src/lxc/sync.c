@@ -30,9 +30,27 @@
 #include "sync.h"
 #include "log.h"
 #include "start.h"
+#include "timing.h"
 
 lxc_log_define(lxc_sync, lxc);
 
+static const char *sync_str(int sequence)
+{
+	static const char * const names[] = {
+		[LXC_SYNC_STARTUP]        = "startup",
+		[LXC_SYNC_CONFIGURE]      = "configure",
+		[LXC_SYNC_POST_CONFIGURE] = "post_configure",
+		[LXC_SYNC_CGROUP]         = "cgroup",
+		[LXC_SYNC_POST_CGROUP]    = "post_cgroup",
+		[LXC_SYNC_RESTART]        = "restart",
+		[LXC_SYNC_POST_RESTART]   = "post_restart",
+	};
+
+	if (sequence < 0 || sequence >= sizeof(names) / sizeof(names[0]))
+		return "unknown";
+	return names[sequence];
+}
+
 static int __sync_wait(int fd, int sequence)
 {
 	int sync = -1;
@@ -77,11 +95,27 @@ static int __sync_wake(int fd, int sequence)
 	return 0;
 }
 
+/* time spent waiting on the other side of the start */
+static int __sync_wait_timed(int fd, int sequence)
+{
+	int phase, ret;
+
+	phase = lxc_timing_begin("sync.wait %s", sync_str(sequence));
+	ret = __sync_wait(fd, sequence);
+	lxc_timing_end(phase);
+	return ret;
+}
+
 static int __sync_barrier(int fd, int sequence)
 {
+	int phase, ret;
+
 	if (__sync_wake(fd, sequence))
 		return -1;
-	return __sync_wait(fd, sequence+1);
+	phase = lxc_timing_begin("sync.barrier %s", sync_str(sequence));
+	ret = __sync_wait(fd, sequence+1);
+	lxc_timing_end(phase);
+	return ret;
 }
 
 int lxc_sync_barrier_parent(struct lxc_handler *handler, int sequence)
@@ -101,12 +135,12 @@ int lxc_sync_wake_parent(struct lxc_handler *handler, int sequence)
 
 int lxc_sync_wait_parent(struct lxc_handler *handler, int sequence)
 {
-	return __sync_wait(handler->sv[0], sequence);
+	return __sync_wait_timed(handler->sv[0], sequence);
 }
 
 int lxc_sync_wait_child(struct lxc_handler *handler, int sequence)
 {
-	return __sync_wait(handler->sv[1], sequence);
+	return __sync_wait_timed(handler->sv[1], sequence);
 }
 
 int lxc_sync_wake_child(struct lxc_handler *handler, int sequence)
@@ -0,0 +1,219 @@
+/*
+ * lxc: linux Container library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+
+#include "log.h"
+#include "timing.h"
+#include "utils.h"
+
+lxc_log_define(lxc_timing, lxc);
+
+static __thread struct lxc_timing *current_timing;
+
+static uint64_t timing_now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return 0;
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct lxc_timing *lxc_timing_new(void)
+{
+	struct lxc_timing *timing;
+
+	/* shared, so that the container's child records into it as well */
+	timing = mmap(NULL, sizeof(*timing), PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (timing == MAP_FAILED) {
+		SYSERROR("failed to allocate start timing");
+		return NULL;
+	}
+	timing->epoch = timing_now();
+	timing->monitor = getpid();
+	return timing;
+}
+
+void lxc_timing_free(struct lxc_timing *timing)
+{
+	if (!timing)
+		return;
+	if (current_timing == timing)
+		current_timing = NULL;
+	munmap(timing, sizeof(*timing));
+}
+
+void lxc_timing_set_current(struct lxc_timing *timing)
+{
+	current_timing = timing;
+}
+
+static int timing_vbegin(const char *fmt, va_list ap)
+{
+	struct lxc_timing *timing = current_timing;
+	struct lxc_timing_phase *phase;
+	unsigned int n;
+
+	if (!timing)
+		return -1;
+
+	/* the monitor and the container's child may record at the same time */
+	n = __sync_fetch_and_add(&timing->nphases, 1);
+	if (n >= LXC_TIMING_MAX)
+		return -1;
+
+	phase = &timing->phases[n];
+	vsnprintf(phase->name, sizeof(phase->name), fmt, ap);
+	phase->pid = getpid();
+	phase->start = timing_now() - timing->epoch;
+	return n;
+}
+
+int lxc_timing_begin(const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = timing_vbegin(fmt, ap);
+	va_end(ap);
+	return n;
+}
+
+void lxc_timing_end(int n)
+{
+	struct lxc_timing *timing = current_timing;
+
+	if (!timing || n < 0 || n >= LXC_TIMING_MAX)
+		return;
+	timing->phases[n].end = timing_now() - timing->epoch;
+	__sync_synchronize();
+	timing->phases[n].done = 1;
+}
+
+void lxc_timing_mark(const char *fmt, ...)
+{
+	struct lxc_timing *timing = current_timing;
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = timing_vbegin(fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		return;
+	timing->phases[n].end = timing->phases[n].start;
+	__sync_synchronize();
+	timing->phases[n].done = 1;
+}
+
+static int phase_cmp(const void *a, const void *b)
+{
+	const struct lxc_timing_phase *p1 = *(const struct lxc_timing_phase **)a;
+	const struct lxc_timing_phase *p2 = *(const struct lxc_timing_phase **)b;
+
+	if (p1->start != p2->start)
+		return p1->start < p2->start ? -1 : 1;
+	/* phases opened in the same tick stay in the order they were opened */
+	return p1 < p2 ? -1 : (p1 > p2);
+}
+
+char *lxc_timing_format(struct lxc_timing *timing, const char *name,
+			size_t *len)
+{
+	struct lxc_timing_phase *sorted[LXC_TIMING_MAX];
+	unsigned int i, n, total;
+	size_t sz = LXC_TIMING_DATA_MAX, off = 0;
+	char *buf;
+	int ret;
+
+	buf = malloc(sz);
+	if (!buf)
+		return NULL;
+
+	total = timing->nphases;
+	n = MIN(total, LXC_TIMING_MAX);
+	for (i = 0; i < n; i++)
+		sorted[i] = &timing->phases[i];
+	qsort(sorted, n, sizeof(sorted[0]), phase_cmp);
+
+	ret = snprintf(buf, sz, "# start timing of %s, in ms since lxc_init\n"
+		       "# %-38s %-7s %10s %10s\n", name, "phase", "process", "start",
+		       "duration");
+	off += ret;
+	for (i = 0; i < n; i++) {
+		struct lxc_timing_phase *p = sorted[i];
+		/* the child's pid is that of its own pid namespace */
+		const char *who = p->pid == timing->monitor ? "monitor" : "child";
+
+		/* still open, or its process died inside of it */
+		if (!p->done)
+			ret = snprintf(buf + off, sz - off, "%-40s %-7s %10.3f %10s\n",
+				       p->name, who, p->start / 1e6, "-");
+		else
+			ret = snprintf(buf + off, sz - off, "%-40s %-7s %10.3f %10.3f\n",
+				       p->name, who, p->start / 1e6,
+				       (p->end - p->start) / 1e6);
+		if (ret < 0 || (size_t)ret >= sz - off)
+			break;
+		off += ret;
+	}
+	if (total > n && off < sz) {
+		ret = snprintf(buf + off, sz - off, "# %u phases dropped\n", total - n);
+		if (ret > 0 && (size_t)ret < sz - off)
+			off += ret;
+	}
+
+	*len = off;
+	return buf;
+}
+
+int lxc_timing_write(struct lxc_timing *timing, const char *name,
+		     const char *lxcpath)
+{
+	char path[MAXPATHLEN];
+	char *buf;
+	size_t len;
+	int ret;
+
+	ret = snprintf(path, sizeof(path), "%s/%s/start-timing", lxcpath, name);
+	if (ret < 0 || ret >= sizeof(path))
+		return -1;
+
+	buf = lxc_timing_format(timing, name, &len);
+	if (!buf)
+		return -1;
+	ret = lxc_write_to_file(path, buf, len, false);
+	if (ret < 0)
+		WARN("failed to write start timing to %s: %s", path,
+		     strerror(errno));
+	free(buf);
+	return ret;
+}
@@ -0,0 +1,86 @@
+/*
+ * lxc: linux Container library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LXC_TIMING_H
+#define __LXC_TIMING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Phase timing of the container start pipeline.
+ *
+ * lxc_init() creates a trace in a shared anonymous mapping, so that phases
+ * recorded by the container's child process before it execs init land in
+ * the same trace as those of the monitor. Phases are recorded against the
+ * trace current in the calling thread, which keeps the call sites free of
+ * plumbing; outside of a container start there is no current trace and
+ * recording is a no-op.
+ */
+
+#define LXC_TIMING_NAME_MAX 96
+#define LXC_TIMING_MAX 512
+/* the file and command response size of a full trace */
+#define LXC_TIMING_DATA_MAX (LXC_TIMING_MAX * (LXC_TIMING_NAME_MAX + 40) + 256)
+
+struct lxc_timing_phase {
+	char name[LXC_TIMING_NAME_MAX];
+	pid_t pid; /* as seen by the recording process */
+	int done;
+	uint64_t start; /* ns since the trace began */
+	uint64_t end;
+};
+
+struct lxc_timing {
+	uint64_t epoch; /* CLOCK_MONOTONIC ns at lxc_timing_new() */
+	pid_t monitor; /* the process which created the trace */
+	unsigned int nphases; /* may exceed LXC_TIMING_MAX, excess is dropped */
+	struct lxc_timing_phase phases[LXC_TIMING_MAX];
+};
+
+extern struct lxc_timing *lxc_timing_new(void);
+extern void lxc_timing_free(struct lxc_timing *timing);
+
+/* Make @timing (may be NULL) the trace recorded into by this thread. */
+extern void lxc_timing_set_current(struct lxc_timing *timing);
+
+/*
+ * Open a phase named after @fmt in the current trace. Returns a handle for
+ * lxc_timing_end(), -1 if nothing is recorded.
+ */
+extern int lxc_timing_begin(const char *fmt, ...)
+	__attribute__((format(printf, 1, 2)));
+extern void lxc_timing_end(int phase);
+
+/* Record a zero-length phase, e.g. the exec of the container's init. */
+extern void lxc_timing_mark(const char *fmt, ...)
+	__attribute__((format(printf, 1, 2)));
+
+/*
+ * Render @timing as text, one phase per line in order of their start.
+ * Returns the malloc()ed text, its length in @len.
+ */
+extern char *lxc_timing_format(struct lxc_timing *timing, const char *name,
+			       size_t *len);
+
+/* Store the rendered trace in $lxcpath/$name/start-timing. */
+extern int lxc_timing_write(struct lxc_timing *timing, const char *name,
+			    const char *lxcpath);
+
+#endif
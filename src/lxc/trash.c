@@ -0,0 +1,270 @@
+/*
+ * lxc: linux Container library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/param.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "log.h"
+#include "start.h"
+#include "trash.h"
+#include "utils.h"
+
+lxc_log_define(lxc_trash, lxc);
+
+#define LXC_TRASH_DIR ".lxc-trash"
+
+#ifndef IOPRIO_WHO_PROCESS
+#define IOPRIO_WHO_PROCESS 1
+#endif
+
+#ifndef IOPRIO_CLASS_IDLE
+#define IOPRIO_CLASS_IDLE 3
+#endif
+
+#ifndef IOPRIO_CLASS_SHIFT
+#define IOPRIO_CLASS_SHIFT 13
+#endif
+
+int lxc_trash_path(const char *lxcpath, char *path, size_t sz)
+{
+	int ret;
+
+	ret = snprintf(path, sz, "%s/%s", lxcpath, LXC_TRASH_DIR);
+	if (ret < 0 || (size_t)ret >= sz)
+		return -1;
+
+	return 0;
+}
+
+int lxc_trash_move(const char *lxcpath, const char *path)
+{
+	char trash[MAXPATHLEN], entry[MAXPATHLEN], *tmp, *name;
+	int ret;
+
+	if (lxc_trash_path(lxcpath, trash, sizeof(trash)) < 0)
+		return -ENAMETOOLONG;
+
+	if (mkdir(trash, 0700) < 0 && errno != EEXIST) {
+		SYSERROR("Failed to create %s", trash);
+		return -errno;
+	}
+
+	tmp = strdupa(path);
+	name = basename(tmp);
+
+	ret = snprintf(entry, sizeof(entry), "%s/%s.XXXXXX", trash, name);
+	if (ret < 0 || (size_t)ret >= sizeof(entry))
+		return -ENAMETOOLONG;
+
+	/*
+	 * The placeholder makes the entry name unique. rename() atomically
+	 * replaces it, so after a crash we are left with either the original
+	 * directory or an entry in the trash.
+	 */
+	if (!mkdtemp(entry)) {
+		SYSERROR("Failed to create trash entry for %s", path);
+		return -errno;
+	}
+
+	if (rename(path, entry) < 0) {
+		ret = -errno;
+		rmdir(entry);
+		if (ret != -EXDEV)
+			SYSERROR("Failed to move %s to %s", path, entry);
+		return ret;
+	}
+
+	INFO("Moved %s to %s", path, entry);
+	return 0;
+}
+
+/*
+ * The reaper should not compete with running containers, so it does its
+ * I/O in the idle class and runs at the lowest CPU priority. Both are
+ * inherited by the threads lxc_rmdir_onedev() starts.
+ */
+static void lxc_trash_throttle(void)
+{
+#ifdef __NR_ioprio_set
+	if (syscall(__NR_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+		    IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) < 0)
+		WARN("Failed to set idle I/O priority: %s", strerror(errno));
+#endif
+	if (setpriority(PRIO_PROCESS, 0, 19) < 0)
+		WARN("Failed to lower CPU priority: %s", strerror(errno));
+}
+
+/*
+ * Remove every entry of the trash once. Returns the number of entries
+ * removed and stores the number of those which could not be in @left.
+ */
+static int lxc_trash_pass(DIR *dir, const char *trash, int *left)
+{
+	char entry[MAXPATHLEN];
+	struct dirent *direntp;
+	int ret, removed = 0;
+
+	*left = 0;
+	rewinddir(dir);
+	while ((direntp = readdir(dir))) {
+		if (!strcmp(direntp->d_name, ".") ||
+		    !strcmp(direntp->d_name, ".."))
+			continue;
+
+		ret = snprintf(entry, sizeof(entry), "%s/%s", trash, direntp->d_name);
+		if (ret < 0 || (size_t)ret >= sizeof(entry))
+			continue;
+
+		if (lxc_rmdir_onedev(entry, NULL) < 0) {
+			ERROR("Failed to remove %s", entry);
+			(*left)++;
+			continue;
+		}
+		INFO("Removed %s", entry);
+		removed++;
+	}
+
+	return removed;
+}
+
+static int lxc_trash_count(DIR *dir)
+{
+	struct dirent *direntp;
+	int n = 0;
+
+	rewinddir(dir);
+	while ((direntp = readdir(dir)))
+		if (strcmp(direntp->d_name, ".") && strcmp(direntp->d_name, ".."))
+			n++;
+
+	return n;
+}
+
+int lxc_trash_reap(const char *lxcpath)
+{
+	char trash[MAXPATHLEN];
+	DIR *dir;
+	int fd, left = 0, ret = 0;
+
+	if (lxc_trash_path(lxcpath, trash, sizeof(trash)) < 0)
+		return -1;
+
+	fd = open(trash, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return errno == ENOENT ? 0 : -1;
+
+	dir = fdopendir(fd);
+	if (!dir) {
+		close(fd);
+		return -1;
+	}
+
+	/*
+	 * Only one reaper works at a time, others leave right away. Anyone
+	 * who moved something into the trash starts a reaper afterwards, so
+	 * the one holding the lock keeps going until a pass finds nothing to
+	 * remove, and looks again after releasing the lock, since a reaper
+	 * turned away just before then may have left an entry behind.
+	 */
+	for (;;) {
+		if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+			if (errno != EWOULDBLOCK) {
+				SYSERROR("Failed to lock %s", trash);
+				ret = -1;
+			}
+			break;
+		}
+
+		lxc_trash_throttle();
+		while (lxc_trash_pass(dir, trash, &left) > 0)
+			;
+
+		flock(fd, LOCK_UN);
+		if (lxc_trash_count(dir) <= left) {
+			ret = left ? -1 : 0;
+			break;
+		}
+	}
+
+	closedir(dir);
+	return ret;
+}
+
+int lxc_trash_reap_spawn(const char *lxcpath)
+{
+	char trash[MAXPATHLEN];
+	sigset_t mask;
+	pid_t pid;
+	int ret;
+
+	if (lxc_trash_path(lxcpath, trash, sizeof(trash)) < 0)
+		return -1;
+
+	if (!dir_exists(trash))
+		return 0;
+
+	/* double fork to avoid zombies when the reaper exits */
+	pid = fork();
+	if (pid < 0) {
+		SYSERROR("failed to fork");
+		return -1;
+	}
+
+	if (pid) {
+		if (waitpid(pid, NULL, 0) != pid)
+			return -1;
+		return 0;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		SYSERROR("failed to fork");
+		_exit(EXIT_FAILURE);
+	}
+	if (pid)
+		_exit(EXIT_SUCCESS);
+
+	if (setsid() < 0)
+		SYSERROR("failed to setsid");
+
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+
+	lxc_check_inherited(NULL, true, -1);
+	if (null_stdfds() < 0)
+		_exit(EXIT_FAILURE);
+
+	ret = lxc_trash_reap(lxcpath);
+	lxc_log_flush();
+	_exit(ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,54 @@
+/*
+ * lxc: linux Container library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LXC_TRASH_H
+#define __LXC_TRASH_H
+
+#include <stddef.h>
+
+/*
+ * Deferred removal of container directories.
+ *
+ * A container which is destroyed asynchronously has its directory renamed
+ * into the trash area of its lxcpath ($lxcpath/.lxc-trash), which frees
+ * its name right away. A reaper running at idle I/O priority removes the
+ * contents of the trash later on. Since entries stay on disk until they
+ * are deleted, anything left behind by a crash is picked up by the next
+ * reaper, which lxc-monitord starts whenever it comes up.
+ */
+
+/* Store the trash directory of @lxcpath in @path. */
+extern int lxc_trash_path(const char *lxcpath, char *path, size_t sz);
+
+/*
+ * Move @path into the trash of @lxcpath. Returns 0 on success or a
+ * negative errno, -EXDEV if @path is on a different filesystem.
+ */
+extern int lxc_trash_move(const char *lxcpath, const char *path);
+
+/*
+ * Remove everything in the trash of @lxcpath. Returns 0 right away if
+ * another reaper is at work, which then also removes what is moved into
+ * the trash in the meantime.
+ */
+extern int lxc_trash_reap(const char *lxcpath);
+
+/* Run lxc_trash_reap() in a detached background process. */
+extern int lxc_trash_reap_spawn(const char *lxcpath);
+
+#endif
@@ -28,6 +28,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <libgen.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -87,97 +88,366 @@ lxc_log_define(lxc_utils, lxc);
  */
 extern bool btrfs_try_remove_subvol(const char *path);
 
-static int _recursive_rmdir(char *dirname, dev_t pdev,
-			    const char *exclude, int level, bool onedev)
-{
-	struct dirent dirent, *direntp;
+/*
+ * Recursive delete used by lxc_rmdir_onedev().
+ *
+ * Every directory becomes a node which is handed out to a pool of worker
+ * threads. A worker opens its node relative to the parent's directory fd,
+ * unlinks the non-directory entries relative to its own and queues the
+ * subdirectories as new nodes. A node counts its own scan plus every queued
+ * subdirectory, and whoever drops that count to zero closes the directory,
+ * removes it from its parent and releases the parent. Only the counts and
+ * the queue are under the lock, no syscalls are. A directory therefore
+ * stays open only while some of its subdirectories are still pending, and
+ * full paths are only put together for messages and the btrfs fallback.
+ */
+#define LXC_RMDIR_MAX_WORKERS 8
+
+struct rmdir_node {
+	/* relative to the parent's directory, the full path for the root */
+	char *name;
 	DIR *dir;
-	int ret, failed=0;
+	struct rmdir_node *parent;
+	int pending;
+	int level;
+	/* the excluded snapshot directory was kept, so we cannot be removed */
+	bool keep;
+	struct rmdir_node *next;
+};
+
+struct rmdir_ctx {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct rmdir_node *queue;
+	int busy;
+	bool failed;
+	dev_t pdev;
+	const char *exclude;
+	bool onedev;
+};
+
+static struct rmdir_node *rmdir_node_new(const char *name,
+					 struct rmdir_node *parent)
+{
+	struct rmdir_node *node;
+
+	node = malloc(sizeof(*node));
+	if (!node)
+		return NULL;
+
+	node->name = strdup(name);
+	if (!node->name) {
+		free(node);
+		return NULL;
+	}
+
+	node->dir = NULL;
+	node->parent = parent;
+	node->pending = 1;
+	node->level = parent ? parent->level + 1 : 0;
+	node->keep = false;
+	node->next = NULL;
+	return node;
+}
+
+/*
+ * Put the path of @node, followed by @name if not NULL, into @buf. Returns
+ * the length of the path, or -1 if it does not fit.
+ */
+static int rmdir_node_path(const struct rmdir_node *node, const char *name,
+			   char *buf, size_t size)
+{
+	int len, ret;
+
+	if (node->parent)
+		len = rmdir_node_path(node->parent, node->name, buf, size);
+	else
+		len = snprintf(buf, size, "%s", node->name);
+	if (len < 0 || len >= size)
+		return -1;
+
+	if (!name)
+		return len;
+
+	ret = snprintf(buf + len, size - len, "/%s", name);
+	if (ret < 0 || ret >= size - len)
+		return -1;
+
+	return len + ret;
+}
+
+/* Like rmdir_node_path() for messages, falling back to the bare name. */
+static const char *rmdir_node_name(const struct rmdir_node *node,
+				   const char *name, char *buf, size_t size)
+{
+	if (rmdir_node_path(node, name, buf, size) < 0)
+		return name ? name : node->name;
+	return buf;
+}
+
+/*
+ * Close and remove @node once nothing is pending on it anymore. Called
+ * without ctx->lock, the parent stays open as @node still counts on it.
+ * Returns -1 on failure.
+ */
+static int rmdir_node_remove(struct rmdir_node *node)
+{
 	char pathname[MAXPATHLEN];
-	bool hadexclude = false;
+	int ret;
+
+	if (node->dir)
+		closedir(node->dir);
+
+	if (node->parent)
+		ret = unlinkat(dirfd(node->parent->dir), node->name,
+			       AT_REMOVEDIR);
+	else
+		ret = rmdir(node->name);
+	if (ret < 0 &&
+	    (rmdir_node_path(node, NULL, pathname, sizeof(pathname)) < 0 ||
+	     !btrfs_try_remove_subvol(pathname)) && !node->keep) {
+		ERROR("%s: failed to delete %s", __func__,
+		      rmdir_node_name(node, NULL, pathname, sizeof(pathname)));
+		ret = -1;
+	} else {
+		ret = 0;
+	}
+
+	free(node->name);
+	free(node);
+	return ret;
+}
+
+static int rmdir_exclude(int dirfd, const char *name, struct rmdir_node *node)
+{
+	char buf[MAXPATHLEN];
+	const char *pathname;
+	int saved_errno;
+
+	if (unlinkat(dirfd, name, AT_REMOVEDIR) == 0)
+		return 0;
 
-	dir = opendir(dirname);
-	if (!dir) {
-		ERROR("%s: failed to open %s", __func__, dirname);
+	saved_errno = errno;
+	pathname = rmdir_node_name(node, name, buf, sizeof(buf));
+	errno = saved_errno;
+	switch (errno) {
+	case ENOTEMPTY:
+		INFO("Not deleting snapshot %s", pathname);
+		node->keep = true;
+		return 0;
+	case ENOTDIR:
+		if (unlinkat(dirfd, name, 0) < 0)
+			INFO("%s: failed to remove %s", __func__, pathname);
+		return 0;
+	default:
+		SYSERROR("%s: failed to rmdir %s", __func__, pathname);
 		return -1;
 	}
+}
 
-	while (!readdir_r(dir, &dirent, &direntp)) {
-		struct stat mystat;
-		int rc;
+/* Unlink the non-directory @name below @node, logging its full path on error. */
+static int rmdir_unlink(int dirfd, const char *name, struct rmdir_node *node)
+{
+	char buf[MAXPATHLEN];
+	const char *pathname;
+	int saved_errno;
 
-		if (!direntp)
-			break;
+	if (unlinkat(dirfd, name, 0) == 0)
+		return 0;
+
+	saved_errno = errno;
+	pathname = rmdir_node_name(node, name, buf, sizeof(buf));
+	errno = saved_errno;
+	SYSERROR("%s: failed to delete %s", __func__, pathname);
+	return -1;
+}
+
+static int rmdir_scan(struct rmdir_ctx *ctx, struct rmdir_node *node)
+{
+	struct dirent *direntp;
+	struct rmdir_node *child;
+	struct stat mystat;
+	char pathname[MAXPATHLEN];
+	int fd, failed = 0;
 
+	/* the parent stays open as long as this node is pending */
+	if (node->parent)
+		fd = openat(dirfd(node->parent->dir), node->name,
+			    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	else
+		fd = open(node->name,
+			  O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0 || !(node->dir = fdopendir(fd))) {
+		ERROR("%s: failed to open %s", __func__,
+		      rmdir_node_name(node, NULL, pathname, sizeof(pathname)));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	while ((direntp = readdir(node->dir))) {
 		if (!strcmp(direntp->d_name, ".") ||
 		    !strcmp(direntp->d_name, ".."))
 			continue;
 
-		rc = snprintf(pathname, MAXPATHLEN, "%s/%s", dirname, direntp->d_name);
-		if (rc < 0 || rc >= MAXPATHLEN) {
-			ERROR("pathname too long");
-			failed=1;
+		if (!node->level && ctx->exclude &&
+		    !strcmp(direntp->d_name, ctx->exclude)) {
+			if (rmdir_exclude(fd, direntp->d_name, node) < 0)
+				failed = 1;
 			continue;
 		}
 
-		if (!level && exclude && !strcmp(direntp->d_name, exclude)) {
-			ret = rmdir(pathname);
-			if (ret < 0) {
-				switch(errno) {
-				case ENOTEMPTY:
-					INFO("Not deleting snapshot %s", pathname);
-					hadexclude = true;
-					break;
-				case ENOTDIR:
-					ret = unlink(pathname);
-					if (ret)
-						INFO("%s: failed to remove %s", __func__, pathname);
-					break;
-				default:
-					SYSERROR("%s: failed to rmdir %s", __func__, pathname);
-					failed = 1;
-					break;
-				}
-			}
+		/* Without the device check the dirent type is all we need. */
+		if (!ctx->onedev && direntp->d_type != DT_DIR &&
+		    direntp->d_type != DT_UNKNOWN) {
+			if (rmdir_unlink(fd, direntp->d_name, node) < 0)
+				failed = 1;
 			continue;
 		}
 
-		ret = lstat(pathname, &mystat);
-		if (ret) {
-			ERROR("%s: failed to stat %s", __func__, pathname);
+		if (fstatat(fd, direntp->d_name, &mystat, AT_SYMLINK_NOFOLLOW) < 0) {
+			ERROR("%s: failed to stat %s", __func__,
+			      rmdir_node_name(node, direntp->d_name, pathname,
+					      sizeof(pathname)));
 			failed = 1;
 			continue;
 		}
-		if (onedev && mystat.st_dev != pdev) {
+
+		if (!S_ISDIR(mystat.st_mode) &&
+		    (!ctx->onedev || mystat.st_dev == ctx->pdev)) {
+			if (rmdir_unlink(fd, direntp->d_name, node) < 0)
+				failed = 1;
+			continue;
+		}
+
+		if (ctx->onedev && mystat.st_dev != ctx->pdev) {
+			if (rmdir_node_path(node, direntp->d_name, pathname,
+					    sizeof(pathname)) < 0) {
+				ERROR("pathname too long");
+				failed = 1;
+				continue;
+			}
 			/* TODO should we be checking /proc/self/mountinfo for
 			 * pathname and not doing this if found? */
 			if (btrfs_try_remove_subvol(pathname))
 				INFO("Removed btrfs subvolume at %s\n", pathname);
 			continue;
 		}
-		if (S_ISDIR(mystat.st_mode)) {
-			if (_recursive_rmdir(pathname, pdev, exclude, level+1, onedev) < 0)
-				failed=1;
-		} else {
-			if (unlink(pathname) < 0) {
-				SYSERROR("%s: failed to delete %s", __func__, pathname);
-				failed=1;
-			}
+
+		child = rmdir_node_new(direntp->d_name, node);
+		if (!child) {
+			ERROR("%s: out of memory", __func__);
+			failed = 1;
+			continue;
 		}
+
+		pthread_mutex_lock(&ctx->lock);
+		node->pending++;
+		child->next = ctx->queue;
+		ctx->queue = child;
+		pthread_cond_signal(&ctx->cond);
+		pthread_mutex_unlock(&ctx->lock);
 	}
 
-	if (rmdir(dirname) < 0 && !btrfs_try_remove_subvol(dirname) && !hadexclude) {
-		ERROR("%s: failed to delete %s", __func__, dirname);
-		failed=1;
+	return failed ? -1 : 0;
+}
+
+/*
+ * Called once the scan of @node is done. Only the counts are updated under
+ * ctx->lock, the directories which are done are removed after dropping it.
+ */
+static void rmdir_done(struct rmdir_ctx *ctx, struct rmdir_node *node, int ret)
+{
+	struct rmdir_node *parent;
+	bool last;
+
+	while (node) {
+		pthread_mutex_lock(&ctx->lock);
+		if (ret < 0)
+			ctx->failed = true;
+		last = --node->pending == 0;
+		pthread_mutex_unlock(&ctx->lock);
+		if (!last)
+			break;
+
+		parent = node->parent;
+		ret = rmdir_node_remove(node);
+		node = parent;
 	}
 
-	ret = closedir(dir);
-	if (ret) {
-		ERROR("%s: failed to close directory %s", __func__, dirname);
-		failed=1;
+	pthread_mutex_lock(&ctx->lock);
+	if (ret < 0)
+		ctx->failed = true;
+	ctx->busy--;
+	pthread_cond_broadcast(&ctx->cond);
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+static void *rmdir_worker(void *data)
+{
+	struct rmdir_ctx *ctx = data;
+	struct rmdir_node *node;
+
+	for (;;) {
+		pthread_mutex_lock(&ctx->lock);
+		while (!ctx->queue && ctx->busy > 0)
+			pthread_cond_wait(&ctx->cond, &ctx->lock);
+		node = ctx->queue;
+		if (!node) {
+			pthread_mutex_unlock(&ctx->lock);
+			return NULL;
+		}
+		ctx->queue = node->next;
+		ctx->busy++;
+		pthread_mutex_unlock(&ctx->lock);
+
+		rmdir_done(ctx, node, rmdir_scan(ctx, node));
 	}
+}
 
-	return failed ? -1 : 0;
+static int _recursive_rmdir(char *dirname, dev_t pdev,
+			    const char *exclude, bool onedev)
+{
+	struct rmdir_ctx ctx;
+	struct rmdir_node *root;
+	pthread_t workers[LXC_RMDIR_MAX_WORKERS - 1];
+	long nworkers;
+	int i, n = 0;
+
+	root = rmdir_node_new(dirname, NULL);
+	if (!root)
+		return -1;
+
+	memset(&ctx, 0, sizeof(ctx));
+	pthread_mutex_init(&ctx.lock, NULL);
+	pthread_cond_init(&ctx.cond, NULL);
+	ctx.pdev = pdev;
+	ctx.exclude = exclude;
+	ctx.onedev = onedev;
+
+	/* Only bring up workers if there is more than one directory. */
+	ctx.busy = 1;
+	rmdir_done(&ctx, root, rmdir_scan(&ctx, root));
+
+	if (ctx.queue) {
+		nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+		if (nworkers > LXC_RMDIR_MAX_WORKERS)
+			nworkers = LXC_RMDIR_MAX_WORKERS;
+
+		for (n = 0; n < nworkers - 1; n++)
+			if (pthread_create(&workers[n], NULL, rmdir_worker, &ctx))
+				break;
+
+		rmdir_worker(&ctx);
+	}
+
+	for (i = 0; i < n; i++)
+		pthread_join(workers[i], NULL);
+
+	pthread_cond_destroy(&ctx.cond);
+	pthread_mutex_destroy(&ctx.lock);
+
+	return ctx.failed ? -1 : 0;
 }
 
 /* we have two different magic values for overlayfs, yay */
@@ -216,7 +486,7 @@ extern int lxc_rmdir_onedev(char *path, const char *exclude)
 		return -1;
 	}
 
-	return _recursive_rmdir(path, mystat.st_dev, exclude, 0, onedev);
+	return _recursive_rmdir(path, mystat.st_dev, exclude, onedev);
 }
 
 /* borrowed from iproute2 */
@@ -467,6 +737,12 @@ const char** lxc_va_arg_list_to_argv_const(va_list ap, size_t skip)
 }
 
 extern struct lxc_popen_FILE *lxc_popen(const char *command)
+{
+	return lxc_popen_argv(NULL, command);
+}
+
+extern struct lxc_popen_FILE *lxc_popen_argv(char * const argv[],
+					     const char *command)
 {
 	struct lxc_popen_FILE *fp = NULL;
 	int parent_end = -1, child_end = -1;
@@ -519,6 +795,8 @@ extern struct lxc_popen_FILE *lxc_popen(const char *command)
 			sigprocmask(SIG_UNBLOCK, &mask, NULL);
 		}
 
+		if (argv)
+			execvp(argv[0], argv);
 		execl("/bin/sh", "sh", "-c", command, (char *) NULL);
 		exit(127);
 	}
@@ -903,15 +1181,10 @@ out_error:
 	return -1;
 }
 
-int lxc_read_from_file(const char *filename, void* buf, size_t count)
+int lxc_read_from_fd(int fd, void* buf, size_t count)
 {
-	int fd = -1, saved_errno;
 	ssize_t ret;
 
-	fd = open(filename, O_RDONLY | O_CLOEXEC);
-	if (fd < 0)
-		return -1;
-
 	if (!buf || !count) {
 		char buf2[100];
 		size_t count2 = 0;
@@ -923,7 +1196,19 @@ int lxc_read_from_file(const char *filename, void* buf, size_t count)
 		memset(buf, 0, count);
 		ret = read(fd, buf, count);
 	}
+	return ret;
+}
+
+int lxc_read_from_file(const char *filename, void* buf, size_t count)
+{
+	int fd = -1, saved_errno;
+	ssize_t ret;
+
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
 
+	ret = lxc_read_from_fd(fd, buf, count);
 	if (ret < 0)
 		ERROR("read %s: %s", filename, strerror(errno));
 
@@ -63,6 +63,29 @@ static inline int setns(int fd, int nstype)
 }
 #endif
 
+/* close_range() is not wrapped by older C libraries, only architectures
+ * whose number is known get a fallback, others report ENOSYS */
+#ifndef __NR_close_range
+#  if defined __alpha__
+#    define __NR_close_range 546
+#  elif (defined __x86_64__ && !defined __ILP32__) || defined __i386__ || \
+	defined __aarch64__ || (defined __arm__ && defined __ARM_EABI__) || \
+	defined __powerpc__ || defined __s390__ || defined __riscv
+#    define __NR_close_range 436
+#  endif
+#endif
+
+static inline int lxc_close_range(unsigned int fd, unsigned int max_fd,
+				  unsigned int flags)
+{
+#ifdef __NR_close_range
+	return syscall(__NR_close_range, fd, max_fd, flags);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
 /* Define unshare() if missing from the C library */
 #ifndef HAVE_UNSHARE
 static inline int unshare(int flags)
@@ -165,6 +188,13 @@ struct lxc_popen_FILE {
  */
 extern struct lxc_popen_FILE *lxc_popen(const char *command);
 
+/* Like lxc_popen(), but exec @argv directly, without a shell, unless that
+ * fails. @command, which must be equivalent to @argv, is then run through
+ * the shell as usual.
+ */
+extern struct lxc_popen_FILE *lxc_popen_argv(char * const argv[],
+					     const char *command);
+
 /* pclose() replacement to be used on struct lxc_popen_FILE *,
  * returned by lxc_popen().
  * Waits for associated process to terminate, returns its exit status and
@@ -216,6 +246,7 @@ extern int sha1sum_file(char *fnam, unsigned char *md_value);
 /* read and write whole files */
 extern int lxc_write_to_file(const char *filename, const void* buf, size_t count, bool add_newline);
 extern int lxc_read_from_file(const char *filename, void* buf, size_t count);
+extern int lxc_read_from_fd(int fd, void* buf, size_t count);
 
 /* convert variadic argument lists to arrays (for execl type argument lists) */
 extern char** lxc_va_arg_list_to_argv(va_list ap, size_t skip, int do_strdup);
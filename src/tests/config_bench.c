@@ -0,0 +1,166 @@
+/* liblxcapi
+ *
+ * Micro-benchmark for container config parsing and key lookup.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <lxc/lxccontainer.h>
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MYNAME "lxctest-config-bench"
+
+static const char *keys[] = {
+	"lxc.utsname",
+	"lxc.rootfs",
+	"lxc.tty",
+	"lxc.pts",
+	"lxc.network.0.link",
+	"lxc.network.0.ipv4",
+	"lxc.hook.pre-start",
+	"lxc.start.auto",
+	"lxc.start.delay",
+	"lxc.console.logfile",
+	"lxc.init_cmd",
+	NULL
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int write_config(const char *path, int nics, int lines)
+{
+	FILE *f;
+	int i;
+
+	f = fopen(path, "w");
+	if (!f)
+		return -1;
+
+	fprintf(f, "lxc.utsname = %s\n", MYNAME);
+	fprintf(f, "lxc.rootfs = /var/lib/lxc/%s/rootfs\n", MYNAME);
+	fprintf(f, "lxc.tty = 4\n");
+	fprintf(f, "lxc.start.auto = 1\n");
+	fprintf(f, "lxc.init_cmd = /sbin/init\n");
+	fprintf(f, "lxc.console.logfile = /tmp/%s.log\n", MYNAME);
+	fprintf(f, "lxc.hook.pre-start = /bin/true\n");
+	for (i = 0; i < nics; i++) {
+		fprintf(f, "lxc.network.type = veth\n");
+		fprintf(f, "lxc.network.link = br%d\n", i);
+		fprintf(f, "lxc.network.flags = up\n");
+		fprintf(f, "lxc.network.name = eth%d\n", i);
+		fprintf(f, "lxc.network.hwaddr = 00:16:3e:%02x:%02x:%02x\n",
+			(i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+		fprintf(f, "lxc.network.ipv4 = 10.%d.%d.2/24\n",
+			(i >> 8) & 0xff, i & 0xff);
+		fprintf(f, "lxc.network.mtu = 1500\n");
+	}
+	for (i = 0; i < lines; i++) {
+		fprintf(f, "# comment %d\n", i);
+		fprintf(f, "lxc.mount.entry = /srv/%d srv/%d none bind,create=dir 0 0\n", i, i);
+		fprintf(f, "lxc.cgroup.memory.limit_in_bytes = %d\n", 1 << 20 | i);
+		fprintf(f, "lxc.cap.drop = sys_module mac_admin\n");
+		fprintf(f, "lxc.environment = VAR%d=%d\n", i, i);
+	}
+
+	return fclose(f);
+}
+
+int main(int argc, char *argv[])
+{
+	struct lxc_container *c = NULL;
+	char dir[] = "/tmp/lxc-config-bench-XXXXXX";
+	char path[sizeof(dir) + 10];
+	char *buf = NULL;
+	int loads = 20, lookups = 200000, nics = 64, lines = 2000;
+	int i, j, len, ret = EXIT_FAILURE;
+	double t, load_t, get_t;
+
+	if (argc > 1)
+		lines = atoi(argv[1]);
+	if (argc > 2)
+		lookups = atoi(argv[2]);
+
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		exit(EXIT_FAILURE);
+	}
+	snprintf(path, sizeof(path), "%s/config", dir);
+
+	if (write_config(path, nics, lines) < 0) {
+		fprintf(stderr, "%d: failed to write %s\n", __LINE__, path);
+		goto out;
+	}
+
+	t = now();
+	for (i = 0; i < loads; i++) {
+		c = lxc_container_new(MYNAME, dir);
+		if (!c) {
+			fprintf(stderr, "%d: error creating lxc_container %s\n", __LINE__, MYNAME);
+			goto out;
+		}
+		if (!c->load_config(c, path)) {
+			fprintf(stderr, "%d: failed to load %s\n", __LINE__, path);
+			goto out;
+		}
+		if (i < loads - 1) {
+			lxc_container_put(c);
+			c = NULL;
+		}
+	}
+	load_t = now() - t;
+
+	len = c->get_config_item(c, "lxc.network.0.link", NULL, 0);
+	if (len != 3) {
+		fprintf(stderr, "%d: lxc.network.0.link has length %d\n", __LINE__, len);
+		goto out;
+	}
+
+	buf = malloc(256);
+	if (!buf)
+		goto out;
+
+	t = now();
+	for (i = 0; i < lookups; ) {
+		for (j = 0; keys[j] && i < lookups; j++, i++) {
+			if (c->get_config_item(c, keys[j], buf, 256) < 0) {
+				fprintf(stderr, "%d: failed to get %s\n", __LINE__, keys[j]);
+				goto out;
+			}
+		}
+	}
+	get_t = now() - t;
+
+	printf("config: %d nics, %d x 5 lines\n", nics, lines);
+	printf("load_config: %.3f ms/load\n", load_t * 1e3 / loads);
+	printf("get_config_item: %.1f ns/call\n", get_t * 1e9 / lookups);
+	ret = EXIT_SUCCESS;
+
+out:
+	free(buf);
+	if (c)
+		lxc_container_put(c);
+	unlink(path);
+	rmdir(dir);
+	exit(ret);
+}
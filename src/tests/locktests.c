@@ -24,6 +24,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <stdlib.h>
+#include <errno.h>
 
 #define mycontainername "lxctest.sem"
 #define TIMEOUT_SECS 3
@@ -93,6 +94,60 @@ static void test_two_locks(void)
 	lxc_putlock(l);
 }
 
+static void test_shared_locks(void)
+{
+	struct lxc_lock *l1, *l2;
+	pid_t pid;
+	int status;
+
+	l1 = lxc_newlock("/tmp", "lxctest-shared");
+	l2 = lxc_newlock("/tmp", "lxctest-shared");
+	if (!l1 || !l2) {
+		fprintf(stderr, "%d: failed to create locks\n", __LINE__);
+		exit(1);
+	}
+	if (lxclock_shared(l1, 0) < 0) {
+		fprintf(stderr, "%d: failed to take shared lock\n", __LINE__);
+		exit(1);
+	}
+	/* the conflicting locks are taken by children, fcntl locks of the
+	 * same process don't conflict unless they are OFD locks */
+	if ((pid = fork()) < 0)
+		exit(1);
+	if (pid == 0) {
+		l2 = lxc_newlock("/tmp", "lxctest-shared");
+		if (!l2 || lxclock(l2, 1) != -1 || errno != ETIMEDOUT) {
+			fprintf(stderr, "%d: child: exclusive lock did not time out\n", __LINE__);
+			exit(1);
+		}
+		exit(0);
+	}
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+	    WEXITSTATUS(status) != 0)
+		exit(1);
+	if ((pid = fork()) < 0)
+		exit(1);
+	if (pid == 0) {
+		l2 = lxc_newlock("/tmp", "lxctest-shared");
+		if (!l2 || lxclock_shared(l2, 1) < 0) {
+			fprintf(stderr, "%d: child: failed to share lock\n", __LINE__);
+			exit(1);
+		}
+		exit(0);
+	}
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+	    WEXITSTATUS(status) != 0)
+		exit(1);
+	lxcunlock(l1);
+	if (lxclock(l2, 1) < 0) {
+		fprintf(stderr, "%d: failed to take released lock\n", __LINE__);
+		exit(1);
+	}
+	lxcunlock(l2);
+	lxc_putlock(l1);
+	lxc_putlock(l2);
+}
+
 int main(int argc, char *argv[])
 {
 	int ret;
@@ -133,6 +188,8 @@ int main(int argc, char *argv[])
 
 	test_two_locks();
 
+	test_shared_locks();
+
 	fprintf(stderr, "all tests passed\n");
 
 	exit(ret);